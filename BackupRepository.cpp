@@ -0,0 +1,393 @@
+#include "pch.h"
+
+#include "BackupRepository.h"
+#include "MappedFile.h"
+#include "Hashing.h"
+
+#include <kubazip/zip/zip.h>
+
+namespace dtmdl
+{
+
+	namespace
+	{
+		/// Random values for the gear hash, generated with splitmix64 so they're the same on every platform
+		constexpr array<uint64_t, 256> GearTable = [] {
+			array<uint64_t, 256> table{};
+			uint64_t state = 0x6A09E667F3BCC908ull;
+			for (auto& entry : table)
+			{
+				auto z = (state += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				entry = z ^ (z >> 31);
+			}
+			return table;
+		}();
+
+		/// Cuts where the rolling gear hash of the last 64 bytes has its top bits clear, so chunk boundaries depend on the content
+		/// around them, not on their offset in the file
+		vector<span<uint8_t const>> SplitIntoChunks(span<uint8_t const> data)
+		{
+			static_assert(has_single_bit(BackupRepository::AverageChunkSize));
+			constexpr uint64_t mask = ~0ull << (64 - countr_zero(BackupRepository::AverageChunkSize));
+
+			vector<span<uint8_t const>> chunks;
+			size_t start = 0;
+			while (start < data.size())
+			{
+				auto const remaining = data.size() - start;
+				auto size = min(remaining, BackupRepository::MaxChunkSize);
+				if (remaining > BackupRepository::MinChunkSize)
+				{
+					uint64_t hash = 0;
+					for (size_t i = BackupRepository::MinChunkSize; i < size; ++i)
+					{
+						hash = (hash << 1) + GearTable[data[start + i]];
+						if ((hash & mask) == 0)
+						{
+							size = i + 1;
+							break;
+						}
+					}
+				}
+				chunks.push_back(data.subspan(start, size));
+				start += size;
+			}
+			return chunks;
+		}
+
+		/// Chunks are stored as single-entry zip archives, so they use the same deflate as the rest of the program
+		constexpr char const* ChunkEntryName = "chunk";
+
+		/// Level 0 stores the data as it is
+		result<vector<uint8_t>, string> Compress(span<uint8_t const> data, int level)
+		{
+			auto zip = zip_stream_open(nullptr, 0, level, 'w');
+			if (!zip)
+				return failure("could not create compression stream");
+
+			auto error = zip_entry_open(zip, ChunkEntryName);
+			if (error == 0)
+			{
+				error = zip_entry_write(zip, data.data(), data.size());
+				zip_entry_close(zip);
+			}
+
+			void* buffer = nullptr;
+			size_t size = 0;
+			if (error == 0 && zip_stream_copy(zip, &buffer, &size) < 0)
+				error = -1;
+			zip_stream_close(zip);
+
+			if (error != 0)
+			{
+				free(buffer);
+				return failure("compressing chunk failed");
+			}
+
+			vector<uint8_t> compressed(static_cast<uint8_t const*>(buffer), static_cast<uint8_t const*>(buffer) + size);
+			free(buffer);
+			return compressed;
+		}
+
+		result<vector<uint8_t>, string> Decompress(span<uint8_t const> data)
+		{
+			auto zip = zip_stream_open(reinterpret_cast<char const*>(data.data()), data.size(), 0, 'r');
+			if (!zip)
+				return failure("chunk is not a valid archive");
+
+			vector<uint8_t> decompressed;
+			auto error = zip_entry_open(zip, ChunkEntryName);
+			if (error == 0)
+			{
+				decompressed.resize(size_t(zip_entry_size(zip)));
+				if (zip_entry_noallocread(zip, decompressed.data(), decompressed.size()) != ssize_t(decompressed.size()))
+					error = -1;
+				zip_entry_close(zip);
+			}
+			zip_stream_close(zip);
+
+			if (error != 0)
+				return failure("decompressing chunk failed");
+			return decompressed;
+		}
+
+		/// Writes to a temporary file first, so that the file (once it exists) is always complete
+		result<void, string> WriteFileAtomically(filesystem::path const& path, span<uint8_t const> data)
+		{
+			error_code ec;
+			filesystem::create_directories(path.parent_path(), ec);
+			if (ec)
+				return failure(format("could not create directory '{}': {}", path.parent_path().string(), ec.message()));
+
+			auto temp_path = path;
+			temp_path += format(".{}.tmp", hash<thread::id>{}(this_thread::get_id()));
+			{
+				ofstream out{ temp_path, ios::binary | ios::trunc };
+				out.write(reinterpret_cast<char const*>(data.data()), streamsize(data.size()));
+				if (!out)
+				{
+					out.close();
+					filesystem::remove(temp_path, ec);
+					return failure(format("could not write file '{}'", temp_path.string()));
+				}
+			}
+
+			filesystem::rename(temp_path, path, ec);
+			if (ec)
+			{
+				filesystem::remove(temp_path, ec);
+				return failure(format("could not write file '{}'", path.string()));
+			}
+			return success();
+		}
+	}
+
+	bool BackupOptions::IsCompressedFile(filesystem::path const& path)
+	{
+		static set<string, less<>> const extensions = {
+			".zip", ".gz", ".bz2", ".xz", ".zst", ".7z", ".rar",
+			".png", ".jpg", ".jpeg", ".webp", ".gif",
+			".ogg", ".mp3", ".opus", ".flac", ".mp4", ".webm",
+		};
+		auto extension = path.extension().string();
+		ranges::transform(extension, extension.begin(), [](char c) { return char(tolower(uint8_t(c))); });
+		return extensions.contains(extension);
+	}
+
+	BackupRepository::BackupRepository(filesystem::path directory)
+		: mDirectory(move(directory))
+	{
+	}
+
+	filesystem::path BackupRepository::ChunkPath(string_view hash) const
+	{
+		return mDirectory / "chunks" / hash.substr(0, 2) / hash;
+	}
+
+	filesystem::path BackupRepository::SnapshotPath(string_view snapshot) const
+	{
+		return mDirectory / "snapshots" / format("{}.json", snapshot);
+	}
+
+	result<void, string> BackupRepository::WriteChunk(string_view hash, span<uint8_t const> data, int compression_level) const
+	{
+		auto compressed = Compress(data, compression_level);
+		/// Data that doesn't compress (but wasn't known not to) is stored as it is, so restoring it doesn't cost anything
+		if (compressed.has_value() && compression_level > 0 && compressed.value().size() >= data.size())
+			compressed = Compress(data, 0);
+		if (compressed.has_error())
+			return failure(move(compressed).error());
+		return WriteFileAtomically(ChunkPath(hash), compressed.value());
+	}
+
+	result<vector<uint8_t>, string> BackupRepository::ReadChunk(string_view hash) const
+	{
+		auto mapped = MappedFile::Open(ChunkPath(hash));
+		if (mapped.has_error())
+			return failure(format("chunk '{}' could not be read: {}", hash, mapped.error()));
+		auto data = Decompress(mapped.value()->Data());
+		if (data.has_error())
+			return failure(format("chunk '{}' could not be read: {}", hash, data.error()));
+		if (ToHex(SHA256(data.value())) != hash)
+			return failure(format("chunk '{}' is corrupted", hash));
+		return data;
+	}
+
+	result<BackupReport, string> BackupRepository::CreateSnapshot(filesystem::path const& source, function<bool(filesystem::path const&)> const& include, BackupOptions const& options)
+	{
+		auto const start = chrono::steady_clock::now();
+
+		struct FileChunks
+		{
+			filesystem::path Path; /// relative to `source`
+			uint64_t Size = 0;
+			vector<string> Hashes;
+			size_t NewChunks = 0;
+			uint64_t NewBytes = 0;
+			string Error;
+		};
+		vector<FileChunks> files;
+
+		error_code ec;
+		for (auto it = filesystem::recursive_directory_iterator{ source, ec }; !ec && it != filesystem::recursive_directory_iterator{}; it.increment(ec))
+		{
+			if (!it->is_regular_file(ec))
+				continue;
+			auto relative = it->path().lexically_relative(source);
+			if (include(relative))
+				files.push_back({ move(relative) });
+		}
+		if (ec)
+			return failure(format("could not list files in '{}': {}", source.string(), ec.message()));
+		ranges::sort(files, {}, &FileChunks::Path);
+
+		/// Hashes of chunks that are being written by some file, so two files with the same chunk don't both write it
+		mutex claimed_mutex;
+		set<string, less<>> claimed;
+
+		for_each(execution::par, files.begin(), files.end(), [&](FileChunks& file) {
+			/// Only mapped while this file is backed up, so the whole directory is never mapped at once
+			auto mapped = MappedFile::Open(source / file.Path, MappedFile::Access::Sequential);
+			if (mapped.has_error())
+			{
+				file.Error = move(mapped).error();
+				return;
+			}
+			file.Size = mapped.value()->Size();
+
+			auto const chunks = SplitIntoChunks(mapped.value()->Data());
+			file.Hashes.resize(chunks.size());
+			for_each(execution::par, chunks.begin(), chunks.end(), [&](span<uint8_t const> const& chunk) {
+				file.Hashes[&chunk - chunks.data()] = ToHex(SHA256(chunk));
+			});
+
+			struct NewChunk
+			{
+				size_t Index = 0;
+				bool Written = false;
+				string Error;
+			};
+			vector<NewChunk> new_chunks;
+			{
+				unique_lock lock{ claimed_mutex };
+				for (size_t i = 0; i < chunks.size(); ++i)
+				{
+					if (claimed.insert(file.Hashes[i]).second)
+						new_chunks.push_back({ i });
+				}
+			}
+
+			auto const level = options.StoreUncompressed && options.StoreUncompressed(file.Path) ? 0 : options.CompressionLevel;
+			for_each(execution::par, new_chunks.begin(), new_chunks.end(), [&](NewChunk& chunk) {
+				error_code ec;
+				if (filesystem::exists(ChunkPath(file.Hashes[chunk.Index]), ec))
+					return;
+				if (auto written = WriteChunk(file.Hashes[chunk.Index], chunks[chunk.Index], level); written.has_error())
+					chunk.Error = move(written).error();
+				else
+					chunk.Written = true;
+			});
+
+			for (auto& chunk : new_chunks)
+			{
+				if (!chunk.Error.empty())
+				{
+					file.Error = move(chunk.Error);
+					return;
+				}
+				if (chunk.Written)
+				{
+					file.NewChunks++;
+					file.NewBytes += chunks[chunk.Index].size();
+				}
+			}
+		});
+
+		BackupReport report;
+		for (auto& file : files)
+		{
+			if (!file.Error.empty())
+				return failure(format("could not back up '{}': {}", file.Path.string(), file.Error));
+			report.Files++;
+			report.Bytes += file.Size;
+			report.Chunks += file.Hashes.size();
+			report.NewChunks += file.NewChunks;
+			report.NewBytes += file.NewBytes;
+		}
+
+		/// The manifest is written last, so a snapshot only exists once all of its chunks do
+		auto manifest_files = json::object();
+		for (auto& file : files)
+			manifest_files[file.Path.generic_string()] = json::object({ { "size", file.Size }, { "chunks", file.Hashes } });
+
+		auto const now = chrono::floor<chrono::seconds>(chrono::system_clock::now());
+		report.Snapshot = FreshName(format("{:%Y-%m-%dT%H-%M-%S}", now), [this](string_view name) { return filesystem::exists(SnapshotPath(name)); });
+		auto const manifest = json::object({
+			{ "source", absolute(source).generic_string() },
+			{ "created", format("{}", now) },
+			{ "files", move(manifest_files) },
+		}).dump(1, '\t');
+		if (auto written = WriteFileAtomically(SnapshotPath(report.Snapshot), { reinterpret_cast<uint8_t const*>(manifest.data()), manifest.size() }); written.has_error())
+			return failure(move(written).error());
+
+		report.Duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		return report;
+	}
+
+	vector<string> BackupRepository::Snapshots() const
+	{
+		vector<string> result;
+		error_code ec;
+		for (auto it = filesystem::directory_iterator{ mDirectory / "snapshots", ec }; !ec && it != filesystem::directory_iterator{}; it.increment(ec))
+		{
+			if (it->path().extension() == ".json")
+				result.push_back(it->path().stem().string());
+		}
+		/// Snapshot names start with their creation time
+		ranges::sort(result);
+		return result;
+	}
+
+	result<void, string> BackupRepository::Restore(string_view snapshot, filesystem::path const& target) const
+	{
+		json manifest;
+		try
+		{
+			manifest = ghassanpl::load_json_file(SnapshotPath(snapshot));
+		}
+		catch (exception const& e)
+		{
+			return failure(format("could not read snapshot '{}': {}", snapshot, e.what()));
+		}
+
+		error_code ec;
+		if (filesystem::exists(target, ec) && !filesystem::is_empty(target, ec))
+			return failure(format("'{}' is not empty", target.string()));
+
+		struct RestoredFile
+		{
+			filesystem::path Path;
+			json const* Entry = nullptr;
+			string Error;
+		};
+		vector<RestoredFile> files;
+		for (auto& [name, entry] : manifest.at("files").items())
+		{
+			auto path = filesystem::path{ name }.lexically_normal();
+			if (path.empty() || path.is_absolute() || *path.begin() == "..")
+				return failure(format("snapshot '{}' has an invalid file path '{}'", snapshot, name));
+			files.push_back({ move(path), &entry });
+		}
+
+		for_each(execution::par, files.begin(), files.end(), [&](RestoredFile& file) {
+			vector<uint8_t> data;
+			for (auto& hash : file.Entry->at("chunks"))
+			{
+				auto chunk = ReadChunk(hash.get_ref<json::string_t const&>());
+				if (chunk.has_error())
+				{
+					file.Error = move(chunk).error();
+					return;
+				}
+				data.insert(data.end(), chunk.value().begin(), chunk.value().end());
+			}
+			if (data.size() != file.Entry->at("size").get<size_t>())
+			{
+				file.Error = "size doesn't match the snapshot";
+				return;
+			}
+			if (auto written = WriteFileAtomically(target / file.Path, data); written.has_error())
+				file.Error = move(written).error();
+		});
+
+		for (auto& file : files)
+		{
+			if (!file.Error.empty())
+				return failure(format("could not restore '{}': {}", file.Path.string(), file.Error));
+		}
+		return success();
+	}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+namespace dtmdl
+{
+	struct BackupReport
+	{
+		string Snapshot;
+		size_t Files = 0;
+		size_t Chunks = 0;
+		/// Chunks that weren't in the repository yet; only these were compressed and written
+		size_t NewChunks = 0;
+		uint64_t Bytes = 0;
+		uint64_t NewBytes = 0;
+		chrono::microseconds Duration{};
+	};
+
+	struct BackupOptions
+	{
+		/// 0 (no compression) to 9 (smallest)
+		int CompressionLevel = 6;
+		/// Files for which this returns true are stored without compression; by default, files that are compressed already
+		function<bool(filesystem::path const&)> StoreUncompressed = &IsCompressedFile;
+
+		/// Judging by the extension: archives, images, audio and video
+		static bool IsCompressedFile(filesystem::path const& path);
+	};
+
+	/// Content-addressed, deduplicated backups of a directory.
+	/// Files are split into content-defined chunks, so that an edit in the middle of a file only changes the chunks around it.
+	/// Each chunk is compressed and written once, to `<directory>/chunks/<first two hex digits>/<sha256 hex>`, and
+	/// every backup is a snapshot manifest in `<directory>/snapshots/<name>.json`, listing the chunks of every file.
+	struct BackupRepository
+	{
+		BackupRepository(filesystem::path directory);
+
+		static constexpr size_t MinChunkSize = 16 * 1024;
+		/// Must be a power of two
+		static constexpr size_t AverageChunkSize = 64 * 1024;
+		static constexpr size_t MaxChunkSize = 256 * 1024;
+
+		/// Backs up every regular file under `source` for which `include` returns true (it gets paths relative to `source`).
+		/// Files are processed in parallel, and the new chunks of each file are compressed and written in parallel.
+		/// Each file is only mapped while it's being backed up, and read front to back.
+		result<BackupReport, string> CreateSnapshot(filesystem::path const& source, function<bool(filesystem::path const&)> const& include, BackupOptions const& options = {});
+
+		/// Names of all snapshots, oldest first
+		vector<string> Snapshots() const;
+
+		/// Rebuilds the files of the snapshot in `target`, which must not exist or be empty. Every chunk is checked against its hash.
+		result<void, string> Restore(string_view snapshot, filesystem::path const& target) const;
+
+		auto const& Directory() const noexcept { return mDirectory; }
+
+	private:
+
+		filesystem::path ChunkPath(string_view hash) const;
+		filesystem::path SnapshotPath(string_view snapshot) const;
+
+		result<void, string> WriteChunk(string_view hash, span<uint8_t const> data, int compression_level) const;
+		result<vector<uint8_t>, string> ReadChunk(string_view hash) const;
+
+		filesystem::path mDirectory;
+	};
+}
@@ -0,0 +1,100 @@
+#include "pch.h"
+
+#include "BlobStore.h"
+#include "Hashing.h"
+
+namespace dtmdl
+{
+
+	BlobStore::BlobStore(filesystem::path directory)
+		: mDirectory(move(directory))
+	{
+	}
+
+	filesystem::path BlobStore::PathOf(string_view hash) const
+	{
+		return mDirectory / hash.substr(0, 2) / hash;
+	}
+
+	result<string, string> BlobStore::Put(span<uint8_t const> data)
+	{
+		auto digest = ToHex(SHA256(data));
+		auto path = PathOf(digest);
+
+		error_code ec;
+		if (filesystem::exists(path, ec))
+			return success(move(digest));
+
+		filesystem::create_directories(path.parent_path(), ec);
+		if (ec)
+			return failure(format("could not create blob directory '{}': {}", path.parent_path().string(), ec.message()));
+
+		/// Write to a temporary file first, so that a blob file (once it exists) is always complete,
+		/// even if two stores are putting the same blob at the same time
+		auto temp_path = path;
+		temp_path += format(".{}.tmp", hash<thread::id>{}(this_thread::get_id()));
+		{
+			ofstream out{ temp_path, ios::binary | ios::trunc };
+			out.write(reinterpret_cast<char const*>(data.data()), streamsize(data.size()));
+			if (!out)
+			{
+				out.close();
+				filesystem::remove(temp_path, ec);
+				return failure(format("could not write blob file '{}'", temp_path.string()));
+			}
+		}
+
+		filesystem::rename(temp_path, path, ec);
+		if (ec)
+		{
+			filesystem::remove(temp_path, ec);
+			if (!filesystem::exists(path, ec))
+				return failure(format("could not write blob file '{}'", path.string()));
+		}
+
+		return success(move(digest));
+	}
+
+	result<shared_ptr<MappedFile const>, string> BlobStore::Get(string_view hash) const
+	{
+		unique_lock lock{ mMappedMutex };
+		if (auto it = mMapped.find(hash); it != mMapped.end())
+		{
+			if (auto mapped = it->second.lock())
+				return success(move(mapped));
+			mMapped.erase(it);
+		}
+
+		auto mapped = MappedFile::Open(PathOf(hash));
+		if (mapped.has_error())
+			return failure(format("blob '{}' could not be read: {}", hash, mapped.error()));
+
+		if (mMapped.size() >= mPruneMappedAt)
+		{
+			std::erase_if(mMapped, [](auto const& entry) { return entry.second.expired(); });
+			mPruneMappedAt = max<size_t>(64, mMapped.size() * 2);
+		}
+		mMapped.emplace(string{ hash }, mapped.value());
+		return mapped;
+	}
+
+	bool BlobStore::Has(string_view hash) const
+	{
+		error_code ec;
+		return filesystem::exists(PathOf(hash), ec);
+	}
+
+	json BlobStore::Reference(string hash, size_t size)
+	{
+		return json::object({ { "blob", move(hash) }, { "size", size } });
+	}
+
+	bool BlobStore::IsReference(json const& value)
+	{
+		if (!value.is_object())
+			return false;
+		auto it = value.find("blob");
+		return it != value.end() && it->is_string();
+	}
+
+}
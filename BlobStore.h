@@ -0,0 +1,40 @@
+#pragma once
+
+#include "MappedFile.h"
+
+namespace dtmdl
+{
+	/// Content-addressed storage for large `bytes` values, shared by all data stores of a database.
+	/// Each blob is written once, to `<directory>/<first two hex digits>/<sha256 hex>`, and memory-mapped when read.
+	struct BlobStore
+	{
+		BlobStore(filesystem::path directory);
+
+		/// `bytes` values at least this big are stored as blobs instead of inside the data store
+		static constexpr size_t OutOfLineThreshold = 4096;
+
+		/// Returns the hash of the data; the file is only written if no blob with this hash exists yet
+		result<string, string> Put(span<uint8_t const> data);
+		result<shared_ptr<MappedFile const>, string> Get(string_view hash) const;
+		bool Has(string_view hash) const;
+
+		/// In a data store, a blob is referenced by a `{ "blob": <hash>, "size": <size> }` object in place of the binary value
+		static json Reference(string hash, size_t size);
+		static bool IsReference(json const& value);
+		static string_view ReferencedHash(json const& value) { return value.at("blob").get_ref<json::string_t const&>(); }
+
+		auto const& Directory() const noexcept { return mDirectory; }
+
+	private:
+
+		filesystem::path PathOf(string_view hash) const;
+
+		filesystem::path mDirectory;
+
+		/// Blobs that are in use stay mapped, and are shared between everyone using them
+		mutable mutex mMappedMutex;
+		mutable map<string, weak_ptr<MappedFile const>, less<>> mMapped;
+		/// Entries of blobs nobody uses anymore are dropped once `mMapped` grows to this size, so it only holds what's in use
+		mutable size_t mPruneMappedAt = 64;
+	};
+}
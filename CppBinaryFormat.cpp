@@ -0,0 +1,509 @@
+#include "pch.h"
+#include "CppBinaryFormat.h"
+#include "Schema.h"
+#include "Database.h"
+#include "Validation.h"
+
+namespace dtmdl
+{
+
+	/// Written as it is into every binary header; reads and writes what Export.cpp writes for ExportFormat::Binary
+	static constexpr string_view BinaryRuntime = R"cpp(/// Reads and writes values in dtmdl's binary export format (ExportFormat::Binary in the editor), through the VisitFields hooks of the
+/// reflection header: little endian, LEB128 varints (zigzag-encoded if signed) for integers wider than a byte, fixed widths for floats
+/// and vector components, size-prefixed strings, bytes and containers, and a header with the schema hash, which must match this one.
+/// Types the format doesn't know (own and ref among them) need a WriteBinary(Writer&, T const&) and ReadBinary(Reader&, T&) pair next to them.
+namespace dtmdl_binary
+{
+	inline constexpr char Magic[4] = { 'D', 'T', 'M', 'B' };
+	inline constexpr ::std::uint8_t FormatVersion = 1;
+	enum class Content : ::std::uint8_t { Value = 0, Store = 1 };
+
+	template <typename T>
+	concept Reflected = requires { ReflectionTypeFor(::std::type_identity<T>{}); };
+	template <typename T>
+	using ReflectionOf = typename decltype(ReflectionTypeFor(::std::type_identity<T>{}))::type;
+
+	template <typename T>
+	concept FixedSize = requires { ::std::tuple_size<T>::value; };
+	template <typename T>
+	concept Vector = requires (T const& value) { T::length(); value[0]; };
+	template <typename T>
+	concept Bytes = ::std::ranges::contiguous_range<T> && sizeof(::std::ranges::range_value_t<T>) == 1 && ::std::is_trivially_copyable_v<::std::ranges::range_value_t<T>>;
+
+	template <typename T> inline constexpr bool Unencodable = false;
+
+	struct Writer
+	{
+		::std::vector<::std::uint8_t> Bytes;
+
+		void Byte(::std::uint8_t value) { Bytes.push_back(value); }
+
+		void Varint(::std::uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				Byte(::std::uint8_t(value) | 0x80);
+				value >>= 7;
+			}
+			Byte(::std::uint8_t(value));
+		}
+
+		void Signed(::std::int64_t value) { Varint((::std::uint64_t(value) << 1) ^ ::std::uint64_t(value >> 63)); }
+
+		template <typename T>
+		void Fixed(T value)
+		{
+			if constexpr (sizeof(T) == 1)
+				Byte(::std::uint8_t(value));
+			else
+			{
+				using bits_type = ::std::conditional_t<sizeof(T) == 8, ::std::uint64_t, ::std::conditional_t<sizeof(T) == 4, ::std::uint32_t, ::std::uint16_t>>;
+				auto const bits = ::std::bit_cast<bits_type>(value);
+				for (::std::size_t i = 0; i < sizeof(T); ++i)
+					Byte(::std::uint8_t(bits >> (i * 8)));
+			}
+		}
+
+		void Raw(void const* data, ::std::size_t size)
+		{
+			auto const bytes = static_cast<::std::uint8_t const*>(data);
+			Bytes.insert(Bytes.end(), bytes, bytes + size);
+		}
+
+		void String(::std::string_view value)
+		{
+			Varint(value.size());
+			Raw(value.data(), value.size());
+		}
+
+		void Header(Content content)
+		{
+			Raw(Magic, sizeof(Magic));
+			Byte(FormatVersion);
+			Byte(::std::uint8_t(content));
+			String(DTMDL_SCHEMA_HASH);
+		}
+
+		template <typename T>
+		void Value(T const& value)
+		{
+			if constexpr (requires { WriteBinary(*this, value); })
+				WriteBinary(*this, value);
+			else if constexpr (::std::is_same_v<T, bool>)
+				Byte(value);
+			else if constexpr (::std::is_enum_v<T>)
+				Signed(::std::int64_t(value));
+			else if constexpr (::std::is_integral_v<T> && sizeof(T) == 1)
+				Byte(::std::uint8_t(value));
+			else if constexpr (::std::is_integral_v<T> && ::std::is_signed_v<T>)
+				Signed(value);
+			else if constexpr (::std::is_integral_v<T>)
+				Varint(value);
+			else if constexpr (::std::is_floating_point_v<T>)
+				Fixed(value);
+			else if constexpr (Reflected<T>)
+				ReflectionOf<T>::template VisitFields<::dtmdl::VisitType::Serialize, Writer, T const&>(*this, value);
+			else if constexpr (requires { value.bits; })
+				Varint(::std::uint64_t(value.bits));
+			else if constexpr (requires { value.dump(); })
+				String(value.dump());
+			else if constexpr (::std::convertible_to<T const&, ::std::string_view>)
+				String(::std::string_view{ value });
+			else if constexpr (Vector<T>)
+			{
+				for (decltype(T::length()) i = 0; i < T::length(); ++i)
+					Fixed(value[i]);
+			}
+			else if constexpr (requires { value.index(); ::std::variant_size<T>::value; })
+			{
+				Varint(value.index());
+				::std::visit([this](auto const& alternative) { Value(alternative); }, value);
+			}
+			else if constexpr (requires { typename T::key_type; typename T::mapped_type; })
+			{
+				Varint(::std::ranges::size(value));
+				for (auto const& [key, element] : value)
+				{
+					Value(key);
+					Value(element);
+				}
+			}
+			else if constexpr (FixedSize<T> && ::std::ranges::range<T>)
+			{
+				for (auto const& element : value)
+					Value(element);
+			}
+			else if constexpr (dtmdl_binary::Bytes<T>)
+			{
+				Varint(::std::ranges::size(value));
+				Raw(::std::ranges::data(value), ::std::ranges::size(value));
+			}
+			else if constexpr (::std::ranges::sized_range<T>)
+			{
+				Varint(::std::ranges::size(value));
+				for (auto const& element : value)
+					Value(element);
+			}
+			else
+				static_assert(Unencodable<T>, "this type has no binary encoding; declare WriteBinary(Writer&, T const&) and ReadBinary(Reader&, T&) for it");
+		}
+
+		/// Called by VisitFields
+		template <typename FIELD, typename TAG>
+		void operator()(FIELD const& field, ::std::string_view, TAG) { Value(field); }
+	};
+
+	struct Reader
+	{
+		::std::span<::std::uint8_t const> Data;
+		::std::size_t Position = 0;
+		/// The first thing that went wrong; once set, everything else reads as zero
+		char const* Error = nullptr;
+
+		explicit Reader(::std::span<::std::uint8_t const> data) : Data(data) {}
+
+		::std::size_t Remaining() const noexcept { return Data.size() - Position; }
+
+		void Fail(char const* error)
+		{
+			if (!Error)
+				Error = error;
+			Position = Data.size();
+		}
+
+		::std::uint8_t Byte()
+		{
+			if (Position >= Data.size())
+			{
+				Fail("unexpected end of data");
+				return 0;
+			}
+			return Data[Position++];
+		}
+
+		::std::uint64_t Varint()
+		{
+			::std::uint64_t result = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				auto const byte = Byte();
+				result |= ::std::uint64_t(byte & 0x7F) << shift;
+				if (!(byte & 0x80))
+					return result;
+			}
+			Fail("varint is too long");
+			return 0;
+		}
+
+		::std::int64_t Signed()
+		{
+			auto const value = Varint();
+			return ::std::int64_t(value >> 1) ^ -::std::int64_t(value & 1);
+		}
+
+		template <typename T>
+		T Fixed()
+		{
+			if constexpr (sizeof(T) == 1)
+				return T(Byte());
+			else
+			{
+				using bits_type = ::std::conditional_t<sizeof(T) == 8, ::std::uint64_t, ::std::conditional_t<sizeof(T) == 4, ::std::uint32_t, ::std::uint16_t>>;
+				if (Remaining() < sizeof(T))
+				{
+					Fail("unexpected end of data");
+					return T{};
+				}
+				bits_type bits = 0;
+				for (::std::size_t i = 0; i < sizeof(T); ++i)
+					bits |= bits_type(Data[Position + i]) << (i * 8);
+				Position += sizeof(T);
+				return ::std::bit_cast<T>(bits);
+			}
+		}
+
+		/// The bytes stay in Data
+		::std::span<::std::uint8_t const> Raw(::std::size_t size)
+		{
+			if (size > Remaining())
+			{
+				Fail("unexpected end of data");
+				return {};
+			}
+			Position += size;
+			return Data.subspan(Position - size, size);
+		}
+
+		::std::string_view String()
+		{
+			auto const size = Varint();
+			auto const bytes = Raw(size > Remaining() ? Remaining() + 1 : ::std::size_t(size));
+			return { reinterpret_cast<char const*>(bytes.data()), bytes.size() };
+		}
+
+		/// Element counts can't be more than the remaining bytes, so a corrupt count can't make us reserve too much
+		::std::size_t Count()
+		{
+			auto const count = Varint();
+			return ::std::size_t(::std::min<::std::uint64_t>(count, Remaining()));
+		}
+
+		bool Header(Content content)
+		{
+			auto const magic = Raw(sizeof(Magic));
+			if (!Error && !::std::equal(magic.begin(), magic.end(), Magic))
+				Fail("not dtmdl binary data");
+			else if (!Error && Byte() != FormatVersion)
+				Fail("unsupported binary format version");
+			else if (!Error && Byte() != ::std::uint8_t(content))
+				Fail(content == Content::Store ? "this is a value, not a store" : "this is a store, not a value");
+			else if (!Error && String() != DTMDL_SCHEMA_HASH)
+				Fail("the data was exported with a different schema");
+			return !Error;
+		}
+
+		template <typename T>
+		void Value(T& value)
+		{
+			if constexpr (requires { ReadBinary(*this, value); })
+				ReadBinary(*this, value);
+			else if constexpr (::std::is_same_v<T, bool>)
+			{
+				auto const byte = Byte();
+				if (byte > 1)
+					Fail("invalid bool");
+				value = byte != 0;
+			}
+			else if constexpr (::std::is_enum_v<T>)
+			{
+				value = T(Signed());
+				if constexpr (Reflected<T>)
+				{
+					if (!Error && !ReflectionOf<T>::EnumValid(::std::type_identity<T>{}, value))
+						Fail("invalid enumerator");
+				}
+			}
+			else if constexpr (::std::is_integral_v<T> && sizeof(T) == 1)
+				value = T(Byte());
+			else if constexpr (::std::is_integral_v<T>)
+			{
+				auto const wide = [this] { if constexpr (::std::is_signed_v<T>) return Signed(); else return Varint(); }();
+				if (!::std::in_range<T>(wide))
+					Fail("integer out of range");
+				value = T(wide);
+			}
+			else if constexpr (::std::is_floating_point_v<T>)
+				value = Fixed<T>();
+			else if constexpr (Reflected<T>)
+				ReflectionOf<T>::template VisitFields<::dtmdl::VisitType::Deserialize, Reader, T&>(*this, value);
+			else if constexpr (requires { value.bits; })
+				value.bits = decltype(value.bits)(Varint());
+			else if constexpr (requires { value.dump(); T::parse(::std::string_view{}, nullptr, false); })
+			{
+				value = T::parse(String(), nullptr, false);
+				if (value.is_discarded())
+					Fail("invalid JSON");
+			}
+			else if constexpr (::std::convertible_to<T const&, ::std::string_view>)
+				value = T(String());
+			else if constexpr (Vector<T>)
+			{
+				for (decltype(T::length()) i = 0; i < T::length(); ++i)
+					value[i] = Fixed<::std::remove_cvref_t<decltype(value[i])>>();
+			}
+			else if constexpr (requires { value.index(); ::std::variant_size<T>::value; })
+				Alternative<T, 0>(value, Varint());
+			else if constexpr (requires { typename T::key_type; typename T::mapped_type; })
+			{
+				value.clear();
+				auto const count = Count();
+				for (::std::size_t i = 0; i < count && !Error; ++i)
+				{
+					typename T::key_type key{};
+					typename T::mapped_type element{};
+					Value(key);
+					Value(element);
+					value.insert_or_assign(::std::move(key), ::std::move(element));
+				}
+			}
+			else if constexpr (FixedSize<T> && ::std::ranges::range<T>)
+			{
+				for (auto& element : value)
+					Value(element);
+			}
+			else if constexpr (dtmdl_binary::Bytes<T> && requires { value.resize(::std::size_t{}); })
+			{
+				auto const bytes = Raw(::std::size_t(::std::min<::std::uint64_t>(Varint(), Remaining() + 1)));
+				value.resize(bytes.size());
+				if (!bytes.empty())
+					::std::memcpy(::std::ranges::data(value), bytes.data(), bytes.size());
+			}
+			else if constexpr (requires { value.clear(); value.push_back(::std::ranges::range_value_t<T>{}); })
+			{
+				value.clear();
+				auto const count = Count();
+				if constexpr (requires { value.reserve(count); })
+					value.reserve(count);
+				for (::std::size_t i = 0; i < count && !Error; ++i)
+				{
+					::std::ranges::range_value_t<T> element{};
+					Value(element);
+					value.push_back(::std::move(element));
+				}
+			}
+			else
+				static_assert(Unencodable<T>, "this type has no binary encoding; declare WriteBinary(Writer&, T const&) and ReadBinary(Reader&, T&) for it");
+		}
+
+		/// Called by VisitFields
+		template <typename FIELD, typename TAG>
+		void operator()(FIELD& field, ::std::string_view, TAG) { Value(field); }
+		/// Called by VisitFields for fields that are serialized but not deserialized; they're still in the data.
+		/// Having this also keeps VisitFields from passing fields that are deserialized but not serialized, as the data doesn't have them.
+		template <typename FIELD, typename TAG>
+		void SkipField(FIELD const&, ::std::string_view, TAG)
+		{
+			::std::remove_cvref_t<FIELD> skipped{};
+			Value(skipped);
+		}
+
+	private:
+
+		template <typename T, ::std::size_t I>
+		void Alternative(T& value, ::std::uint64_t index)
+		{
+			if constexpr (I < ::std::variant_size_v<T>)
+			{
+				if (index == I)
+					Value(value.template emplace<I>());
+				else
+					Alternative<T, I + 1>(value, index);
+			}
+			else
+				Fail("invalid variant alternative");
+		}
+	};
+
+	/// The header, then the value: what the editor writes when it exports a single value
+	template <typename T>
+	::std::vector<::std::uint8_t> Serialize(T const& value)
+	{
+		Writer writer;
+		writer.Header(Content::Value);
+		writer.Value(value);
+		return ::std::move(writer.Bytes);
+	}
+
+	/// Returns nullptr if it worked, or what went wrong
+	template <typename T>
+	char const* Deserialize(::std::span<::std::uint8_t const> data, T& value)
+	{
+		Reader reader{ data };
+		if (reader.Header(Content::Value))
+			reader.Value(value);
+		if (!reader.Error && reader.Remaining())
+			reader.Fail("unexpected data after the value");
+		return reader.Error;
+	}
+
+	/// A store exported by the editor. Open only indexes its roots and tables; they're decoded when asked for, straight from the data,
+	/// which must outlive this.
+	struct Store
+	{
+		struct Entry
+		{
+			/// The type of a root, as the editor writes types in JSON
+			::std::string_view Type;
+			/// The number of rows of a table
+			::std::size_t RowCount = 0;
+			::std::span<::std::uint8_t const> Data;
+		};
+
+		::std::map<::std::string_view, Entry, ::std::less<>> Roots;
+		::std::map<::std::string_view, Entry, ::std::less<>> Tables;
+
+		/// Returns nullptr if it worked, or what went wrong
+		char const* Open(::std::span<::std::uint8_t const> data)
+		{
+			Roots.clear();
+			Tables.clear();
+			Reader reader{ data };
+			if (!reader.Header(Content::Store))
+				return reader.Error;
+			for (auto count = reader.Count(), i = ::std::size_t{}; i < count && !reader.Error; ++i)
+			{
+				Entry entry;
+				auto const name = reader.String();
+				entry.Type = reader.String();
+				entry.Data = reader.Raw(::std::size_t(::std::min<::std::uint64_t>(reader.Varint(), reader.Remaining() + 1)));
+				Roots.insert_or_assign(name, entry);
+			}
+			for (auto count = reader.Count(), i = ::std::size_t{}; i < count && !reader.Error; ++i)
+			{
+				Entry entry;
+				auto const name = reader.String();
+				entry.RowCount = ::std::size_t(reader.Varint());
+				entry.Data = reader.Raw(::std::size_t(::std::min<::std::uint64_t>(reader.Varint(), reader.Remaining() + 1)));
+				Tables.insert_or_assign(name, entry);
+			}
+			if (!reader.Error && reader.Remaining())
+				reader.Fail("unexpected data after the tables");
+			return reader.Error;
+		}
+
+		template <typename T>
+		char const* Root(::std::string_view name, T& value) const
+		{
+			auto it = Roots.find(name);
+			if (it == Roots.end())
+				return "no root with this name";
+			Reader reader{ it->second.Data };
+			reader.Value(value);
+			if (!reader.Error && reader.Remaining())
+				reader.Fail("the root is not of this type");
+			return reader.Error;
+		}
+
+		/// Calls row_func(ROW&&) for every row of the table of the record ROW is generated from
+		template <typename ROW, typename FUNC>
+		char const* ForEachRow(::std::string_view table, FUNC&& row_func) const
+		{
+			auto it = Tables.find(table);
+			if (it == Tables.end())
+				return "no table with this name";
+			Reader reader{ it->second.Data };
+			for (::std::size_t i = 0; i < it->second.RowCount && !reader.Error; ++i)
+			{
+				ROW row{};
+				reader.Value(row);
+				if (!reader.Error)
+					row_func(::std::move(row));
+			}
+			if (!reader.Error && reader.Remaining())
+				reader.Fail("the rows are not of this type");
+			return reader.Error;
+		}
+		/// For the records that have tables, TableName(::std::type_identity<ROW>) is generated below
+		template <typename ROW, typename FUNC>
+		char const* ForEachRow(FUNC&& row_func) const { return ForEachRow<ROW>(TableName(::std::type_identity<ROW>{}), ::std::forward<FUNC>(row_func)); }
+	};
+}
+)cpp";
+
+	string CppBinaryFormat::Export(Database const& db)
+	{
+		auto out = StartOutput(db, { "types.hpp", "reflection.hpp" });
+
+		out.WriteVerbatim(BinaryRuntime);
+
+		/// Binary stores name their tables after the records
+		for (auto def : db.Structs())
+		{
+			if (def->Flags.contain(StructFlags::CreateTableType))
+				out.WriteLine("constexpr ::std::string_view TableName(::std::type_identity<{}>) {{ return \"{}\"; }}", FormatTypeName(db, def), def->Name());
+		}
+
+		return FinishOutput(db);
+	}
+
+}
\ No newline at end of file
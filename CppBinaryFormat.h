@@ -0,0 +1,15 @@
+#pragma once
+
+#include "CppFormatPlugin.h"
+
+namespace dtmdl
+{
+
+	struct CppBinaryFormat : CppFormatPlugin
+	{
+		virtual string FormatName() override { return "C++ Binary Serialization Header"; }
+		virtual string ExportFileName() override { return "binary.hpp"; }
+		virtual string Export(Database const&) override;
+	};
+
+}
\ No newline at end of file
@@ -92,9 +92,15 @@ namespace dtmdl
 		SimpleOutputter out{ mOutString };
 		out.WriteLine("/// source_database: \"{}\"", string_ops::escaped(filesystem::absolute(db.Directory()).string(), "\"\\"));
 		out.WriteLine("/// generated_time: \"{}\"", chrono::zoned_time{ chrono::current_zone(), chrono::system_clock::now() });
+		out.WriteLine("/// schema_version: {}", db.Schema().Version());
+		out.WriteLine("/// schema_hash: \"{}\"", db.Schema().Hash());
 
 		out.WriteLine("#pragma once");
 
+		/// Every header of a database defines the same macros, so headers generated from different schemas can't be mixed
+		out.WriteLine("#define DTMDL_SCHEMA_VERSION {}", db.Schema().Version());
+		out.WriteLine("#define DTMDL_SCHEMA_HASH \"{}\"", db.Schema().Hash());
+
 		for (auto include : includes)
 			out.WriteLine("#include \"{}\"", include);
 
@@ -4,3 +4,4 @@
 #include "CppReflectionFormat.h"
 #include "CppTablesFormat.h"
 #include "CppDatabaseFormat.h"
+#include "CppBinaryFormat.h"
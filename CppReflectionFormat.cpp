@@ -79,14 +79,29 @@ namespace dtmdl
 					if (fld->Flags.contain(FieldFlags::NoSerialize)) unwanted_visitors.insert("Serialize");
 					if (fld->Flags.contain(FieldFlags::NoDeserialize)) unwanted_visitors.insert("Deserialize");
 
-					if (unwanted_visitors.size())
+					vector<string> conditions;
+					for (auto& visitor : unwanted_visitors)
+						conditions.push_back("VISIT_TYPE == vt::" + visitor);
+					/// Serialized data doesn't have these fields, so visitors that read it in order (like dtmdl_binary::Reader) must not be given them
+					if (unwanted_visitors.contains("Serialize") && !unwanted_visitors.contains("Deserialize"))
+						conditions.push_back(format("(VISIT_TYPE == vt::Deserialize && requires {{ visitor.SkipField(record.{0}, \"{1}\", dtmdl_{2}_Mirror_Tag); }})", MemberName(db, fld), fld->Name, fld->ParentRecord->Name()));
+
+					if (conditions.size())
 					{
-						out.WriteLine("if constexpr (!({}))", string_ops::join(unwanted_visitors | views::transform([](string const& visitor) { return "VISIT_TYPE == vt::" + visitor; }), " || "));
+						out.WriteLine("if constexpr (!({}))", string_ops::join(conditions, " || "));
 						out.Indent();
 					}
 					out.WriteLine("visitor(record.{}, \"{}\", dtmdl_{}_Mirror_Tag);", MemberName(db, fld), fld->Name, fld->ParentRecord->Name());
-					if (unwanted_visitors.size())
+					if (conditions.size())
 						out.Unindent();
+					/// Serialized data still has these fields, so visitors that read it in order (like dtmdl_binary::Reader) need to skip them
+					if (unwanted_visitors.contains("Deserialize") && !unwanted_visitors.contains("Serialize"))
+					{
+						out.WriteLine("if constexpr (VISIT_TYPE == vt::Deserialize && requires {{ visitor.SkipField(record.{0}, \"{1}\", dtmdl_{2}_Mirror_Tag); }})", MemberName(db, fld), fld->Name, fld->ParentRecord->Name());
+						out.Indent();
+						out.WriteLine("visitor.SkipField(record.{}, \"{}\", dtmdl_{}_Mirror_Tag);", MemberName(db, fld), fld->Name, fld->ParentRecord->Name());
+						out.Unindent();
+					}
 				}
 				out.WriteLine("if constexpr (VISIT_TYPE == vt::Deserialize) PostDeserialize(visitor, record);");
 				out.WriteLine("if constexpr (VISIT_TYPE == vt::Serialize) PostSerialize(visitor, record);");
@@ -7,16 +7,399 @@
 namespace dtmdl
 {
 
+	/// Written as it is into every tables header
+	static constexpr string_view QueryRuntime = R"cpp(/// Queries over generated tables: table.Select(clauses...) returns a lazy range; nothing is copied or buffered.
+/// Clauses, in any order:
+///   Where{ predicate }                    rows for which predicate(row) is true
+///   Equal<"Column">(value)                rows whose column equals value; uses the column's index, if it has one
+///   Between<"Column">(from, to)           rows whose column is in [from, to), with both converted to the column's type;
+///                                         uses the column's index, if it's ordered
+///   OrderBy<"Column">, OrderByDescending<"Column">
+///                                         the column must have an Ordered or Sorted index, which the query walks
+///   GroupedBy<"Column">                   yields (key, rows) pairs instead of rows; the column must have an Ordered or Sorted index
+///                                         (rows is a filtered view, so it can't be iterated through a const variable)
+///   Columns<"Column", ...>                yields tuples of references to the columns' values instead of rows
+///   Limit{ count, offset }
+/// Rows are the table's RowType, or RowView for columnar tables.
+namespace dtmdl_query
+{
+	enum class IndexUse { None, Equality, Ordered };
+	enum class ClauseKind { Filter, Equal, Range, OrderBy, GroupedBy, Columns, Limit };
+
+	template <::dtmdl::FixedString COLUMN> struct ColumnTag {};
+
+	template <typename PREDICATE>
+	struct Where
+	{
+		static constexpr ClauseKind Kind = ClauseKind::Filter;
+		using Column = void;
+		PREDICATE Predicate;
+	};
+	template <typename PREDICATE> Where(PREDICATE) -> Where<PREDICATE>;
+
+	template <::dtmdl::FixedString COLUMN, typename VALUE>
+	struct EqualClause
+	{
+		static constexpr ClauseKind Kind = ClauseKind::Equal;
+		static constexpr auto Name = COLUMN;
+		using Column = ColumnTag<COLUMN>;
+		VALUE Value;
+	};
+	template <::dtmdl::FixedString COLUMN>
+	struct EqualMaker { template <typename VALUE> constexpr EqualClause<COLUMN, ::std::decay_t<VALUE>> operator()(VALUE&& value) const { return { ::std::forward<VALUE>(value) }; } };
+	template <::dtmdl::FixedString COLUMN> inline constexpr EqualMaker<COLUMN> Equal{};
+
+	template <::dtmdl::FixedString COLUMN, typename FROM, typename TO = FROM>
+	struct RangeClause
+	{
+		static constexpr ClauseKind Kind = ClauseKind::Range;
+		static constexpr auto Name = COLUMN;
+		using Column = ColumnTag<COLUMN>;
+		FROM From;
+		TO To;
+	};
+	/// The bounds can be of different types (`Between<"X">(x, 5)`); Select converts them to the column's type (see Bind)
+	template <::dtmdl::FixedString COLUMN>
+	struct RangeMaker { template <typename FROM, typename TO> constexpr RangeClause<COLUMN, ::std::decay_t<FROM>, ::std::decay_t<TO>> operator()(FROM&& from, TO&& to) const { return { ::std::forward<FROM>(from), ::std::forward<TO>(to) }; } };
+	template <::dtmdl::FixedString COLUMN> inline constexpr RangeMaker<COLUMN> Between{};
+
+	template <::dtmdl::FixedString COLUMN, bool DESCENDING>
+	struct OrderByClause
+	{
+		static constexpr ClauseKind Kind = ClauseKind::OrderBy;
+		static constexpr auto Name = COLUMN;
+		static constexpr bool Descending = DESCENDING;
+		using Column = ColumnTag<COLUMN>;
+	};
+	template <::dtmdl::FixedString COLUMN> inline constexpr OrderByClause<COLUMN, false> OrderBy{};
+	template <::dtmdl::FixedString COLUMN> inline constexpr OrderByClause<COLUMN, true> OrderByDescending{};
+
+	template <::dtmdl::FixedString COLUMN>
+	struct GroupedByClause
+	{
+		static constexpr ClauseKind Kind = ClauseKind::GroupedBy;
+		static constexpr auto Name = COLUMN;
+		static constexpr bool Descending = false;
+		using Column = ColumnTag<COLUMN>;
+	};
+	template <::dtmdl::FixedString COLUMN> inline constexpr GroupedByClause<COLUMN> GroupedBy{};
+
+	template <::dtmdl::FixedString... COLUMNS>
+	struct ColumnsClause
+	{
+		static constexpr ClauseKind Kind = ClauseKind::Columns;
+		using Column = void;
+		template <typename TABLE, typename ROW>
+		static auto Project(ROW const& row) { return ::std::forward_as_tuple(TABLE::template ColumnValue<COLUMNS>(row)...); }
+	};
+	template <::dtmdl::FixedString... COLUMNS> inline constexpr ColumnsClause<COLUMNS...> Columns{};
+
+	struct Limit
+	{
+		static constexpr ClauseKind Kind = ClauseKind::Limit;
+		using Column = void;
+		::std::ptrdiff_t Count = PTRDIFF_MAX;
+		::std::ptrdiff_t Offset = 0;
+	};
+
+	/// Index of the first clause for which TEST is true, or the number of clauses
+	template <typename... CLAUSES, typename TEST>
+	constexpr ::std::size_t FindClause(TEST test)
+	{
+		::std::size_t index = 0;
+		(void)((test.template operator()<CLAUSES>() || (++index, false)) || ...);
+		return index;
+	}
+
+	template <typename CLAUSE, ClauseKind... KINDS>
+	constexpr bool IsKind() { return ((CLAUSE::Kind == KINDS) || ...); }
+
+	template <typename MEMBER> struct MemberValue;
+	template <typename CLASS, typename VALUE> struct MemberValue<VALUE CLASS::*> { using Type = VALUE; };
+	template <typename TABLE, ::dtmdl::FixedString COLUMN>
+	using ColumnType = typename MemberValue<decltype(TABLE::template GetField<COLUMN>())>::Type;
+
+	/// Converts range bounds to the column's type once, so every row and index key is compared with them the same way
+	template <typename TABLE, typename CLAUSE>
+	auto Bind(CLAUSE&& clause)
+	{
+		using Clause = ::std::decay_t<CLAUSE>;
+		if constexpr (Clause::Kind == ClauseKind::Range)
+		{
+			using Value = ColumnType<TABLE, Clause::Name>;
+			return RangeClause<Clause::Name, Value>{ Value(::std::forward<CLAUSE>(clause).From), Value(::std::forward<CLAUSE>(clause).To) };
+		}
+		else
+			return Clause(::std::forward<CLAUSE>(clause));
+	}
+
+	template <typename TABLE, typename ROW, typename CLAUSE>
+	bool Matches(ROW const& row, CLAUSE const& clause)
+	{
+		if constexpr (CLAUSE::Kind == ClauseKind::Filter)
+			return clause.Predicate(row);
+		else if constexpr (CLAUSE::Kind == ClauseKind::Equal)
+			return TABLE::template ColumnValue<CLAUSE::Name>(row) == clause.Value;
+		else if constexpr (CLAUSE::Kind == ClauseKind::Range)
+		{
+			auto const& value = TABLE::template ColumnValue<CLAUSE::Name>(row);
+			return !(value < clause.From) && value < clause.To;
+		}
+		else
+			return true;
+	}
+
+	/// All the filtering clauses but the one at SKIP (which the query got from an index already)
+	template <typename TABLE, ::std::size_t SKIP, typename ROW, typename CLAUSES, ::std::size_t... INDICES>
+	bool MatchesAll(ROW const& row, CLAUSES const& clauses, ::std::index_sequence<INDICES...>)
+	{
+		return ((INDICES == SKIP || Matches<TABLE>(row, ::std::get<INDICES>(clauses))) && ...);
+	}
+
+	/// Index entries (key, row id) matching the clause, in key order
+	template <typename TABLE, typename CLAUSE>
+	auto IndexEntries(TABLE const& table, CLAUSE const& clause)
+	{
+		auto const& index = table.template QueryIndex<CLAUSE::Name>();
+		if constexpr (CLAUSE::Kind == ClauseKind::Equal)
+		{
+			auto const [begin, end] = index.equal_range(clause.Value);
+			return ::std::ranges::subrange(begin, end);
+		}
+		else if constexpr (CLAUSE::Kind == ClauseKind::Range)
+			return ::std::ranges::subrange(index.lower_bound(clause.From), index.lower_bound(clause.To));
+		else
+			return ::std::ranges::subrange(index.begin(), index.end());
+	}
+
+	/// The entries of an ordered index, split into runs of equal keys
+	template <typename ITERATOR>
+	struct KeyGroups : ::std::ranges::view_interface<KeyGroups<ITERATOR>>
+	{
+		struct Iterator
+		{
+			using value_type = ::std::ranges::subrange<ITERATOR>;
+			using difference_type = ::std::ptrdiff_t;
+			ITERATOR Current{};
+			ITERATOR End{};
+			value_type operator*() const { return { Current, GroupEnd() }; }
+			Iterator& operator++() { Current = GroupEnd(); return *this; }
+			void operator++(int) { ++*this; }
+			bool operator==(::std::default_sentinel_t) const { return Current == End; }
+			ITERATOR GroupEnd() const { return ::std::ranges::find_if(Current, End, [&key = Current->first](auto const& entry) { return key < entry.first; }); }
+		};
+
+		ITERATOR Begin{};
+		ITERATOR End{};
+		KeyGroups() = default;
+		KeyGroups(ITERATOR begin, ITERATOR end) : Begin(begin), End(end) {}
+		Iterator begin() const { return { Begin, End }; }
+		::std::default_sentinel_t end() const { return {}; }
+	};
+
+	template <typename TABLE, ::std::size_t SKIP, typename CLAUSES>
+	struct RowFilter
+	{
+		CLAUSES Clauses;
+		template <typename ROW>
+		bool operator()(ROW const& row) const { return MatchesAll<TABLE, SKIP>(row, Clauses, ::std::make_index_sequence<::std::tuple_size_v<CLAUSES>>{}); }
+	};
+
+	template <typename TABLE>
+	struct RowLookup
+	{
+		TABLE const* Table = nullptr;
+		template <typename ENTRY>
+		decltype(auto) operator()(ENTRY const& entry) const { return Table->QueryRow(entry.second); }
+	};
+
+	template <typename TABLE, typename PROJECTION>
+	struct RowProjection
+	{
+		template <typename ROW>
+		auto operator()(ROW const& row) const { return PROJECTION::template Project<TABLE>(row); }
+	};
+
+	template <typename TABLE, ::std::size_t PROJECTION, typename CLAUSES, typename ROWS>
+	auto Project(ROWS&& rows)
+	{
+		if constexpr (PROJECTION < ::std::tuple_size_v<CLAUSES>)
+			return ::std::forward<ROWS>(rows) | ::std::views::transform(RowProjection<TABLE, ::std::tuple_element_t<PROJECTION, CLAUSES>>{});
+		else
+			return ::std::views::all(::std::forward<ROWS>(rows));
+	}
+
+	template <::std::size_t LIMIT, typename CLAUSES, typename RESULTS>
+	auto Limited(CLAUSES const& clauses, RESULTS&& results)
+	{
+		if constexpr (LIMIT < ::std::tuple_size_v<CLAUSES>)
+		{
+			auto const& clause = ::std::get<LIMIT>(clauses);
+			return ::std::forward<RESULTS>(results) | ::std::views::drop(clause.Offset) | ::std::views::take(clause.Count);
+		}
+		else
+			return ::std::views::all(::std::forward<RESULTS>(results));
+	}
+
+	/// One (key, rows) pair for each run of equal keys in an ordered index
+	template <typename TABLE, ::std::size_t PROJECTION, typename CLAUSES, typename FILTER>
+	struct GroupRows
+	{
+		TABLE const* Table = nullptr;
+		FILTER Filter;
+		template <typename GROUP>
+		auto operator()(GROUP const& group) const
+		{
+			auto const& key = group.begin()->first;
+			auto rows = Project<TABLE, PROJECTION, CLAUSES>(group | ::std::views::transform(RowLookup<TABLE>{ Table }) | ::std::views::filter(Filter));
+			return ::std::pair<decltype(key), decltype(rows)>{ key, ::std::move(rows) };
+		}
+	};
+
+	template <::std::size_t ORDER, typename CLAUSES>
+	constexpr bool IsGrouped()
+	{
+		if constexpr (ORDER < ::std::tuple_size_v<CLAUSES>)
+			return IsKind<::std::tuple_element_t<ORDER, CLAUSES>, ClauseKind::GroupedBy>();
+		else
+			return false;
+	}
+
+	template <::std::size_t ORDER, typename CLAUSES>
+	constexpr bool IsDescending()
+	{
+		if constexpr (ORDER < ::std::tuple_size_v<CLAUSES>)
+			return ::std::tuple_element_t<ORDER, CLAUSES>::Descending;
+		else
+			return false;
+	}
+
+	/// The index the query walks: the ordering column's, narrowed by an Equal or Between clause on that column if there is one,
+	/// or else the first Equal or Between clause on a column with a suitable index. Returns the clause's position.
+	template <typename TABLE, typename... CLAUSES>
+	constexpr ::std::size_t Driver()
+	{
+		constexpr auto none = sizeof...(CLAUSES);
+		constexpr auto order = FindClause<CLAUSES...>([]<typename C>() { return IsKind<C, ClauseKind::OrderBy, ClauseKind::GroupedBy>(); });
+		if constexpr (order != none)
+		{
+			using Order = ::std::tuple_element_t<order, ::std::tuple<CLAUSES...>>;
+			static_assert(TABLE::template IndexOn<Order::Name>() == IndexUse::Ordered, "OrderBy and GroupedBy columns must have an Ordered or Sorted index");
+			constexpr auto narrowing = FindClause<CLAUSES...>([]<typename C>() { return IsKind<C, ClauseKind::Equal, ClauseKind::Range>() && ::std::is_same_v<typename C::Column, typename Order::Column>; });
+			return narrowing != none ? narrowing : order;
+		}
+		else
+		{
+			return FindClause<CLAUSES...>([]<typename C>() {
+				if constexpr (IsKind<C, ClauseKind::Equal>())
+					return TABLE::template IndexOn<C::Name>() != IndexUse::None;
+				else if constexpr (IsKind<C, ClauseKind::Range>())
+					return TABLE::template IndexOn<C::Name>() == IndexUse::Ordered;
+				else
+					return false;
+			});
+		}
+	}
+
+	template <typename TABLE, typename... CLAUSES>
+	auto Select(TABLE const& table, CLAUSES... clause_list)
+	{
+		using Clauses = ::std::tuple<decltype(Bind<TABLE>(::std::declval<CLAUSES>()))...>;
+		constexpr auto none = sizeof...(CLAUSES);
+		constexpr auto order = FindClause<CLAUSES...>([]<typename C>() { return IsKind<C, ClauseKind::OrderBy, ClauseKind::GroupedBy>(); });
+		constexpr auto projection = FindClause<CLAUSES...>([]<typename C>() { return IsKind<C, ClauseKind::Columns>(); });
+		constexpr auto limit = FindClause<CLAUSES...>([]<typename C>() { return IsKind<C, ClauseKind::Limit>(); });
+		constexpr auto driver = Driver<TABLE, CLAUSES...>();
+
+		Clauses clauses{ Bind<TABLE>(::std::move(clause_list))... };
+		RowFilter<TABLE, driver, Clauses> const filter{ clauses };
+
+		if constexpr (driver == none)
+			return Limited<limit>(clauses, Project<TABLE, projection, Clauses>(table.QueryRows() | ::std::views::filter(filter)));
+		else
+		{
+			auto const entries = IndexEntries(table, ::std::get<driver>(clauses));
+			if constexpr (IsGrouped<order, Clauses>())
+			{
+				return Limited<limit>(clauses, KeyGroups{ entries.begin(), entries.end() }
+					/// Groups whose rows are all filtered out are skipped; filter views can only be iterated when not const, hence the copy
+					| ::std::views::transform(GroupRows<TABLE, projection, Clauses, decltype(filter)>{ &table, filter })
+					| ::std::views::filter([](auto group) { return !::std::ranges::empty(group.second); }));
+			}
+			else if constexpr (IsDescending<order, Clauses>())
+				return Limited<limit>(clauses, Project<TABLE, projection, Clauses>(entries | ::std::views::reverse | ::std::views::transform(RowLookup<TABLE>{ &table }) | ::std::views::filter(filter)));
+			else
+				return Limited<limit>(clauses, Project<TABLE, projection, Clauses>(entries | ::std::views::transform(RowLookup<TABLE>{ &table }) | ::std::views::filter(filter)));
+		}
+	}
+})cpp";
+
+	/// Map-backed tables keep their indices through ::dtmdl::TableBase, which only knows std::map, so they are always Ordered
+	IndexKind CppTablesFormat::IndexTypeIn(StructDefinition const* table, FieldDefinition const* field)
+	{
+		if (!table->Flags.contain(StructFlags::DenseTable) && !table->Flags.contain(StructFlags::ColumnarTable))
+			return IndexKind::Ordered;
+		return field->IndexType();
+	}
+
+	string CppTablesFormat::IndexMemberName(StructDefinition const* table, FieldDefinition const* field)
+	{
+		switch (IndexTypeIn(table, field))
+		{
+		case IndexKind::Hash: return format("mHashedBy{}", field->Name);
+		case IndexKind::Sorted: return format("mSortedBy{}", field->Name);
+		}
+		return format("mOrderedBy{}", field->Name);
+	}
+
+	string CppTablesFormat::IndexTypeName(Database const& db, StructDefinition const* table, FieldDefinition const* field)
+	{
+		auto const key = FormatTypeReference(db, field->FieldType);
+		auto const unique = field->Flags.contain(FieldFlags::Unique);
+		switch (IndexTypeIn(table, field))
+		{
+		case IndexKind::Hash: return format("dtmdl_HashIndex<{}>", key);
+		case IndexKind::Sorted: return format("dtmdl_SortedIndex<{}, {}>", key, unique);
+		}
+		if (unique)
+			return format("::std::map<{}, ::std::int64_t, ::std::less<>>", key);
+		return format("::std::multimap<{}, ::std::int64_t, ::std::less<>>", key);
+	}
+
 	string CppTablesFormat::Export(Database const& db)
 	{
 		auto out = StartOutput(db, { "types.hpp" });
 
+		auto const uses_index_types = ranges::any_of(db.Structs(), [](auto def) {
+			return def->Flags.contain(StructFlags::CreateTableType) && ranges::any_of(def->AllFieldsOrdered(), [def](auto field) {
+				return field->Flags.contain(FieldFlags::Indexed) && IndexTypeIn(def, field) != IndexKind::Ordered;
+			});
+		});
+		if (uses_index_types)
+			WriteIndexTypes(out);
+
+		if (ranges::any_of(db.Structs(), [](auto def) { return def->Flags.contain(StructFlags::CreateTableType); }))
+			out.WriteVerbatim(QueryRuntime);
+
+		auto const table_with = [&db](StructFlags flag) {
+			return ranges::any_of(db.Structs(), [flag](auto def) { return def->Flags.contain(StructFlags::CreateTableType) && def->Flags.contain(flag); });
+		};
+		if (table_with(StructFlags::DenseTable) || table_with(StructFlags::ColumnarTable))
+			WriteDenseRows(out);
+		if (table_with(StructFlags::ColumnarTable))
+			WriteColumnTypes(out);
+
 		for (auto def : db.Structs())
 		{
 			if (!def->Flags.contain(StructFlags::CreateTableType))
 				continue;
 
-			out.WriteStart("struct dtmdl_{0}Table : ::dtmdl::TableBase<dtmdl_{0}Table> {{", def->Name());
+			auto const columnar = def->Flags.contain(StructFlags::ColumnarTable);
+			auto const dense = columnar || def->Flags.contain(StructFlags::DenseTable);
+			if (dense)
+				out.WriteStart("struct dtmdl_{0}Table {{", def->Name());
+			else
+				out.WriteStart("struct dtmdl_{0}Table : ::dtmdl::TableBase<dtmdl_{0}Table> {{", def->Name());
 			out.WriteLine("using RowType = {};", FormatTypeName(db, def));
 			out.WriteLine("template <::dtmdl::FixedString COLUMN>");
 			out.WriteStart("static constexpr auto GetField() {{");
@@ -27,21 +410,44 @@ namespace dtmdl
 			out.WriteLine("static_assert(::std::is_same_v<decltype(COLUMN), void>, \"column name not an (accessible) field in {}\");", FormatTypeName(db, def));
 			out.WriteEnd("}}");
 
+			/// Map-backed tables are changed through ::dtmdl::TableBase, which knows nothing of triggers, so only tables
+			/// that manage their own rows get them
+			if (dense)
+				WriteTriggers(out, db, def);
+
+			if (columnar)
+				WriteColumnarStorage(out, db, def);
+			else if (dense)
+				WriteDenseStorage(out, db, def);
+			WriteIndexQueries(out, def);
+			WriteQueryHooks(out, db, def);
+
 			out.Unindent();
 			out.WriteLine("protected:");
 			out.Indent();
-			out.WriteLine("friend struct ::dtmdl::TableBase<dtmdl_{}Table>;", def->Name());
-			out.WriteLine("::std::int64_t mLastRowID = 0;");
-			out.WriteLine("::std::map<::std::int64_t, {}> mRows;", FormatTypeName(db, def));
+			if (columnar)
+			{
+				out.WriteLine("dtmdl_RowSlots mRowSlots;");
+				for (auto field : def->AllFieldsOrdered())
+					out.WriteLine("dtmdl_Column<{}> mColumn{};", FormatTypeReference(db, field->FieldType), field->Name);
+				WriteColumnarAccess(out, db, def);
+			}
+			else if (dense)
+			{
+				out.WriteLine("dtmdl_DenseRows<RowType> mRows;");
+			}
+			else
+			{
+				out.WriteLine("friend struct ::dtmdl::TableBase<dtmdl_{}Table>;", def->Name());
+				out.WriteLine("::std::int64_t mLastRowID = 0;");
+				out.WriteLine("::std::map<::std::int64_t, {}> mRows;", FormatTypeName(db, def));
+			}
+			if (dense)
+				WriteTriggerState(out);
 			for (auto& field : def->AllFieldsOrdered())
 			{
 				if (field->Flags.contain(FieldFlags::Indexed))
-				{
-					if (field->Flags.contain(FieldFlags::Unique))
-						out.WriteLine("::std::map<{}, ::std::int64_t, ::std::less<>> mOrderedBy{};", FormatTypeReference(db, field->FieldType), field->Name);
-					else
-						out.WriteLine("::std::multimap<{}, ::std::int64_t, ::std::less<>> mOrderedBy{};", FormatTypeReference(db, field->FieldType), field->Name);
-				}
+					out.WriteLine("{} {};", IndexTypeName(db, def, field), IndexMemberName(def, field));
 			}
 			out.WriteEnd("}};");
 		}
@@ -49,4 +455,653 @@ namespace dtmdl
 		return FinishOutput(db);
 	}
 
+	/// Written once per header, for the Indexed fields with a Hash or Sorted index; both have the parts of the std::map interface
+	/// that tables use, so the generated code doesn't depend on the kind of index
+	void CppTablesFormat::WriteIndexTypes(SimpleOutputter& out)
+	{
+		out.WriteLine("/// Unique keys only; open addressing with linear probing, and backward-shift deletion so there are no tombstones.");
+		out.WriteLine("/// Pointers to entries are invalidated by any insertion or erasure.");
+		out.WriteLine("template <typename KEY>");
+		out.WriteStart("struct dtmdl_HashIndex {{");
+		out.WriteLine("using value_type = ::std::pair<KEY, ::std::int64_t>;");
+		out.WriteLine("using LookupKey = ::std::conditional_t<::std::is_same_v<KEY, ::std::string>, ::std::string_view, KEY>;");
+		out.WriteStart("value_type const* find(LookupKey const& key) const noexcept {{");
+		out.WriteLine("if (mSize == 0) return nullptr;");
+		out.WriteLine("auto const mask = mEntries.size() - 1;");
+		out.WriteLine("for (auto i = Hash(key) & mask; mUsed[i]; i = (i + 1) & mask)");
+		out.WriteLine("\tif (mEntries[i].first == key) return &mEntries[i];");
+		out.WriteLine("return nullptr;");
+		out.WriteEnd("}}");
+		out.WriteLine("value_type const* end() const noexcept {{ return nullptr; }}");
+		out.WriteLine("bool contains(LookupKey const& key) const noexcept {{ return find(key) != nullptr; }}");
+		out.WriteLine("::std::pair<value_type const*, value_type const*> equal_range(LookupKey const& key) const noexcept {{ auto const it = find(key); return {{ it, it ? it + 1 : it }}; }}");
+		out.WriteStart("::std::pair<value_type const*, bool> emplace(KEY key, ::std::int64_t id) {{");
+		out.WriteLine("if ((mSize + 1) * 4 > mEntries.size() * 3) Rehash(::std::max<::std::size_t>(16, mEntries.size() * 2));");
+		out.WriteLine("auto const mask = mEntries.size() - 1;");
+		out.WriteLine("auto i = Hash(key) & mask;");
+		out.WriteLine("for (; mUsed[i]; i = (i + 1) & mask)");
+		out.WriteLine("\tif (mEntries[i].first == key) return {{ &mEntries[i], false }};");
+		out.WriteLine("mEntries[i] = {{ ::std::move(key), id }};");
+		out.WriteLine("mUsed[i] = true;");
+		out.WriteLine("++mSize;");
+		out.WriteLine("return {{ &mEntries[i], true }};");
+		out.WriteEnd("}}");
+		out.WriteStart("void erase(value_type const* it) {{");
+		out.WriteLine("auto const mask = mEntries.size() - 1;");
+		out.WriteLine("auto hole = ::std::size_t(it - mEntries.data());");
+		out.WriteLine("mUsed[hole] = false;");
+		out.WriteLine("--mSize;");
+		out.WriteStart("for (auto i = (hole + 1) & mask; mUsed[i]; i = (i + 1) & mask) {{");
+		out.WriteLine("/// An entry can only move back into the hole if that doesn't put it before its home slot");
+		out.WriteLine("auto const home = Hash(mEntries[i].first) & mask;");
+		out.WriteLine("if (((i - home) & mask) < ((i - hole) & mask)) continue;");
+		out.WriteLine("mEntries[hole] = ::std::move(mEntries[i]);");
+		out.WriteLine("mUsed[hole] = true;");
+		out.WriteLine("mUsed[i] = false;");
+		out.WriteLine("hole = i;");
+		out.WriteEnd("}}");
+		out.WriteEnd("}}");
+		out.WriteLine("::std::size_t size() const noexcept {{ return mSize; }}");
+		out.WriteStart("void reserve(::std::size_t count) {{");
+		out.WriteLine("::std::size_t capacity = 16;");
+		out.WriteLine("while (capacity * 3 < count * 4) capacity *= 2;");
+		out.WriteLine("if (capacity > mEntries.size()) Rehash(capacity);");
+		out.WriteEnd("}}");
+		out.Unindent();
+		out.WriteLine("private:");
+		out.Indent();
+		out.WriteLine("/// std::hash is the identity for integers on most standard libraries, so spread the bits before masking");
+		out.WriteLine("static ::std::size_t Hash(LookupKey const& key) noexcept {{ auto const hash = ::std::uint64_t(::std::hash<LookupKey>{{}}(key)) * 0x9E3779B97F4A7C15ull; return ::std::size_t(hash ^ (hash >> 32)); }}");
+		out.WriteStart("void Rehash(::std::size_t capacity) {{");
+		out.WriteLine("auto entries = ::std::exchange(mEntries, ::std::vector<value_type>(capacity));");
+		out.WriteLine("auto used = ::std::exchange(mUsed, ::std::vector<char>(capacity));");
+		out.WriteLine("mSize = 0;");
+		out.WriteLine("for (::std::size_t i = 0; i < entries.size(); ++i)");
+		out.WriteLine("\tif (used[i]) emplace(::std::move(entries[i].first), entries[i].second);");
+		out.WriteEnd("}}");
+		out.WriteLine("::std::vector<value_type> mEntries; /// size is 0 or a power of two");
+		out.WriteLine("::std::vector<char> mUsed;");
+		out.WriteLine("::std::size_t mSize = 0;");
+		out.WriteEnd("}};");
+
+		out.WriteLine("/// Entries sorted by key, in one vector; equal keys (if not UNIQUE) are kept in insertion order.");
+		out.WriteLine("/// Best for tables that are mostly read: lookups are binary searches and scans are linear, but every insertion");
+		out.WriteLine("/// and erasure moves the entries after it. Iterators are invalidated by any insertion or erasure.");
+		out.WriteLine("template <typename KEY, bool UNIQUE>");
+		out.WriteStart("struct dtmdl_SortedIndex {{");
+		out.WriteLine("using value_type = ::std::pair<KEY, ::std::int64_t>;");
+		out.WriteLine("using const_iterator = typename ::std::vector<value_type>::const_iterator;");
+		out.WriteLine("template <typename K> const_iterator lower_bound(K const& key) const {{ return ::std::ranges::lower_bound(mEntries, key, ::std::less<>{{}}, &value_type::first); }}");
+		out.WriteLine("template <typename K> const_iterator upper_bound(K const& key) const {{ return ::std::ranges::upper_bound(mEntries, key, ::std::less<>{{}}, &value_type::first); }}");
+		out.WriteLine("template <typename K> ::std::pair<const_iterator, const_iterator> equal_range(K const& key) const {{ return {{ lower_bound(key), upper_bound(key) }}; }}");
+		out.WriteLine("template <typename K> const_iterator find(K const& key) const {{ auto const it = lower_bound(key); return it != end() && !::std::less<>{{}}(key, it->first) ? it : end(); }}");
+		out.WriteLine("template <typename K> bool contains(K const& key) const {{ return find(key) != end(); }}");
+		out.WriteStart("::std::pair<const_iterator, bool> emplace(KEY key, ::std::int64_t id) {{");
+		out.WriteStart("if constexpr (UNIQUE) {{");
+		out.WriteLine("auto const it = lower_bound(key);");
+		out.WriteLine("if (it != end() && !::std::less<>{{}}(key, it->first)) return {{ it, false }};");
+		out.WriteLine("return {{ mEntries.emplace(it, ::std::move(key), id), true }};");
+		out.WriteEnd("}}");
+		out.WriteLine("else return {{ mEntries.emplace(upper_bound(key), ::std::move(key), id), true }};");
+		out.WriteEnd("}}");
+		out.WriteLine("const_iterator erase(const_iterator it) {{ return mEntries.erase(it); }}");
+		out.WriteLine("const_iterator begin() const noexcept {{ return mEntries.begin(); }}");
+		out.WriteLine("const_iterator end() const noexcept {{ return mEntries.end(); }}");
+		out.WriteLine("::std::size_t size() const noexcept {{ return mEntries.size(); }}");
+		out.WriteLine("void reserve(::std::size_t count) {{ mEntries.reserve(count); }}");
+		out.WriteLine("/// For bulk loading: Append entries in any order, then Sort once; keys must not repeat if UNIQUE");
+		out.WriteLine("void Append(KEY key, ::std::int64_t id) {{ mEntries.emplace_back(::std::move(key), id); }}");
+		out.WriteLine("void Sort() {{ ::std::ranges::stable_sort(mEntries, ::std::less<>{{}}, &value_type::first); }}");
+		out.Unindent();
+		out.WriteLine("private:");
+		out.Indent();
+		out.WriteLine("::std::vector<value_type> mEntries;");
+		out.WriteEnd("}};");
+	}
+
+	/// Lookups through the indices of Indexed fields, whatever kind of index they use
+	void CppTablesFormat::WriteIndexQueries(SimpleOutputter& out, StructDefinition const* def)
+	{
+		for (auto field : def->AllFieldsOrdered())
+		{
+			if (!field->Flags.contain(FieldFlags::Indexed))
+				continue;
+
+			auto const index = IndexMemberName(def, field);
+			if (field->Flags.contain(FieldFlags::Unique))
+				out.WriteLine("template <typename KEY> ::std::int64_t FindBy{0}(KEY const& key) const {{ auto const it = {1}.find(key); return it == {1}.end() ? 0 : it->second; }}", field->Name, index);
+			else
+				out.WriteLine("template <typename KEY> auto FindAllBy{0}(KEY const& key) const {{ return {1}.equal_range(key); }}", field->Name, index);
+			if (IndexTypeIn(def, field) != IndexKind::Hash)
+			{
+				out.WriteLine("/// Entries with keys in [from, to)");
+				out.WriteLine("template <typename KEY> auto FindRangeBy{0}(KEY const& from, KEY const& to) const {{ return ::std::ranges::subrange({1}.lower_bound(from), {1}.lower_bound(to)); }}", field->Name, index);
+			}
+		}
+	}
+
+	/// What dtmdl_query::Select needs to know about a table; everything is resolved at compile time
+	void CppTablesFormat::WriteQueryHooks(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto const fields = def->AllFieldsOrdered();
+		auto const columnar = def->Flags.contain(StructFlags::ColumnarTable);
+		auto const dense = columnar || def->Flags.contain(StructFlags::DenseTable);
+
+		out.WriteLine("/// See dtmdl_query; the result refers to this table, and is invalidated by any change to it");
+		out.WriteLine("template <typename... CLAUSES>");
+		out.WriteLine("auto Select(CLAUSES... clauses) const {{ return dtmdl_query::Select(*this, ::std::move(clauses)...); }}");
+
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.WriteStart("static constexpr dtmdl_query::IndexUse IndexOn() {{");
+		for (auto field : fields)
+		{
+			if (field->Flags.contain(FieldFlags::Indexed))
+				out.WriteLine("if constexpr (COLUMN.eq(\"{}\")) {{ return dtmdl_query::IndexUse::{}; }} else", field->Name, IndexTypeIn(def, field) == IndexKind::Hash ? "Equality" : "Ordered");
+		}
+		out.WriteLine("return dtmdl_query::IndexUse::None;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.WriteStart("auto const& QueryIndex() const noexcept {{");
+		for (auto field : fields)
+		{
+			if (field->Flags.contain(FieldFlags::Indexed))
+				out.WriteLine("if constexpr (COLUMN.eq(\"{}\")) {{ return {}; }} else", field->Name, IndexMemberName(def, field));
+		}
+		out.WriteLine("static_assert(::std::is_same_v<decltype(COLUMN), void>, \"column is not indexed\");");
+		out.WriteEnd("}}");
+
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		if (columnar)
+		{
+			out.WriteStart("static decltype(auto) ColumnValue(RowView const& row) noexcept {{");
+			for (auto field : fields)
+				out.WriteLine("if constexpr (COLUMN.eq(\"{}\")) {{ return (row.{}); }} else", field->Name, MemberName(db, field));
+			out.WriteLine("static_assert(::std::is_same_v<decltype(COLUMN), void>, \"column name not an (accessible) field in {}\");", FormatTypeName(db, def));
+			out.WriteEnd("}}");
+			out.WriteLine("RowView QueryRow(::std::int64_t id) const noexcept {{ return RowAt(mRowSlots.IndexOf(id)); }}");
+			out.WriteLine("auto QueryRows() const {{ return Rows(); }}");
+		}
+		else
+		{
+			out.WriteLine("static decltype(auto) ColumnValue(RowType const& row) noexcept {{ return (row.*GetField<COLUMN>()); }}");
+			if (dense)
+			{
+				out.WriteLine("RowType const& QueryRow(::std::int64_t id) const noexcept {{ return *mRows.Find(id); }}");
+				out.WriteLine("auto QueryRows() const noexcept {{ return mRows.Rows(); }}");
+			}
+			else
+			{
+				out.WriteLine("RowType const& QueryRow(::std::int64_t id) const {{ return mRows.find(id)->second; }}");
+				out.WriteLine("auto QueryRows() const {{ return mRows | ::std::views::values; }}");
+			}
+		}
+	}
+
+	/// Written once per header, for the tables with the DenseTable or ColumnarTable flag
+	void CppTablesFormat::WriteDenseRows(SimpleOutputter& out)
+	{
+		out.WriteLine("/// Slot map of row ids: rows are kept contiguous, in no particular order (erasing a row moves the last row into its place).");
+		out.WriteLine("/// Row ids are handles - the slot index in the low 32 bits and the slot's generation in the high 32 bits - so finding");
+		out.WriteLine("/// a row by id is two array lookups, and the id of an erased row never finds the row that reuses its slot.");
+		out.WriteLine("/// 0 is never a valid row id. The row data itself is kept by the user of this, in the same order as the ids.");
+		out.WriteStart("struct dtmdl_RowSlots {{");
+		out.WriteLine("static constexpr ::std::uint32_t NoIndex = ~::std::uint32_t(0);");
+
+		out.WriteLine("/// The new row's index is the previous Size()");
+		out.WriteStart("::std::int64_t Add() {{");
+		out.WriteLine("::std::uint32_t slot = mFreeSlot;");
+		out.WriteLine("if (slot != NoIndex) mFreeSlot = mSlots[slot].Index;");
+		out.WriteLine("else {{ slot = ::std::uint32_t(mSlots.size()); mSlots.emplace_back(); }}");
+		out.WriteLine("mSlots[slot].Index = ::std::uint32_t(mRowSlots.size());");
+		out.WriteLine("mRowSlots.push_back(slot);");
+		out.WriteLine("return MakeID(slot, mSlots[slot].Generation);");
+		out.WriteEnd("}}");
+
+		out.WriteStart("::std::uint32_t IndexOf(::std::int64_t id) const noexcept {{");
+		out.WriteLine("auto const slot = ::std::uint32_t(::std::uint64_t(id));");
+		out.WriteLine("if (slot >= mSlots.size() || mSlots[slot].Generation != ::std::uint32_t(::std::uint64_t(id) >> 32)) return NoIndex;");
+		out.WriteLine("/// Free slots keep the next free slot in Index, so check that the row really is in this slot");
+		out.WriteLine("auto const index = mSlots[slot].Index;");
+		out.WriteLine("return index < mRowSlots.size() && mRowSlots[index] == slot ? index : NoIndex;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("/// Frees the slot of the row at `index` and gives the index to the last row. Returns the last row's previous index;");
+		out.WriteLine("/// the caller must move the last row's data to `index` (if they differ), and then pop it.");
+		out.WriteStart("::std::uint32_t Remove(::std::uint32_t index) {{");
+		out.WriteLine("auto const slot = mRowSlots[index];");
+		out.WriteLine("auto const last = ::std::uint32_t(mRowSlots.size() - 1);");
+		out.WriteStart("if (index != last) {{");
+		out.WriteLine("mRowSlots[index] = mRowSlots[last];");
+		out.WriteLine("mSlots[mRowSlots[index]].Index = index;");
+		out.WriteEnd("}}");
+		out.WriteLine("mRowSlots.pop_back();");
+		out.WriteLine("++mSlots[slot].Generation;");
+		out.WriteLine("mSlots[slot].Index = mFreeSlot;");
+		out.WriteLine("mFreeSlot = slot;");
+		out.WriteLine("return last;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("::std::int64_t IDAt(::std::size_t index) const noexcept {{ auto const slot = mRowSlots[index]; return MakeID(slot, mSlots[slot].Generation); }}");
+		out.WriteLine("::std::size_t Size() const noexcept {{ return mRowSlots.size(); }}");
+		out.WriteLine("void Reserve(::std::size_t count) {{ mRowSlots.reserve(count); mSlots.reserve(count); }}");
+
+		out.Unindent();
+		out.WriteLine("private:");
+		out.Indent();
+		out.WriteLine("/// Generations start at 1, so that no id is 0");
+		out.WriteLine("static constexpr ::std::int64_t MakeID(::std::uint32_t slot, ::std::uint32_t generation) noexcept {{ return ::std::int64_t((::std::uint64_t(generation) << 32) | slot); }}");
+		out.WriteStart("struct Slot {{");
+		out.WriteLine("::std::uint32_t Index = NoIndex; /// of the row, or of the next free slot");
+		out.WriteLine("::std::uint32_t Generation = 1; /// bumped whenever the slot's row is erased");
+		out.WriteEnd("}};");
+		out.WriteLine("::std::vector<::std::uint32_t> mRowSlots; /// slot of each row, in row order");
+		out.WriteLine("::std::vector<Slot> mSlots;");
+		out.WriteLine("::std::uint32_t mFreeSlot = NoIndex;");
+		out.WriteEnd("}};");
+
+		out.WriteLine("/// Rows in one vector, identified by dtmdl_RowSlots ids");
+		out.WriteLine("template <typename ROW>");
+		out.WriteStart("struct dtmdl_DenseRows {{");
+		out.WriteLine("::std::int64_t Insert(ROW row) {{ mRows.push_back(::std::move(row)); return mSlots.Add(); }}");
+		out.WriteLine("ROW* Find(::std::int64_t id) noexcept {{ auto const index = mSlots.IndexOf(id); return index == dtmdl_RowSlots::NoIndex ? nullptr : &mRows[index]; }}");
+		out.WriteLine("ROW const* Find(::std::int64_t id) const noexcept {{ auto const index = mSlots.IndexOf(id); return index == dtmdl_RowSlots::NoIndex ? nullptr : &mRows[index]; }}");
+		out.WriteLine("bool Contains(::std::int64_t id) const noexcept {{ return mSlots.IndexOf(id) != dtmdl_RowSlots::NoIndex; }}");
+		out.WriteStart("bool Erase(::std::int64_t id) {{");
+		out.WriteLine("auto const index = mSlots.IndexOf(id);");
+		out.WriteLine("if (index == dtmdl_RowSlots::NoIndex) return false;");
+		out.WriteLine("if (auto const last = mSlots.Remove(index); index != last) mRows[index] = ::std::move(mRows[last]);");
+		out.WriteLine("mRows.pop_back();");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+		out.WriteLine("/// Rows in memory order; erasing rows changes the order");
+		out.WriteLine("::std::span<ROW const> Rows() const noexcept {{ return mRows; }}");
+		out.WriteLine("::std::int64_t IDAt(::std::size_t index) const noexcept {{ return mSlots.IDAt(index); }}");
+		out.WriteLine("::std::size_t Size() const noexcept {{ return mRows.size(); }}");
+		out.WriteLine("void Reserve(::std::size_t count) {{ mRows.reserve(count); mSlots.Reserve(count); }}");
+		out.Unindent();
+		out.WriteLine("private:");
+		out.Indent();
+		out.WriteLine("::std::vector<ROW> mRows;");
+		out.WriteLine("dtmdl_RowSlots mSlots;");
+		out.WriteEnd("}};");
+
+		out.WriteLine("/// Removes the entry of row `id` from an index of a dense table");
+		out.WriteLine("template <typename INDEX, typename KEY>");
+		out.WriteStart("void dtmdl_EraseIndexEntry(INDEX& index, KEY const& key, ::std::int64_t id) {{");
+		out.WriteLine("for (auto [it, end] = index.equal_range(key); it != end; ++it)");
+		out.WriteLine("\tif (it->second == id) {{ index.erase(it); return; }}");
+		out.WriteEnd("}}");
+	}
+
+	/// Each column gets a bit, so checking whether any trigger cares about a change is a single AND; fields past
+	/// the 64th share the last bit
+	void CppTablesFormat::WriteTriggers(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto const fields = def->AllFieldsOrdered();
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.WriteStart("static constexpr ::std::uint64_t ColumnBit() {{");
+		for (size_t i = 0; i < fields.size(); ++i)
+			out.WriteLine("if constexpr (COLUMN.eq(\"{}\")) {{ return ::std::uint64_t(1) << {}; }} else", fields[i]->Name, min<size_t>(i, 63));
+		out.WriteLine("static_assert(::std::is_same_v<decltype(COLUMN), void>, \"column name not an (accessible) field in {}\");", FormatTypeName(db, def));
+		out.WriteEnd("}}");
+		out.WriteLine("template <::dtmdl::FixedString... COLUMNS>");
+		out.WriteLine("static constexpr ::std::uint64_t ColumnMask() {{ return (ColumnBit<COLUMNS>() | ... | ::std::uint64_t(0)); }}");
+		out.WriteLine("static constexpr ::std::uint64_t AllColumns = ~::std::uint64_t(0);");
+
+		out.WriteLine("enum class TriggerTiming {{ Before, After }};");
+		out.WriteLine("enum class TriggerEvent {{ Insert, Update, Delete }};");
+		out.WriteStart("struct RowChange {{");
+		out.WriteLine("::std::int64_t RowID = 0;");
+		out.WriteLine("::std::optional<RowType> Old; /// empty for inserts");
+		out.WriteLine("::std::optional<RowType> New; /// empty for deletes");
+		out.WriteLine("::std::uint64_t Columns = AllColumns;");
+		out.WriteEnd("}};");
+		out.WriteLine("/// Callbacks may add and remove triggers; added ones only see later changes, and removed ones aren't called again");
+		out.WriteStart("struct Trigger {{");
+		out.WriteLine("TriggerTiming When = TriggerTiming::After;");
+		out.WriteLine("TriggerEvent On = TriggerEvent::Update;");
+		out.WriteLine("::std::uint64_t Columns = AllColumns; /// see ColumnMask");
+		out.WriteLine("bool PerBatch = false; /// After triggers only: changes made during a batch are passed to one call at the end of it");
+		out.WriteLine("::std::function<void(::std::span<RowChange const>)> Callback;");
+		out.WriteEnd("}};");
+		out.WriteStart("struct TriggerStats {{");
+		out.WriteLine("::std::uint64_t ChangesChecked = 0;");
+		out.WriteLine("::std::uint64_t ChangesMatched = 0;");
+		out.WriteLine("::std::uint64_t Calls = 0;");
+		out.WriteEnd("}};");
+
+		out.WriteStart("::std::size_t AddTrigger(Trigger trigger) {{");
+		out.WriteLine("mTriggers.push_back({{ ++mLastTriggerID, ::std::move(trigger), {{}}, false }});");
+		out.WriteLine("UpdateTriggerMasks();");
+		out.WriteLine("PruneTriggers();");
+		out.WriteLine("return mLastTriggerID;");
+		out.WriteEnd("}}");
+		out.WriteStart("void RemoveTrigger(::std::size_t id) {{");
+		out.WriteLine("for (auto& registered : mTriggers) if (registered.ID == id) {{ registered.Removed = true; registered.Pending.clear(); }}");
+		out.WriteLine("UpdateTriggerMasks();");
+		out.WriteLine("PruneTriggers();");
+		out.WriteEnd("}}");
+		out.WriteLine("void BeginTriggerBatch() {{ ++mTriggerBatchDepth; }}");
+		out.WriteStart("void EndTriggerBatch() {{");
+		out.WriteLine("if (--mTriggerBatchDepth != 0) return;");
+		out.WriteLine("++mCallingTriggers;");
+		out.WriteLine("/// By index, and with the callback copied, as callbacks can add triggers and so move the ones in mTriggers");
+		out.WriteStart("for (::std::size_t i = 0, count = mTriggers.size(); i < count; ++i) {{");
+		out.WriteLine("if (mTriggers[i].Pending.empty()) continue;");
+		out.WriteLine("auto changes = ::std::exchange(mTriggers[i].Pending, {{}});");
+		out.WriteLine("auto const callback = mTriggers[i].Definition.Callback;");
+		out.WriteLine("++mTriggerStats.Calls;");
+		out.WriteLine("callback(changes);");
+		out.WriteEnd("}}");
+		out.WriteLine("--mCallingTriggers;");
+		out.WriteLine("PruneTriggers();");
+		out.WriteEnd("}}");
+		out.WriteLine("TriggerStats const& TriggerStatistics() const noexcept {{ return mTriggerStats; }}");
+		out.WriteLine("/// Called by the table on every row change; returns immediately if no trigger is interested in the changed columns");
+		out.WriteStart("void FireTriggers(TriggerTiming when, TriggerEvent on, ::std::uint64_t columns, ::std::int64_t row_id, RowType const* old_row, RowType const* new_row) {{");
+		out.WriteLine("if ((mTriggerMasks[int(when)][int(on)] & columns) == 0) return;");
+		out.WriteLine("++mTriggerStats.ChangesChecked;");
+		out.WriteLine("/// Copied before any callback runs, as callbacks can change this table and so move the rows pointed to");
+		out.WriteLine("RowChange const change{{ row_id, old_row ? ::std::optional<RowType>{{ *old_row }} : ::std::nullopt, new_row ? ::std::optional<RowType>{{ *new_row }} : ::std::nullopt, columns }};");
+		out.WriteLine("++mCallingTriggers;");
+		out.WriteStart("for (::std::size_t i = 0, count = mTriggers.size(); i < count; ++i) {{");
+		out.WriteLine("auto& registered = mTriggers[i];");
+		out.WriteLine("auto const& trigger = registered.Definition;");
+		out.WriteLine("if (registered.Removed || trigger.When != when || trigger.On != on || (trigger.Columns & columns) == 0) continue;");
+		out.WriteLine("++mTriggerStats.ChangesMatched;");
+		out.WriteLine("if (trigger.PerBatch && mTriggerBatchDepth > 0) {{ registered.Pending.push_back(change); continue; }}");
+		out.WriteLine("auto const callback = trigger.Callback;");
+		out.WriteLine("++mTriggerStats.Calls;");
+		out.WriteLine("callback({{ &change, 1 }});");
+		out.WriteEnd("}}");
+		out.WriteLine("--mCallingTriggers;");
+		out.WriteEnd("}}");
+	}
+
+	void CppTablesFormat::WriteTriggerState(SimpleOutputter& out)
+	{
+		out.WriteStart("struct RegisteredTrigger {{");
+		out.WriteLine("::std::size_t ID = 0;");
+		out.WriteLine("Trigger Definition;");
+		out.WriteLine("::std::vector<RowChange> Pending;");
+		out.WriteLine("bool Removed = false; /// triggers removed while triggers are being called are only erased once that's done");
+		out.WriteEnd("}};");
+		out.WriteLine("::std::vector<RegisteredTrigger> mTriggers;");
+		out.WriteLine("::std::size_t mLastTriggerID = 0;");
+		out.WriteLine("int mTriggerBatchDepth = 0;");
+		out.WriteLine("int mCallingTriggers = 0;");
+		out.WriteLine("::std::uint64_t mTriggerMasks[2][3]{{}}; /// union of the column masks of all triggers, per timing and event");
+		out.WriteLine("TriggerStats mTriggerStats;");
+		out.WriteStart("void UpdateTriggerMasks() {{");
+		out.WriteLine("for (auto& masks : mTriggerMasks) for (auto& mask : masks) mask = 0;");
+		out.WriteLine("for (auto& registered : mTriggers) if (!registered.Removed) mTriggerMasks[int(registered.Definition.When)][int(registered.Definition.On)] |= registered.Definition.Columns;");
+		out.WriteEnd("}}");
+		out.WriteStart("void PruneTriggers() {{");
+		out.WriteLine("if (mCallingTriggers == 0) ::std::erase_if(mTriggers, [](auto const& registered) {{ return registered.Removed; }});");
+		out.WriteEnd("}}");
+	}
+
+	/// Used by dense and columnar tables, both before and after the Before triggers, as the triggers may change the table
+	void CppTablesFormat::WriteUniqueChecks(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto unique = def->AllFieldsOrdered();
+		erase_if(unique, [](auto field) { return !field->Flags.contain(FieldFlags::Indexed) || !field->Flags.contain(FieldFlags::Unique); });
+
+		out.WriteLine("/// Whether a row other than `id` has `value` in COLUMN, which is Unique");
+		out.WriteLine("template <::dtmdl::FixedString COLUMN, typename VALUE>");
+		out.WriteStart("bool IsValueTaken([[maybe_unused]] VALUE const& value, [[maybe_unused]] ::std::int64_t id) const {{");
+		for (auto field : unique)
+			out.WriteLine("if constexpr (COLUMN.eq(\"{0}\")) {{ auto const it = {1}.find(value); return it != {1}.end() && it->second != id; }} else", field->Name, IndexMemberName(def, field));
+		out.WriteLine("return false;");
+		out.WriteEnd("}}");
+		out.Write("bool IsAnyValueTaken([[maybe_unused]] RowType const& row) const {{ return ");
+		for (auto field : unique)
+			out.Write("{}.contains(row.{}) || ", IndexMemberName(def, field), MemberName(db, field));
+		out.WriteLine("false; }}");
+	}
+
+	/// Dense tables manage their own rows instead of going through ::dtmdl::TableBase, as the row storage has a different interface
+	void CppTablesFormat::WriteDenseStorage(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto indexed = def->AllFieldsOrdered();
+		erase_if(indexed, [](auto field) { return !field->Flags.contain(FieldFlags::Indexed); });
+
+		WriteUniqueChecks(out, db, def);
+
+		out.WriteLine("/// Returns the id of the new row, or 0 if a Unique column already has the row's value");
+		out.WriteStart("::std::int64_t Insert(RowType row) {{");
+		out.WriteLine("if (IsAnyValueTaken(row)) return 0;");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Insert)] != 0) {{");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Insert, AllColumns, 0, nullptr, &row);");
+		out.WriteLine("if (IsAnyValueTaken(row)) return 0;");
+		out.WriteEnd("}}");
+		out.WriteLine("auto const id = mRows.Insert(::std::move(row));");
+		out.WriteLine("auto const& inserted = *mRows.Find(id);");
+		for (auto field : indexed)
+			out.WriteLine("{}.emplace(inserted.{}, id);", IndexMemberName(def, field), MemberName(db, field));
+		out.WriteLine("FireTriggers(TriggerTiming::After, TriggerEvent::Insert, AllColumns, id, nullptr, &inserted);");
+		out.WriteLine("return id;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("/// Returns false if there's no such row, or if COLUMN is Unique and another row already has `value`");
+		out.WriteLine("template <::dtmdl::FixedString COLUMN, typename VALUE>");
+		out.WriteStart("bool Update(::std::int64_t id, VALUE&& value) {{");
+		out.WriteLine("auto row = mRows.Find(id);");
+		out.WriteLine("if (!row || IsValueTaken<COLUMN>(value, id)) return false;");
+		out.WriteLine("/// Only copy the row when an Update trigger on COLUMN wants to see it before and after; otherwise change it in place");
+		out.WriteStart("if (((mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Update)] | mTriggerMasks[int(TriggerTiming::After)][int(TriggerEvent::Update)]) & ColumnBit<COLUMN>()) == 0) {{");
+		for (auto field : indexed)
+			out.WriteLine("if constexpr (COLUMN.eq(\"{0}\")) {{ dtmdl_EraseIndexEntry({2}, row->{1}, id); {2}.emplace(value, id); }}", field->Name, MemberName(db, field), IndexMemberName(def, field));
+		out.WriteLine("(*row).*GetField<COLUMN>() = ::std::forward<VALUE>(value);");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+		out.WriteLine("RowType updated = *row;");
+		out.WriteLine("updated.*GetField<COLUMN>() = value;");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Update)] & ColumnBit<COLUMN>()) {{");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Update, ColumnBit<COLUMN>(), id, row, &updated);");
+		out.WriteLine("/// The triggers may have changed this table, which can move, change or erase the row");
+		out.WriteLine("row = mRows.Find(id);");
+		out.WriteLine("if (!row || IsValueTaken<COLUMN>(value, id)) return false;");
+		out.WriteLine("updated = *row;");
+		out.WriteLine("updated.*GetField<COLUMN>() = ::std::forward<VALUE>(value);");
+		out.WriteEnd("}}");
+		for (auto field : indexed)
+			out.WriteLine("if constexpr (COLUMN.eq(\"{0}\")) {{ dtmdl_EraseIndexEntry({2}, row->{1}, id); {2}.emplace(updated.{1}, id); }}", field->Name, MemberName(db, field), IndexMemberName(def, field));
+		out.WriteLine("::std::swap(*row, updated);");
+		out.WriteLine("FireTriggers(TriggerTiming::After, TriggerEvent::Update, ColumnBit<COLUMN>(), id, &updated, row);");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+
+		out.WriteStart("bool Erase(::std::int64_t id) {{");
+		out.WriteLine("auto row = mRows.Find(id);");
+		out.WriteLine("if (!row) return false;");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Delete)] != 0) {{");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Delete, AllColumns, id, row, nullptr);");
+		out.WriteLine("/// The triggers may have changed this table, which can move or erase the row");
+		out.WriteLine("row = mRows.Find(id);");
+		out.WriteLine("if (!row) return false;");
+		out.WriteEnd("}}");
+		for (auto field : indexed)
+			out.WriteLine("dtmdl_EraseIndexEntry({}, row->{}, id);", IndexMemberName(def, field), MemberName(db, field));
+		out.WriteLine("/// The row is overwritten by the last one, so only keep it if an After trigger needs it");
+		out.WriteLine("::std::optional<RowType> erased;");
+		out.WriteLine("if (mTriggerMasks[int(TriggerTiming::After)][int(TriggerEvent::Delete)] != 0) erased.emplace(::std::move(*row));");
+		out.WriteLine("mRows.Erase(id);");
+		out.WriteLine("if (erased) FireTriggers(TriggerTiming::After, TriggerEvent::Delete, AllColumns, id, &*erased, nullptr);");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("RowType const* Find(::std::int64_t id) const noexcept {{ return mRows.Find(id); }}");
+		out.WriteLine("bool Contains(::std::int64_t id) const noexcept {{ return mRows.Contains(id); }}");
+		out.WriteLine("::std::size_t RowCount() const noexcept {{ return mRows.Size(); }}");
+		out.WriteLine("void Reserve(::std::size_t count) {{ mRows.Reserve(count); }}");
+		out.WriteLine("/// Rows in memory order; use RowIDAt to get the id of the row at an index");
+		out.WriteLine("::std::span<RowType const> Rows() const noexcept {{ return mRows.Rows(); }}");
+		out.WriteLine("::std::int64_t RowIDAt(::std::size_t index) const noexcept {{ return mRows.IDAt(index); }}");
+	}
+
+	/// Written once per header, for the tables with the ColumnarTable flag
+	void CppTablesFormat::WriteColumnTypes(SimpleOutputter& out)
+	{
+		out.WriteLine("/// Columns start on a cache line, so SIMD loops over them can use aligned loads");
+		out.WriteLine("template <typename T>");
+		out.WriteStart("struct dtmdl_ColumnAllocator {{");
+		out.WriteLine("using value_type = T;");
+		out.WriteLine("static constexpr ::std::align_val_t Alignment{{ ::std::max<::std::size_t>(64, alignof(T)) }};");
+		out.WriteLine("dtmdl_ColumnAllocator() noexcept = default;");
+		out.WriteLine("template <typename U> dtmdl_ColumnAllocator(dtmdl_ColumnAllocator<U> const&) noexcept {{}}");
+		out.WriteLine("T* allocate(::std::size_t count) {{ return static_cast<T*>(::operator new(count * sizeof(T), Alignment)); }}");
+		out.WriteLine("void deallocate(T* pointer, ::std::size_t count) noexcept {{ ::operator delete(pointer, count * sizeof(T), Alignment); }}");
+		out.WriteLine("template <typename U> bool operator==(dtmdl_ColumnAllocator<U> const&) const noexcept {{ return true; }}");
+		out.WriteEnd("}};");
+		out.WriteLine("/// bool columns are kept as bytes, as ::std::vector<bool> has no contiguous storage to span");
+		out.WriteLine("template <typename T>");
+		out.WriteLine("using dtmdl_ColumnValue = ::std::conditional_t<::std::is_same_v<T, bool>, ::std::uint8_t, T>;");
+		out.WriteLine("template <typename T>");
+		out.WriteLine("using dtmdl_Column = ::std::vector<dtmdl_ColumnValue<T>, dtmdl_ColumnAllocator<dtmdl_ColumnValue<T>>>;");
+	}
+
+	/// Columnar tables keep the rows of a dense table split into one dtmdl_Column per field; rows are only put
+	/// together (as RowType) when a trigger needs them
+	void CppTablesFormat::WriteColumnarStorage(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto const fields = def->AllFieldsOrdered();
+		auto indexed = fields;
+		erase_if(indexed, [](auto field) { return !field->Flags.contain(FieldFlags::Indexed); });
+
+		out.WriteLine("/// A row, as references into the columns; invalidated by any insertion or erasure");
+		out.WriteStart("struct RowView {{");
+		out.WriteLine("::std::int64_t RowID = 0;");
+		for (auto field : fields)
+			out.WriteLine("dtmdl_ColumnValue<{}> const& {};", FormatTypeReference(db, field->FieldType), MemberName(db, field));
+		out.WriteStart("RowType ToRow() const {{");
+		out.WriteLine("RowType row;");
+		for (auto field : fields)
+			out.WriteLine("row.{0} = {0};", MemberName(db, field));
+		out.WriteLine("return row;");
+		out.WriteEnd("}}");
+		out.WriteEnd("}};");
+
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.Write("static constexpr bool IsIndexedColumn() {{ return ");
+		for (auto field : indexed)
+			out.Write("COLUMN.eq(\"{}\") || ", field->Name);
+		out.WriteLine("false; }}");
+
+		WriteUniqueChecks(out, db, def);
+
+		out.WriteLine("/// Returns the id of the new row, or 0 if a Unique column already has the row's value");
+		out.WriteStart("::std::int64_t Insert(RowType row) {{");
+		out.WriteLine("if (IsAnyValueTaken(row)) return 0;");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Insert)] != 0) {{");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Insert, AllColumns, 0, nullptr, &row);");
+		out.WriteLine("if (IsAnyValueTaken(row)) return 0;");
+		out.WriteEnd("}}");
+		out.WriteLine("auto const id = mRowSlots.Add();");
+		for (auto field : indexed)
+			out.WriteLine("{}.emplace(row.{}, id);", IndexMemberName(def, field), MemberName(db, field));
+		out.WriteLine("/// The row's values can be moved into the columns, unless an After trigger needs the row");
+		out.WriteLine("auto const keep = mTriggerMasks[int(TriggerTiming::After)][int(TriggerEvent::Insert)] != 0;");
+		for (auto field : fields)
+			out.WriteLine("mColumn{0}.push_back(keep ? row.{1} : ::std::move(row.{1}));", field->Name, MemberName(db, field));
+		out.WriteLine("FireTriggers(TriggerTiming::After, TriggerEvent::Insert, AllColumns, id, nullptr, &row);");
+		out.WriteLine("return id;");
+		out.WriteEnd("}}");
+
+		out.WriteLine("/// Returns false if there's no such row, or if COLUMN is Unique and another row already has `value`");
+		out.WriteLine("template <::dtmdl::FixedString COLUMN, typename VALUE>");
+		out.WriteStart("bool Update(::std::int64_t id, VALUE&& value) {{");
+		out.WriteLine("auto index = mRowSlots.IndexOf(id);");
+		out.WriteLine("if (index == dtmdl_RowSlots::NoIndex || IsValueTaken<COLUMN>(value, id)) return false;");
+		out.WriteLine("::std::optional<RowType> old, updated;");
+		out.WriteStart("if (((mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Update)] | mTriggerMasks[int(TriggerTiming::After)][int(TriggerEvent::Update)]) & ColumnBit<COLUMN>()) != 0) {{");
+		out.WriteLine("old = RowAt(index).ToRow();");
+		out.WriteLine("updated = old;");
+		out.WriteLine("(*updated).*GetField<COLUMN>() = value;");
+		out.WriteEnd("}}");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Update)] & ColumnBit<COLUMN>()) {{");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Update, ColumnBit<COLUMN>(), id, &*old, &*updated);");
+		out.WriteLine("/// The triggers may have changed this table, which can move, change or erase the row");
+		out.WriteLine("index = mRowSlots.IndexOf(id);");
+		out.WriteLine("if (index == dtmdl_RowSlots::NoIndex || IsValueTaken<COLUMN>(value, id)) return false;");
+		out.WriteLine("old = RowAt(index).ToRow();");
+		out.WriteLine("updated = old;");
+		out.WriteLine("(*updated).*GetField<COLUMN>() = value;");
+		out.WriteEnd("}}");
+		out.WriteLine("auto& cell = ColumnVector<COLUMN>()[index];");
+		for (auto field : indexed)
+			out.WriteLine("if constexpr (COLUMN.eq(\"{0}\")) {{ dtmdl_EraseIndexEntry({1}, cell, id); {1}.emplace(value, id); }}", field->Name, IndexMemberName(def, field));
+		out.WriteLine("cell = ::std::forward<VALUE>(value);");
+		out.WriteLine("FireTriggers(TriggerTiming::After, TriggerEvent::Update, ColumnBit<COLUMN>(), id, old ? &*old : nullptr, updated ? &*updated : nullptr);");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+
+		out.WriteStart("bool Erase(::std::int64_t id) {{");
+		out.WriteLine("auto index = mRowSlots.IndexOf(id);");
+		out.WriteLine("if (index == dtmdl_RowSlots::NoIndex) return false;");
+		out.WriteLine("::std::optional<RowType> erased;");
+		out.WriteStart("if (mTriggerMasks[int(TriggerTiming::Before)][int(TriggerEvent::Delete)] != 0) {{");
+		out.WriteLine("erased = RowAt(index).ToRow();");
+		out.WriteLine("FireTriggers(TriggerTiming::Before, TriggerEvent::Delete, AllColumns, id, &*erased, nullptr);");
+		out.WriteLine("/// The triggers may have changed this table, which can move, change or erase the row");
+		out.WriteLine("index = mRowSlots.IndexOf(id);");
+		out.WriteLine("if (index == dtmdl_RowSlots::NoIndex) return false;");
+		out.WriteEnd("}}");
+		out.WriteLine("if (mTriggerMasks[int(TriggerTiming::After)][int(TriggerEvent::Delete)] != 0) erased = RowAt(index).ToRow();");
+		for (auto field : indexed)
+			out.WriteLine("dtmdl_EraseIndexEntry({}, mColumn{}[index], id);", IndexMemberName(def, field), field->Name);
+		out.WriteLine("EraseRowAt(index);");
+		out.WriteLine("FireTriggers(TriggerTiming::After, TriggerEvent::Delete, AllColumns, id, erased ? &*erased : nullptr, nullptr);");
+		out.WriteLine("return true;");
+		out.WriteEnd("}}");
+
+		out.Write("RowView RowAt(::std::size_t index) const noexcept {{ return {{ mRowSlots.IDAt(index)");
+		for (auto field : fields)
+			out.Write(", mColumn{}[index]", field->Name);
+		out.WriteLine(" }}; }}");
+		out.WriteLine("::std::optional<RowView> Find(::std::int64_t id) const noexcept {{ auto const index = mRowSlots.IndexOf(id); return index == dtmdl_RowSlots::NoIndex ? ::std::nullopt : ::std::optional<RowView>{{ RowAt(index) }}; }}");
+		out.WriteLine("bool Contains(::std::int64_t id) const noexcept {{ return mRowSlots.IndexOf(id) != dtmdl_RowSlots::NoIndex; }}");
+		out.WriteLine("::std::size_t RowCount() const noexcept {{ return mRowSlots.Size(); }}");
+		out.Write("void Reserve(::std::size_t count) {{ mRowSlots.Reserve(count);");
+		for (auto field : fields)
+			out.Write(" mColumn{}.reserve(count);", field->Name);
+		out.WriteLine(" }}");
+		out.WriteLine("::std::int64_t RowIDAt(::std::size_t index) const noexcept {{ return mRowSlots.IDAt(index); }}");
+		out.WriteLine("/// Rows in memory order, as RowViews");
+		out.WriteLine("auto Rows() const {{ return ::std::views::iota(::std::size_t(0), RowCount()) | ::std::views::transform([this](::std::size_t index) {{ return RowAt(index); }}); }}");
+		out.WriteLine("/// The values of one field of every row, in memory order (the same as RowAt)");
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.WriteLine("auto Column() const noexcept {{ auto const& column = ColumnVector<COLUMN>(); return ::std::span{{ column.data(), column.size() }}; }}");
+		out.WriteLine("/// For bulk updates of columns that aren't indexed; doesn't fire triggers");
+		out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+		out.WriteStart("auto MutableColumn() noexcept {{");
+		out.WriteLine("static_assert(!IsIndexedColumn<COLUMN>(), \"indexed columns can only be changed with Update\");");
+		out.WriteLine("auto& column = ColumnVector<COLUMN>();");
+		out.WriteLine("return ::std::span{{ column.data(), column.size() }};");
+		out.WriteEnd("}}");
+	}
+
+	void CppTablesFormat::WriteColumnarAccess(SimpleOutputter& out, Database const& db, StructDefinition const* def)
+	{
+		auto const fields = def->AllFieldsOrdered();
+		for (auto constness : { "", " const" })
+		{
+			out.WriteLine("template <::dtmdl::FixedString COLUMN>");
+			out.WriteStart("auto{0}& ColumnVector(){0} noexcept {{", constness);
+			for (auto field : fields)
+				out.WriteLine("if constexpr (COLUMN.eq(\"{0}\")) {{ return mColumn{0}; }} else", field->Name);
+			out.WriteLine("static_assert(::std::is_same_v<decltype(COLUMN), void>, \"column name not an (accessible) field in {}\");", FormatTypeName(db, def));
+			out.WriteEnd("}}");
+		}
+		out.WriteStart("void EraseRowAt(::std::uint32_t index) {{");
+		out.WriteStart("if (auto const last = mRowSlots.Remove(index); index != last) {{");
+		for (auto field : fields)
+			out.WriteLine("mColumn{0}[index] = ::std::move(mColumn{0}[last]);", field->Name);
+		out.WriteEnd("}}");
+		for (auto field : fields)
+			out.WriteLine("mColumn{}.pop_back();", field->Name);
+		out.WriteEnd("}}");
+	}
+
 }
\ No newline at end of file
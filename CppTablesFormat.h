@@ -10,6 +10,24 @@ namespace dtmdl
 		virtual string FormatName() override { return "C++ Tables Header"; }
 		virtual string ExportFileName() override { return "tables.hpp"; }
 		virtual string Export(Database const&) override;
+
+	private:
+
+		static IndexKind IndexTypeIn(StructDefinition const* table, FieldDefinition const* field);
+		static string IndexMemberName(StructDefinition const* table, FieldDefinition const* field);
+		static string IndexTypeName(Database const& db, StructDefinition const* table, FieldDefinition const* field);
+
+		void WriteIndexTypes(SimpleOutputter& out);
+		void WriteIndexQueries(SimpleOutputter& out, StructDefinition const* def);
+		void WriteQueryHooks(SimpleOutputter& out, Database const& db, StructDefinition const* def);
+		void WriteTriggers(SimpleOutputter& out, Database const& db, StructDefinition const* def);
+		void WriteTriggerState(SimpleOutputter& out);
+		void WriteDenseRows(SimpleOutputter& out);
+		void WriteUniqueChecks(SimpleOutputter& out, Database const& db, StructDefinition const* def);
+		void WriteDenseStorage(SimpleOutputter& out, Database const& db, StructDefinition const* def);
+		void WriteColumnTypes(SimpleOutputter& out);
+		void WriteColumnarStorage(SimpleOutputter& out, Database const& db, StructDefinition const* def);
+		void WriteColumnarAccess(SimpleOutputter& out, Database const& db, StructDefinition const* def);
 	};
 
 }
\ No newline at end of file
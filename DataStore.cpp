@@ -3,126 +3,148 @@
 #include "DataStore.h"
 #include "Database.h"
 #include "Values.h"
+#include "BlobStore.h"
+#include "UBJSON.h"
 
 namespace dtmdl
 {
 
-	void DataStore::SetTypeName(string_view old_name, string_view new_name)
+	/// Roots and tables are always created non-const, so once nothing else shares them they can be changed in place
+	template <typename T>
+	static T& Unshare(shared_ptr<T const>& shared)
 	{
-		/// NOTE: Add this point, the database/schema has done everything it could
-		/// to remove any reference to the old name, so the only place
-		/// it could have been left is the root table
-
-		for (auto&& item : mStorage.at("roots").items())
-		{
-			auto& type = item.value().at("type");
-			if (type.get_ref<json::string_t&>() == old_name)
-				type = new_name;
-		}
+		if (shared.use_count() > 1)
+			shared = make_shared<T>(*shared);
+		return const_cast<T&>(*shared);
 	}
 
-	void DataStore::SetFieldName(string_view record, string_view old_name, string_view new_name)
+	/// An exception leaving the element function of a parallel algorithm calls std::terminate, so the first one thrown is kept
+	/// (which also stops the other elements early) and rethrown once the algorithm returns
+	template <typename RANGE, typename FUNC>
+	static bool ParallelAnyOf(RANGE& range, FUNC&& func)
 	{
-		this->ForEveryObjectWithTypeName(record, [=](json& record_data) {
-			json old_field_data = move(*record_data.find(old_name));
-			record_data[string{ new_name }] = move(old_field_data);
-			record_data.erase(record_data.find(old_name));
-			return false;
-			});
+		mutex error_mutex;
+		exception_ptr error;
+		auto const result = any_of(execution::par, range.begin(), range.end(), [&](auto& element) {
+			try
+			{
+				return bool(func(element));
+			}
+			catch (...)
+			{
+				lock_guard lock{ error_mutex };
+				if (!error)
+					error = current_exception();
+				return true;
+			}
+		});
+		if (error)
+			rethrow_exception(error);
+		return result;
 	}
 
-	void DataStore::SetFieldType(string_view record, string_view field, TypeReference const& old_type, TypeReference const& new_type)
+	void DataStore::SetFieldType(string_view record, string_view field_key, TypeReference const& old_type, TypeReference const& new_type)
 	{
 		this->ForEveryObjectWithTypeName(record, [=](json& record_data) {
-			if (auto it = record_data.find(field); it != record_data.end())
+			if (auto it = record_data.find(field_key); it != record_data.end())
 			{
 				if (!Convert(old_type, new_type, *it) && !InitializeValue(new_type, *it))
 					record_data.erase(it);
 			}
 			return false;
 			});
+
+		/// Field keys are unique across the schema, so any table with this column is affected (even those of derived structs)
+		for (auto& [table_record, table] : mTables)
+		{
+			if (table->Column(field_key))
+				Unshare(table).ConvertColumn(field_key, old_type, new_type);
+		}
 	}
 
-	bool DataStore::HasFieldData(string_view record, string_view name) const
+	bool DataStore::HasFieldData(string_view record, string_view field_key) const
 	{
+		if (ranges::any_of(mTables, [=](auto const& kvp) { return kvp.second->RowCount() > 0 && kvp.second->Column(field_key); }))
+			return true;
 		return this->ForEveryObjectWithTypeName(record, [=](json const& record_data) {
-			return record_data.find(name) != record_data.end();
+			return record_data.find(field_key) != record_data.end();
 			});
 	}
 
 
-	void DataStore::DeleteField(string_view record, string_view name)
+	void DataStore::DeleteField(string_view record, string_view field_key)
 	{
 		this->ForEveryObjectWithTypeName(record, [=](json& record_data) {
-			if (auto it = record_data.find(name); it != record_data.end())
+			if (auto it = record_data.find(field_key); it != record_data.end())
 				record_data.erase(it);
 			return false;
 			});
-	}
 
-	void DataStore::SetEnumeratorName(string_view enoom, string_view old_enumerator_name, string_view new_enumerator_name)
-	{
-		this->ForEveryEnumValue(enoom, [=](json& enum_data) {
-			if (enum_data.is_string())
-			{
-				auto& val = enum_data.get_ref<json::string_t&>();
-				if (val == old_enumerator_name)
-					val = string{ new_enumerator_name };
-			}
-			else if (enum_data.is_array())
-			{
-				for (auto& flag : enum_data.get_ref<json::array_t&>())
-				{
-					auto& val = flag.get_ref<json::string_t&>();
-					if (val == old_enumerator_name)
-						val = string{ new_enumerator_name };
-				}
-			}
-			return false;
-			});
+		for (auto& [table_record, table] : mTables)
+		{
+			if (table->Column(field_key))
+				Unshare(table).DropColumn(field_key);
+		}
 	}
 
-	bool DataStore::HasEnumeratorData(string_view enoom, string_view enumerator) const
+	bool DataStore::HasEnumeratorData(string_view enoom, int64_t enumerator_value) const
 	{
-		return this->ForEveryEnumValue(enoom, [=](json const& enum_data) {
-			if (enum_data.is_string())
-			{
-				return enum_data.get_ref<json::string_t const&>() == enumerator;
-			}
-			else if (enum_data.is_array())
-			{
-				for (auto& flag : enum_data.get_ref<json::array_t const&>())
-					return flag.get_ref<json::string_t const&>() == enumerator;
-			}
-			return false;
+		auto enum_type = TypeReference{ mSchema.ResolveType(enoom) };
+		auto flags_type = TypeReference{ mSchema.ResolveType("flags"), vector<TemplateArgument>{ enum_type } };
+		auto bit = FlagBit(enumerator_value);
+
+		return ForEveryRoot([&](TypeReference const& root_type, json const& root_value) {
+			return dtmdl::ForEveryObjectWithType(root_type, root_value, enum_type, [&](json const& enum_data) {
+				return enum_data.is_number_integer() && enum_data.get<int64_t>() == enumerator_value;
+				})
+				|| dtmdl::ForEveryObjectWithType(root_type, root_value, flags_type, [&](json const& flags_data) {
+				return bit && flags_data.is_number_integer() && (flags_data.get<uint64_t>() & bit) != 0;
+				});
 			});
 	}
 
-	void DataStore::DeleteEnumerator(string_view enoom, string_view enumerator)
+	void DataStore::RemapEnumeratorValues(string_view enoom, map<int64_t, int64_t> const& value_map, optional<int64_t> removed_value)
 	{
-		auto enum_def = mSchema.ResolveType<EnumDefinition>(enoom);
-		/// Assuming(enum_def);
-		auto default_enum_val = enum_def->DefaultEnumerator();
-		this->ForEveryEnumValue(enoom, [=](json& enum_data) {
-			if (enum_data.is_string())
-			{
-				auto& val = enum_data.get_ref<json::string_t&>();
-				if (val == enumerator)
-					val = default_enum_val->Name;
-			}
-			else if (enum_data.is_array())
-			{
-				erase_if(enum_data.get_ref<json::array_t&>(), [enumerator](json const& flag) {
-					auto& val = flag.get_ref<json::string_t const&>();
-					return val == enumerator;
-					});
-			}
+		auto enum_type = TypeReference{ mSchema.ResolveType(enoom) };
+		auto flags_type = TypeReference{ mSchema.ResolveType("flags"), vector<TemplateArgument>{ enum_type } };
+
+		ForEveryRoot([&](TypeReference const& root_type, json& root_value) {
+			ignore = dtmdl::ForEveryObjectWithType(root_type, root_value, enum_type, [&](json& enum_data) {
+				if (enum_data.is_number_integer())
+				{
+					if (auto it = value_map.find(enum_data.get<int64_t>()); it != value_map.end())
+						enum_data = it->second;
+				}
+				return false;
+				});
+			ignore = dtmdl::ForEveryObjectWithType(root_type, root_value, flags_type, [&](json& flags_data) {
+				if (!flags_data.is_number_integer())
+					return false;
+				auto bits = flags_data.get<uint64_t>();
+				if (removed_value)
+					bits &= ~FlagBit(*removed_value);
+				uint64_t result = 0;
+				for (int64_t value = 0; value < 64; ++value)
+				{
+					if ((bits & FlagBit(value)) == 0)
+						continue;
+					auto it = value_map.find(value);
+					result |= FlagBit(it != value_map.end() ? it->second : value);
+				}
+				flags_data = result;
+				return false;
+				});
 			return false;
+			}, [&](TypeReference const& root_type, json const& root_value) {
+				return dtmdl::ForEveryObjectWithType(root_type, root_value, enum_type, [](json const&) { return true; })
+					|| dtmdl::ForEveryObjectWithType(root_type, root_value, flags_type, [](json const&) { return true; });
 			});
 	}
 
 	bool DataStore::HasTypeData(string_view type_name) const
 	{
+		if (auto table = FindTable(type_name); table && table->RowCount() > 0)
+			return true;
 		return this->ForEveryObjectWithTypeName(type_name, [=](json const& record_data) {
 			return true;
 			});
@@ -133,92 +155,1805 @@ namespace dtmdl
 		/// NOTE: Add this point, the database/schema has done everything it could
 		/// to remove any fields or field data with this type, so the only place
 		/// it could have been left is the root table
-		erase_if(mStorage.at("roots").get_ref<json::object_t&>(), [this, type_name](auto& kvp) {
-			TypeReference ref = TypeFromJSON(mSchema, kvp.second.at("type"));
+		LoadAllRoots();
+		erase_if(mRoots, [this, type_name](auto const& kvp) {
+			TypeReference ref = TypeFromStorageJSON(mSchema, kvp.second->at("type"));
 			return ref->Name() == type_name;
 		});
+
+		mHeap.RemoveIf([type_name](HeapObject const& object) { return object.Class->Name() == type_name; });
+		erase_if(mTriggers, [type_name](auto const& kvp) { return kvp.first->Name() == type_name; });
+		erase_if(mTables, [type_name](auto const& kvp) { return kvp.first->Name() == type_name; });
+	}
+
+	DataStore::DataStore(dtmdl::Schema const& schema, BlobStore& blobs, json storage)
+		: mSchema(schema), mBlobs(blobs), mStorage(move(storage))
+	{
+		UpgradeStorage();
+		if (!mStorage.contains("schema"))
+			mStorage["schema"] = "undefined";
+
+		auto& roots = mStorage["roots"];
+		for (auto& [name, root] : roots.get_ref<json::object_t&>())
+			mRoots.emplace(name, make_shared<json>(move(root)));
+		roots = json::object();
+
+		auto& tables = mStorage["tables"];
+		for (auto& [type_id, table] : tables.items())
+		{
+			uint64_t id = 0;
+			ignore = from_chars(type_id.data(), type_id.data() + type_id.size(), id);
+			/// Tables of types that no longer exist are dropped, same as DeleteType would
+			if (auto record = dynamic_cast<StructDefinition const*>(mSchema.ResolveTypeByID(id)))
+				mTables.emplace(record, make_shared<Table>(Table::FromJSON(record, table)));
+		}
+		tables = json::object();
+
+		auto& heap = mStorage["gcheap"];
+		mHeap = GCHeap::FromJSON(mSchema, heap, mStorage["gcnextid"].get<uint64_t>());
+		heap = json::array();
+		/// Anything loaded is old enough to be collected
+		mLastCycleStartID = mHeap.NextID();
+	}
+
+	void DataStore::UpgradeStorage()
+	{
+		auto& storage_format = mStorage["format"];
+		auto const has_enum_names = storage_format == "json-simple-v1";
+		if (has_enum_names || storage_format == "json-simple-v2")
+		{
+			/// Root types in these formats are stored by name, which FromStorageJSON still understands
+			for (auto& root : mStorage["roots"])
+			{
+				auto root_type = TypeFromStorageJSON(mSchema, root.at("type"));
+				auto& root_value = root.at("value");
+				/// Field keys must be encoded first, as visiting record values relies on them
+				EncodeFieldNames(root_type, root_value);
+				if (has_enum_names)
+					EncodeEnumNames(root_type, root_value);
+				root["type"] = ToStorageJSON(root_type);
+			}
+			storage_format = "json-simple-v3";
+		}
+		if (storage_format == "json-simple-v3")
+		{
+			/// v3 stores just have no blob references yet
+			storage_format = "json-simple-v4";
+		}
+		if (storage_format == "json-simple-v4")
+		{
+			mStorage["tables"] = json::object();
+			storage_format = "json-simple-v5";
+		}
+		if (storage_format == "json-simple-v5")
+		{
+			/// Nothing was ever put in the gcheap before v6
+			mStorage["gcheap"] = json::array();
+			mStorage["gcnextid"] = 1;
+			storage_format = string{ StorageFormat };
+		}
+		if (!storage_format.is_string() || storage_format.get_ref<json::string_t const&>() != StorageFormat)
+			throw std::runtime_error(format("unsupported data store format: {}", storage_format.dump()));
+	}
+
+	DataStore DataStore::Snapshot() const
+	{
+		/// Roots not loaded yet would be read from files this store may overwrite by the time the snapshot needs them
+		LoadAllRoots();
+		DataStore snapshot{ mSchema, mBlobs };
+		snapshot.mStorage = mStorage;
+		snapshot.mRoots = mRoots;
+		snapshot.mTables = mTables;
+		snapshot.mHeap = mHeap;
+		return snapshot;
 	}
 
 	bool DataStore::HasValue(string_view name) const
 	{
-		return mStorage.at("roots").contains(name);
+		return mRoots.contains(name);
 	}
 
 	void DataStore::AddValue(string_view name, TypeReference const& type)
 	{
-		mStorage.at("roots")[string{ name }] = json::object({ { "type", ToJSON(TypeReference{ mSchema.VoidType()})}, {"value", json{}} });
+		mRoots.insert_or_assign(string{ name }, make_shared<json>(json::object({ { "type", ToStorageJSON(TypeReference{ mSchema.VoidType()})}, {"value", json{}} })));
+	}
+
+	json* DataStore::MutableRoot(string_view name)
+	{
+		auto it = mRoots.find(name);
+		if (it == mRoots.end())
+			return nullptr;
+		LoadRoot(*it);
+		return &Unshare(it->second);
+	}
+
+	DataStore::RootMap const& DataStore::Roots() const
+	{
+		LoadAllRoots();
+		return mRoots;
+	}
+
+	shared_ptr<json const> DataStore::Root(string_view name) const
+	{
+		auto it = mRoots.find(name);
+		if (it == mRoots.end())
+			return nullptr;
+		LoadRoot(*it);
+		return it->second;
 	}
 
 	void DataStore::DeleteValue(string_view name)
 	{
-		auto& roots = Roots();
-		if (auto it = roots.find(name); it != roots.end())
-			roots.erase(it);
+		auto it = mRoots.find(name);
+		if (it == mRoots.end())
+			return;
+
+		if (mTriggers.empty())
+		{
+			mRoots.erase(it);
+			return;
+		}
+
+		/// Roots are never changed once replaced, so the old one can be handed to the after triggers as it is
+		LoadRoot(*it);
+		auto const old_root = it->second;
+		auto const type = TypeFromStorageJSON(mSchema, old_root->at("type"));
+		BeginTriggerBatch();
+		FireRootTriggers(type, old_root->at("value"), Trigger::Timing::Before, Trigger::Event::Delete);
+		mRoots.erase(it);
+		FireRootTriggers(type, old_root->at("value"), Trigger::Timing::After, Trigger::Event::Delete);
+		EndTriggerBatch();
 	}
 
-	result<json, string> DataStore::ExportValue(string_view name)
+	void DataStore::SetValue(string_view name, TypeReference const& type, json value)
 	{
-		auto& roots = Roots();
-		if (auto it = roots.find(name); it != roots.end())
-			return success(*it);
-		return failure("no value found");
+		auto& root = mRoots[string{ name }];
+		if (mTriggers.empty())
+		{
+			root = make_shared<json>(json::object({ { "type", ToStorageJSON(type) }, { "value", move(value) } }));
+			return;
+		}
+
+		LoadRoot(*mRoots.find(name));
+		auto const old_root = root;
+		auto const old_type = old_root ? TypeFromStorageJSON(mSchema, old_root->at("type")) : TypeReference{};
+		BeginTriggerBatch();
+		if (old_type)
+			FireRootTriggers(old_type, old_root->at("value"), Trigger::Timing::Before, Trigger::Event::Delete);
+		FireRootTriggers(type, value, Trigger::Timing::Before, Trigger::Event::Insert);
+		root = make_shared<json>(json::object({ { "type", ToStorageJSON(type) }, { "value", move(value) } }));
+		if (old_type)
+			FireRootTriggers(old_type, old_root->at("value"), Trigger::Timing::After, Trigger::Event::Delete);
+		FireRootTriggers(type, root->at("value"), Trigger::Timing::After, Trigger::Event::Insert);
+		EndTriggerBatch();
 	}
 
-	bool DataStore::ForEveryObjectWithTypeName(string_view type_name, function<bool(json&)> const& object_func)
+	result<size_t, string> DataStore::UpdateRecords(string_view record_type, function<void(json&)> const& update_func)
 	{
-		for (auto&& item : mStorage.at("roots").items())
+		auto record = mSchema.ResolveType<RecordDefinition>(record_type);
+		if (!record)
+			return failure(format("'{}' is not a struct or class", record_type));
+
+		mutex objects_mutex;
+		vector<json*> objects;
+		ForEveryObjectWithTypeName(record_type, [&](json& object) {
+			lock_guard lock{ objects_mutex };
+			objects.push_back(&object);
+			return false;
+		});
+
+		/// Without triggers on this type, there's nothing to compare or copy
+		auto triggers = mTriggers.find(record);
+		if (triggers == mTriggers.end())
 		{
-			//string current_name = item.at("name");
-			TypeReference current_type = TypeFromJSON(mSchema, item.value().at("type"));
-			json& current_value = item.value().at("value");
+			for (auto object : objects)
+				update_func(*object);
+			return RebuildTableIndices(objects.size());
+		}
 
-			if (dtmdl::ForEveryObjectWithTypeName(current_type, current_value, type_name, object_func))
-				return true;
+		BeginTriggerBatch();
+		for (auto object : objects)
+		{
+			RecordChange change{ .Old = *object, .New = *object };
+			update_func(change.New);
+
+			for (auto& [key, value] : change.New.items())
+			{
+				if (auto old = change.Old.find(key); old == change.Old.end() || *old != value)
+					change.Columns.push_back(key);
+			}
+			for (auto& [key, value] : change.Old.items())
+			{
+				if (!change.New.contains(key))
+					change.Columns.push_back(key);
+			}
+			if (change.Columns.empty())
+				continue;
+
+			FireTriggers(triggers->second, Trigger::Timing::Before, Trigger::Event::Update, change);
+			*object = change.New;
+			FireTriggers(triggers->second, Trigger::Timing::After, Trigger::Event::Update, change);
 		}
-		return false;
+		EndTriggerBatch();
+
+		return RebuildTableIndices(objects.size());
 	}
 
-	bool DataStore::ForEveryObjectWithTypeName(string_view type_name, function<bool(json const&)> const& object_func) const
+	result<size_t, string> DataStore::RebuildTableIndices(size_t updated)
 	{
-		for (auto&& item : mStorage.at("roots").items())
+		if (updated == 0)
+			return updated;
+		/// Objects in table cells were changed in place, which indices on those columns don't know about
+		for (auto& [record, table] : mTables)
 		{
-			TypeReference current_type = TypeFromJSON(mSchema, item.value().at("type"));
-			json const& current_value = item.value().at("value");
+			if (ranges::none_of(table->Columns(), [](auto const& column) { return column->KeepsJSON() && column->HasIndex(); }))
+				continue;
+			if (auto result = Unshare(table).RebuildJSONIndices(); result.has_error())
+				return failure(result.error());
+		}
+		return updated;
+	}
 
-			if (dtmdl::ForEveryObjectWithTypeName(current_type, current_value, type_name, object_func))
-				return true;
+	/// Triggers
+
+	result<size_t, string> DataStore::AddTrigger(string_view record_type, Trigger trigger)
+	{
+		auto record = mSchema.ResolveType<RecordDefinition>(record_type);
+		if (!record)
+			return failure(format("'{}' is not a struct or class", record_type));
+		if (!trigger.Callback)
+			return failure("trigger has no callback");
+		if (trigger.PerBatch && trigger.When != Trigger::Timing::After)
+			return failure("only 'after' triggers can be batched");
+
+		set<string, less<>> column_keys;
+		for (auto& column : trigger.Columns)
+		{
+			auto field = record->OwnOrBaseField(column);
+			if (!field)
+				return failure(format("record '{}' has no field named '{}'", record_type, column));
+			column_keys.insert(field->StorageKey());
 		}
-		return false;
+		trigger.Columns = move(column_keys);
+
+		auto const id = mNextTriggerID++;
+		mTriggers[record].push_back({ .ID = id, .Definition = move(trigger) });
+		PruneTriggers();
+		return id;
 	}
 
-	bool DataStore::ForEveryEnumValue(string_view enoom, function<bool(json const&)> const& object_func) const
+	void DataStore::RemoveTrigger(size_t trigger_id)
 	{
-		for (auto&& item : mStorage.at("roots").items())
+		for (auto& [record, triggers] : mTriggers)
 		{
-			TypeReference current_type = TypeFromJSON(mSchema, item.value().at("type"));
-			json const& current_value = item.value().at("value");
+			for (auto& registered : triggers)
+			{
+				if (registered.ID == trigger_id)
+				{
+					registered.Removed = true;
+					registered.Pending.clear();
+				}
+			}
+		}
+		PruneTriggers();
+	}
 
-			if (dtmdl::ForEveryObjectWithType(current_type, current_value, TypeReference{ mSchema.ResolveType(enoom) }, object_func))
-				return true;
-			if (dtmdl::ForEveryObjectWithType(current_type, current_value, TypeReference{ mSchema.ResolveType("flags"), vector<TemplateArgument>{TypeReference{mSchema.ResolveType(enoom)} } }, object_func))
-				return true;
+	void DataStore::PruneTriggers()
+	{
+		if (mCallingTriggers != 0 || mTriggerBatchDepth != 0)
+			return;
+
+		erase_if(mTriggers, [](auto& kvp) {
+			erase_if(kvp.second, [](RegisteredTrigger const& registered) { return registered.Removed; });
+			return kvp.second.empty();
+		});
+	}
+
+	void DataStore::BeginTriggerBatch()
+	{
+		++mTriggerBatchDepth;
+	}
+
+	void DataStore::EndTriggerBatch()
+	{
+		if (--mTriggerBatchDepth == 0)
+		{
+			FlushTriggerBatch();
+			PruneTriggers();
 		}
-		return false;
 	}
 
-	bool DataStore::ForEveryEnumValue(string_view enoom, function<bool(json&)> const& object_func)
+	/// The callback is a copy, as the trigger it belongs to can move if the callback adds triggers
+	static void CallTrigger(function<void(span<RecordChange const>)> const callback, span<RecordChange const> changes, TriggerStats& stats)
+	{
+		auto const start = chrono::steady_clock::now();
+		callback(changes);
+		stats.CallbackTime += chrono::steady_clock::now() - start;
+		++stats.Calls;
+	}
+
+	void DataStore::FireTriggers(vector<RegisteredTrigger>& triggers, Trigger::Timing when, Trigger::Event event, RecordChange const& change)
 	{
-		for (auto&& item : mStorage.at("roots").items())
+		++mTriggerStats.ChangesChecked;
+		++mCallingTriggers;
+		/// By index, as callbacks can add triggers to `triggers`; those only see later changes
+		for (size_t i = 0, count = triggers.size(); i < count; ++i)
 		{
-			TypeReference current_type = TypeFromJSON(mSchema, item.value().at("type"));
-			json& current_value = item.value().at("value");
+			auto& registered = triggers[i];
+			auto& trigger = registered.Definition;
+			if (registered.Removed || trigger.When != when || trigger.On != event)
+				continue;
+			if (!trigger.Columns.empty() && ranges::none_of(change.Columns, [&](string const& key) { return trigger.Columns.contains(key); }))
+				continue;
 
-			if (dtmdl::ForEveryObjectWithType(current_type, current_value, TypeReference{ mSchema.ResolveType(enoom) }, object_func))
-				return true;
-			if (dtmdl::ForEveryObjectWithType(current_type, current_value, TypeReference{ mSchema.ResolveType("flags"), vector<TemplateArgument>{TypeReference{mSchema.ResolveType(enoom)} } }, object_func))
+			++mTriggerStats.ChangesMatched;
+			if (trigger.PerBatch && mTriggerBatchDepth > 0)
+				registered.Pending.push_back(change);
+			else
+				CallTrigger(trigger.Callback, { &change, 1 }, mTriggerStats);
+		}
+		--mCallingTriggers;
+	}
+
+	void DataStore::FireRootTriggers(TypeReference const& root_type, json const& root_value, Trigger::Timing when, Trigger::Event event)
+	{
+		for (auto& [record, triggers] : mTriggers)
+		{
+			if (ranges::none_of(triggers, [&](RegisteredTrigger const& registered) { return !registered.Removed && registered.Definition.When == when && registered.Definition.On == event; }))
+				continue;
+
+			vector<RecordChange> changes;
+			ignore = dtmdl::ForEveryObjectWithTypeName(root_type, root_value, record->Name(), [&](json const& object) {
+				RecordChange change;
+				(event == Trigger::Event::Insert ? change.New : change.Old) = object;
+				for (auto& [key, value] : object.items())
+					change.Columns.push_back(key);
+				changes.push_back(move(change));
+				return false;
+			});
+
+			for (auto& change : changes)
+				FireTriggers(triggers, when, event, change);
+		}
+	}
+
+	void DataStore::FlushTriggerBatch()
+	{
+		++mCallingTriggers;
+		for (auto& [record, triggers] : mTriggers)
+		{
+			/// By index, as callbacks can add triggers; those have nothing pending
+			for (size_t i = 0, count = triggers.size(); i < count; ++i)
+			{
+				if (triggers[i].Pending.empty())
+					continue;
+				auto changes = exchange(triggers[i].Pending, {});
+				CallTrigger(triggers[i].Definition.Callback, changes, mTriggerStats);
+			}
+		}
+		--mCallingTriggers;
+	}
+
+	bool DataStore::SavedWithSchema(string_view hash) const
+	{
+		auto const& stamp = SchemaStamp();
+		return stamp.is_object() && stamp.value("hash", string{}) == hash;
+	}
+
+	/// "DTMJ" and the generation of the store file the journal was started for, little endian
+	static array<uint8_t, DataStore::JournalHeaderSize> JournalHeader(uint64_t generation)
+	{
+		array<uint8_t, DataStore::JournalHeaderSize> header{ 'D', 'T', 'M', 'J' };
+		for (size_t i = 0; i < 8; ++i)
+			header[4 + i] = uint8_t(generation >> (i * 8));
+		return header;
+	}
+
+	void DataStore::Save(filesystem::path const& path)
+	{
+		CollectGarbage();
+		/// Changes to the schema are applied to every store as they're made, so whatever is saved matches the current schema
+		mStorage["schema"] = json::object({ { "version", mSchema.Version() }, { "hash", mSchema.Hash() } });
+		if (mShards)
+		{
+			ExternalizeBlobs(0);
+			SaveSharded(path);
+			return;
+		}
+		ExternalizeBlobs();
+
+		/// The journal only makes sense on top of the file it was started for
+		auto const journal_path = JournalPath(path);
+		if (!mSaved || mSaved->Path != path || !filesystem::is_regular_file(path) || (mSaved->JournalSize > 0 && !filesystem::exists(journal_path)))
+		{
+			SaveWhole(path);
+			return;
+		}
+
+		auto const changes = ChangesSince(*mSaved);
+		if (changes.empty())
+			return;
+
+		auto const entry = json::to_ubjson(changes);
+		auto const new_journal = mSaved->JournalSize == 0;
+		auto const journal_size = mSaved->JournalSize + (new_journal ? JournalHeaderSize : 0) + sizeof(uint32_t) + entry.size();
+		if (journal_size > mSaved->FileSize * JournalRewriteRatio)
+		{
+			SaveWhole(path);
+			return;
+		}
+
+		auto const size = uint32_t(entry.size());
+		uint8_t const size_bytes[] = { uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16), uint8_t(size >> 24) };
+		/// A new journal replaces whatever an earlier store file may have left behind
+		ofstream journal{ journal_path, ios::binary | (new_journal ? ios::trunc : ios::app) };
+		if (new_journal)
+		{
+			auto const header = JournalHeader(mStorage.value("generation", uint64_t{}));
+			journal.write(reinterpret_cast<char const*>(header.data()), header.size());
+		}
+		journal.write(reinterpret_cast<char const*>(size_bytes), sizeof(size_bytes));
+		journal.write(reinterpret_cast<char const*>(entry.data()), entry.size());
+		journal.flush();
+		if (!journal)
+		{
+			/// Entries appended after a partial one would never be read, so the journal is cut back to what it was;
+			/// if even that fails, the next save rewrites the whole store
+			journal.close();
+			error_code error;
+			filesystem::resize_file(journal_path, mSaved->JournalSize, error);
+			if (error)
+				mSaved.reset();
+			throw std::runtime_error(format("could not append to journal '{}'", journal_path.string()));
+		}
+
+		mSaved->Roots = mRoots;
+		mSaved->Tables = mTables;
+		mSaved->Heap = mHeap;
+		mSaved->JournalSize = journal_size;
+		mSaved->SchemaStamp = mStorage["schema"];
+	}
+
+	void DataStore::SaveWhole(filesystem::path const& path)
+	{
+		mSaved.reset();
+		/// The store was sharded before
+		if (filesystem::is_directory(path))
+			filesystem::remove_all(path);
+
+		/// The store is written piece by piece, so roots are encoded one at a time instead of being gathered into one big
+		/// JSON value first; roots that were never loaded are copied from the mapped file as they are
+		auto const temp_path = filesystem::path{ path } += ".tmp";
+		map<string, UBJSONRange, less<>> written_roots;
+		{
+			ofstream out{ temp_path, ios::binary | ios::trunc };
+			size_t written = 0;
+			auto const write = [&](span<uint8_t const> bytes) {
+				out.write(reinterpret_cast<char const*>(bytes.data()), streamsize(bytes.size()));
+				written += bytes.size();
+			};
+			auto const write_marker = [&](uint8_t marker) { write({ &marker, 1 }); };
+			auto const write_key = [&](string_view key) {
+				vector<uint8_t> bytes;
+				AppendUBJSONKey(bytes, key);
+				write(bytes);
+			};
+			auto const write_member = [&](string_view key, json const& value) {
+				write_key(key);
+				write(json::to_ubjson(value));
+			};
+
+			/// Tells journals written on top of this file from ones left over from an earlier one (see JournalHeader)
+			mStorage["generation"] = mStorage.value("generation", uint64_t{}) + 1;
+			write_marker('{');
+			for (auto& [key, value] : mStorage.items())
+			{
+				if (key != "roots" && key != "tables" && key != "gcheap" && key != "gcnextid")
+					write_member(key, value);
+			}
+			json tables = json::object();
+			for (auto& [record, table] : mTables)
+				tables[std::to_string(record->ID())] = table->ToJSON();
+			write_member("tables", tables);
+			write_member("gcheap", mHeap.ToJSON());
+			write_member("gcnextid", mHeap.NextID());
+
+			write_key("roots");
+			write_marker('{');
+			for (auto& [name, root] : mRoots)
+			{
+				write_key(name);
+				auto const start = written;
+				if (root)
+					write(json::to_ubjson(*root));
+				else
+				{
+					auto const& range = mMapped->Roots.at(name);
+					write(mMapped->File->Data().subspan(range.Offset, range.Size));
+				}
+				written_roots.emplace(name, UBJSONRange{ start, written - start });
+			}
+			write_marker('}');
+			write_marker('}');
+
+			out.close();
+			if (!out)
+			{
+				filesystem::remove(temp_path);
+				throw std::runtime_error(format("could not write data store file '{}'", temp_path.string()));
+			}
+		}
+
+		/// The file can't be replaced while it's mapped (on Windows at least); if replacing it fails, the old one is still there
+		auto previous = move(mMapped);
+		mMapped.reset();
+		if (previous)
+			previous->File.reset();
+		error_code error;
+		filesystem::rename(temp_path, path, error);
+		if (error)
+		{
+			filesystem::remove(temp_path);
+			if (previous)
+				MapStoreFile(move(*previous));
+			throw std::runtime_error(format("could not replace data store file '{}': {}", path.string(), error.message()));
+		}
+		MapStoreFile({ nullptr, path, move(written_roots) });
+
+		filesystem::remove(JournalPath(path));
+		mSaved = SavedState{ path, mRoots, mTables, mHeap, filesystem::file_size(path), 0, mStorage["schema"] };
+	}
+
+	void DataStore::MapStoreFile(MappedRoots mapped)
+	{
+		auto file = MappedFile::Open(mapped.Path);
+		if (file.has_error())
+			throw std::runtime_error(file.error());
+		mapped.File = move(file).value();
+		mMapped = move(mapped);
+	}
+
+	static json PatchOperation(string_view op, json::json_pointer const& path, json value = nullptr)
+	{
+		auto result = json::object({ { "op", op }, { "path", path.to_string() } });
+		if (op != "remove")
+			result["value"] = move(value);
+		return result;
+	}
+
+	/// Row by row changes between two versions of a table, as patch operations on its storage form (see Table::ToJSON);
+	/// if its columns changed, the whole table is replaced
+	static void AppendTableChanges(Table const& before, Table const& after, json::json_pointer const& path, json& changes)
+	{
+		auto const& old_columns = before.Columns();
+		auto const& new_columns = after.Columns();
+		auto const same_columns = ranges::equal(old_columns, new_columns, [](auto const& a, auto const& b) {
+			return a->Key == b->Key && ToStorageJSON(a->Type) == ToStorageJSON(b->Type);
+		});
+		if (!same_columns)
+		{
+			changes.push_back(PatchOperation("replace", path, after.ToJSON()));
+			return;
+		}
+
+		if (before.LastRowID() != after.LastRowID())
+			changes.push_back(PatchOperation("replace", path / "last_rowid", after.LastRowID()));
+
+		/// Row ids are in ascending order in both, so they can be walked together; `position` is where the current row is
+		/// in the table as patched so far
+		auto const& old_ids = before.RowIDs();
+		auto const& new_ids = after.RowIDs();
+		size_t old_position = 0, new_position = 0, position = 0;
+		while (old_position < old_ids.size() || new_position < new_ids.size())
+		{
+			if (new_position == new_ids.size() || (old_position < old_ids.size() && old_ids[old_position] < new_ids[new_position]))
+			{
+				changes.push_back(PatchOperation("remove", path / "rowids" / position));
+				for (auto& column : new_columns)
+					changes.push_back(PatchOperation("remove", path / "columns" / column->Key / position));
+				++old_position;
+			}
+			else if (old_position == old_ids.size() || new_ids[new_position] < old_ids[old_position])
+			{
+				changes.push_back(PatchOperation("add", path / "rowids" / position, new_ids[new_position]));
+				for (auto& column : new_columns)
+					changes.push_back(PatchOperation("add", path / "columns" / column->Key / position, column->Get(new_position)));
+				++new_position;
+				++position;
+			}
+			else
+			{
+				for (size_t i = 0; i < new_columns.size(); ++i)
+				{
+					auto value = new_columns[i]->Get(new_position);
+					if (old_columns[i]->Get(old_position) != value)
+						changes.push_back(PatchOperation("replace", path / "columns" / new_columns[i]->Key / position, move(value)));
+				}
+				++old_position;
+				++new_position;
+				++position;
+			}
+		}
+	}
+
+	json DataStore::ChangesSince(SavedState const& saved) const
+	{
+		json changes = json::array();
+		auto const append = [&changes](json diff) {
+			for (auto& op : diff)
+				changes.push_back(move(op));
+		};
+
+		/// Roots and tables that weren't changed since are still shared with `saved`
+		auto const roots_path = json::json_pointer{ "/roots" };
+		for (auto& [name, root] : saved.Roots)
+		{
+			if (!mRoots.contains(name))
+				changes.push_back(PatchOperation("remove", roots_path / name));
+		}
+		for (auto& [name, root] : mRoots)
+		{
+			auto const path = roots_path / name;
+			if (auto it = saved.Roots.find(name); it == saved.Roots.end())
+				changes.push_back(PatchOperation("add", path, *root));
+			else if (it->second != root)
+				append(json::diff(*it->second, *root, path.to_string()));
+		}
+
+		auto const tables_path = json::json_pointer{ "/tables" };
+		for (auto& [record, table] : saved.Tables)
+		{
+			if (!mTables.contains(record))
+				changes.push_back(PatchOperation("remove", tables_path / std::to_string(record->ID())));
+		}
+		for (auto& [record, table] : mTables)
+		{
+			auto const path = tables_path / std::to_string(record->ID());
+			if (auto it = saved.Tables.find(record); it == saved.Tables.end())
+				changes.push_back(PatchOperation("add", path, table->ToJSON()));
+			else if (it->second != table)
+				AppendTableChanges(*it->second, *table, path, changes);
+		}
+
+		auto const heap_path = json::json_pointer{ "/gcheap" };
+		mHeap.ForEachChangedObject(saved.Heap, [&](uint64_t id, HeapObject const* before, HeapObject const* after) {
+			auto const path = heap_path / std::to_string(id);
+			if (!after)
+				changes.push_back(PatchOperation("remove", path));
+			else if (!before || before->Class != after->Class)
+				changes.push_back(PatchOperation("add", path, json::object({ { "id", id }, { "type", ToStorageJSON(TypeReference{ after->Class }) }, { "value", after->Value } })));
+			else
+				append(json::diff(before->Value, after->Value, (path / "value").to_string()));
+		});
+		if (mHeap.NextID() != saved.Heap.NextID())
+			changes.push_back(PatchOperation("replace", json::json_pointer{ "/gcnextid" }, mHeap.NextID()));
+		/// Some schema changes (like renames) don't touch the data at all, but the store still has to say it matches the new schema
+		if (mStorage.at("schema") != saved.SchemaStamp)
+			changes.push_back(PatchOperation("add", json::json_pointer{ "/schema" }, mStorage.at("schema")));
+
+		return changes;
+	}
+
+	static void ApplyPatchOperation(json& storage, json const& op)
+	{
+		auto const& kind = op.at("op").get_ref<json::string_t const&>();
+		auto const path = json::json_pointer{ op.at("path").get<string>() };
+		if (kind == "replace")
+		{
+			storage.at(path) = op.at("value");
+			return;
+		}
+
+		auto& parent = storage.at(path.parent_pointer());
+		auto const& key = path.back();
+		if (kind == "add")
+		{
+			if (!parent.is_array())
+				parent[key] = op.at("value");
+			else if (key == "-")
+				parent.push_back(op.at("value"));
+			else
+				parent.insert(parent.begin() + stoll(key), op.at("value"));
+		}
+		else if (kind == "remove")
+		{
+			if (parent.is_array())
+				parent.erase(size_t(stoull(key)));
+			else if (parent.erase(key) == 0)
+				throw std::out_of_range(format("'{}' not found", path.to_string()));
+		}
+		else
+			throw std::runtime_error(format("unsupported patch operation '{}'", kind));
+	}
+
+	/// Returns false if the journal ends with an incomplete or unreadable entry; the entries before it are applied.
+	/// A journal whose header names another generation of the store file is ignored (see JournalHeader).
+	/// `before_change` is called with the path of each operation before it's applied.
+	static bool ApplyJournal(json& storage, filesystem::path const& journal_path, uintmax_t& applied_size, function<void(string_view)> const& before_change)
+	{
+		ifstream journal{ journal_path, ios::binary };
+		/// Store files written before generations were have journals without a header
+		if (storage.contains("generation"))
+		{
+			array<uint8_t, DataStore::JournalHeaderSize> header{};
+			if (!journal.read(reinterpret_cast<char*>(header.data()), header.size()) || header != JournalHeader(storage["generation"].get<uint64_t>()))
 				return true;
+			applied_size += header.size();
+		}
+
+		/// Journal operations refer to gcheap objects by ID
+		auto& heap = storage["gcheap"];
+		json objects = json::object();
+		for (auto& object : heap)
+			objects[std::to_string(object.at("id").get<uint64_t>())] = move(object);
+		heap = move(objects);
+
+		bool intact = true;
+		vector<uint8_t> entry;
+		while (journal.peek() != ifstream::traits_type::eof())
+		{
+			uint8_t size_bytes[4]{};
+			if (!journal.read(reinterpret_cast<char*>(size_bytes), sizeof(size_bytes)))
+			{
+				intact = false;
+				break;
+			}
+			entry.resize(size_t(size_bytes[0]) | (size_t(size_bytes[1]) << 8) | (size_t(size_bytes[2]) << 16) | (size_t(size_bytes[3]) << 24));
+			if (!journal.read(reinterpret_cast<char*>(entry.data()), entry.size()))
+			{
+				intact = false;
+				break;
+			}
+
+			auto const changes = json::from_ubjson(entry, true, false);
+			if (!changes.is_array())
+			{
+				intact = false;
+				break;
+			}
+
+			/// A complete entry that doesn't apply means the journal isn't for this store file
+			try
+			{
+				for (auto& op : changes)
+				{
+					before_change(op.at("path").get_ref<json::string_t const&>());
+					ApplyPatchOperation(storage, op);
+				}
+			}
+			catch (std::exception const& e)
+			{
+				throw std::runtime_error(format("journal '{}' doesn't match its data store: {}", journal_path.string(), e.what()));
+			}
+			applied_size += sizeof(size_bytes) + entry.size();
+		}
+
+		/// Journals written before "add" operations carried the ID only have it in the path
+		objects = json::array();
+		for (auto& [id, object] : heap.items())
+		{
+			object["id"] = stoull(id);
+			objects.push_back(move(object));
+		}
+		heap = move(objects);
+		return intact;
+	}
+
+	/// Decodes everything in the store file except the roots, and returns where the roots are in it.
+	/// Files that can't be indexed (e.g. not written by json::to_ubjson) are just decoded whole instead.
+	static optional<map<string, UBJSONRange, less<>>> IndexStoreFile(MappedFile const& file, json& storage)
+	{
+		auto const data = file.Data();
+		auto members = IndexUBJSONObject(data);
+		if (members.has_error() || !members.value().contains("roots"))
+			return nullopt;
+		auto roots = IndexUBJSONObject(data, members.value().at("roots").Offset);
+		if (roots.has_error())
+			return nullopt;
+
+		for (auto& [key, range] : members.value())
+		{
+			if (key != "roots")
+				storage[key] = json::from_ubjson(data.subspan(range.Offset, range.Size));
+		}
+		storage["roots"] = json::object();
+		return move(roots).value();
+	}
+
+	static json DecodeRoot(MappedFile const& file, UBJSONRange range)
+	{
+		return json::from_ubjson(file.Data().subspan(range.Offset, range.Size));
+	}
+
+	DataStore DataStore::Load(dtmdl::Schema const& schema, BlobStore& blobs, filesystem::path const& path)
+	{
+		if (filesystem::is_directory(path))
+			return LoadSharded(schema, blobs, path);
+
+		/// Roots stay in the mapped file until they're used (see LoadRoot)
+		json storage = json::object();
+		optional<MappedRoots> mapped;
+		if (auto file = MappedFile::Open(path); file.has_value())
+		{
+			if (auto roots = IndexStoreFile(*file.value(), storage))
+				mapped = MappedRoots{ move(file).value(), path, move(*roots) };
+		}
+		if (!mapped)
+			storage = try_load_ubjson_file(path);
+
+		/// Journals are only ever written on top of a store file in the current format
+		auto const up_to_date = storage.is_object() && storage.value("format", string{}) == StorageFormat;
+		/// Upgrading needs every root
+		if (mapped && !up_to_date)
+		{
+			for (auto& [name, range] : mapped->Roots)
+				storage["roots"][name] = DecodeRoot(*mapped->File, range);
+			mapped.reset();
+		}
+
+		auto const journal_path = JournalPath(path);
+		uintmax_t journal_size = 0;
+		auto journal_intact = true;
+		if (up_to_date && filesystem::exists(journal_path))
+		{
+			/// Roots the journal changes are decoded first; what's in the file for them is out of date, so it's forgotten
+			journal_intact = ApplyJournal(storage, journal_path, journal_size, [&](string_view change_path) {
+				if (!mapped || !change_path.starts_with("/roots/"))
+					return;
+				auto token = change_path.substr("/roots/"sv.size());
+				token = token.substr(0, token.find('/'));
+				string name;
+				for (size_t i = 0; i < token.size(); ++i)
+				{
+					if (token[i] == '~' && i + 1 < token.size())
+						name += token[++i] == '1' ? '/' : '~';
+					else
+						name += token[i];
+				}
+				if (auto it = mapped->Roots.find(name); it != mapped->Roots.end())
+				{
+					storage["roots"][name] = DecodeRoot(*mapped->File, it->second);
+					mapped->Roots.erase(it);
+				}
+			});
+		}
+
+		DataStore store{ schema, blobs, move(storage) };
+		if (mapped)
+		{
+			for (auto& [name, range] : mapped->Roots)
+				store.mRoots.emplace(name, nullptr);
+			store.mMapped = move(mapped);
+		}
+		if (up_to_date && journal_intact)
+			store.mSaved = SavedState{ path, store.mRoots, store.mTables, store.mHeap, filesystem::file_size(path), journal_size, store.mStorage["schema"] };
+		return store;
+	}
+
+	/// Sharded stores
+
+	void DataStore::SetSharded(bool sharded)
+	{
+		if (sharded == Sharded())
+			return;
+		/// The next save writes the store in the other layout, so nothing can be left to be read from the current one
+		LoadAllRoots();
+		mSaved.reset();
+		mMapped.reset();
+		if (sharded)
+			mShards.emplace();
+		else
+			mShards.reset();
+	}
+
+	void DataStore::LoadRoot(RootMap::value_type& root) const
+	{
+		if (root.second)
+			return;
+
+		json loaded;
+		string source;
+		if (mShards)
+		{
+			auto file = mShards->RootFiles.find(root.first);
+			if (file == mShards->RootFiles.end())
+				return;
+			auto const path = mShards->Directory / file->second;
+			loaded = ghassanpl::load_json_file(path);
+			source = path.string();
+		}
+		else if (mMapped)
+		{
+			auto range = mMapped->Roots.find(root.first);
+			if (range == mMapped->Roots.end())
+				return;
+			loaded = DecodeRoot(*mMapped->File, range->second);
+			source = mMapped->Path.string();
+		}
+		else
+			return;
+
+		if (!loaded.is_object() || !loaded.contains("type") || !loaded.contains("value"))
+			throw std::runtime_error(format("root '{}' in '{}' is not a data store root", root.first, source));
+		root.second = make_shared<json>(move(loaded));
+
+		if (mSaved)
+		{
+			if (auto saved = mSaved->Roots.find(root.first); saved != mSaved->Roots.end() && !saved->second)
+				saved->second = root.second;
+		}
+	}
+
+	void DataStore::LoadAllRoots() const
+	{
+		if (!mShards && !mMapped)
+			return;
+		vector<RootMap::value_type*> unloaded;
+		for (auto& root : mRoots)
+		{
+			if (!root.second)
+				unloaded.push_back(&root);
+		}
+		/// Each root (and its entry in mSaved) is only touched by one thread
+		ParallelAnyOf(unloaded, [this](RootMap::value_type* root) { LoadRoot(*root); return false; });
+	}
+
+	/// Root names can be anything, so only some characters are kept as they are; the rest are %-escaped.
+	/// Roots are spread over 256 directories, so that none of them gets too big.
+	static string RootFileName(string_view name)
+	{
+		string file_name;
+		for (auto c : name)
+		{
+			if (isalnum(uint8_t(c)) || c == '_' || c == '-')
+				file_name += c;
+			else
+				file_name += format("%{:02X}", uint8_t(c));
+		}
+		return format("roots/{:02x}/{}.json", std::hash<string_view>{}(name) & 0xFF, file_name);
+	}
+
+	void DataStore::SaveSharded(filesystem::path const& path)
+	{
+		/// The store was saved as a single file before
+		if (filesystem::is_regular_file(path))
+		{
+			filesystem::remove(path);
+			filesystem::remove(JournalPath(path));
+		}
+
+		/// Roots that weren't loaded are only left alone if they stay where they were loaded from
+		auto const same_place = mSaved && mSaved->Path == path && mShards->Directory == path;
+		if (!same_place)
+		{
+			LoadAllRoots();
+			mSaved.reset();
+		}
+		mShards->Directory = path;
+		auto& files = mShards->RootFiles;
+
+		/// File names may collide on case-insensitive file systems, so those are compared lowercase
+		auto const lowercase = [](string file) {
+			ranges::transform(file, file.begin(), [](char c) { return char(tolower(uint8_t(c))); });
+			return file;
+		};
+		set<string, less<>> used_files;
+		bool manifest_changed = !same_place || mSaved->SchemaStamp != mStorage["schema"];
+		vector<pair<filesystem::path, json const*>> writes;
+		for (auto& [name, root] : mRoots)
+		{
+			auto file = files.find(name);
+			if (file == files.end())
+			{
+				if (used_files.empty())
+				{
+					for (auto& [other_name, other_file] : files)
+						used_files.insert(lowercase(other_file));
+				}
+				auto const base_name = RootFileName(name);
+				auto file_name = base_name;
+				for (int suffix = 1; used_files.contains(lowercase(file_name)); ++suffix)
+					file_name = format("{}~{}.json", string_view{ base_name }.substr(0, base_name.size() - ".json"sv.size()), suffix);
+				used_files.insert(lowercase(file_name));
+				file = files.emplace(name, move(file_name)).first;
+				manifest_changed = true;
+			}
+
+			auto changed = !same_place;
+			if (!changed)
+			{
+				auto const saved = mSaved->Roots.find(name);
+				changed = saved == mSaved->Roots.end() || saved->second != root;
+			}
+			/// Roots that aren't loaded haven't changed
+			if (root && changed)
+				writes.emplace_back(path / file->second, root.get());
+		}
+		for (auto it = files.begin(); it != files.end();)
+		{
+			if (mRoots.contains(it->first))
+			{
+				++it;
+				continue;
+			}
+			filesystem::remove(path / it->second);
+			it = files.erase(it);
+			manifest_changed = true;
+		}
+
+		for_each(execution::par, writes.begin(), writes.end(), [](auto const& write) {
+			filesystem::create_directories(write.first.parent_path());
+			save_json_file(write.first, *write.second);
+		});
+
+		if (manifest_changed)
+		{
+			auto manifest = mStorage;
+			manifest.erase("roots");
+			manifest.erase("tables");
+			manifest.erase("gcheap");
+			manifest.erase("gcnextid");
+			manifest["roots"] = files;
+			save_json_file(path / "manifest.json", manifest);
+		}
+
+		auto data_changed = !same_place || mSaved->Tables != mTables || mSaved->Heap.NextID() != mHeap.NextID();
+		if (!data_changed)
+			mHeap.ForEachChangedObject(mSaved->Heap, [&](uint64_t, HeapObject const*, HeapObject const*) { data_changed = true; });
+		if (data_changed)
+		{
+			json tables = json::object();
+			for (auto& [record, table] : mTables)
+				tables[std::to_string(record->ID())] = table->ToJSON();
+			save_ubjson_file(path / "data.ubjson", json::object({
+				{ "tables", move(tables) },
+				{ "gcheap", mHeap.ToJSON() },
+				{ "gcnextid", mHeap.NextID() },
+			}));
+		}
+
+		mSaved = SavedState{ path, mRoots, mTables, mHeap, 0, 0, mStorage["schema"] };
+	}
+
+	DataStore DataStore::LoadSharded(dtmdl::Schema const& schema, BlobStore& blobs, filesystem::path const& path)
+	{
+		auto storage = ghassanpl::load_json_file(path / "manifest.json");
+		if (!storage.is_object() || !storage.contains("roots"))
+			throw std::runtime_error(format("'{}' has no data store manifest", path.string()));
+		auto root_files = storage["roots"].get<map<string, string, less<>>>();
+		storage["roots"] = json::object();
+
+		auto data = try_load_ubjson_file(path / "data.ubjson");
+		storage["tables"] = data.is_object() ? data["tables"] : json::object();
+		storage["gcheap"] = data.is_object() ? data["gcheap"] : json::array();
+		storage["gcnextid"] = data.is_object() ? data["gcnextid"] : json(1);
+
+		/// Older formats are upgraded all at once, so every root is read up front, and the next save rewrites them all
+		auto const up_to_date = storage.value("format", string{}) == StorageFormat;
+		if (!up_to_date)
+		{
+			for (auto& [name, file] : root_files)
+				storage["roots"][name] = ghassanpl::load_json_file(path / file);
+		}
+
+		DataStore store{ schema, blobs, move(storage) };
+		store.mShards = ShardedLayout{ path, move(root_files) };
+		if (up_to_date)
+		{
+			for (auto& [name, file] : store.mShards->RootFiles)
+				store.mRoots.emplace(name, nullptr);
+			store.mSaved = SavedState{ path, store.mRoots, store.mTables, store.mHeap, 0, 0, store.mStorage["schema"] };
+		}
+		return store;
+	}
+
+	/// Tables
+
+	Table const* DataStore::FindTable(string_view record_type) const
+	{
+		auto it = ranges::find_if(mTables, [record_type](auto const& kvp) { return kvp.first->Name() == record_type; });
+		return it != mTables.end() ? it->second.get() : nullptr;
+	}
+
+	Table* DataStore::MutableTable(string_view record_type)
+	{
+		auto record = mSchema.ResolveType<StructDefinition>(record_type);
+		if (!record || !record->Flags.contain(StructFlags::CreateTableType))
+			return nullptr;
+		return &MutableTable(record);
+	}
+
+	Table& DataStore::MutableTable(StructDefinition const* record)
+	{
+		auto& table = mTables[record];
+		if (!table)
+			table = make_shared<Table>(record);
+		return Unshare(table);
+	}
+
+	result<int64_t, string> DataStore::InsertRow(string_view record_type, json row)
+	{
+		auto table = MutableTable(record_type);
+		if (!table)
+			return failure(format("'{}' is not a struct with the {} flag", record_type, magic_enum::enum_name(StructFlags::CreateTableType)));
+
+		auto triggers = mTriggers.find(table->Record());
+		if (triggers == mTriggers.end())
+			return table->Insert(row);
+
+		RecordChange change{ .New = move(row) };
+		for (auto& [key, value] : change.New.items())
+			change.Columns.push_back(key);
+		FireTriggers(triggers->second, Trigger::Timing::Before, Trigger::Event::Insert, change);
+		auto row_id = table->Insert(change.New);
+		if (row_id.has_error())
+			return row_id;
+		/// After triggers see the row as stored, with default values filled in
+		change.New = table->Row(table->RowCount() - 1);
+		FireTriggers(triggers->second, Trigger::Timing::After, Trigger::Event::Insert, change);
+		return row_id;
+	}
+
+	result<void, string> DataStore::SetRowField(string_view record_type, int64_t row_id, string_view field_key, json value)
+	{
+		auto table = MutableTable(record_type);
+		if (!table)
+			return failure(format("'{}' is not a struct with the {} flag", record_type, magic_enum::enum_name(StructFlags::CreateTableType)));
+
+		auto triggers = mTriggers.find(table->Record());
+		if (triggers == mTriggers.end())
+			return table->Set(row_id, field_key, value);
+
+		auto position = table->PositionOf(row_id);
+		if (!position)
+			return failure(format("table has no row with id {}", row_id));
+		RecordChange change{ .Old = table->Row(*position), .Columns = { string{ field_key } } };
+		change.New = change.Old;
+		change.New[string{ field_key }] = value;
+		FireTriggers(triggers->second, Trigger::Timing::Before, Trigger::Event::Update, change);
+		if (auto result = table->Set(row_id, field_key, value); result.has_error())
+			return result;
+		FireTriggers(triggers->second, Trigger::Timing::After, Trigger::Event::Update, change);
+		return success();
+	}
+
+	result<size_t, string> DataStore::DeleteRows(string_view record_type, span<int64_t const> row_ids)
+	{
+		auto table = MutableTable(record_type);
+		if (!table)
+			return failure(format("'{}' is not a struct with the {} flag", record_type, magic_enum::enum_name(StructFlags::CreateTableType)));
+
+		auto triggers = mTriggers.find(table->Record());
+		if (triggers == mTriggers.end())
+			return table->Delete(row_ids);
+
+		vector<RecordChange> changes;
+		for (auto row_id : row_ids)
+		{
+			if (auto position = table->PositionOf(row_id))
+			{
+				auto& change = changes.emplace_back(RecordChange{ .Old = table->Row(*position) });
+				for (auto& [key, value] : change.Old.items())
+					change.Columns.push_back(key);
+			}
+		}
+
+		BeginTriggerBatch();
+		for (auto& change : changes)
+			FireTriggers(triggers->second, Trigger::Timing::Before, Trigger::Event::Delete, change);
+		auto const deleted = table->Delete(row_ids);
+		for (auto& change : changes)
+			FireTriggers(triggers->second, Trigger::Timing::After, Trigger::Event::Delete, change);
+		EndTriggerBatch();
+		return deleted;
+	}
+
+	result<size_t, string> DataStore::MoveValueIntoTable(string_view name)
+	{
+		auto it = mRoots.find(name);
+		if (it == mRoots.end())
+			return failure("no value found");
+
+		LoadRoot(*it);
+		auto const root = it->second;
+		auto const type = TypeFromStorageJSON(mSchema, root->at("type"));
+		if (type->Name() != "list" || type.TemplateArguments.empty() || !holds_alternative<TypeReference>(type.TemplateArguments[0]))
+			return failure("only list values can be moved into tables");
+		auto record = dynamic_cast<StructDefinition const*>(get<TypeReference>(type.TemplateArguments[0]).Type);
+		if (!record || !record->Flags.contain(StructFlags::CreateTableType))
+			return failure(format("list elements must be structs with the {} flag", magic_enum::enum_name(StructFlags::CreateTableType)));
+
+		/// Insert into a copy, so the table is left alone if any record doesn't fit
+		auto existing = mTables.find(record);
+		Table table = existing != mTables.end() ? *existing->second : Table{ record };
+		auto& records = root->at("value");
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			if (auto row_id = table.Insert(records[i]); row_id.has_error())
+				return failure(format("could not move record #{}: {}", i, row_id.error()));
+		}
+
+		auto const moved = records.size();
+		mTables.insert_or_assign(record, make_shared<Table>(move(table)));
+		mRoots.erase(it);
+		return moved;
+	}
+
+	void DataStore::UpdateTableIndices()
+	{
+		for (auto& [record, table] : mTables)
+		{
+			if (auto result = Unshare(table).UpdateIndices(); result.has_error())
+				throw std::runtime_error(result.error());
+		}
+	}
+
+	/// Roots whose type changed are merged as a whole, as their values can't be compared
+	static void MergeRoot(json& ours, json const& theirs, json const* base, json::json_pointer const& path, MergeContext& context)
+	{
+		if (ours.at("type") == theirs.at("type"))
+		{
+			auto const base_value = base && base->at("type") == ours.at("type") ? &base->at("value") : nullptr;
+			MergeValues(ours.at("value"), theirs.at("value"), base_value, path / "value", context);
+			return;
+		}
+
+		if (base && context.Base.Hash(*base) == context.Theirs.Hash(theirs))
+			++context.Report.Stats.SubtreesSkipped;
+		else if (base && context.Base.Hash(*base) == context.Ours.Hash(ours))
+		{
+			ours = theirs;
+			++context.Report.Stats.SubtreesTaken;
+		}
+		else
+			context.Report.Conflicts.push_back({ path.to_string(), ours, theirs, base ? *base : json{} });
+	}
+
+	result<MergeReport, string> DataStore::Merge(DataStore const& theirs, DataStore const* base)
+	{
+		if (&theirs == this || base == this)
+			return failure("cannot merge a data store with itself");
+		if (&theirs.mSchema != &mSchema || (base && &base->mSchema != &mSchema))
+			return failure("only data stores of the same database can be merged");
+
+		auto const start = chrono::steady_clock::now();
+		MergeReport report;
+
+		LoadAllRoots();
+		theirs.LoadAllRoots();
+		if (base)
+			base->LoadAllRoots();
+		auto const& their_roots = theirs.mRoots;
+		auto const base_roots = base ? &base->mRoots : nullptr;
+		auto const find_base_root = [&](string const& name) -> json const* {
+			if (!base_roots)
+				return nullptr;
+			auto it = base_roots->find(name);
+			return it != base_roots->end() ? it->second.get() : nullptr;
+		};
+
+		/// Roots on both sides; collected up front, as looking them up isn't safe while other threads are changing them
+		struct SharedRoot
+		{
+			string Name;
+			shared_ptr<json const>* Ours = nullptr;
+			json const* Theirs = nullptr;
+			json const* Base = nullptr;
+			MergeReport Report;
+		};
+		vector<SharedRoot> shared_roots;
+		MergeContext context;
+		for (auto& [name, their_root] : their_roots)
+		{
+			auto const base_root = find_base_root(name);
+			if (auto it = mRoots.find(name); it != mRoots.end())
+			{
+				/// Stores that share a root (like a store and its snapshot) have nothing to merge there
+				if (it->second == their_root)
+					++report.Stats.SubtreesSkipped;
+				else
+					shared_roots.push_back({ name, &it->second, their_root.get(), base_root });
+				continue;
+			}
+
+			if (!base_root)
+			{
+				mRoots.emplace(name, their_root);
+				++report.Stats.SubtreesTaken;
+			}
+			else if (context.Base.Hash(*base_root) != context.Theirs.Hash(*their_root))
+				report.Conflicts.push_back({ (json::json_pointer{ "/roots" } / name).to_string(), json{}, *their_root, *base_root });
+		}
+
+		if (base_roots)
+		{
+			vector<string> deleted;
+			for (auto& [name, our_root] : mRoots)
+			{
+				auto const base_root = find_base_root(name);
+				if (their_roots.contains(name) || !base_root)
+					continue;
+				if (context.Base.Hash(*base_root) == context.Ours.Hash(*our_root))
+					deleted.push_back(name);
+				else
+					report.Conflicts.push_back({ (json::json_pointer{ "/roots" } / name).to_string(), *our_root, json{}, *base_root });
+			}
+			for (auto& name : deleted)
+				mRoots.erase(name);
+			report.Stats.SubtreesTaken += deleted.size();
+		}
+
+		auto merge_root = [](SharedRoot& root) {
+			MergeContext root_context;
+			/// A root shared with a snapshot is only copied if the merge would change it; hashes of the shared root are
+			/// kept apart from root_context, as the merge works on the copy
+			if (root.Ours->use_count() > 1)
+			{
+				StructuralHasher shared_hasher;
+				auto const our_hash = shared_hasher.Hash(**root.Ours);
+				auto const their_hash = root_context.Theirs.Hash(*root.Theirs);
+				if (our_hash == their_hash || (root.Base && root_context.Base.Hash(*root.Base) == their_hash))
+				{
+					++root_context.Report.Stats.SubtreesSkipped;
+					root.Report = move(root_context.Report);
+					return;
+				}
+			}
+			MergeRoot(Unshare(*root.Ours), *root.Theirs, root.Base, json::json_pointer{ "/roots" } / root.Name, root_context);
+			root.Report = move(root_context.Report);
+		};
+		if (shared_roots.size() >= ParallelRootThreshold)
+			for_each(execution::par, shared_roots.begin(), shared_roots.end(), merge_root);
+		else
+			for_each(shared_roots.begin(), shared_roots.end(), merge_root);
+		for (auto& root : shared_roots)
+			report.Append(move(root.Report));
+
+		MergeTables(theirs, base, report);
+
+		report.Stats.Duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		return report;
+	}
+
+	/// Tables that only we have are kept as they are; tables are created on demand, so one missing on their side just means they have no rows
+	void DataStore::MergeTables(DataStore const& theirs, DataStore const* base, MergeReport& report)
+	{
+		for (auto& [record, shared_their_table] : theirs.mTables)
+		{
+			auto& shared_our_table = mTables[record];
+			if (!shared_our_table)
+				shared_our_table = make_shared<Table>(record);
+			auto const& their_table = *shared_their_table;
+			Table const* base_table = nullptr;
+			if (base)
+			{
+				if (auto it = base->mTables.find(record); it != base->mTables.end())
+					base_table = it->second.get();
+			}
+
+			/// Whole tables first, as comparing native columns is much cheaper than comparing rows
+			if (shared_our_table == shared_their_table || shared_our_table->SameRows(their_table) || (base_table && base_table->SameRows(their_table)))
+			{
+				++report.Stats.SubtreesSkipped;
+				continue;
+			}
+			if (base_table && base_table->SameRows(*shared_our_table))
+			{
+				/// Shared rather than copied; whichever store changes it first gets its own copy
+				shared_our_table = shared_their_table;
+				++report.Stats.SubtreesTaken;
+				continue;
+			}
+
+			auto& our_table = Unshare(shared_our_table);
+
+			/// Row ids from all sides, in order
+			vector<int64_t> row_ids;
+			ranges::set_union(our_table.RowIDs(), their_table.RowIDs(), back_inserter(row_ids));
+			if (base_table)
+			{
+				vector<int64_t> all_row_ids;
+				ranges::set_union(row_ids, base_table->RowIDs(), back_inserter(all_row_ids));
+				row_ids = move(all_row_ids);
+			}
+
+			auto const table_path = json::json_pointer{ "/tables" } / record->Name();
+			vector<int64_t> deleted;
+			for (auto row_id : row_ids)
+			{
+				++report.Stats.RowsCompared;
+				auto const row_path = table_path / to_string(row_id);
+				auto const our_position = our_table.PositionOf(row_id);
+				auto const their_position = their_table.PositionOf(row_id);
+				auto const base_position = base_table ? base_table->PositionOf(row_id) : nullopt;
+				json const their_row = their_position ? their_table.Row(*their_position) : json{};
+				json const base_row = base_position ? base_table->Row(*base_position) : json{};
+
+				if (our_position && their_position)
+				{
+					auto const original = our_table.Row(*our_position);
+					auto merged = original;
+					/// Rows are temporaries, so each one gets fresh hashes
+					MergeContext context;
+					MergeValues(merged, their_row, base_position ? &base_row : nullptr, row_path, context);
+					for (auto& [key, value] : merged.items())
+					{
+						if (auto it = original.find(key); it != original.end() && *it == value)
+							continue;
+						if (auto set = our_table.Set(row_id, key, value); set.has_error())
+							context.Report.Conflicts.push_back({ (row_path / key).to_string(), original.value(key, json{}), value, json{} });
+					}
+					report.Append(move(context.Report));
+				}
+				else if (their_position)
+				{
+					if (!base_position)
+					{
+						/// They added it
+						if (auto inserted = our_table.InsertWithID(row_id, their_row); inserted.has_error())
+							report.Conflicts.push_back({ row_path.to_string(), json{}, their_row, json{} });
+						else
+							++report.Stats.SubtreesTaken;
+					}
+					else if (base_row != their_row)
+						report.Conflicts.push_back({ row_path.to_string(), json{}, their_row, base_row });
+				}
+				else if (our_position && base_position)
+				{
+					auto our_row = our_table.Row(*our_position);
+					if (our_row == base_row)
+						deleted.push_back(row_id);
+					else
+						report.Conflicts.push_back({ row_path.to_string(), move(our_row), json{}, base_row });
+				}
+			}
+
+			report.Stats.SubtreesTaken += our_table.Delete(deleted);
+		}
+	}
+
+	void DataStore::ExternalizeBlobs(size_t threshold)
+	{
+		auto bytes_type = TypeReference{ mSchema.ResolveType("bytes") };
+		auto const is_large = [threshold](json const& bytes_data) {
+			return bytes_data.is_binary() && bytes_data.get_binary().size() >= threshold;
+		};
+
+		ForEveryRoot([&](TypeReference const& root_type, json& root_value) {
+			ignore = dtmdl::ForEveryObjectWithType(root_type, root_value, bytes_type, [&](json& bytes_data) {
+				if (!is_large(bytes_data))
+					return false;
+				auto& data = bytes_data.get_binary();
+				/// If the blob can't be written, the data just stays inline
+				if (auto hash = mBlobs.Put(data); hash.has_value())
+					bytes_data = BlobStore::Reference(move(hash).value(), data.size());
+				return false;
+				});
+			return false;
+			}, [&](TypeReference const& root_type, json const& root_value) {
+				return dtmdl::ForEveryObjectWithType(root_type, root_value, bytes_type, is_large);
+			}, false);
+	}
+
+	/// `value_of` gives the value to pass to `root_func` for a root, or nullptr to skip it
+	template <typename ROOTS, typename VALUE_FUNC, typename FUNC>
+	static bool AnyRoot(Schema const& schema, ROOTS& roots, size_t parallel_threshold, VALUE_FUNC&& value_of, FUNC&& root_func)
+	{
+		using root_pointer = decltype(&roots.begin()->second);
+		vector<root_pointer> root_entries;
+		root_entries.reserve(roots.size());
+		for (auto& [name, root] : roots)
+			root_entries.push_back(&root);
+
+		auto do_root = [&](root_pointer root) {
+			/// Roots that aren't loaded are only passed in when they're meant to be skipped
+			if (!*root)
+				return false;
+			TypeReference type = TypeFromStorageJSON(schema, (*root)->at("type"));
+			auto const value = value_of(type, *root);
+			return value && root_func(type, *value);
+		};
+
+		if (root_entries.size() >= parallel_threshold)
+			return ParallelAnyOf(root_entries, do_root);
+		return any_of(root_entries.begin(), root_entries.end(), do_root);
+	}
+
+	vector<json const*> DataStore::ObjectsWithTypeName(string_view type_name) const
+	{
+		mutex result_mutex;
+		vector<json const*> result;
+		ForEveryRoot([&](TypeReference const& root_type, json const& root_value) {
+			vector<json const*> objects;
+			ignore = dtmdl::ForEveryObjectWithTypeName(root_type, root_value, type_name, [&](json const& object) {
+				objects.push_back(&object);
+				return false;
+			});
+			lock_guard lock{ result_mutex };
+			result.insert(result.end(), objects.begin(), objects.end());
+			return false;
+		});
+		return result;
+	}
+
+	/// Heap pages are processed in parallel the same way roots are
+	template <typename FUNC>
+	static bool AnyHeapPage(GCHeap const& heap, size_t parallel_threshold, FUNC&& page_func)
+	{
+		vector<size_t> pages;
+		pages.reserve(heap.PageCount());
+		for (size_t page = 0; page < heap.PageCount(); ++page)
+			pages.push_back(page);
+
+		if (heap.Size() >= parallel_threshold)
+			return ParallelAnyOf(pages, page_func);
+		return any_of(pages.begin(), pages.end(), page_func);
+	}
+
+	bool DataStore::ForEveryRoot(function<bool(TypeReference const&, json&)> const& root_func, function<bool(TypeReference const&, json const&)> const& needs_change, bool unloaded_too)
+	{
+		if (unloaded_too)
+			LoadAllRoots();
+
+		/// Each root is only touched by one thread, so unsharing them concurrently is fine
+		auto const root_value = [&](TypeReference const& type, shared_ptr<json const>& root) -> json* {
+			if (root.use_count() > 1 && needs_change && !needs_change(type, root->at("value")))
+				return nullptr;
+			return &Unshare(root).at("value");
+		};
+		if (AnyRoot(mSchema, mRoots, ParallelRootThreshold, root_value, root_func))
+			return true;
+
+		for (auto& [record, shared_table] : mTables)
+		{
+			for (size_t i = 0; i < shared_table->Columns().size(); ++i)
+			{
+				auto const* column = shared_table->Columns()[i].get();
+				if (column->IsPlain())
+					continue;
+				auto const key = column->Key;
+				auto const shared = shared_table.use_count() > 1;
+
+				/// Cells are visited in place, so what `root_func` finds in them stays put as long as the table does (see UpdateRecords)
+				if (column->KeepsJSON())
+				{
+					if (shared && needs_change && ranges::none_of(column->JSONValues(), [&](json const& cell) { return needs_change(column->Type, cell); }))
+						continue;
+					auto const type = column->Type;
+					auto& table = Unshare(shared_table);
+					auto const stop = ranges::any_of(table.MutableJSONValues(key), [&](json& cell) { return root_func(type, cell); });
+					if (auto result = table.RebuildJSONIndices(); result.has_error())
+						throw runtime_error(result.error());
+					if (stop)
+						return true;
+					continue;
+				}
+
+				/// Columns kept natively hold enums or flags, which contain nothing else, so a copy will do; it's only written back if it changed
+				auto const list_type = TypeReference{ mSchema.ResolveType("list"), vector<TemplateArgument>{ column->Type } };
+				auto values = column->ToJSON();
+				if (shared && needs_change && !needs_change(list_type, values))
+					continue;
+				auto const stop = root_func(list_type, values);
+				if (values != shared_table->Column(key)->ToJSON())
+					Unshare(shared_table).SetColumnValues(key, values);
+				if (stop)
+					return true;
+			}
+		}
+
+		return AnyHeapPage(mHeap, ParallelRootThreshold, [&](size_t page) {
+			if (mHeap.PageShared(page) && needs_change && !mHeap.AnyObjectOnPage(page, [&](uint64_t, HeapObject const& object) { return needs_change(TypeReference{ object.Class }, object.Value); }))
+				return false;
+			return mHeap.AnyMutableObjectOnPage(page, [&](uint64_t, HeapObject& object) { return root_func(TypeReference{ object.Class }, object.Value); });
+		});
+	}
+
+	bool DataStore::ForEveryRoot(function<bool(TypeReference const&, json const&)> const& root_func) const
+	{
+		LoadAllRoots();
+		auto const root_value = [](TypeReference const&, shared_ptr<json const> const& root) { return &root->at("value"); };
+		if (AnyRoot(mSchema, mRoots, ParallelRootThreshold, root_value, root_func))
+			return true;
+
+		for (auto& [record, table] : mTables)
+		{
+			for (auto const& column : table->Columns())
+			{
+				if (column->IsPlain())
+					continue;
+				/// As above, cells kept as JSON are visited in place and the natively kept enums and flags as a copy
+				if (column->KeepsJSON())
+				{
+					if (ranges::any_of(column->JSONValues(), [&](json const& cell) { return root_func(column->Type, cell); }))
+						return true;
+					continue;
+				}
+				auto const list_type = TypeReference{ mSchema.ResolveType("list"), vector<TemplateArgument>{ column->Type } };
+				if (root_func(list_type, column->ToJSON()))
+					return true;
+			}
+		}
+
+		return AnyHeapPage(mHeap, ParallelRootThreshold, [&](size_t page) {
+			return mHeap.AnyObjectOnPage(page, [&](uint64_t, HeapObject const& object) { return root_func(TypeReference{ object.Class }, object.Value); });
+		});
+	}
+
+	bool DataStore::ForEveryObjectWithTypeName(string_view type_name, function<bool(json&)> const& object_func)
+	{
+		return ForEveryRoot([&](TypeReference const& root_type, json& root_value) {
+			return dtmdl::ForEveryObjectWithTypeName(root_type, root_value, type_name, object_func);
+		}, [&](TypeReference const& root_type, json const& root_value) {
+			return dtmdl::ForEveryObjectWithTypeName(root_type, root_value, type_name, [](json const&) { return true; });
+		});
+	}
+
+	bool DataStore::ForEveryObjectWithTypeName(string_view type_name, function<bool(json const&)> const& object_func) const
+	{
+		return ForEveryRoot([&](TypeReference const& root_type, json const& root_value) {
+			return dtmdl::ForEveryObjectWithTypeName(root_type, root_value, type_name, object_func);
+		});
+	}
+
+	/// Garbage collection
+
+	result<uint64_t, string> DataStore::NewObject(string_view class_name, json value)
+	{
+		auto klass = mSchema.ResolveType<ClassDefinition>(class_name);
+		if (!klass)
+			return failure(format("'{}' is not a class", class_name));
+		if (!value.is_object())
+			return failure("objects must be record values");
+		return mHeap.Add({ klass, move(value) });
+	}
+
+	json* DataStore::MutableObject(uint64_t id)
+	{
+		auto object = mHeap.FindMutable(id);
+		return object ? &object->Value : nullptr;
+	}
+
+	void DataStore::StartCollection()
+	{
+		/// Marking needs every root
+		LoadAllRoots();
+		auto& cycle = mCollection.emplace();
+		cycle.Roots = mRoots;
+		cycle.Tables = mTables;
+		cycle.Heap = mHeap;
+		cycle.NextRoot = cycle.Roots.begin();
+		cycle.NextTable = cycle.Tables.begin();
+		cycle.Marked.resize(mHeap.NextID());
+		cycle.FirstYoungID = exchange(mLastCycleStartID, mHeap.NextID());
+
+		/// Young objects may not have been stored anywhere yet, so they are roots of this cycle
+		for (auto id = cycle.FirstYoungID; id < mHeap.NextID(); ++id)
+		{
+			if (mHeap.Find(id))
+			{
+				cycle.Marked[id] = true;
+				cycle.Gray.push_back(id);
+			}
+		}
+	}
+
+	void DataStore::ScanValue(TypeReference const& type, json const& value, size_t& budget)
+	{
+		auto& cycle = *mCollection;
+		if (!type)
+			return;
+		if (type->Name() == "own")
+		{
+			/// Anything in the snapshot's heap has an ID below Marked.size()
+			if (!cycle.Heap.Resolve(value))
+				return;
+			auto const object_id = value.get<uint64_t>();
+			if (!cycle.Marked[object_id])
+			{
+				cycle.Marked[object_id] = true;
+				cycle.Gray.push_back(object_id);
+			}
+			return;
+		}
+
+		ignore = VisitValue(type, value, [&](TypeReference const& child_type, json::json_pointer, json const& child_value) {
+			/// Scalars, strings, bytes and enums can't hold `own` values
+			if (!child_type || (child_type.TemplateArguments.empty() && (child_type->IsBuiltIn() || child_type->AsEnum())))
+				return false;
+			cycle.Values.emplace_back(child_type, &child_value);
+			if (budget > 0)
+				--budget;
+			return false;
+		});
+	}
+
+	bool DataStore::CollectGarbage(size_t budget)
+	{
+		/// Without objects there's nothing to collect, and no reason to load every root of a sharded store to mark them
+		if (!mCollection && mHeap.Size() == 0)
+			return false;
+
+		auto const start = chrono::steady_clock::now();
+		if (!mCollection)
+			StartCollection();
+		auto& cycle = *mCollection;
+
+		while (budget > 0 && !cycle.Sweeping)
+		{
+			--budget;
+			/// The snapshot keeps everything these point to from changing or going away
+			if (!cycle.Values.empty())
+			{
+				auto const [type, value] = cycle.Values.back();
+				cycle.Values.pop_back();
+				ScanValue(type, *value, budget);
+			}
+			else if (!cycle.Gray.empty())
+			{
+				auto const id = cycle.Gray.back();
+				cycle.Gray.pop_back();
+				++cycle.ObjectsMarked;
+				auto const object = cycle.Heap.Find(id);
+				cycle.Values.emplace_back(TypeReference{ object->Class }, &object->Value);
+			}
+			else if (cycle.NextRoot != cycle.Roots.end())
+			{
+				auto& root = *cycle.NextRoot->second;
+				++cycle.NextRoot;
+				cycle.Values.emplace_back(TypeFromStorageJSON(mSchema, root.at("type")), &root.at("value"));
+			}
+			else if (cycle.NextTable != cycle.Tables.end())
+			{
+				auto& columns = cycle.NextTable->second->Columns();
+				if (cycle.NextColumn < columns.size())
+				{
+					/// Columns kept natively hold enums and flags, which can't own objects
+					auto& column = *columns[cycle.NextColumn];
+					auto const cells = column.IsPlain() ? span<json const>{} : column.JSONValues();
+					if (cycle.NextCell < cells.size())
+						cycle.Values.emplace_back(column.Type, &cells[cycle.NextCell++]);
+					else
+					{
+						++cycle.NextColumn;
+						cycle.NextCell = 0;
+					}
+				}
+				else
+				{
+					++cycle.NextTable;
+					cycle.NextColumn = 0;
+				}
+			}
+			else
+			{
+				/// Everything reachable is marked; without the snapshot, sweeping can change pages in place
+				cycle.Roots.clear();
+				cycle.Tables.clear();
+				cycle.Heap = {};
+				cycle.Sweeping = true;
+			}
+		}
+
+		uint64_t freed = 0;
+		while (budget > 0 && cycle.Sweeping && cycle.NextSweptID < cycle.FirstYoungID)
+		{
+			--budget;
+			auto const id = cycle.NextSweptID++;
+			if (!cycle.Marked[id] && mHeap.Remove(id))
+				++freed;
+		}
+		mGCStats.ObjectsFreed += freed;
+
+		auto const finished = cycle.Sweeping && cycle.NextSweptID >= cycle.FirstYoungID;
+		if (finished)
+		{
+			mGCStats.ObjectsMarked = cycle.ObjectsMarked;
+			++mGCStats.Cycles;
+			mCollection.reset();
 		}
-		return false;
+		mGCStats.Time += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		return finished;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,27 +1,95 @@
 #pragma once
 
+#include "Table.h"
+#include "Merge.h"
+#include "GCHeap.h"
+#include "BlobStore.h"
+#include "UBJSON.h"
+
 namespace dtmdl
 {
-	struct Schema;
-	struct TypeReference;
+	struct RecordChange
+	{
+		json Old; /// null for inserts
+		json New; /// null for deletes
+		vector<string> Columns; /// storage keys of the fields that changed (see FieldDefinition::StorageKey); all fields for inserts and deletes
+	};
+
+	/// Called when records of a given type are inserted, updated or deleted in a data store
+	struct Trigger
+	{
+		enum class Timing { Before, After };
+		enum class Event { Insert, Update, Delete };
+
+		Timing When = Timing::After;
+		Event On = Event::Update;
+		/// Names of the fields whose changes fire this trigger; empty means any field
+		set<string, less<>> Columns;
+		/// After triggers only: changes made during a batch are passed to one call at the end of it
+		bool PerBatch = false;
+		function<void(span<RecordChange const>)> Callback;
+	};
+
+	struct TriggerStats
+	{
+		uint64_t ChangesChecked = 0; /// changes to records of a type that has any triggers
+		uint64_t ChangesMatched = 0; /// (change, trigger) pairs where the trigger wanted the change
+		uint64_t Calls = 0;
+		chrono::nanoseconds CallbackTime{};
+	};
 
 	struct DataStore
 	{
-		DataStore(Schema const& schema) : mSchema(schema) {}
-		DataStore(Schema const& schema, json storage) : mSchema(schema), mStorage(move(storage)) {}
+		DataStore(dtmdl::Schema const& schema, BlobStore& blobs) : mSchema(schema), mBlobs(blobs) {}
+		DataStore(dtmdl::Schema const& schema, BlobStore& blobs, json storage);
+
+		/// Roots and tables are shared between a store and its snapshots, and copied by whichever side changes them first
+		using RootMap = map<string, shared_ptr<json const>, less<>>;
+		using TableMap = map<StructDefinition const*, shared_ptr<Table const>>;
+
+		/// The store's data as it is now, readable on another thread; call on the thread that changes the store
+		DataStore Snapshot() const;
+
+		/// v1 stored enums as enumerator names and flags as arrays of names
+		/// v2 stores enums as enumerator values and flags as bitmasks
+		/// v3 keys record members by field ID (see FieldDefinition::StorageKey) and refers to root types by type ID
+		/// v4 allows large `bytes` values to be blob references (see BlobStore)
+		/// v5 adds tables (see Table), keyed by struct type ID
+		/// v6 puts class instances in the gcheap (see GCHeap), with `own` and `ref` values holding their IDs
+		static constexpr string_view StorageFormat = "json-simple-v6";
 
 		auto const& Storage() const noexcept { return mStorage; }
+		auto const& Schema() const noexcept { return mSchema; }
+
+		/// `{ "version": ..., "hash": ... }` of the schema the store was last saved with, or "undefined"
+		json const& SchemaStamp() const { return mStorage.at("schema"); }
+		/// A store saved with the current schema can't have data that doesn't match it, so it doesn't need validating
+		bool SavedWithSchema(string_view hash) const;
+
+		void SetFieldType(string_view record, string_view field_key, TypeReference const& old_type, TypeReference const& new_type);
+		bool HasFieldData(string_view record, string_view field_key) const;
+		void DeleteField(string_view record, string_view field_key);
+
+		bool HasEnumeratorData(string_view enoom, int64_t enumerator_value) const;
+		/// Values not in `value_map` are left alone; flags bits for `removed_value` are cleared
+		void RemapEnumeratorValues(string_view enoom, map<int64_t, int64_t> const& value_map, optional<int64_t> removed_value = nullopt);
 
-		void SetTypeName(string_view old_name, string_view new_name);
-		void SetFieldName(string_view record, string_view old_name, string_view new_name);
+		/// Moves inline `bytes` values of at least `threshold` bytes into the blob store; roots not loaded yet are skipped
+		void ExternalizeBlobs(size_t threshold = BlobStore::OutOfLineThreshold);
+		/// Appends the changes since the last load or save of `path` to its journal, or rewrites the whole store (see JournalRewriteRatio)
+		void Save(filesystem::path const& path);
+		/// Roots are decoded from the mapped store file when first used; a journal entry cut short is ignored, along with the rest
+		static DataStore Load(dtmdl::Schema const& schema, BlobStore& blobs, filesystem::path const& path);
 
-		void SetFieldType(string_view record, string_view field, TypeReference const& old_type, TypeReference const& new_type);
-		bool HasFieldData(string_view record, string_view name) const;
-		void DeleteField(string_view record, string_view name);
+		/// Saved as a directory with a manifest, a JSON file per root, and the tables and gcheap in `data.ubjson`
+		bool Sharded() const noexcept { return mShards.has_value(); }
+		/// Takes effect at the next save, which replaces the store file with a directory or the other way around
+		void SetSharded(bool sharded);
 
-		void SetEnumeratorName(string_view enoom, string_view old_enumerator_name, string_view new_enumerator_name);
-		bool HasEnumeratorData(string_view enoom, string_view enumerator) const;
-		void DeleteEnumerator(string_view enoom, string_view enumerator);
+		/// A header with the store file's generation, then JSON Patch entries in UBJSON, each preceded by its 32-bit size
+		static filesystem::path JournalPath(filesystem::path const& path) { return filesystem::path{ path } += ".journal"; }
+		static constexpr size_t JournalHeaderSize = 12;
+		static constexpr double JournalRewriteRatio = 0.5;
 
 		bool HasTypeData(string_view type_name) const;
 		void DeleteType(string_view type_name);
@@ -29,35 +97,195 @@ namespace dtmdl
 		bool HasValue(string_view name) const;
 		void AddValue(string_view name, TypeReference const& type);
 		void DeleteValue(string_view name);
-		result<json, string> ExportValue(string_view name);
+
+		/// All record objects of the given type, in no particular order; pointers are valid until the store is modified
+		vector<json const*> ObjectsWithTypeName(string_view type_name) const;
+
+		/// Fires delete triggers for the records in the old value and insert triggers for the ones in the new value
+		void SetValue(string_view name, TypeReference const& type, json value);
+
+		/// One trigger batch, firing update triggers for the fields `update_func` changed; returns the number of records visited
+		result<size_t, string> UpdateRecords(string_view record_type, function<void(json&)> const& update_func);
+
+		/// Triggers are not persisted, and don't fire for changes caused by schema changes
+		result<size_t, string> AddTrigger(string_view record_type, Trigger trigger);
+		void RemoveTrigger(size_t trigger_id);
+		/// Batches can nest; batched triggers are called when the outermost batch ends
+		void BeginTriggerBatch();
+		void EndTriggerBatch();
+		auto const& TriggerStatistics() const noexcept { return mTriggerStats; }
+
+		/// Tables, for structs with the CreateTableType flag; rows are record objects keyed by field storage keys
+		auto const& Tables() const noexcept { return mTables; }
+		Table const* FindTable(string_view record_type) const;
+		result<int64_t, string> InsertRow(string_view record_type, json row);
+		result<void, string> SetRowField(string_view record_type, int64_t row_id, string_view field_key, json value);
+		result<size_t, string> DeleteRows(string_view record_type, span<int64_t const> row_ids);
+		/// Moves the records of a `list` value into their struct's table, without firing triggers
+		result<size_t, string> MoveValueIntoTable(string_view name);
+		/// Throws if a field became Unique but has duplicate values
+		void UpdateTableIndices();
+
+		/// Class instances, which `own<T>` and `ref<T>` values refer to by ID
+		auto const& Heap() const noexcept { return mHeap; }
+		/// NOTE: Store the new object's ID in an `own` value before the next collection cycle starts, or it will be collected
+		result<uint64_t, string> NewObject(string_view class_name, json value = json::object());
+		/// nullptr if there's no such object
+		json* MutableObject(uint64_t id);
+
+		/// Does up to `budget` units (values scanned or object IDs swept) of collection work; returns true if a cycle finished
+		bool CollectGarbage(size_t budget = DefaultCollectionBudget);
+		bool CollectingGarbage() const noexcept { return mCollection.has_value(); }
+		auto const& GCStatistics() const noexcept { return mGCStats; }
+
+		/// Enough to keep a frame short, even with millions of objects
+		static constexpr size_t DefaultCollectionBudget = 10000;
+
+		/// Merges another store of the same database into this one, given their common ancestor if there is one; no triggers fire
+		result<MergeReport, string> Merge(DataStore const& theirs, DataStore const* base = nullptr);
 
 		//void ForEveryRoot(function<bool(string_view, TypeReference const&, json&)>);
 
-		auto& Roots() { return mStorage.at("roots"); }
+		/// Each root is { "type": ..., "value": ... }; loads every root that isn't loaded yet
+		RootMap const& Roots() const;
+		/// Loads just this root, if it isn't loaded yet; nullptr if there is no such root
+		shared_ptr<json const> Root(string_view name) const;
+		/// Every root, without loading any; the ones that aren't loaded yet are null
+		auto const& LazyRoots() const noexcept { return mRoots; }
+		/// nullptr if there is no such root
+		json* MutableRoot(string_view name);
+		auto& Blobs() const noexcept { return mBlobs; }
 
 	private:
 
+		friend struct Database;
+
+		/// Stores with at least this many roots have their roots processed in parallel
+		static constexpr size_t ParallelRootThreshold = 64;
+
+		/// Also passes table cells and gcheap objects as roots; runs concurrently for large stores, so `root_func` must be thread-safe
+		bool ForEveryRoot(function<bool(TypeReference const&, json&)> const& root_func, function<bool(TypeReference const&, json const&)> const& needs_change = {}, bool unloaded_too = true);
+		bool ForEveryRoot(function<bool(TypeReference const&, json const&)> const& root_func) const;
+		/// Rebuilds the indices of table columns whose cells UpdateRecords changed in place; returns `updated`
+		result<size_t, string> RebuildTableIndices(size_t updated);
+
 		bool ForEveryObjectWithTypeName(string_view type_name, function<bool(json&)> const& object_func);
 		bool ForEveryObjectWithTypeName(string_view type_name, function<bool(json const&)> const& object_func) const;
 
-		bool ForEveryEnumValue(string_view enoom, function<bool(json const&)> const& object_func) const;
-		bool ForEveryEnumValue(string_view enoom, function<bool(json&)> const& object_func);
+		void UpgradeStorage();
+
+		void MergeTables(DataStore const& theirs, DataStore const* base, MergeReport& report);
+
+		struct RegisteredTrigger
+		{
+			size_t ID = 0;
+			dtmdl::Trigger Definition;
+			vector<RecordChange> Pending; /// for batched triggers
+			bool Removed = false; /// only erased once no triggers are being called
+		};
+
+		/// Only record types that have triggers are in here, so checking for triggers is a single lookup
+		map<RecordDefinition const*, vector<RegisteredTrigger>> mTriggers;
+		size_t mNextTriggerID = 1;
+		int mTriggerBatchDepth = 0;
+		int mCallingTriggers = 0;
+		TriggerStats mTriggerStats;
 
-		Schema const& mSchema;
+		/// A garbage collection cycle in progress (see CollectGarbage)
+		struct CollectionCycle
+		{
+			/// The store as it was when the cycle started; only used for marking, and dropped before sweeping
+			RootMap Roots;
+			TableMap Tables;
+			GCHeap Heap;
+
+			RootMap::const_iterator NextRoot;
+			TableMap::const_iterator NextTable;
+			size_t NextColumn = 0;
+			size_t NextCell = 0;
+			vector<pair<TypeReference, json const*>> Values; /// still to be scanned, each one a unit of work
+			vector<uint64_t> Gray; /// marked, but not scanned yet
+			vector<bool> Marked; /// by object ID; objects allocated after the cycle started aren't in here, and are never swept
+			uint64_t ObjectsMarked = 0;
+
+			bool Sweeping = false;
+			/// Objects from this ID on were allocated since the previous cycle started, so they're not swept
+			uint64_t FirstYoungID = 0;
+			uint64_t NextSweptID = 1;
+		};
+		optional<CollectionCycle> mCollection;
+		uint64_t mLastCycleStartID = 1;
+		GCStats mGCStats;
+
+		void StartCollection();
+		/// Marks the object an `own` value holds, or queues the values inside `value` that could hold one, charging `budget` for each
+		void ScanValue(TypeReference const& type, json const& value, size_t& budget);
+
+		void FireTriggers(vector<RegisteredTrigger>& triggers, Trigger::Timing when, Trigger::Event event, RecordChange const& change);
+		void FireRootTriggers(TypeReference const& root_type, json const& root_value, Trigger::Timing when, Trigger::Event event);
+		void FlushTriggerBatch();
+		/// Erases removed triggers, unless triggers are being called or batched (whoever is doing that may hold on to them)
+		void PruneTriggers();
+
+		dtmdl::Schema const& mSchema;
+		BlobStore& mBlobs;
 
 		json mStorage = json::object({
-			{ "format", "json-simple-v1" },
+			{ "format", string{ StorageFormat } },
 			{ "gcheap", json::array() },
+			{ "gcnextid", 1 },
 			{ "roots", json::object() },
+			{ "tables", json::object() },
 			{ "schema", "undefined" }
 			});
 
-		/*
-		{ "schema", json::object({
-			{ "uri", db.Directory().string() },
-			{ "version", db.Schema().Version() }, /// TODO: These values are not updated when we change the schema in the editor!
-			{ "hash", db.Schema().Hash() }
-			*/
+		/// Roots of sharded and mapped stores are null until loaded, which const functions can do too
+		mutable RootMap mRoots;
+		TableMap mTables;
+		GCHeap mHeap;
+		Table* MutableTable(string_view record_type);
+		Table& MutableTable(StructDefinition const* record);
+
+		/// What the store file and its journal hold, as of the last load or save
+		struct SavedState
+		{
+			filesystem::path Path;
+			RootMap Roots;
+			TableMap Tables;
+			GCHeap Heap;
+			uintmax_t FileSize = 0;
+			uintmax_t JournalSize = 0;
+			json SchemaStamp;
+		};
+		mutable optional<SavedState> mSaved;
+
+		void SaveWhole(filesystem::path const& path);
+		/// The JSON Patch operations that turn `saved` into the store as it is now
+		json ChangesSince(SavedState const& saved) const;
+
+		struct ShardedLayout
+		{
+			filesystem::path Directory; /// empty until the store is first saved as a sharded one
+			map<string, string, less<>> RootFiles; /// root name -> path relative to Directory
+		};
+		optional<ShardedLayout> mShards;
+
+		/// The store file last loaded or saved as a whole, and where each root is in it
+		struct MappedRoots
+		{
+			shared_ptr<MappedFile const> File;
+			filesystem::path Path;
+			map<string, UBJSONRange, less<>> Roots;
+		};
+		optional<MappedRoots> mMapped;
+		/// Throws if the file can't be mapped
+		void MapStoreFile(MappedRoots mapped);
+
+		/// Neither is thread-safe, except that LoadAllRoots loads roots in parallel
+		void LoadRoot(RootMap::value_type& root) const;
+		void LoadAllRoots() const;
+		void SaveSharded(filesystem::path const& path);
+		static DataStore LoadSharded(dtmdl::Schema const& schema, BlobStore& blobs, filesystem::path const& path);
 	};
 	/*
 		bool EditVoid(TypeReference const& type, json& value, json const& field_attributes, json::json_pointer const& value_path);
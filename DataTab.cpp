@@ -5,6 +5,10 @@
 #include "Database.h"
 #include "Values.h"
 #include "Validation.h"
+#include "Query.h"
+#include "Import.h"
+#include "Export.h"
+#include "StoreValidation.h"
 
 namespace dtmdl
 {
@@ -17,6 +21,499 @@ namespace dtmdl
 			});
 	}
 
+	struct QueryUIState
+	{
+		string Text;
+		vector<string> Columns;
+		vector<json> Rows;
+		string Error;
+		QueryStats Stats;
+	};
+
+	void DoQueryUI(DataStore& store, QueryUIState& state)
+	{
+		using namespace ImGui;
+
+		/// Only this many rows are kept for display; the stats still count all of them
+		static constexpr size_t MaxDisplayedRows = 1000;
+
+		SetNextItemWidth(GetContentRegionAvail().x - 100.0f);
+		bool run = InputTextWithHint("##Query", "select * from Type where ... order by ... limit ...", &state.Text, ImGuiInputTextFlags_EnterReturnsTrue);
+		SameLine();
+		run |= Button(ICON_VS_PLAY "Run Query");
+		if (run)
+		{
+			state.Columns.clear();
+			state.Rows.clear();
+			state.Error.clear();
+			auto query = ParseQuery(store.Schema(), state.Text);
+			if (query.has_error())
+				state.Error = move(query).error();
+			else
+			{
+				for (auto& column : query.value().Columns)
+					state.Columns.push_back(column.Label);
+				auto stats = RunQuery(store, query.value(), [&](json const& row) {
+					if (state.Rows.size() < MaxDisplayedRows)
+						state.Rows.push_back(row);
+					return true;
+				});
+				if (stats.has_error())
+					state.Error = move(stats).error();
+				else
+					state.Stats = stats.value();
+			}
+		}
+
+		if (!state.Error.empty())
+		{
+			TextColored({ 1,0,0,1 }, ICON_VS_ERROR "%s", state.Error.c_str());
+			return;
+		}
+		if (state.Columns.empty())
+			return;
+
+		auto const ms = state.Stats.Duration.count() / 1000.0;
+		TextF("{} rows returned ({} matched of {} scanned) in {:.3f} ms", state.Stats.RowsReturned, state.Stats.RowsMatched, state.Stats.RowsScanned, ms);
+		if (state.Rows.size() < state.Stats.RowsReturned)
+		{
+			SameLine();
+			TextColored({ 1,1,0,1 }, ICON_VS_WARNING "only the first %zu are shown", state.Rows.size());
+		}
+
+		if (BeginTable("Query Results", int(state.Columns.size()), ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp, { 0, 300.0f }))
+		{
+			for (auto& column : state.Columns)
+				TableSetupColumn(column.c_str());
+			TableSetupScrollFreeze(0, 1);
+			TableHeadersRow();
+
+			ImGuiListClipper clipper;
+			clipper.Begin(int(state.Rows.size()));
+			while (clipper.Step())
+			{
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+				{
+					TableNextRow();
+					for (auto& column : state.Columns)
+					{
+						TableNextColumn();
+						auto& cell = state.Rows[i][column];
+						TextU(cell.is_string() ? cell.get_ref<json::string_t const&>() : cell.dump());
+					}
+				}
+			}
+
+			EndTable();
+		}
+	}
+
+	void DoTablesUI(DataStore& store)
+	{
+		using namespace ImGui;
+
+		for (auto& [record, shared_table] : store.Tables())
+		{
+			/// Adding or deleting rows can swap the table for a copy, if a snapshot shares it
+			auto const table = shared_table;
+			PushID(record);
+			auto const header = format("{} {} ({} rows, {:.1f} KiB)###Table", record->Icon(), record->Name(), table->RowCount(), table->MemoryUsage() / 1024.0);
+			if (CollapsingHeader(header.c_str()))
+			{
+				if (SmallButton(ICON_VS_ADD "Add Row"))
+				{
+					if (auto row_id = store.InsertRow(record->Name(), json::object()); row_id.has_error())
+						CheckError(failure(row_id.error()));
+				}
+
+				auto& columns = table->Columns();
+				optional<int64_t> row_to_delete;
+				if (BeginTable("Rows", int(columns.size()) + 2, ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp, { 0, 300.0f }))
+				{
+					TableSetupColumn("Row ID");
+					for (auto& column : columns)
+					{
+						auto field = record->OwnOrBaseFieldByKey(column->Key);
+						TableSetupColumn(field ? field->Name.c_str() : column->Key.c_str());
+					}
+					TableSetupColumn("Actions");
+					TableSetupScrollFreeze(0, 1);
+					TableHeadersRow();
+
+					ImGuiListClipper clipper;
+					clipper.Begin(int(table->RowCount()));
+					while (clipper.Step())
+					{
+						for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+						{
+							auto const row_id = table->RowIDs()[i];
+							PushID(i);
+							TableNextRow();
+							TableNextColumn();
+							TextF("{}", row_id);
+							for (auto& column : columns)
+							{
+								TableNextColumn();
+								auto value = column->Get(i);
+								if (column->Type->Type() == DefinitionType::Enum || !column->Type->IsBuiltIn() || !column->Type.TemplateArguments.empty())
+									ViewValue(column->Type, value, {}, &store);
+								else
+									TextU(value.is_string() ? value.get_ref<json::string_t const&>() : value.dump());
+							}
+							TableNextColumn();
+							if (SmallButton(ICON_VS_TRASH "Delete"))
+								row_to_delete = row_id;
+							PopID();
+						}
+					}
+
+					EndTable();
+				}
+
+				if (row_to_delete)
+				{
+					if (auto deleted = store.DeleteRows(record->Name(), span{ &*row_to_delete, 1 }); deleted.has_error())
+						CheckError(failure(deleted.error()));
+				}
+			}
+			PopID();
+		}
+	}
+
+	struct ImportUIState
+	{
+		string Path;
+		string Name;
+		bool BareValue = false; /// the file holds just a value of Type, instead of an export
+		TypeReference Type;
+
+		/// Imports run in the background, while the popup shows their progress
+		future<result<ImportedValue, string>> Pending;
+		atomic<uint64_t> BytesRead = 0;
+		atomic<uint64_t> TotalBytes = 0;
+		atomic<bool> Cancel = false;
+	};
+
+	void DoImportPopupUI(DataStore& store, ImportUIState& state)
+	{
+		using namespace ImGui;
+
+		if (!BeginPopupModal("Import Value from JSON", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+			return;
+
+		if (!state.Pending.valid())
+		{
+			InputTextWithHint("File", "path/to/value.json", &state.Path);
+			InputText("Value name", &state.Name);
+			Checkbox("File holds a bare value, not an export", &state.BareValue);
+			if (state.BareValue)
+				TypeChooser(*mCurrentDatabase, state.Type, {}, "Value type");
+			if (store.HasValue(state.Name))
+				TextColored({ 1,1,0,1 }, ICON_VS_WARNING "Value '%s' will be replaced", state.Name.c_str());
+
+			BeginDisabled(state.Path.empty() || state.Name.empty() || (state.BareValue && !state.Type));
+			if (Button(ICON_VS_JSON "Import"))
+			{
+				state.BytesRead = 0;
+				state.TotalBytes = 0;
+				state.Cancel = false;
+				auto type = state.BareValue ? state.Type : TypeReference{};
+				state.Pending = async(launch::async, [&schema = store.Schema(), &blobs = store.Blobs(), &state, path = filesystem::path{ state.Path }, type = move(type)] {
+					return ImportValueFromJSONFile(schema, blobs, path, type, [&state](ImportProgress const& progress) {
+						state.BytesRead = progress.BytesRead;
+						state.TotalBytes = progress.TotalBytes;
+						return !state.Cancel;
+					});
+				});
+			}
+			EndDisabled();
+			SameLine();
+			if (Button("Close"))
+				CloseCurrentPopup();
+		}
+		else
+		{
+			auto const total = state.TotalBytes.load();
+			auto const read = state.BytesRead.load();
+			ProgressBar(total ? float(double(read) / double(total)) : 0.0f, { 400.0f, 0 }, format("{} / {} KiB", read / 1024, total / 1024).c_str());
+			BeginDisabled(state.Cancel);
+			if (Button(ICON_VS_CLOSE "Cancel"))
+				state.Cancel = true;
+			EndDisabled();
+
+			if (state.Pending.wait_for(0s) == future_status::ready)
+			{
+				auto imported = state.Pending.get();
+				if (imported.has_error())
+					CheckError(failure(move(imported).error()));
+				else
+				{
+					auto& [type, value] = imported.value();
+					store.SetValue(state.Name, type, move(value));
+				}
+				CloseCurrentPopup();
+			}
+		}
+
+		EndPopup();
+	}
+
+	struct ExportUIState
+	{
+		string Path;
+		ExportOptions Options;
+
+		/// Exports run in the background, on a snapshot of the store, so it can still be edited meanwhile
+		future<result<uint64_t, string>> Pending;
+	};
+
+	/// Exports the value named `value_name`, or the whole store if it's empty
+	void DoExportPopupUI(DataStore& store, string_view value_name, ExportUIState& state)
+	{
+		using namespace ImGui;
+
+		if (state.Pending.valid() && state.Pending.wait_for(0s) == future_status::ready)
+		{
+			if (auto exported = state.Pending.get(); exported.has_error())
+				CheckError(failure(move(exported).error()));
+		}
+
+		if (!BeginPopup("Export"))
+			return;
+
+		if (state.Pending.valid())
+		{
+			TextU(ICON_VS_LOADING "Exporting...");
+			EndPopup();
+			return;
+		}
+
+		InputTextWithHint("File", "path/to/export.json", &state.Path);
+		if (BeginCombo("Format", magic_enum::enum_name(state.Options.Format).data()))
+		{
+			for (auto format : magic_enum::enum_values<ExportFormat>())
+			{
+				if (Selectable(magic_enum::enum_name(format).data(), format == state.Options.Format))
+					state.Options.Format = format;
+			}
+			EndCombo();
+		}
+		if (state.Options.Format == ExportFormat::JSON)
+		{
+			bool pretty = state.Options.Indent >= 0;
+			if (Checkbox("Pretty-print", &pretty))
+				state.Options.Indent = pretty ? 2 : -1;
+		}
+
+		BeginDisabled(state.Path.empty());
+		if (Button(ICON_VS_SAVE "Export"))
+		{
+			state.Pending = async(launch::async, [snapshot = make_shared<DataStore>(store.Snapshot()), name = string{ value_name }, path = filesystem::path{ state.Path }, options = state.Options] {
+				return name.empty()
+					? ExportStoreToFile(*snapshot, path, options)
+					: ExportValueToFile(*snapshot, name, path, options);
+			});
+			CloseCurrentPopup();
+		}
+		EndDisabled();
+
+		EndPopup();
+	}
+
+	struct MergeUIState
+	{
+		string From;
+		string Base; /// empty for a two-way merge
+		optional<MergeReport> Report;
+		string Error;
+	};
+
+	static void StoreChooser(char const* label, string& chosen, string_view exclude, char const* none_label)
+	{
+		using namespace ImGui;
+		if (BeginCombo(label, chosen.empty() ? none_label : chosen.c_str()))
+		{
+			if (Selectable(none_label, chosen.empty()))
+				chosen.clear();
+			for (auto& [name, other] : mCurrentDatabase->DataStores())
+			{
+				if (name != exclude && Selectable(name.c_str(), chosen == name))
+					chosen = name;
+			}
+			EndCombo();
+		}
+	}
+
+	void DoMergePopupUI(DataStore& store, string_view store_name, MergeUIState& state)
+	{
+		using namespace ImGui;
+
+		if (!BeginPopup("Merge Data Store"))
+			return;
+
+		StoreChooser("Merge from", state.From, store_name, "<choose a data store>");
+		StoreChooser("Common ancestor", state.Base, store_name, "<none>");
+
+		BeginDisabled(state.From.empty() || state.From == state.Base);
+		if (Button(ICON_VS_MERGE "Merge"))
+		{
+			state.Report.reset();
+			state.Error.clear();
+			auto& stores = mCurrentDatabase->DataStores();
+			auto theirs = stores.find(state.From);
+			auto base = state.Base.empty() ? stores.end() : stores.find(state.Base);
+			if (theirs == stores.end() || (!state.Base.empty() && base == stores.end()))
+				state.Error = "data store no longer exists";
+			else if (auto merged = store.Merge(theirs->second, base != stores.end() ? &base->second : nullptr); merged.has_error())
+				state.Error = move(merged).error();
+			else
+				state.Report = move(merged).value();
+			CloseCurrentPopup();
+		}
+		EndDisabled();
+
+		EndPopup();
+	}
+
+	void DoMergeReportUI(MergeUIState& state)
+	{
+		using namespace ImGui;
+
+		if (!state.Error.empty())
+		{
+			TextColored({ 1,0,0,1 }, ICON_VS_ERROR "%s", state.Error.c_str());
+			return;
+		}
+		if (!state.Report)
+			return;
+
+		auto& report = *state.Report;
+		auto const ms = report.Stats.Duration.count() / 1000.0;
+		TextF("Merged '{}' in {:.3f} ms: {} values taken, {} unchanged subtrees skipped, {} table rows compared, {} conflicts",
+			state.From, ms, report.Stats.SubtreesTaken, report.Stats.SubtreesSkipped, report.Stats.RowsCompared, report.Conflicts.size());
+		SameLine();
+		if (SmallButton(ICON_VS_CLOSE "Dismiss"))
+		{
+			state.Report.reset();
+			return;
+		}
+
+		if (report.Conflicts.empty())
+			return;
+
+		TextColored({ 1,1,0,1 }, ICON_VS_WARNING "Conflicting values were left as they were in this data store:");
+		if (BeginTable("Merge Conflicts", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp, { 0, 200.0f }))
+		{
+			TableSetupColumn("Path");
+			TableSetupColumn("Ours");
+			TableSetupColumn("Theirs");
+			TableSetupColumn("Ancestor");
+			TableSetupScrollFreeze(0, 1);
+			TableHeadersRow();
+
+			auto show = [](json const& value) {
+				TableNextColumn();
+				if (value.is_null())
+					TextDisabled("<none>");
+				else
+					TextU(value.dump());
+			};
+
+			ImGuiListClipper clipper;
+			clipper.Begin(int(report.Conflicts.size()));
+			while (clipper.Step())
+			{
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+				{
+					auto& conflict = report.Conflicts[i];
+					TableNextRow();
+					TableNextColumn();
+					TextU(conflict.Path);
+					show(conflict.Ours);
+					show(conflict.Theirs);
+					show(conflict.Base);
+				}
+			}
+
+			EndTable();
+		}
+	}
+
+	struct ValidationUIState
+	{
+		/// Validation runs in the background, on a snapshot of the store
+		future<StoreValidationReport> Pending;
+		optional<StoreValidationReport> Report;
+	};
+
+	void DoValidationUI(DataStore& store, ValidationUIState& state)
+	{
+		using namespace ImGui;
+
+		if (state.Pending.valid() && state.Pending.wait_for(0s) == future_status::ready)
+			state.Report = state.Pending.get();
+
+		if (state.Pending.valid())
+		{
+			TextU(ICON_VS_LOADING "Validating...");
+			return;
+		}
+
+		if (Button(ICON_VS_CHECKLIST "Validate Data Store"))
+		{
+			state.Pending = async(launch::async, [snapshot = make_shared<DataStore>(store.Snapshot())] {
+				return ValidateStore(*snapshot);
+			});
+		}
+
+		if (!state.Report)
+			return;
+
+		auto& report = *state.Report;
+		SameLine();
+		if (report.Diagnostics.empty())
+			TextColored({ 0,1,0,1 }, ICON_VS_PASS "%s", format("{} values checked in {:.3f} ms, no problems found", report.ValuesChecked, report.Duration.count() / 1000.0).c_str());
+		else
+			TextF("{} values checked in {:.3f} ms, {} problems found", report.ValuesChecked, report.Duration.count() / 1000.0, report.Diagnostics.size());
+		SameLine();
+		if (SmallButton(ICON_VS_CLOSE "Dismiss"))
+		{
+			state.Report.reset();
+			return;
+		}
+
+		if (report.Diagnostics.empty())
+			return;
+
+		if (BeginTable("Validation Diagnostics", 2, ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingStretchProp, { 0, 200.0f }))
+		{
+			TableSetupColumn("Path");
+			TableSetupColumn("Problem");
+			TableSetupScrollFreeze(0, 1);
+			TableHeadersRow();
+
+			ImGuiListClipper clipper;
+			clipper.Begin(int(report.Diagnostics.size()));
+			while (clipper.Step())
+			{
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
+				{
+					auto& diagnostic = report.Diagnostics[i];
+					TableNextRow();
+					TableNextColumn();
+					TextU(diagnostic.Path);
+					TableNextColumn();
+					if (diagnostic.Level == ValueDiagnostic::Severity::Error)
+						TextColored({ 1,0,0,1 }, ICON_VS_ERROR "%s", diagnostic.Message.c_str());
+					else
+						TextColored({ 1,1,0,1 }, ICON_VS_WARNING "%s", diagnostic.Message.c_str());
+				}
+			}
+
+			EndTable();
+		}
+	}
+
 	void DataTab()
 	{
 		using namespace ImGui;
@@ -31,7 +528,6 @@ namespace dtmdl
 			{
 				if (BeginTabItem(name.c_str()))
 				{
-					/// TODO: Tables!
 					if (Button(ICON_VS_ADD "Add Value"))
 					{
 						auto name = FreshName("Value", [&](string_view name) { return store.HasValue(name); });
@@ -49,15 +545,21 @@ namespace dtmdl
 
 					}
 					SameLine();
+					static map<string, ImportUIState, less<>> import_states;
 					if (Button(ICON_VS_JSON "Import Value from JSON"))
-					{
-
-					}
+						OpenPopup("Import Value from JSON");
+					DoImportPopupUI(store, import_states[name]);
+					SameLine();
+					static map<string, ExportUIState, less<>> store_export_states;
+					if (Button(ICON_VS_SAVE_AS "Export Data Store"))
+						OpenPopup("Export");
+					DoExportPopupUI(store, {}, store_export_states[name]);
 					SameLine();
+					static map<string, MergeUIState, less<>> merge_states;
+					auto& merge_state = merge_states[name];
 					if (Button(ICON_VS_MERGE "Merge Another Data Store"))
-					{
-
-					}
+						OpenPopup("Merge Data Store");
+					DoMergePopupUI(store, name, merge_state);
 					SameLine();
 					if (Button(ICON_VS_TRASH "Delete Data Store"))
 					{
@@ -67,14 +569,33 @@ namespace dtmdl
 
 					static bool show_json = false;
 					Checkbox("Show JSON", &show_json);
+					SameLine();
+					if (bool sharded = store.Sharded(); Checkbox("One File per Value", &sharded))
+						store.SetSharded(sharded);
+					SameLine();
+					auto& gc_stats = store.GCStatistics();
+					TextF("{} objects in gcheap ({} freed in {} collection cycles, {:.1f} ms)", store.Heap().Size(), gc_stats.ObjectsFreed, gc_stats.Cycles, gc_stats.Time.count() / 1000.0);
+
+					DoMergeReportUI(merge_state);
+
+					static map<string, ValidationUIState, less<>> validation_states;
+					DoValidationUI(store, validation_states[name]);
+
+					static map<string, QueryUIState, less<>> query_states;
+					DoQueryUI(store, query_states[name]);
 
 					Spacing();
 					Separator();
 					Spacing();
 
+					DoTablesUI(store);
+
 					if (show_json)
 					{
-						string j = store.Storage().dump(2);
+						auto storage = store.Storage();
+						for (auto& [name, root] : store.Roots())
+							storage["roots"][name] = *root;
+						string j = storage.dump(2);
 						PushTextWrapPos(0.0f);
 						TextUnformatted(j.data(), j.data() + j.size());
 						PopTextWrapPos();
@@ -93,26 +614,40 @@ namespace dtmdl
 							TableNextRow();
 							int index = 0;
 
-							for (auto& [name, value] : store.Roots().items())
+							for (auto& [name, shared_root] : store.LazyRoots())
 							{
+								TableNextColumn();
+								/// Editing swaps the root for a copy if a snapshot shares it, so we hold on to the one we're showing.
+								/// Roots that aren't loaded yet are only loaded once they're scrolled into view.
+								auto const root = shared_root ? shared_root : IsRectVisible({ 1.0f, GetTextLineHeightWithSpacing() }) ? store.Root(name) : nullptr;
+								if (!root)
+								{
+									TextU(name);
+									TableNextColumn();
+									TextDisabled("...");
+									TableNextColumn();
+									TableNextColumn();
+									index++;
+									continue;
+								}
+								auto& value = *root;
 								PushID(index);
 
-								TableNextColumn();
 								/// FieldNameEditor(db, field);
 								TextU(name); SameLine(); SmallButton(ICON_VS_EDIT "Edit");
 								TableNextColumn();
 								SetNextItemWidth(GetContentRegionAvail().x);
 								/// FieldTypeEditor(db, field);
-								TypeReference old_type = TypeFromJSON(mCurrentDatabase->Schema(), value.at("type"));
-								GenericEditor<json*, TypeReference>("Type", &value,
+								TypeReference old_type = TypeFromStorageJSON(mCurrentDatabase->Schema(), value.at("type"));
+								GenericEditor<json const*, TypeReference>("Type", &value,
 									/// validator
-									[&](json* value, TypeReference const& new_type) -> result<void, string> {
+									[&](json const* value, TypeReference const& new_type) -> result<void, string> {
 										if (ResultOfConversion(old_type, new_type, value->at("value")) == ConversionResult::ConversionImpossible)
 											return failure("conversion to this type is impossible");
 										return ValidateType(new_type);
 									},
 									/// editor
-										[&](json* value, TypeReference& current) {
+										[&](json const* value, TypeReference& current) {
 										TypeChooser(*mCurrentDatabase, current);
 										auto result = ResultOfConversion(old_type, current, value->at("value"));
 										switch (result)
@@ -126,23 +661,40 @@ namespace dtmdl
 										}
 									},
 										/// setter
-										[&](json* value, TypeReference const& new_type) -> result<void, string> {
-										TypeReference old_type = TypeFromJSON(mCurrentDatabase->Schema(), value->at("type"));
-										value->at("type") = ToJSON(new_type);
-										return Convert(old_type, new_type, value->at("value"));
+										[&](json const*, TypeReference const& new_type) -> result<void, string> {
+										auto root = store.MutableRoot(name);
+										TypeReference old_type = TypeFromStorageJSON(mCurrentDatabase->Schema(), root->at("type"));
+										root->at("type") = ToStorageJSON(new_type);
+										return Convert(old_type, new_type, root->at("value"));
 									},
 										/// getter
-										[&](json* value) { return TypeFromJSON(mCurrentDatabase->Schema(), value->at("type")); }
+										[&](json const* value) { return TypeFromStorageJSON(mCurrentDatabase->Schema(), value->at("type")); }
 									);
 								TableNextColumn();
 								json::json_pointer ptr{ "/" + name };
 								SetNextItemWidth(GetContentRegionAvail().x);
-								EditValue(TypeFromJSON(mCurrentDatabase->Schema(), value.at("type")), value.at("value"), {}, ptr, &store);
+								auto const value_type = TypeFromStorageJSON(mCurrentDatabase->Schema(), value.at("type"));
+								/// Only scalars can be edited here; they're edited on a copy, so the root is only unshared when it actually changes
+								if (auto& root_value = value.at("value"); root_value.is_structured() || root_value.is_binary())
+									ViewValue(value_type, root_value, {}, &store);
+								else if (auto edited = root_value; EditValue(value_type, edited, {}, ptr, &store))
+									store.MutableRoot(name)->at("value") = move(edited);
 								TableNextColumn();
 
 								DoDeleteValueUI(store, name);
 								SameLine();
-								SmallButton(ICON_VS_JSON "Export Value to JSON");
+								static ExportUIState value_export_state;
+								if (SmallButton(ICON_VS_JSON "Export Value"))
+									OpenPopup("Export");
+								DoExportPopupUI(store, name, value_export_state);
+								SameLine();
+								if (SmallButton(ICON_VS_TABLE "Move to Table"))
+								{
+									LateExec.push_back([&store, name = string{ name }] {
+										if (auto moved = store.MoveValueIntoTable(name); moved.has_error())
+											CheckError(failure(moved.error()));
+									});
+								}
 
 								index++;
 								PopID();
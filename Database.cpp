@@ -2,9 +2,9 @@
 
 #include "Database.h"
 #include "Validation.h"
+#include "BlobStore.h"
 
 #include <ghassanpl/wilson.h>
-#include <kubazip/zip/zip.h>
 
 namespace dtmdl
 {
@@ -97,6 +97,11 @@ namespace dtmdl
 		/// Schema Change
 		auto name = FreshName("Enumerator", [def](string_view name) { return !!def->Enumerator(name); });
 		mut(def)->mEnumerators.push_back(make_unique<EnumeratorDefinition>(def, name, nullopt));
+		if (auto result = ValidateEnumeratorValues(def); result.has_error())
+		{
+			mut(def)->mEnumerators.pop_back();
+			return result;
+		}
 
 		/// DataStore update (v2)
 		/// Adding a new enumerator (at the end) should not change the data stores
@@ -117,10 +122,20 @@ namespace dtmdl
 		if (enum_index_b >= def->mEnumerators.size()) return failure(format("enumerator #{} of enum {} does not exist", enum_index_b, def->Name()));
 
 		/// Schema Change
+		auto old_values = EnumeratorValues(def);
 		swap(mut(def)->mEnumerators[enum_index_a], mut(def)->mEnumerators[enum_index_b]);
 
 		/// DataStore update
-		/// No need to update datastore, it doesn't care about enumerator order
+		/// Stores don't care about enumerator order, but implicit enumerator values may have changed
+		auto update_result = ValidateEnumeratorValues(def);
+		if (update_result.has_value())
+			update_result = RemapEnumeratorData(def, old_values);
+		if (update_result.has_error())
+		{
+			/// No store was changed, so the schema can't be either
+			swap(mut(def)->mEnumerators[enum_index_a], mut(def)->mEnumerators[enum_index_b]);
+			return update_result;
+		}
 
 		/// ChangeLog add
 		AddChangeLog(json{ {"action", "SwapEnumerators"}, {"record", def->Name()}, {"enumerator_a", enum_index_a}, {"enumerator_b", enum_index_b} });
@@ -128,7 +143,7 @@ namespace dtmdl
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	result<void, string> Database::DeleteEnumerator(Enumerator def)
@@ -140,19 +155,30 @@ namespace dtmdl
 		/// ChangeLog add
 		AddChangeLog(json{ {"action", "DeleteEnumerator"}, {"enum", def->ParentEnum->Name()}, {"enumerator", def->Name}, {"backup", ToJSON(def->Value) } });
 
-		/// DataStore update
-		UpdateDataStores([&](DataStore& store) {
-			store.DeleteEnumerator(def->ParentEnum->Name(), def->Name);
-			});
-
 		/// Schema Change
-		auto index = def->ParentEnum->EnumeratorIndexOf(def);
-		mut(def->ParentEnum)->mEnumerators.erase(def->ParentEnum->mEnumerators.begin() + index);
+		auto enoom = def->ParentEnum;
+		auto old_values = EnumeratorValues(enoom);
+		auto removed_value = def->ActualValue();
+		auto index = enoom->EnumeratorIndexOf(def);
+		auto removed = move(mut(enoom)->mEnumerators[index]);
+		mut(enoom)->mEnumerators.erase(enoom->mEnumerators.begin() + index);
+
+		/// DataStore update
+		/// Values of the deleted enumerator are replaced with the default one, and enumerators after it may have changed value
+		old_values.erase(def);
+		auto update_result = ValidateEnumeratorValues(enoom);
+		if (update_result.has_value())
+			update_result = RemapEnumeratorData(enoom, old_values, removed_value);
+		if (update_result.has_error())
+		{
+			mut(enoom)->mEnumerators.insert(enoom->mEnumerators.begin() + index, move(removed));
+			return update_result;
+		}
 
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	result<void, string> Database::SetEnumeratorName(Enumerator def, string const& new_name)
@@ -166,13 +192,10 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "SetEnumeratorName"}, {"enum", def->ParentEnum->Name()}, {"oldname", def->Name}, {"newname", new_name} });
 
 		/// Schema Change
-		auto old_name = def->Name;
 		mut(def)->Name = new_name;
 
 		/// DataStore update
-		UpdateDataStores([&](DataStore& store) {
-			store.SetEnumeratorName(def->ParentEnum->Name(), old_name, new_name);
-			});
+		/// No need to update store since we're storing the values, not names
 
 		/// Save
 		SaveAll();
@@ -186,7 +209,7 @@ namespace dtmdl
 
 		/// Schema Change
 		auto name = FreshName("Field", [def](string_view name) { return !!def->OwnOrBaseField(name); });
-		mut(def)->mFields.push_back(make_unique<FieldDefinition>(def, name, TypeReference{ VoidType() }));
+		mut(def)->mFields.push_back(make_unique<FieldDefinition>(def, name, TypeReference{ VoidType() }, mSchema.NewID()));
 
 		/// DataStore update
 		/// Adding a new field to a type should not change the data stores - we treat
@@ -234,12 +257,10 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "SetTypeName"}, {"oldname", def->Name()}, {"newname", new_name } });
 
 		/// Schema Change
-		auto old_name = exchange(mut(def)->mName, new_name);
+		mut(def)->mName = new_name;
 
 		/// DataStore update
-		UpdateDataStores([&](DataStore& store) {
-			store.SetTypeName(old_name, new_name);
-			});
+		/// No need to update store since it refers to types by ID
 
 		/// Save
 		SaveAll();
@@ -258,13 +279,10 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "SetFieldName"}, {"record", def->ParentRecord->Name()}, {"oldname", def->Name}, {"newname", new_name} });
 
 		/// Schema Change
-		auto old_name = def->Name;
 		mut(def)->Name = new_name;
 
 		/// DataStore update
-		UpdateDataStores([&](DataStore& store) {
-			store.SetFieldName(def->ParentRecord->Name(), old_name, new_name);
-			});
+		/// No need to update store since it keys record members by field ID
 
 		/// Save
 		SaveAll();
@@ -287,14 +305,19 @@ namespace dtmdl
 		mut(def)->FieldType = type;
 
 		/// DataStore update
-		UpdateDataStores([&](DataStore& store) {
-			store.SetFieldType(def->ParentRecord->Name(), def->Name, old_type, type);
+		auto update_result = UpdateDataStores([&](DataStore& store) {
+			store.SetFieldType(def->ParentRecord->Name(), def->StorageKey(), old_type, type);
 			});
+		if (update_result.has_error())
+		{
+			mut(def)->FieldType = move(old_type);
+			return update_result;
+		}
 
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	result<void, string> Database::SetFieldFlags(Fld def, enum_flags<FieldFlags> flags)
@@ -306,10 +329,41 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "SetFieldFlags"}, {"record", def->ParentRecord->Name()}, {"field", def->Name}, {"flags", flags }, {"previous", def->Flags} });
 
 		/// Schema Change
+		auto const old_flags = def->Flags;
 		mut(def)->Flags = flags;
 
 		/// DataStore update
-		/// No need
+		/// Tables keep indices for Indexed and Unique fields
+		auto update_result = UpdateDataStores([&](DataStore& store) {
+			store.UpdateTableIndices();
+			});
+		if (update_result.has_error())
+		{
+			mut(def)->Flags = old_flags;
+			return update_result;
+		}
+
+		/// Save
+		SaveAll();
+
+		return update_result;
+	}
+
+	result<void, string> Database::SetFieldIndexType(Fld def, IndexKind kind)
+	{
+		/// Validation
+		auto result = ValidateFieldIndexType(def, kind);
+		if (result.has_error())
+			return result;
+
+		/// ChangeLog add
+		AddChangeLog(json{ {"action", "SetFieldIndexType"}, {"record", def->ParentRecord->Name()}, {"field", def->Name}, {"index", magic_enum::enum_name(kind)}, {"previous", magic_enum::enum_name(def->IndexType())} });
+
+		/// Schema Change
+		auto field = mut(def);
+		if (!field->Attributes.is_object())
+			field->Attributes = json::object();
+		field->Attributes["index"] = magic_enum::enum_name(kind);
 
 		/// Save
 		SaveAll();
@@ -404,7 +458,7 @@ namespace dtmdl
 
 		/// Schema Change
 
-		mut(to_record)->mFields.push_back(make_unique<FieldDefinition>(to_record, move(mut(src_field)->Name), src_field->FieldType));
+		mut(to_record)->mFields.push_back(make_unique<FieldDefinition>(to_record, move(mut(src_field)->Name), src_field->FieldType, src_field->ID));
 		auto it = ranges::find_if(from_record->mFields, [src_field](auto const& f) { return f.get() == src_field; });
 		mut(from_record)->mFields.erase(it);
 
@@ -449,12 +503,14 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "DeleteField"},  {"record", def->ParentRecord->Name()}, {"field", def->Name}, {"backup", def->ToJSON() } });
 
 		/// DataStore update
-		/// Need to update data stores - if we delete a field and create a new one with the same name, that
-		/// will be an issue
+		/// Field IDs are never reused, so a new field with the same name won't pick up this data,
+		/// but we still don't want it lying around
 
-		UpdateDataStores([&](DataStore& store) {
-			store.DeleteField(def->ParentRecord->Name(), def->Name);
+		auto update_result = UpdateDataStores([&](DataStore& store) {
+			store.DeleteField(def->ParentRecord->Name(), def->StorageKey());
 			});
+		if (update_result.has_error())
+			return update_result;
 
 		/// Schema Change
 		auto index = def->ParentRecord->FieldIndexOf(def);
@@ -463,7 +519,7 @@ namespace dtmdl
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	template <typename CALLBACK>
@@ -530,7 +586,7 @@ namespace dtmdl
 		vector<string> result;
 		ranges::copy(
 			mDataStores
-			| views::filter([field](auto& kvp) { return kvp.second.HasFieldData(field->ParentRecord->Name(), field->Name); })
+			| views::filter([field](auto& kvp) { return kvp.second.HasFieldData(field->ParentRecord->Name(), field->StorageKey()); })
 			| views::transform([](auto& kvp) { return kvp.first; }),
 			back_inserter(result));
 		return result;
@@ -541,7 +597,7 @@ namespace dtmdl
 		vector<string> result;
 		ranges::copy(
 			mDataStores
-			| views::filter([field](auto& kvp) { return kvp.second.HasEnumeratorData(field->ParentEnum->Name(), field->Name); })
+			| views::filter([field, value = field->ActualValue()](auto& kvp) { return kvp.second.HasEnumeratorData(field->ParentEnum->Name(), value); })
 			| views::transform([](auto& kvp) { return kvp.first; }),
 			back_inserter(result));
 		return result;
@@ -556,7 +612,7 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "SetEnumeratorDescriptiveName"},  {"enum", def->ParentEnum->Name()}, {"enumerator", def->Name}, {"backup", def->Name } });
 
 		/// DataStore update
-		/// No need to update store since we're storing the values by name 
+		/// No need to update store since we're storing the values, not names
 
 		/// Schema Change
 		mut(def)->DescriptiveName = new_name;
@@ -575,16 +631,25 @@ namespace dtmdl
 		/// ChangeLog add
 		AddChangeLog(json{ {"action", "SetEnumeratorValue"},  {"enum", def->ParentEnum->Name()}, {"enumerator", def->Name}, {"backup", ToJSON(value) } });
 
-		/// DataStore update
-		/// No need to update store since we're storing the values by name 
-
 		/// Schema Change
+		auto old_values = EnumeratorValues(def->ParentEnum);
+		auto old_value = def->Value;
 		mut(def)->Value = value;
 
+		/// DataStore update
+		auto update_result = ValidateEnumeratorValues(def->ParentEnum);
+		if (update_result.has_value())
+			update_result = RemapEnumeratorData(def->ParentEnum, old_values);
+		if (update_result.has_error())
+		{
+			mut(def)->Value = move(old_value);
+			return update_result;
+		}
+
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	result<void, string> Database::DeleteType(Def type)
@@ -605,9 +670,11 @@ namespace dtmdl
 		AddChangeLog(json{ {"action", "DeleteType"}, {"type", type->Name()}, {"backup", type->ToJSON() } });
 
 		/// DataStore update
-		UpdateDataStores([type](DataStore& store) {
+		auto update_result = UpdateDataStores([type](DataStore& store) {
 			store.DeleteType(type->Name());
 			});
+		if (update_result.has_error())
+			return update_result;
 
 		/// Schema Change
 		auto it = ranges::find_if(mSchema.mDefinitions, [type](auto& def) { return def.get() == type; });
@@ -616,7 +683,7 @@ namespace dtmdl
 		/// Save
 		SaveAll();
 
-		return success();
+		return update_result;
 	}
 
 	Database::Database(filesystem::path dir)
@@ -638,12 +705,15 @@ namespace dtmdl
 		AddFormatPlugin(make_unique<CppDatabaseFormat>());
 		AddFormatPlugin(make_unique<CppReflectionFormat>());
 		AddFormatPlugin(make_unique<CppTablesFormat>());
+		AddFormatPlugin(make_unique<CppBinaryFormat>());
 		AddFormatPlugin(make_unique<CSharpDeclarationFormat>());
 
-		mDataStores.emplace("main", DataStore(mSchema));
+		mBlobs = make_unique<BlobStore>(mDirectory / "blobs");
+
+		mDataStores.emplace("main", DataStore(mSchema, *mBlobs));
 
+		/// Nothing changed by just opening the database, so nothing is saved
 		LoadAll();
-		SaveAll();
 	}
 
 	void Database::AddChangeLog(json log)
@@ -652,96 +722,250 @@ namespace dtmdl
 		mChangeLog << ghassanpl::to_wilson_string(log) << "\n";
 	}
 
-	result<void, string> Database::CreateBackup()
+	result<BackupReport, string> Database::CreateBackup(BackupOptions options)
 	{
-		return CreateBackup(mDirectory);
+		return CreateBackup(mDirectory, move(options));
 	}
 
-	result<void, string> Database::CreateBackup(filesystem::path in_directory)
+	result<BackupReport, string> Database::CreateBackup(filesystem::path in_directory, BackupOptions options)
 	{
 		mChangeLog.flush();
 		mChangeLog.close();
 
-		vector<string> filenames;
-		for (auto it = filesystem::directory_iterator{ absolute(mDirectory) }; it != filesystem::directory_iterator{}; ++it)
-		{
-			if (it->path().extension() != ".zip")
-				filenames.push_back(it->path().string());
-		}
-
-		auto zip_path = (in_directory / format("backup_{}_{:%F-%Hh%Mm%Ss%z}.zip", mDirectory.filename().string(), chrono::zoned_time{ chrono::current_zone(), chrono::system_clock::now() })).string();
-		vector<const char*> filename_cstrs;
-		ranges::transform(filenames, back_inserter(filename_cstrs), [](string const& s) { return s.c_str(); });
-		auto error = zip_create(zip_path.c_str(), filename_cstrs.data(), filename_cstrs.size());
+		/// Recursive, so that the blob directory is backed up too; files keep their paths relative to the database directory
+		auto const root = absolute(mDirectory);
+		BackupRepository repository{ absolute(in_directory) / "backups" };
+		auto const repository_prefix = repository.Directory().lexically_relative(root).generic_string() + "/";
+		/// Large `bytes` values are usually compressed already (images, sounds), and there can be a lot of them
+		auto const blobs_prefix = absolute(mBlobs->Directory()).lexically_relative(root).generic_string() + "/";
+		options.StoreUncompressed = [&blobs_prefix, store_uncompressed = move(options.StoreUncompressed)](filesystem::path const& relative) {
+			return relative.generic_string().starts_with(blobs_prefix) || (store_uncompressed && store_uncompressed(relative));
+		};
+		auto backup = repository.CreateSnapshot(root, [&](filesystem::path const& relative) {
+			/// Skip the repository itself (if it's inside the database directory), old zip backups, and files that are still being written
+			if (relative.generic_string().starts_with(repository_prefix))
+				return false;
+			return relative.extension() != ".zip" && relative.extension() != ".tmp";
+		}, options);
 
 		mChangeLog.open(mDirectory / "changelog.wilson", ios::app | ios::out);
 
-		AddChangeLog({ {"action", "Backup" }, {"filename", zip_path} });
+		if (backup.has_error())
+			return failure(format("creating backup failed: {}", backup.error()));
 
-		if (error == 0)
-			return success();
-		return failure("zipping backup file failed");
+		AddChangeLog({ {"action", "Backup" }, {"repository", repository.Directory().string()}, {"snapshot", backup.value().Snapshot} });
+
+		return backup;
+	}
+
+	result<void, string> Database::RestoreBackup(filesystem::path const& backup_directory, string_view snapshot, filesystem::path const& target_directory)
+	{
+		return BackupRepository{ backup_directory / "backups" }.Restore(snapshot, target_directory);
 	}
 
 	void Database::SaveAll()
 	{
-		/// TODO: This
-		/*
-		auto result = ValidateAll();
-		if (result.has_error())
-			return result;
-			*/
+		/// Stores are not validated here, as that would make every save as slow as a full scan of the data;
+		/// use ValidateAll (or `--validate` on the command line) instead
 
+		/// Exported files only depend on the schema, so they're left alone (timestamps and all) while it stays the same,
+		/// and whatever is built from them isn't rebuilt for nothing
+		auto const schema_hash = mSchema.Hash();
 		for (auto& [name, plugin] : mFormatPlugins)
 		{
-			ghassanpl::save_text_file(mDirectory / plugin->ExportFileName(), plugin->Export(*this));
+			auto const path = mDirectory / plugin->ExportFileName();
+			if (schema_hash != mExportedSchemaHash || !filesystem::exists(path))
+				ghassanpl::save_text_file(path, plugin->Export(*this));
 		}
+		mExportedSchemaHash = schema_hash;
 
 		for (auto& [name, store] : mDataStores)
-		{
-			save_ubjson_file(mDirectory / format("{}.datastore", name), store.Storage());
-		}
+			store.Save(mDirectory / format("{}.datastore", name));
 
 		save_json_file(mDirectory / "database.json", this->Save());
 
 		mChangeLog.flush();
 	}
 
+	void Database::CollectGarbage()
+	{
+		for (auto& [name, store] : mDataStores)
+			store.CollectGarbage();
+	}
+
+	map<string, StoreValidationReport, less<>> Database::ValidateAll() const
+	{
+		map<string, StoreValidationReport, less<>> reports;
+		for (auto& [name, store] : mDataStores)
+			reports.emplace(name, ValidateStore(store));
+		return reports;
+	}
+
 	void Database::LoadAll()
 	{
-		if (filesystem::exists(mDirectory / "database.json"))
+		auto const start = chrono::steady_clock::now();
+		auto const since = [](chrono::steady_clock::time_point from) {
+			return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - from);
+		};
+		mOpenTimings = {};
+
+		auto const load_if_exists = [](filesystem::path path) {
+			return filesystem::exists(path) ? optional<json>{ ghassanpl::load_json_file(path) } : nullopt;
+		};
+		auto database_json = async(launch::async, load_if_exists, mDirectory / "database.json");
+		auto schema_json = async(launch::async, load_if_exists, mDirectory / "schema.json");
+		auto const database = database_json.get();
+		auto const schema = schema_json.get();
+		mOpenTimings.ParseFiles = since(start);
+
+		auto const schema_start = chrono::steady_clock::now();
+		if (database)
+			this->Load(*database);
+		if (schema)
+			LoadSchema(*schema);
+		mOpenTimings.ApplySchema = since(schema_start);
+
+		auto const stores_start = chrono::steady_clock::now();
+		vector<filesystem::path> paths;
+		for (auto it = filesystem::directory_iterator{ mDirectory }; it != filesystem::directory_iterator{}; ++it)
 		{
-			this->Load(ghassanpl::load_json_file(mDirectory / "database.json"));
+			if (it->path().extension() == ".datastore")
+				paths.push_back(it->path());
 		}
 
-		if (filesystem::exists(mDirectory / "schema.json"))
+		/// Loading only reads the schema, so stores can be loaded side by side; the first failure is rethrown once they're all done
+		vector<optional<DataStore>> stores(paths.size());
+		vector<chrono::microseconds> store_times(paths.size());
+		vector<exception_ptr> errors(paths.size());
+		for_each(execution::par, paths.begin(), paths.end(), [&](filesystem::path const& path) {
+			auto const index = &path - paths.data();
+			auto const store_start = chrono::steady_clock::now();
+			try
+			{
+				stores[index].emplace(DataStore::Load(mSchema, *mBlobs, path));
+			}
+			catch (...)
+			{
+				errors[index] = current_exception();
+			}
+			store_times[index] = since(store_start);
+		});
+		if (auto error = ranges::find_if(errors, [](exception_ptr const& e) { return bool(e); }); error != errors.end())
+			rethrow_exception(*error);
+
+		for (size_t i = 0; i < paths.size(); ++i)
 		{
-			LoadSchema(ghassanpl::load_json_file(mDirectory / "schema.json"));
+			auto name = paths[i].stem().string();
+			mOpenTimings.DataStores.emplace_back(name, store_times[i]);
+			mDataStores.erase(name);
+			mDataStores.insert({ move(name), move(*stores[i]) });
 		}
+		mOpenTimings.LoadDataStores = since(stores_start);
+		mOpenTimings.Total = since(start);
+	}
 
-		for (auto it = filesystem::directory_iterator{ mDirectory }; it != filesystem::directory_iterator{}; ++it)
+	result<void, string> Database::UpdateDataStores(function<void(DataStore&)> const& update_func)
+	{
+		vector<DataStore*> stores;
+		mLastDataStoreUpdateReport.clear();
+		for (auto& [name, store] : mDataStores)
+		{
+			mLastDataStoreUpdateReport.push_back({ .StoreName = name });
+			stores.push_back(&store);
+		}
+
+		/// Stores are independent of each other, so we migrate them concurrently; DataStore itself
+		/// splits large stores by root (see DataStore::ForEveryRoot)
+		/// The snapshots share the stores' data, so only the roots and tables the update actually changes get copied
+		vector<optional<DataStore>> backups(stores.size());
+		for_each(execution::par, mLastDataStoreUpdateReport.begin(), mLastDataStoreUpdateReport.end(), [&](DataStoreUpdateReport& report) {
+			auto const index = &report - mLastDataStoreUpdateReport.data();
+			auto& store = *stores[index];
+			auto start = chrono::steady_clock::now();
+
+			backups[index].emplace(store.Snapshot());
+			try
+			{
+				update_func(store);
+			}
+			catch (std::exception const& e)
+			{
+				report.Error = e.what();
+			}
+			catch (...)
+			{
+				report.Error = "unknown error";
+			}
+
+			report.Duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		});
+
+		json timings = json::object();
+		vector<string> errors;
+		for (auto& report : mLastDataStoreUpdateReport)
 		{
-			auto& path = it->path();
-			if (path.extension() == ".datastore")
+			timings[report.StoreName] = json::object({ {"time_us", report.Duration.count()} });
+			if (report.Error)
 			{
-				mDataStores.erase(path.stem().string());
-				mDataStores.insert({ path.stem().string(), DataStore{mSchema, try_load_ubjson_file(path)} });
+				timings[report.StoreName]["error"] = *report.Error;
+				errors.push_back(format("- store '{}': {}", report.StoreName, *report.Error));
 			}
 		}
+		AddChangeLog(json{ {"action", "UpdateDataStores"}, {"stores", move(timings)} });
+
+		if (errors.empty())
+			return success();
+
+		/// The caller is going to undo its schema change, so the stores that did migrate have to go back too,
+		/// or they'd be left holding data for a schema that no longer exists
+		for (size_t i = 0; i < stores.size(); ++i)
+		{
+			auto& store = *stores[i];
+			auto& backup = *backups[i];
+			store.mStorage = move(backup.mStorage);
+			store.mRoots = move(backup.mRoots);
+			store.mTables = move(backup.mTables);
+			store.mHeap = move(backup.mHeap);
+		}
+
+		return failure(format("the following data stores could not be updated, so no stores or schema were changed:\n{}", string_ops::join(errors, "\n")));
 	}
 
-	void Database::UpdateDataStores(function<void(DataStore&)> update_func)
+	map<EnumeratorDefinition const*, int64_t> Database::EnumeratorValues(Enum def)
 	{
-		for (auto& [name, store] : mDataStores)
+		map<EnumeratorDefinition const*, int64_t> result;
+		for (auto e : def->Enumerators())
+			result[e] = e->ActualValue();
+		return result;
+	}
+
+	result<void, string> Database::RemapEnumeratorData(Enum def, map<EnumeratorDefinition const*, int64_t> const& old_values, optional<int64_t> removed_value)
+	{
+		map<int64_t, int64_t> value_map;
+		for (auto e : def->Enumerators())
 		{
-			update_func(store);
+			if (auto it = old_values.find(e); it != old_values.end() && it->second != e->ActualValue())
+				value_map[it->second] = e->ActualValue();
 		}
+		if (removed_value)
+			value_map[*removed_value] = def->DefaultEnumerator()->ActualValue();
+
+		if (value_map.empty())
+			return success();
+
+		return UpdateDataStores([&](DataStore& store) {
+			store.RemapEnumeratorValues(def->Name(), value_map, removed_value);
+			});
 	}
 
 	json Database::SaveSchema() const
 	{
 		json result = json::object();
-		result["version"] = 1;
+		result["version"] = 2;
+		result["namespace"] = mSchema.Namespace;
+		result["next_id"] = mSchema.mNextID;
+		result["schema_version"] = mSchema.Version();
+		result["hash"] = mSchema.Hash();
 		{
 			auto& types = result["types"] = json::object();
 			for (auto type : mSchema.Definitions())
@@ -769,11 +993,24 @@ namespace dtmdl
 
 		mSchema.Namespace = get(schema, "namespace", "", jtype::string);
 
+		/// v1 schemas have no type or field IDs; fresh ones are assigned on load
 		auto version = (int)schema.at("version");
-		if (!(version == 1))
+		if (!(version == 1 || version == 2))
 			throw std::runtime_error("invalid schema version number");
 
 		std::erase_if(mSchema.mDefinitions, [](auto& type) { return !type->IsBuiltIn(); });
+		mSchema.mTypeHashes.clear();
+
+		/// The version only changes if the schema loaded below doesn't hash to what it did when it was saved
+		if (auto it = schema.find("schema_version"); it != schema.end())
+			mSchema.mVersion = it->second;
+		if (auto it = schema.find("hash"); it != schema.end())
+			mSchema.mVersionHash = it->second.get<string>();
+		mExportedSchemaHash = mSchema.mVersionHash;
+
+		/// Saved IDs are all below `next_id`, so IDs given out while adding the types below can't collide with them
+		if (auto it = schema.find("next_id"); it != schema.end())
+			mSchema.mNextID = max<uint64_t>(mSchema.mNextID, it->second);
 
 		for (auto&& [name, type] : schema.at("types").get_ref<json::object_t const&>())
 		{
@@ -795,6 +1032,41 @@ namespace dtmdl
 				throw std::runtime_error(format("invalid type defined: {}", name));
 			type_def->FromJSON(typedesc);
 		}
+
+		/// Schemas exported before `next_id` was written have their types added with IDs that the saved ones then replaced
+		for (auto& def : mSchema.mDefinitions)
+		{
+			mSchema.mNextID = max(mSchema.mNextID, def->mID + 1);
+			if (auto record = dynamic_cast<RecordDefinition*>(def.get()))
+			{
+				for (auto& field : record->mFields)
+					mSchema.mNextID = max(mSchema.mNextID, field->ID + 1);
+			}
+		}
+
+		for (auto& def : mSchema.mDefinitions)
+		{
+			if (auto record = dynamic_cast<RecordDefinition*>(def.get()))
+			{
+				for (auto& field : record->mFields)
+				{
+					if (field->ID == 0)
+						field->ID = mSchema.NewID();
+				}
+			}
+		}
+	}
+
+	vector<string> Database::StoresSavedWithOtherSchema() const
+	{
+		auto const hash = mSchema.Hash();
+		vector<string> result;
+		for (auto& [name, store] : mDataStores)
+		{
+			if (!store.SavedWithSchema(hash))
+				result.push_back(name);
+		}
+		return result;
 	}
 
 	json Database::Save() const
@@ -3,6 +3,8 @@
 #include "Schema.h"
 #include "Formats.h"
 #include "DataStore.h"
+#include "StoreValidation.h"
+#include "BackupRepository.h"
 
 namespace dtmdl
 {
@@ -25,6 +27,25 @@ namespace dtmdl
 
 	using TypeUsage = std::variant<TypeUsedInFieldType, TypeIsBaseTypeOf, TypeHasDataInDataStore>;
 
+	struct BlobStore;
+
+	struct DataStoreUpdateReport
+	{
+		string StoreName;
+		chrono::microseconds Duration{};
+		optional<string> Error; /// if set, the update failed for this store, and all stores were rolled back
+	};
+
+	/// How long each phase of opening a database took (see Database::LoadAll)
+	struct DatabaseOpenTimings
+	{
+		chrono::microseconds ParseFiles{}; /// database.json and schema.json, read and parsed concurrently
+		chrono::microseconds ApplySchema{};
+		chrono::microseconds LoadDataStores{}; /// all stores, loaded concurrently
+		vector<pair<string, chrono::microseconds>> DataStores; /// each store on its own, by name
+		chrono::microseconds Total{};
+	};
+
 	string Describe(TypeUsedInFieldType const& usage);
 	string Describe(TypeIsBaseTypeOf const& usage);
 	string Describe(TypeHasDataInDataStore const& usage);
@@ -48,8 +69,9 @@ namespace dtmdl
 
 		//TypeDefinition const* ResolveType(string_view name) const;
 
+		/// Every schema change goes through this, so the schema knows which types' hashes to recalculate
 		template <typename T>
-		inline constexpr static T* mut(T const* v) noexcept { return const_cast<T*>(v); }
+		T* mut(T const* v) const noexcept { mSchema.Invalidate(v); return const_cast<T*>(v); }
 
 		//string FreshTypeName(string_view base) const;
 
@@ -59,8 +81,11 @@ namespace dtmdl
 		result<void, string> ValidateTypeName(Def def, string const& new_name);
 		result<void, string> ValidateFieldName(Fld def, string const& new_name);
 		result<void, string> ValidateEnumeratorName(Enumerator def, string const& new_name);
+		/// Checks the values the enumerators of `def` have now, in case `def` is used as flags (see ValidateFlagsEnum)
+		result<void, string> ValidateEnumeratorValues(Enum def) const;
 		result<void, string> ValidateClassFlags(Cls def, enum_flags<ClassFlags> flags);
 		result<void, string> ValidateFieldFlags(Fld def, enum_flags<FieldFlags> flags) { return success(); }
+		result<void, string> ValidateFieldIndexType(Fld def, IndexKind kind);
 		result<void, string> ValidateStructFlags(Str def, enum_flags<StructFlags> flags);
 
 		vector<TypeUsage> LocateTypeUsages(Def type) const;
@@ -80,6 +105,8 @@ namespace dtmdl
 		result<void, string> SetFieldName(Fld def, string const& new_name);
 		result<void, string> SetFieldType(Fld def, TypeReference const& type);
 		result<void, string> SetFieldFlags(Fld def, enum_flags<FieldFlags> flags);
+		/// Only affects generated tables; see IndexKind
+		result<void, string> SetFieldIndexType(Fld def, IndexKind kind);
 		result<void, string> SetClassFlags(Cls def, enum_flags<ClassFlags> flags);
 		result<void, string> SetStructFlags(Str def, enum_flags<StructFlags> flags);
 
@@ -109,18 +136,35 @@ namespace dtmdl
 		Database(filesystem::path dir);
 
 		void SaveAll();
+		/// Data stores only depend on the schema, so they are loaded concurrently once it's loaded
 		void LoadAll();
-		result<void, string> CreateBackup();
-		result<void, string> CreateBackup(filesystem::path in_directory);
+		/// A bounded step of garbage collection in every data store (see DataStore::CollectGarbage); meant to be called every frame
+		void CollectGarbage();
+		/// Validates every data store against the schema; stores are validated one after another, each in parallel (see ValidateStore)
+		map<string, StoreValidationReport, less<>> ValidateAll() const;
+		/// Backs up the database directory to the deduplicated backup repository in `<in_directory>/backups` (see BackupRepository);
+		/// only the parts of files that changed since earlier backups are stored. Blobs are stored uncompressed, along with
+		/// whatever `options` says.
+		result<BackupReport, string> CreateBackup(BackupOptions options = {});
+		result<BackupReport, string> CreateBackup(filesystem::path in_directory, BackupOptions options = {});
+		/// Rebuilds the database directory as it was in the snapshot, in `target_directory`; `backup_directory` is the one given to CreateBackup
+		static result<void, string> RestoreBackup(filesystem::path const& backup_directory, string_view snapshot, filesystem::path const& target_directory);
 
 		/// Accessors and Queries
 
 		auto const& Directory() const noexcept { return mDirectory; }
 		auto const& Schema() const noexcept { return mSchema; }
 		auto& DataStores() noexcept { return mDataStores; }
+		auto const& LastDataStoreUpdateReport() const noexcept { return mLastDataStoreUpdateReport; }
+		auto const& OpenTimings() const noexcept { return mOpenTimings; }
 
 		auto VoidType() const noexcept { return mSchema.VoidType(); }
 
+		/// What schema.json holds (see JSONSchemaFormat)
+		json SaveSchema() const;
+		/// Names of data stores that were last saved with a different schema than the current one; their data may not match it
+		vector<string> StoresSavedWithOtherSchema() const;
+
 		//string Namespace;
 		string PrivateFieldPrefix = "m";
 
@@ -129,7 +173,10 @@ namespace dtmdl
 		filesystem::path mDirectory;
 		ofstream mChangeLog;
 		dtmdl::Schema mSchema;
+		unique_ptr<BlobStore> mBlobs;
 		map<string, DataStore, less<>> mDataStores;
+		/// Hash of the schema the exported files were generated from; they're only generated again when it changes
+		string mExportedSchemaHash;
 
 		json Save() const;
 		void Load(json const& j);
@@ -139,10 +186,17 @@ namespace dtmdl
 
 		void AddChangeLog(json log);
 
-		json SaveSchema() const;
 		void LoadSchema(json const& from);
 
-		void UpdateDataStores(function<void(DataStore&)> update_func);
+		/// Applies `update_func` to every data store concurrently. It's all or nothing: if the update throws for any store,
+		/// every store is rolled back to its previous state, and the caller must undo its schema change before saving.
+		result<void, string> UpdateDataStores(function<void(DataStore&)> const& update_func);
+		vector<DataStoreUpdateReport> mLastDataStoreUpdateReport;
+		DatabaseOpenTimings mOpenTimings;
+
+		/// Stores keep enum values, not names, so any schema change that changes enumerator values needs to remap the data
+		static map<EnumeratorDefinition const*, int64_t> EnumeratorValues(Enum def);
+		result<void, string> RemapEnumeratorData(Enum def, map<EnumeratorDefinition const*, int64_t> const& old_values, optional<int64_t> removed_value = nullopt);
 	};
 
 }
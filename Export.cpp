@@ -0,0 +1,977 @@
+#include "pch.h"
+
+#include "Export.h"
+#include "DataStore.h"
+#include "Values.h"
+#include "BlobStore.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace dtmdl
+{
+
+	/// Buffers output and hands it to the sink a chunk at a time; once the sink fails, everything else written is dropped
+	struct ChunkedOutput
+	{
+		ChunkedOutput(ExportSink const& sink, size_t chunk_size)
+			: mSink(sink), mChunkSize(max<size_t>(chunk_size, 64))
+		{
+			mBuffer.reserve(mChunkSize);
+		}
+
+		void Put(char c)
+		{
+			mBuffer.push_back(c);
+			if (mBuffer.size() >= mChunkSize)
+				Flush();
+		}
+
+		void Write(string_view data)
+		{
+			/// Big pieces (like blobs) go straight to the sink instead of through the buffer
+			if (data.size() >= mChunkSize)
+			{
+				Flush();
+				Send(data);
+				return;
+			}
+			mBuffer.insert(mBuffer.end(), data.begin(), data.end());
+			if (mBuffer.size() >= mChunkSize)
+				Flush();
+		}
+		void Write(span<uint8_t const> data) { Write(string_view{ reinterpret_cast<char const*>(data.data()), data.size() }); }
+
+		void Fill(char c, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				Put(c);
+		}
+
+		/// Big-endian, as all of the binary formats want
+		template <typename T>
+		void WriteBigEndian(T value)
+		{
+			auto const bits = bit_cast<make_unsigned_t<conditional_t<is_floating_point_v<T>, conditional_t<sizeof(T) == 8, int64_t, int32_t>, T>>>(value);
+			for (size_t i = sizeof(T); i-- > 0;)
+				Put(char(uint8_t(bits >> (i * 8))));
+		}
+
+		void Flush()
+		{
+			Send({ mBuffer.data(), mBuffer.size() });
+			mBuffer.clear();
+		}
+
+		bool Failed() const noexcept { return mError.has_value(); }
+		auto const& Error() const noexcept { return mError; }
+		uint64_t Written() const noexcept { return mWritten; }
+
+	private:
+
+		void Send(string_view data)
+		{
+			if (mError || data.empty())
+				return;
+			if (auto sent = mSink(span{ data.data(), data.size() }); sent.has_error())
+				mError = move(sent).error();
+			else
+				mWritten += data.size();
+		}
+
+		ExportSink const& mSink;
+		size_t mChunkSize;
+		vector<char> mBuffer;
+		uint64_t mWritten = 0;
+		optional<string> mError;
+	};
+
+	/// Writes a stream of values in one of the export formats; container sizes are always known up front
+	struct TokenWriter
+	{
+		explicit TokenWriter(ChunkedOutput& out) : Out(out) {}
+		virtual ~TokenWriter() noexcept = default;
+
+		virtual void Null() = 0;
+		virtual void Bool(bool value) = 0;
+		virtual void Integer(int64_t value) = 0;
+		virtual void Unsigned(uint64_t value) = 0;
+		virtual void Float(double value) = 0;
+		virtual void String(string_view value) = 0;
+		virtual void Binary(span<uint8_t const> value) = 0;
+		virtual void BeginArray(size_t size) = 0;
+		virtual void EndArray() = 0;
+		virtual void BeginObject(size_t size) = 0;
+		virtual void Key(string_view key) = 0;
+		virtual void EndObject() = 0;
+
+		ChunkedOutput& Out;
+	};
+
+	struct JSONWriter : TokenWriter
+	{
+		JSONWriter(ChunkedOutput& out, int indent) : TokenWriter(out), mIndent(indent) {}
+
+		virtual void Null() override { Prefix(); Out.Write("null"); }
+		virtual void Bool(bool value) override { Prefix(); Out.Write(value ? "true" : "false"); }
+		virtual void Integer(int64_t value) override { Prefix(); Number(value); }
+		virtual void Unsigned(uint64_t value) override { Prefix(); Number(value); }
+		virtual void Float(double value) override
+		{
+			Prefix();
+			/// Same as nlohmann::json: non-finite numbers become null, and whole numbers keep a ".0" so they are read back as floats
+			if (!isfinite(value))
+			{
+				Out.Write("null");
+				return;
+			}
+			char buffer[32];
+			auto const last = to_chars(begin(buffer), end(buffer), value).ptr;
+			auto const text = string_view{ buffer, size_t(last - buffer) };
+			Out.Write(text);
+			if (text.find_first_of(".e") == string_view::npos)
+				Out.Write(".0");
+		}
+		virtual void String(string_view value) override { Prefix(); Escaped(value); }
+		virtual void Binary(span<uint8_t const> value) override
+		{
+			/// As nlohmann::json writes binary values
+			Prefix();
+			Out.Write("{\"bytes\":[");
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				if (i)
+					Out.Put(',');
+				Number(value[i]);
+			}
+			Out.Write("],\"subtype\":null}");
+		}
+		virtual void BeginArray(size_t) override { Prefix(); Out.Put('['); mEmpty.push_back(true); }
+		virtual void EndArray() override { End(']'); }
+		virtual void BeginObject(size_t) override { Prefix(); Out.Put('{'); mEmpty.push_back(true); }
+		virtual void Key(string_view key) override
+		{
+			Prefix();
+			Escaped(key);
+			Out.Put(':');
+			if (mIndent >= 0)
+				Out.Put(' ');
+			mAfterKey = true;
+		}
+		virtual void EndObject() override { End('}'); }
+
+	private:
+
+		int mIndent = -1;
+		vector<bool> mEmpty; /// for each open container
+		bool mAfterKey = false;
+
+		void NewLine()
+		{
+			if (mIndent < 0)
+				return;
+			Out.Put('\n');
+			Out.Fill(' ', mEmpty.size() * size_t(mIndent));
+		}
+
+		void Prefix()
+		{
+			if (exchange(mAfterKey, false) || mEmpty.empty())
+				return;
+			if (!mEmpty.back())
+				Out.Put(',');
+			mEmpty.back() = false;
+			NewLine();
+		}
+
+		void End(char bracket)
+		{
+			auto const empty = mEmpty.back();
+			mEmpty.pop_back();
+			if (!empty)
+				NewLine();
+			Out.Put(bracket);
+		}
+
+		template <typename T>
+		void Number(T value)
+		{
+			char buffer[24];
+			auto const last = to_chars(begin(buffer), end(buffer), value).ptr;
+			Out.Write(string_view{ buffer, size_t(last - buffer) });
+		}
+
+		void Escaped(string_view value)
+		{
+			static constexpr char digits[] = "0123456789abcdef";
+			Out.Put('"');
+			for (auto c : value)
+			{
+				switch (c)
+				{
+				case '"': Out.Write("\\\""); break;
+				case '\\': Out.Write("\\\\"); break;
+				case '\b': Out.Write("\\b"); break;
+				case '\f': Out.Write("\\f"); break;
+				case '\n': Out.Write("\\n"); break;
+				case '\r': Out.Write("\\r"); break;
+				case '\t': Out.Write("\\t"); break;
+				default:
+					if (uint8_t(c) < 0x20)
+					{
+						Out.Write("\\u00");
+						Out.Put(digits[uint8_t(c) >> 4]);
+						Out.Put(digits[uint8_t(c) & 0xF]);
+					}
+					else
+						Out.Put(c);
+				}
+			}
+			Out.Put('"');
+		}
+	};
+
+	struct UBJSONWriter : TokenWriter
+	{
+		using TokenWriter::TokenWriter;
+
+		virtual void Null() override { Out.Put('Z'); }
+		virtual void Bool(bool value) override { Out.Put(value ? 'T' : 'F'); }
+		virtual void Integer(int64_t value) override
+		{
+			if (value >= numeric_limits<int8_t>::min() && value <= numeric_limits<int8_t>::max()) { Out.Put('i'); Out.WriteBigEndian(int8_t(value)); }
+			else if (value >= 0 && value <= numeric_limits<uint8_t>::max()) { Out.Put('U'); Out.WriteBigEndian(uint8_t(value)); }
+			else if (value >= numeric_limits<int16_t>::min() && value <= numeric_limits<int16_t>::max()) { Out.Put('I'); Out.WriteBigEndian(int16_t(value)); }
+			else if (value >= numeric_limits<int32_t>::min() && value <= numeric_limits<int32_t>::max()) { Out.Put('l'); Out.WriteBigEndian(int32_t(value)); }
+			else { Out.Put('L'); Out.WriteBigEndian(value); }
+		}
+		virtual void Unsigned(uint64_t value) override
+		{
+			if (value <= uint64_t(numeric_limits<int64_t>::max()))
+				return Integer(int64_t(value));
+			/// Too big for any UBJSON integer type
+			auto const digits = to_string(value);
+			Out.Put('H');
+			Integer(int64_t(digits.size()));
+			Out.Write(digits);
+		}
+		virtual void Float(double value) override { Out.Put('D'); Out.WriteBigEndian(value); }
+		virtual void String(string_view value) override { Out.Put('S'); Key(value); }
+		virtual void Binary(span<uint8_t const> value) override
+		{
+			/// A strongly-typed array of uint8
+			Out.Write("[$U#");
+			Integer(int64_t(value.size()));
+			Out.Write(value);
+		}
+		virtual void BeginArray(size_t) override { Out.Put('['); }
+		virtual void EndArray() override { Out.Put(']'); }
+		virtual void BeginObject(size_t) override { Out.Put('{'); }
+		virtual void Key(string_view key) override
+		{
+			Integer(int64_t(key.size()));
+			Out.Write(key);
+		}
+		virtual void EndObject() override { Out.Put('}'); }
+	};
+
+	struct CBORWriter : TokenWriter
+	{
+		using TokenWriter::TokenWriter;
+
+		virtual void Null() override { Out.Put(char(0xF6)); }
+		virtual void Bool(bool value) override { Out.Put(char(value ? 0xF5 : 0xF4)); }
+		virtual void Integer(int64_t value) override
+		{
+			if (value >= 0)
+				Head(0, uint64_t(value));
+			else
+				Head(1, uint64_t(-1 - value));
+		}
+		virtual void Unsigned(uint64_t value) override { Head(0, value); }
+		virtual void Float(double value) override { Out.Put(char(0xFB)); Out.WriteBigEndian(value); }
+		virtual void String(string_view value) override { Head(3, value.size()); Out.Write(value); }
+		virtual void Binary(span<uint8_t const> value) override { Head(2, value.size()); Out.Write(value); }
+		virtual void BeginArray(size_t size) override { Head(4, size); }
+		virtual void EndArray() override {}
+		virtual void BeginObject(size_t size) override { Head(5, size); }
+		virtual void Key(string_view key) override { String(key); }
+		virtual void EndObject() override {}
+
+	private:
+
+		void Head(uint8_t major, uint64_t argument)
+		{
+			major <<= 5;
+			if (argument < 24) Out.Put(char(major | argument));
+			else if (argument <= 0xFF) { Out.Put(char(major | 24)); Out.WriteBigEndian(uint8_t(argument)); }
+			else if (argument <= 0xFFFF) { Out.Put(char(major | 25)); Out.WriteBigEndian(uint16_t(argument)); }
+			else if (argument <= 0xFFFFFFFF) { Out.Put(char(major | 26)); Out.WriteBigEndian(uint32_t(argument)); }
+			else { Out.Put(char(major | 27)); Out.WriteBigEndian(argument); }
+		}
+	};
+
+	struct MessagePackWriter : TokenWriter
+	{
+		using TokenWriter::TokenWriter;
+
+		virtual void Null() override { Out.Put(char(0xC0)); }
+		virtual void Bool(bool value) override { Out.Put(char(value ? 0xC3 : 0xC2)); }
+		virtual void Integer(int64_t value) override
+		{
+			if (value >= 0) Unsigned(uint64_t(value));
+			else if (value >= -32) Out.Put(char(int8_t(value)));
+			else if (value >= numeric_limits<int8_t>::min()) { Out.Put(char(0xD0)); Out.WriteBigEndian(int8_t(value)); }
+			else if (value >= numeric_limits<int16_t>::min()) { Out.Put(char(0xD1)); Out.WriteBigEndian(int16_t(value)); }
+			else if (value >= numeric_limits<int32_t>::min()) { Out.Put(char(0xD2)); Out.WriteBigEndian(int32_t(value)); }
+			else { Out.Put(char(0xD3)); Out.WriteBigEndian(value); }
+		}
+		virtual void Unsigned(uint64_t value) override
+		{
+			if (value <= 0x7F) Out.Put(char(value));
+			else if (value <= 0xFF) { Out.Put(char(0xCC)); Out.WriteBigEndian(uint8_t(value)); }
+			else if (value <= 0xFFFF) { Out.Put(char(0xCD)); Out.WriteBigEndian(uint16_t(value)); }
+			else if (value <= 0xFFFFFFFF) { Out.Put(char(0xCE)); Out.WriteBigEndian(uint32_t(value)); }
+			else { Out.Put(char(0xCF)); Out.WriteBigEndian(value); }
+		}
+		virtual void Float(double value) override { Out.Put(char(0xCB)); Out.WriteBigEndian(value); }
+		virtual void String(string_view value) override
+		{
+			if (value.size() < 32) Out.Put(char(0xA0 | value.size()));
+			else Size(value.size(), 0xD9, 0xDA, 0xDB);
+			Out.Write(value);
+		}
+		virtual void Binary(span<uint8_t const> value) override
+		{
+			Size(value.size(), 0xC4, 0xC5, 0xC6);
+			Out.Write(value);
+		}
+		virtual void BeginArray(size_t size) override
+		{
+			if (size < 16) Out.Put(char(0x90 | size));
+			else Size(size, 0, 0xDC, 0xDD);
+		}
+		virtual void EndArray() override {}
+		virtual void BeginObject(size_t size) override
+		{
+			if (size < 16) Out.Put(char(0x80 | size));
+			else Size(size, 0, 0xDE, 0xDF);
+		}
+		virtual void Key(string_view key) override { String(key); }
+		virtual void EndObject() override {}
+
+	private:
+
+		/// `marker8` is 0 for containers, which have no 8-bit size
+		void Size(size_t size, uint8_t marker8, uint8_t marker16, uint8_t marker32)
+		{
+			if (marker8 && size <= 0xFF) { Out.Put(char(marker8)); Out.WriteBigEndian(uint8_t(size)); }
+			else if (size <= 0xFFFF) { Out.Put(char(marker16)); Out.WriteBigEndian(uint16_t(size)); }
+			else { Out.Put(char(marker32)); Out.WriteBigEndian(uint32_t(size)); }
+		}
+	};
+
+	static unique_ptr<TokenWriter> MakeWriter(ExportOptions const& options, ChunkedOutput& out)
+	{
+		switch (options.Format)
+		{
+		case ExportFormat::UBJSON: return make_unique<UBJSONWriter>(out);
+		case ExportFormat::CBOR: return make_unique<CBORWriter>(out);
+		case ExportFormat::MessagePack: return make_unique<MessagePackWriter>(out);
+		default: return make_unique<JSONWriter>(out, options.Indent);
+		}
+	}
+
+	/// Walks stored values, converting them to their export form on the way out (like ResolveEnumNames and ResolveFieldNames do), inlining blobs
+	struct ValueExporter
+	{
+		Schema const& StoreSchema;
+		BlobStore& Blobs;
+		TokenWriter& Writer;
+		optional<string> Error;
+
+		bool Failed() const { return Error || Writer.Out.Failed(); }
+
+		void WriteRaw(json const& value)
+		{
+			switch (value.type())
+			{
+			case json::value_t::boolean: return Writer.Bool(value.get<bool>());
+			case json::value_t::number_integer: return Writer.Integer(value.get<int64_t>());
+			case json::value_t::number_unsigned: return Writer.Unsigned(value.get<uint64_t>());
+			case json::value_t::number_float: return Writer.Float(value.get<double>());
+			case json::value_t::string: return Writer.String(value.get_ref<json::string_t const&>());
+			case json::value_t::binary: return Writer.Binary(value.get_binary());
+			case json::value_t::array:
+				Writer.BeginArray(value.size());
+				for (auto& element : value)
+					WriteRaw(element);
+				return Writer.EndArray();
+			case json::value_t::object:
+				Writer.BeginObject(value.size());
+				for (auto& [key, element] : value.items())
+				{
+					Writer.Key(key);
+					WriteRaw(element);
+				}
+				return Writer.EndObject();
+			default:
+				return Writer.Null();
+			}
+		}
+
+		static TypeReference const* Argument(TypeReference const& type, size_t index)
+		{
+			return index < type.TemplateArguments.size() ? get_if<TypeReference>(&type.TemplateArguments[index]) : nullptr;
+		}
+
+		void Write(TypeReference const& type, json const& value)
+		{
+			if (Failed())
+				return;
+			if (!type)
+				return WriteRaw(value);
+
+			if (auto enoom = type->AsEnum(); enoom && value.is_number_integer())
+			{
+				if (auto enumerator = enoom->EnumeratorByValue(value.get<int64_t>()))
+					return Writer.String(enumerator->Name);
+				return WriteRaw(value);
+			}
+
+			if (auto record = type->AsRecord(); record && value.is_object())
+			{
+				Writer.BeginObject(value.size());
+				for (auto& [key, field_value] : value.items())
+				{
+					auto field = record->OwnOrBaseFieldByKey(key);
+					Writer.Key(field ? string_view{ field->Name } : string_view{ key });
+					Write(field ? field->FieldType : TypeReference{}, field_value);
+				}
+				return Writer.EndObject();
+			}
+
+			if (!type->IsBuiltIn())
+				return WriteRaw(value);
+
+			auto const& name = type->Name();
+			if (name == "flags" && value.is_number_integer())
+			{
+				auto enum_type = Argument(type, 0);
+				auto enoom = enum_type && *enum_type ? (*enum_type)->AsEnum() : nullptr;
+				if (!enoom)
+					return WriteRaw(value);
+				auto names = FlagNames(enoom, value.get<uint64_t>());
+				Writer.BeginArray(names.size());
+				for (auto& flag_name : names)
+					Writer.String(flag_name);
+				return Writer.EndArray();
+			}
+
+			if (name == "bytes" && BlobStore::IsReference(value))
+			{
+				/// Straight from the mapped blob file
+				auto mapped = Blobs.Get(BlobStore::ReferencedHash(value));
+				if (mapped.has_error())
+				{
+					Error = move(mapped).error();
+					return;
+				}
+				return Writer.Binary(mapped.value()->Data());
+			}
+
+			if ((name == "list" || name == "array") && value.is_array())
+			{
+				auto element_type = Argument(type, 0);
+				Writer.BeginArray(value.size());
+				for (auto& element : value)
+					Write(element_type ? *element_type : TypeReference{}, element);
+				return Writer.EndArray();
+			}
+
+			if (name == "map" && value.is_object())
+			{
+				auto value_type = Argument(type, 1);
+				Writer.BeginObject(value.size());
+				for (auto& [key, element] : value.items())
+				{
+					Writer.Key(key);
+					Write(value_type ? *value_type : TypeReference{}, element);
+				}
+				return Writer.EndObject();
+			}
+
+			if (name == "variant" && value.is_array() && value.size() == 2 && value[0].is_number_integer())
+			{
+				auto alternative = Argument(type, value[0].get<size_t>());
+				Writer.BeginArray(2);
+				WriteRaw(value[0]);
+				Write(alternative ? *alternative : TypeReference{}, value[1]);
+				return Writer.EndArray();
+			}
+
+			WriteRaw(value);
+		}
+
+		/// { "type": ..., "value": ... }
+		void WriteRoot(json const& root)
+		{
+			auto const type = TypeFromStorageJSON(StoreSchema, root.at("type"));
+			Writer.BeginObject(2);
+			Writer.Key("type");
+			WriteRaw(ToJSON(type));
+			Writer.Key("value");
+			Write(type, root.at("value"));
+			Writer.EndObject();
+		}
+
+		void WriteTable(Table const& table)
+		{
+			auto const type = TypeReference{ table.Record() };
+			Writer.BeginArray(table.RowCount());
+			for (size_t i = 0; i < table.RowCount() && !Failed(); ++i)
+				Write(type, table.Row(i));
+			Writer.EndArray();
+		}
+
+		result<uint64_t, string> Finish()
+		{
+			if (!Error)
+				Writer.Out.Flush();
+			if (Error)
+				return failure(move(*Error));
+			if (auto& error = Writer.Out.Error())
+				return failure(*error);
+			return Writer.Out.Written();
+		}
+	};
+
+	/// Counts what BinaryValueWriter would write, so the sections of a binary store can be prefixed with their size without buffering them
+	struct ByteCounter
+	{
+		uint64_t Count = 0;
+
+		void Put(char) { ++Count; }
+		void Write(string_view data) { Count += data.size(); }
+		void Write(span<uint8_t const> data) { Count += data.size(); }
+	};
+
+	/// Writes stored values in ExportFormat::Binary (see Export.h), to a ChunkedOutput or a ByteCounter.
+	/// Unlike the other formats, this one has no names or markers, so values are always written whole, in the shape of their type:
+	/// fields that are missing (and values of the wrong kind) are written as their defaults.
+	template <typename OUTPUT>
+	struct BinaryValueWriter
+	{
+		static constexpr uint8_t FormatVersion = 1;
+		enum class Content : uint8_t { Value = 0, Store = 1 };
+
+		BlobStore& Blobs;
+		OUTPUT& Out;
+		optional<string> Error;
+
+		void Varint(uint64_t value)
+		{
+			while (value >= 0x80)
+			{
+				Out.Put(char(uint8_t(value) | 0x80));
+				value >>= 7;
+			}
+			Out.Put(char(value));
+		}
+
+		void Signed(int64_t value) { Varint((uint64_t(value) << 1) ^ uint64_t(value >> 63)); }
+
+		template <typename T>
+		void Fixed(T value)
+		{
+			auto const bits = bit_cast<make_unsigned_t<conditional_t<is_floating_point_v<T>, conditional_t<sizeof(T) == 8, int64_t, int32_t>, T>>>(value);
+			for (size_t i = 0; i < sizeof(T); ++i)
+				Out.Put(char(uint8_t(bits >> (i * 8))));
+		}
+
+		void String(string_view value)
+		{
+			Varint(value.size());
+			Out.Write(value);
+		}
+
+		void Header(Content content, string_view schema_hash)
+		{
+			Out.Write("DTMB");
+			Out.Put(char(FormatVersion));
+			Out.Put(char(content));
+			String(schema_hash);
+		}
+
+		void Default(TypeReference const& type)
+		{
+			/// InitializeValue doesn't do records, but an empty object is all missing fields
+			if (type->AsRecord())
+				return Write(type, json::object());
+			json value;
+			if (auto initialized = InitializeValue(type, value); initialized.has_error())
+			{
+				Error = format("could not write a default {}: {}", type.ToString(), initialized.error());
+				return;
+			}
+			Write(type, value);
+		}
+
+		void Bytes(json const& value)
+		{
+			if (BlobStore::IsReference(value))
+			{
+				auto const size = value.at("size").get<uint64_t>();
+				Varint(size);
+				if constexpr (is_same_v<OUTPUT, ByteCounter>)
+				{
+					/// Counting doesn't need the data
+					Out.Count += size;
+				}
+				else
+				{
+					auto mapped = Blobs.Get(BlobStore::ReferencedHash(value));
+					if (mapped.has_error())
+					{
+						Error = move(mapped).error();
+						return;
+					}
+					if (mapped.value()->Data().size() != size)
+					{
+						Error = format("blob {} is not the size it's referenced with", BlobStore::ReferencedHash(value));
+						return;
+					}
+					Out.Write(mapped.value()->Data());
+				}
+				return;
+			}
+			auto const& data = value.get_binary();
+			Varint(data.size());
+			Out.Write(span<uint8_t const>{ data.data(), data.size() });
+		}
+
+		/// Map keys are stored as strings; keys of other types are parsed back into their values first
+		void MapKey(TypeReference const* key_type, string const& key)
+		{
+			if (!key_type || !*key_type || (*key_type)->Name() == "string")
+				return String(key);
+			auto value = json::parse(key, nullptr, false);
+			Write(*key_type, value.is_discarded() ? json(key) : value);
+		}
+
+		/// vec2 to bvec4; components are 4 bytes (8 for dvec, 1 for bvec)
+		void Vector(string_view name, json const& value)
+		{
+			auto const size = size_t(name.back() - '0');
+			for (size_t i = 0; i < size; ++i)
+			{
+				auto const& component = i < value.size() && value[i].is_primitive() ? value[i] : json(0);
+				switch (name.front())
+				{
+				case 'd': Fixed(component.is_number() ? component.get<double>() : 0.0); break;
+				case 'i': Fixed(component.is_number() ? component.get<int32_t>() : 0); break;
+				case 'u': Fixed(component.is_number() ? component.get<uint32_t>() : 0u); break;
+				case 'b': Out.Put(char(component.is_boolean() ? component.get<bool>() : component.is_number() && component.get<double>() != 0)); break;
+				default: Fixed(component.is_number() ? component.get<float>() : 0.0f); break;
+				}
+			}
+		}
+
+		void Write(TypeReference const& type, json const& value)
+		{
+			if (Error)
+				return;
+			if (!type)
+			{
+				Error = "values without a type can't be written in the binary format";
+				return;
+			}
+
+			if (type->AsEnum())
+			{
+				if (!value.is_number_integer())
+					return Default(type);
+				return Signed(value.get<int64_t>());
+			}
+
+			if (auto record = type->AsRecord())
+			{
+				if (!value.is_object())
+					return Default(type);
+				for (auto field : record->AllFieldsOrdered())
+				{
+					if (field->Flags.contain(FieldFlags::Transient) || field->Flags.contain(FieldFlags::NoSerialize))
+						continue;
+					if (auto it = value.find(field->StorageKey()); it != value.end())
+						Write(field->FieldType, *it);
+					else
+						Default(field->FieldType);
+				}
+				return;
+			}
+
+			auto const& name = type->Name();
+			if (name == "void")
+				return;
+			if (name == "bool")
+				return value.is_boolean() ? Out.Put(char(value.get<bool>())) : Default(type);
+			if (name == "json")
+				return String(value.dump());
+			if (name == "string")
+				return value.is_string() ? String(value.get_ref<json::string_t const&>()) : Default(type);
+			if (name == "bytes")
+				return value.is_binary() || BlobStore::IsReference(value) ? Bytes(value) : Default(type);
+			if (name == "ref" || name == "own")
+				return Varint(value.is_number_integer() && value.get<int64_t>() > 0 ? value.get<uint64_t>() : 0);
+			if (name.ends_with("vec2") || name.ends_with("vec3") || name.ends_with("vec4"))
+				return value.is_array() ? Vector(name, value) : Default(type);
+
+			if (name == "i8" || name == "u8" || name == "i16" || name == "i32" || name == "i64" || name == "u16" || name == "u32" || name == "u64" || name == "f32" || name == "f64" || name == "flags")
+			{
+				if (!value.is_number())
+					return Default(type);
+				if (name == "i8") return Out.Put(char(value.get<int8_t>()));
+				if (name == "u8") return Out.Put(char(value.get<uint8_t>()));
+				if (name == "f32") return Fixed(value.get<float>());
+				if (name == "f64") return Fixed(value.get<double>());
+				if (name.front() == 'i') return Signed(value.get<int64_t>());
+				return Varint(value.get<uint64_t>());
+			}
+
+			if (name == "list")
+			{
+				if (!value.is_array())
+					return Default(type);
+				auto element_type = ValueExporter::Argument(type, 0);
+				Varint(value.size());
+				for (auto& element : value)
+					Write(element_type ? *element_type : TypeReference{}, element);
+				return;
+			}
+
+			if (name == "array")
+			{
+				if (!value.is_array())
+					return Default(type);
+				/// Always exactly as many elements as the type says
+				auto element_type = ValueExporter::Argument(type, 0);
+				auto const size = get<uint64_t>(type.TemplateArguments.at(1));
+				for (size_t i = 0; i < size; ++i)
+				{
+					if (i < value.size())
+						Write(element_type ? *element_type : TypeReference{}, value[i]);
+					else if (element_type)
+						Default(*element_type);
+				}
+				return;
+			}
+
+			if (name == "map")
+			{
+				if (!value.is_object())
+					return Default(type);
+				auto key_type = ValueExporter::Argument(type, 0);
+				auto value_type = ValueExporter::Argument(type, 1);
+				Varint(value.size());
+				for (auto& [key, element] : value.items())
+				{
+					MapKey(key_type, key);
+					Write(value_type ? *value_type : TypeReference{}, element);
+				}
+				return;
+			}
+
+			if (name == "variant")
+			{
+				auto alternative = value.is_array() && value.size() == 2 && value[0].is_number_integer() && value[0].get<int64_t>() >= 0 ? ValueExporter::Argument(type, value[0].get<size_t>()) : nullptr;
+				if (!alternative)
+					return Default(type);
+				Varint(value[0].get<uint64_t>());
+				return Write(*alternative, value[1]);
+			}
+
+			Error = format("type {} can't be written in the binary format", type.ToString());
+		}
+	};
+
+	/// The counting pass works out the size, so the section can be written straight from the store's data, like the other formats
+	template <typename FUNC>
+	static void WriteBinarySection(BinaryValueWriter<ChunkedOutput>& writer, FUNC&& write_func)
+	{
+		ByteCounter counter;
+		BinaryValueWriter<ByteCounter> counting{ writer.Blobs, counter };
+		write_func(counting);
+		if (counting.Error)
+		{
+			writer.Error = move(counting.Error);
+			return;
+		}
+		writer.Varint(counter.Count);
+		write_func(writer);
+	}
+
+	static result<uint64_t, string> FinishBinary(BinaryValueWriter<ChunkedOutput>& writer)
+	{
+		if (!writer.Error)
+			writer.Out.Flush();
+		if (writer.Error)
+			return failure(move(*writer.Error));
+		if (auto& error = writer.Out.Error())
+			return failure(*error);
+		return writer.Out.Written();
+	}
+
+	static result<uint64_t, string> ExportBinaryValue(DataStore const& store, json const& root, ExportSink const& sink, ExportOptions const& options)
+	{
+		ChunkedOutput output{ sink, options.ChunkSize };
+		BinaryValueWriter<ChunkedOutput> writer{ store.Blobs(), output };
+		writer.Header(BinaryValueWriter<ChunkedOutput>::Content::Value, store.Schema().Hash());
+		writer.Write(TypeFromStorageJSON(store.Schema(), root.at("type")), root.at("value"));
+		return FinishBinary(writer);
+	}
+
+	static result<uint64_t, string> ExportBinaryStore(DataStore const& store, ExportSink const& sink, ExportOptions const& options)
+	{
+		ChunkedOutput output{ sink, options.ChunkSize };
+		BinaryValueWriter<ChunkedOutput> writer{ store.Blobs(), output };
+		writer.Header(BinaryValueWriter<ChunkedOutput>::Content::Store, store.Schema().Hash());
+
+		auto& roots = store.Roots();
+		writer.Varint(roots.size());
+		for (auto& [name, root] : roots)
+		{
+			if (writer.Error || output.Failed())
+				break;
+			auto const type = TypeFromStorageJSON(store.Schema(), root->at("type"));
+			writer.String(name);
+			writer.String(ToJSON(type).dump());
+			WriteBinarySection(writer, [&](auto& section) { section.Write(type, root->at("value")); });
+		}
+
+		writer.Varint(store.Tables().size());
+		for (auto& [record, table] : store.Tables())
+		{
+			if (writer.Error || output.Failed())
+				break;
+			auto const type = TypeReference{ record };
+			writer.String(record->Name());
+			writer.Varint(table->RowCount());
+			WriteBinarySection(writer, [&](auto& section) {
+				for (size_t i = 0; i < table->RowCount() && !section.Error; ++i)
+					section.Write(type, table->Row(i));
+			});
+		}
+
+		return FinishBinary(writer);
+	}
+
+	ExportSink FileDescriptorSink(int fd)
+	{
+		return [fd](span<char const> data) -> result<void, string> {
+			while (!data.empty())
+			{
+#ifdef _WIN32
+				auto const written = ::_write(fd, data.data(), unsigned(min<size_t>(data.size(), numeric_limits<int>::max())));
+#else
+				auto const written = ::write(fd, data.data(), data.size());
+#endif
+				if (written < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					return failure(format("could not write to file descriptor {}: {}", fd, generic_category().message(errno)));
+				}
+				data = data.subspan(size_t(written));
+			}
+			return success();
+		};
+	}
+
+	ExportSink StreamSink(ostream& stream)
+	{
+		return [&stream](span<char const> data) -> result<void, string> {
+			if (!stream.write(data.data(), streamsize(data.size())))
+				return failure("could not write to stream");
+			return success();
+		};
+	}
+
+	result<uint64_t, string> ExportValue(DataStore const& store, string_view name, ExportSink const& sink, ExportOptions const& options)
+	{
+		auto const root = store.Root(name);
+		if (!root)
+			return failure(format("no value named '{}'", name));
+		if (options.Format == ExportFormat::Binary)
+			return ExportBinaryValue(store, *root, sink, options);
+
+		ChunkedOutput output{ sink, options.ChunkSize };
+		auto writer = MakeWriter(options, output);
+		ValueExporter exporter{ store.Schema(), store.Blobs(), *writer };
+		exporter.WriteRoot(*root);
+		return exporter.Finish();
+	}
+
+	result<uint64_t, string> ExportStore(DataStore const& store, ExportSink const& sink, ExportOptions const& options)
+	{
+		if (options.Format == ExportFormat::Binary)
+			return ExportBinaryStore(store, sink, options);
+
+		ChunkedOutput output{ sink, options.ChunkSize };
+		auto writer = MakeWriter(options, output);
+		ValueExporter exporter{ store.Schema(), store.Blobs(), *writer };
+
+		auto& roots = store.Roots();
+		writer->BeginObject(2);
+		writer->Key("roots");
+		writer->BeginObject(roots.size());
+		for (auto& [name, root] : roots)
+		{
+			if (exporter.Failed())
+				break;
+			writer->Key(name);
+			exporter.WriteRoot(*root);
+		}
+		writer->EndObject();
+
+		writer->Key("tables");
+		writer->BeginObject(store.Tables().size());
+		for (auto& [record, table] : store.Tables())
+		{
+			if (exporter.Failed())
+				break;
+			writer->Key(record->Name());
+			exporter.WriteTable(*table);
+		}
+		writer->EndObject();
+		writer->EndObject();
+
+		return exporter.Finish();
+	}
+
+	template <typename FUNC>
+	static result<uint64_t, string> ExportToFile(filesystem::path const& path, FUNC&& export_func)
+	{
+		ofstream file{ path, ios::binary };
+		if (!file)
+			return failure(format("could not open '{}' for writing", path.string()));
+		auto result = export_func(StreamSink(file));
+		file.close();
+		if (result.has_value() && !file)
+			return failure(format("could not write '{}'", path.string()));
+		return result;
+	}
+
+	result<uint64_t, string> ExportValueToFile(DataStore const& store, string_view name, filesystem::path const& path, ExportOptions const& options)
+	{
+		return ExportToFile(path, [&](ExportSink const& sink) { return ExportValue(store, name, sink, options); });
+	}
+
+	result<uint64_t, string> ExportStoreToFile(DataStore const& store, filesystem::path const& path, ExportOptions const& options)
+	{
+		return ExportToFile(path, [&](ExportSink const& sink) { return ExportStore(store, sink, options); });
+	}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+namespace dtmdl
+{
+	struct DataStore;
+
+	enum class ExportFormat
+	{
+		JSON,
+		UBJSON,
+		CBOR,
+		MessagePack,
+		/// Compact and schema-bound, for the game to load with the generated binary.hpp (see CppBinaryFormat) without going through JSON.
+		/// Little endian. A header of "DTMB", a format version byte, a content byte (0 for a value, 1 for a store) and the schema hash
+		/// (as a string) comes first. Then, by type:
+		///   bool, i8, u8: 1 byte; other integers: LEB128 varints, zigzag-encoded if signed; f32, f64: 4 and 8 bytes
+		///   enums: the zigzag varint of the enumerator's value; flags: the varint of the bitmask
+		///   string, bytes, json (as JSON text): a varint size, then the bytes
+		///   list, map: a varint count, then the elements (or keys and values); array: just its elements
+		///   variant: the varint index of the alternative, then its value; ref, own: the varint object ID, 0 for null
+		///   vecN: N components of 4 bytes (1 for bool, 8 for dvec)
+		///   records: their fields in declaration order, base fields first, without Transient and NoSerialize fields; missing ones get their defaults
+		/// A value is exported as the header and the value. A store is exported as the header, then a varint count of roots, each
+		/// with its name, its type (as JSON text), a varint size and the value, then a varint count of tables, each with its
+		/// record name, a varint row count, a varint size and the rows. The sizes let a reader skip what it doesn't need.
+		Binary,
+	};
+
+	struct ExportOptions
+	{
+		ExportFormat Format = ExportFormat::JSON;
+		/// Only for JSON; negative means no pretty-printing
+		int Indent = -1;
+		/// Output is handed to the sink in chunks of about this size
+		size_t ChunkSize = 1024 * 1024;
+	};
+
+	/// Receives the exported data, one chunk at a time
+	using ExportSink = function<result<void, string>(span<char const>)>;
+
+	ExportSink FileDescriptorSink(int fd);
+	ExportSink StreamSink(ostream& stream);
+
+	/// Exports a root value as { "type": ..., "value": ... }, with field and enumerator names and blobs inlined.
+	/// The output is written straight from the store's data as it is walked, without copying it; blobs are written from their mapped files.
+	/// Returns the number of bytes written. Exporting a snapshot (see DataStore::Snapshot) lets this run on another thread while the store keeps changing.
+	result<uint64_t, string> ExportValue(DataStore const& store, string_view name, ExportSink const& sink, ExportOptions const& options = {});
+	/// Exports all roots, as { "roots": { name: { "type": ..., "value": ... } }, "tables": { struct name: [rows...] } }
+	/// (ExportFormat::Binary lays both of these out as described there)
+	result<uint64_t, string> ExportStore(DataStore const& store, ExportSink const& sink, ExportOptions const& options = {});
+
+	result<uint64_t, string> ExportValueToFile(DataStore const& store, string_view name, filesystem::path const& path, ExportOptions const& options = {});
+	result<uint64_t, string> ExportStoreToFile(DataStore const& store, filesystem::path const& path, ExportOptions const& options = {});
+}
@@ -41,6 +41,19 @@ namespace dtmdl
 		template <typename... ARGS>
 		void WriteEnd(string_view fmt, ARGS&&... args) { Unindent(); WriteLine(fmt, forward<ARGS>(args)...); }
 
+		/// Writes the lines of `text` as they are, without formatting them, at the current indentation
+		void WriteVerbatim(string_view text)
+		{
+			string_ops::split(text, "\n", [this](string_view line, bool) {
+				if (!line.empty())
+				{
+					WriteIndent();
+					OutStream << line;
+				}
+				Nl();
+			});
+		}
+
 		void Nl() { OutStream << "\n"; NewLine = true; }
 
 		void Indent() { Indentation++; }
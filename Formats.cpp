@@ -21,26 +21,7 @@ namespace dtmdl
 
 	string JSONSchemaFormat::Export(Database const& db)
 	{
-		json result = json::object();
-		result["version"] = 1;
-		result["namespace"] = db.Schema().Namespace;
-		{
-			auto& types = result["types"] = json::object();
-			for (auto type : db.UserDefinitions())
-			{
-				types[type->Name()] = magic_enum::enum_name(type->Type());
-			}
-		}
-
-		{
-			auto& types = result["typedesc"] = json::object();
-			for (auto type : db.UserDefinitions())
-			{
-				types[type->Name()] = type->ToJSON();
-			}
-		}
-
-		return result.dump(2);
+		return db.SaveSchema().dump(2);
 	}
 
 	string MemberName(Database const& db, FieldDefinition const* def)
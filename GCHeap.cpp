@@ -0,0 +1,167 @@
+#include "pch.h"
+
+#include "GCHeap.h"
+
+namespace dtmdl
+{
+
+	HeapObject const* GCHeap::Find(uint64_t id) const noexcept
+	{
+		auto const page = id / PageSize;
+		if (page >= mPages.size() || !mPages[page])
+			return nullptr;
+		auto& slot = mPages[page]->Slots[id % PageSize];
+		return slot ? &*slot : nullptr;
+	}
+
+	HeapObject* GCHeap::FindMutable(uint64_t id)
+	{
+		if (!Find(id))
+			return nullptr;
+		return &*MutablePage(id / PageSize).Slots[id % PageSize];
+	}
+
+	HeapObject const* GCHeap::Resolve(json const& id) const noexcept
+	{
+		if (id.is_number_unsigned() || (id.is_number_integer() && id.get<int64_t>() > 0))
+			return Find(id.get<uint64_t>());
+		return nullptr;
+	}
+
+	uint64_t GCHeap::Add(HeapObject object)
+	{
+		auto const id = mNextID++;
+		auto const page = id / PageSize;
+		if (page >= mPages.size())
+			mPages.resize(page + 1);
+		if (!mPages[page])
+			mPages[page] = make_shared<Page>();
+		auto& target = MutablePage(page);
+		target.Slots[id % PageSize] = move(object);
+		++target.Count;
+		++mSize;
+		return id;
+	}
+
+	bool GCHeap::Remove(uint64_t id)
+	{
+		if (!Find(id))
+			return false;
+		auto const page = id / PageSize;
+		auto& target = MutablePage(page);
+		target.Slots[id % PageSize].reset();
+		--mSize;
+		if (--target.Count == 0)
+			mPages[page] = nullptr;
+		return true;
+	}
+
+	void GCHeap::RemoveIf(function<bool(HeapObject const&)> const& predicate)
+	{
+		for (size_t page = 0; page < mPages.size(); ++page)
+		{
+			vector<uint64_t> removed;
+			ignore = AnyObjectOnPage(page, [&](uint64_t id, HeapObject const& object) {
+				if (predicate(object))
+					removed.push_back(id);
+				return false;
+			});
+			for (auto id : removed)
+				Remove(id);
+		}
+	}
+
+	bool GCHeap::AnyObjectOnPage(size_t page, function<bool(uint64_t, HeapObject const&)> const& object_func) const
+	{
+		auto const& source = mPages[page];
+		if (!source)
+			return false;
+		for (uint64_t slot = 0; slot < PageSize; ++slot)
+		{
+			if (source->Slots[slot] && object_func(page * PageSize + slot, *source->Slots[slot]))
+				return true;
+		}
+		return false;
+	}
+
+	bool GCHeap::AnyMutableObjectOnPage(size_t page, function<bool(uint64_t, HeapObject&)> const& object_func)
+	{
+		if (!mPages[page])
+			return false;
+		auto& target = MutablePage(page);
+		for (uint64_t slot = 0; slot < PageSize; ++slot)
+		{
+			if (target.Slots[slot] && object_func(page * PageSize + slot, *target.Slots[slot]))
+				return true;
+		}
+		return false;
+	}
+
+	void GCHeap::ForEachChangedObject(GCHeap const& before, function<void(uint64_t, HeapObject const*, HeapObject const*)> const& object_func) const
+	{
+		static Page const empty_page{};
+		for (size_t page = 0; page < max(mPages.size(), before.mPages.size()); ++page)
+		{
+			auto const old_page = page < before.mPages.size() ? before.mPages[page].get() : nullptr;
+			auto const new_page = page < mPages.size() ? mPages[page].get() : nullptr;
+			if (old_page == new_page)
+				continue;
+
+			auto& old_slots = (old_page ? *old_page : empty_page).Slots;
+			auto& new_slots = (new_page ? *new_page : empty_page).Slots;
+			for (uint64_t slot = 0; slot < PageSize; ++slot)
+			{
+				auto const& old_object = old_slots[slot];
+				auto const& new_object = new_slots[slot];
+				if (!old_object && !new_object)
+					continue;
+				if (old_object && new_object && old_object->Class == new_object->Class && old_object->Value == new_object->Value)
+					continue;
+				object_func(page * PageSize + slot, old_object ? &*old_object : nullptr, new_object ? &*new_object : nullptr);
+			}
+		}
+	}
+
+	/// Pages are always created non-const, so once nothing else shares one it can be changed in place
+	GCHeap::Page& GCHeap::MutablePage(size_t page)
+	{
+		auto& shared = mPages[page];
+		if (shared.use_count() > 1)
+			shared = make_shared<Page>(*shared);
+		return const_cast<Page&>(*shared);
+	}
+
+	json GCHeap::ToJSON() const
+	{
+		json result = json::array();
+		for (size_t page = 0; page < mPages.size(); ++page)
+		{
+			ignore = AnyObjectOnPage(page, [&](uint64_t id, HeapObject const& object) {
+				result.push_back(json::object({ { "id", id }, { "type", ToStorageJSON(TypeReference{ object.Class }) }, { "value", object.Value } }));
+				return false;
+			});
+		}
+		return result;
+	}
+
+	GCHeap GCHeap::FromJSON(Schema const& schema, json const& objects, uint64_t next_id)
+	{
+		GCHeap heap;
+		uint64_t end_id = next_id;
+		for (auto& object : objects)
+		{
+			auto const type = TypeFromStorageJSON(schema, object.at("type"));
+			auto const id = object.at("id").get<uint64_t>();
+			if (!type || !type->IsClass() || id == 0)
+				continue;
+
+			/// Add hands out the next ID, so we make that the stored one
+			heap.mNextID = id;
+			heap.Add({ type->AsClass(), object.at("value") });
+			end_id = max(end_id, id + 1);
+		}
+		heap.mNextID = end_id;
+		return heap;
+	}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	/// A class instance in a data store's gcheap
+	struct HeapObject
+	{
+		ClassDefinition const* Class = nullptr;
+		json Value; /// the record object, keyed by field storage keys like any other record value
+	};
+
+	/// The class instances of a data store, by object ID; `own<T>` and `ref<T>` values in storage form are these IDs (or null).
+	/// IDs are handed out in order and never reused, so looking one up is just indexing into a page, and a `ref` to a collected
+	/// object stays dangling instead of pointing at some new object.
+	/// Pages are shared between copies of the heap (see DataStore::Snapshot) and copied the first time one is changed while shared.
+	struct GCHeap
+	{
+		static constexpr uint64_t PageSize = 1024;
+
+		HeapObject const* Find(uint64_t id) const noexcept;
+		/// Copies the object's page first, if it's shared
+		HeapObject* FindMutable(uint64_t id);
+		/// `id` may be an `own` or `ref` value in storage form; nullptr if it's null or the object doesn't exist (anymore)
+		HeapObject const* Resolve(json const& id) const noexcept;
+
+		uint64_t Add(HeapObject object);
+		bool Remove(uint64_t id);
+		void RemoveIf(function<bool(HeapObject const&)> const& predicate);
+
+		size_t Size() const noexcept { return mSize; }
+		uint64_t NextID() const noexcept { return mNextID; }
+
+		/// Objects are visited a page at a time, so pages can be handed out to different threads
+		size_t PageCount() const noexcept { return mPages.size(); }
+		bool PageShared(size_t page) const noexcept { return mPages[page].use_count() > 1; }
+		/// Both return true as soon as `object_func` does; the second one copies the page first, if it's shared
+		bool AnyObjectOnPage(size_t page, function<bool(uint64_t, HeapObject const&)> const& object_func) const;
+		bool AnyMutableObjectOnPage(size_t page, function<bool(uint64_t, HeapObject&)> const& object_func);
+		/// Calls `object_func` for every object that was added, removed or changed since `before` (an earlier copy of this heap),
+		/// with nullptr for the side it's missing from; pages both heaps still share are skipped without looking inside
+		void ForEachChangedObject(GCHeap const& before, function<void(uint64_t, HeapObject const*, HeapObject const*)> const& object_func) const;
+
+		/// [ { "id": ..., "type": ..., "value": ... } ]
+		json ToJSON() const;
+		/// Objects of classes that no longer exist are dropped
+		static GCHeap FromJSON(Schema const& schema, json const& objects, uint64_t next_id);
+
+	private:
+
+		struct Page
+		{
+			array<optional<HeapObject>, PageSize> Slots;
+			size_t Count = 0;
+		};
+
+		Page& MutablePage(size_t page);
+
+		vector<shared_ptr<Page const>> mPages;
+		size_t mSize = 0;
+		uint64_t mNextID = 1; /// 0 is never used, so it can't be mistaken for a real ID
+	};
+
+	struct GCStats
+	{
+		uint64_t Cycles = 0;
+		uint64_t ObjectsMarked = 0; /// by the last finished cycle
+		uint64_t ObjectsFreed = 0;
+		chrono::microseconds Time{}; /// spent in DataStore::CollectGarbage
+	};
+}
@@ -0,0 +1,145 @@
+#include "pch.h"
+
+#include "Hashing.h"
+
+namespace dtmdl
+{
+	static constexpr uint32_t SHA256RoundConstants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+	SHA256Hasher::SHA256Hasher() noexcept
+		: mState{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+	{
+	}
+
+	void SHA256Hasher::Transform(uint8_t const* block) noexcept
+	{
+		uint32_t w[64];
+		for (size_t i = 0; i < 16; ++i)
+			w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+		for (size_t i = 16; i < 64; ++i)
+		{
+			auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		auto [a, b, c, d, e, f, g, h] = mState;
+		for (size_t i = 0; i < 64; ++i)
+		{
+			auto s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+			auto ch = (e & f) ^ (~e & g);
+			auto t1 = h + s1 + ch + SHA256RoundConstants[i] + w[i];
+			auto s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+			auto maj = (a & b) ^ (a & c) ^ (b & c);
+			auto t2 = s0 + maj;
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		mState[0] += a; mState[1] += b; mState[2] += c; mState[3] += d;
+		mState[4] += e; mState[5] += f; mState[6] += g; mState[7] += h;
+	}
+
+	void SHA256Hasher::Update(span<uint8_t const> data) noexcept
+	{
+		mTotalSize += data.size();
+
+		if (mBufferSize)
+		{
+			auto to_copy = min(data.size(), mBuffer.size() - mBufferSize);
+			copy_n(data.data(), to_copy, mBuffer.data() + mBufferSize);
+			mBufferSize += to_copy;
+			data = data.subspan(to_copy);
+			if (mBufferSize < mBuffer.size())
+				return;
+			Transform(mBuffer.data());
+			mBufferSize = 0;
+		}
+
+		while (data.size() >= mBuffer.size())
+		{
+			Transform(data.data());
+			data = data.subspan(mBuffer.size());
+		}
+
+		copy(data.begin(), data.end(), mBuffer.begin());
+		mBufferSize = data.size();
+	}
+
+	SHA256Digest SHA256Hasher::Finish() noexcept
+	{
+		auto const bit_size = mTotalSize * 8;
+
+		uint8_t padding[72]{ 0x80 };
+		auto const padding_size = (mBufferSize < 56 ? 56 : 120) - mBufferSize;
+		for (size_t i = 0; i < 8; ++i)
+			padding[padding_size + i] = uint8_t(bit_size >> (56 - i * 8));
+		Update({ padding, padding_size + 8 });
+
+		SHA256Digest result{};
+		for (size_t i = 0; i < 8; ++i)
+		{
+			result[i * 4] = uint8_t(mState[i] >> 24);
+			result[i * 4 + 1] = uint8_t(mState[i] >> 16);
+			result[i * 4 + 2] = uint8_t(mState[i] >> 8);
+			result[i * 4 + 3] = uint8_t(mState[i]);
+		}
+		return result;
+	}
+
+	SHA256Digest SHA256(span<uint8_t const> data) noexcept
+	{
+		SHA256Hasher hasher;
+		hasher.Update(data);
+		return hasher.Finish();
+	}
+
+	string ToHex(span<uint8_t const> data)
+	{
+		static constexpr char digits[] = "0123456789abcdef";
+		string result;
+		result.reserve(data.size() * 2);
+		for (auto byte : data)
+		{
+			result += digits[byte >> 4];
+			result += digits[byte & 0xF];
+		}
+		return result;
+	}
+
+	/// MurmurHash3's finalizer
+	static constexpr uint64_t Mix64(uint64_t value) noexcept
+	{
+		value ^= value >> 33;
+		value *= 0xFF51AFD7ED558CCDull;
+		value ^= value >> 33;
+		value *= 0xC4CEB9FE1A85EC53ull;
+		value ^= value >> 33;
+		return value;
+	}
+
+	uint64_t Hash64(span<uint8_t const> data, uint64_t seed) noexcept
+	{
+		uint64_t result = seed ^ (data.size() * 0x9E3779B97F4A7C15ull);
+		size_t i = 0;
+		for (; i + 8 <= data.size(); i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data.data() + i, 8);
+			result = rotl(result ^ Mix64(word), 27) * 5 + 0x52DCE729;
+		}
+		uint64_t tail = 0;
+		for (size_t shift = 0; i < data.size(); ++i, shift += 8)
+			tail |= uint64_t(data[i]) << shift;
+		return Mix64(result ^ Mix64(tail));
+	}
+}
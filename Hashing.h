@@ -0,0 +1,42 @@
+#pragma once
+
+namespace dtmdl
+{
+	using SHA256Digest = array<uint8_t, 32>;
+
+	/// Incremental SHA-256, for when the data doesn't come in one piece
+	struct SHA256Hasher
+	{
+		SHA256Hasher() noexcept;
+
+		void Update(span<uint8_t const> data) noexcept;
+		void Update(string_view data) noexcept { Update({ reinterpret_cast<uint8_t const*>(data.data()), data.size() }); }
+		SHA256Digest Finish() noexcept;
+
+	private:
+
+		void Transform(uint8_t const* block) noexcept;
+
+		array<uint32_t, 8> mState{};
+		array<uint8_t, 64> mBuffer{};
+		size_t mBufferSize = 0;
+		uint64_t mTotalSize = 0;
+	};
+
+	SHA256Digest SHA256(span<uint8_t const> data) noexcept;
+	inline SHA256Digest SHA256(string_view data) noexcept { return SHA256({ reinterpret_cast<uint8_t const*>(data.data()), data.size() }); }
+
+	string ToHex(span<uint8_t const> data);
+
+	/// Fast non-cryptographic 64-bit hash, for comparing data in memory; use SHA256 for anything that is stored
+	uint64_t Hash64(span<uint8_t const> data, uint64_t seed = 0) noexcept;
+	inline uint64_t Hash64(string_view data, uint64_t seed = 0) noexcept { return Hash64({ reinterpret_cast<uint8_t const*>(data.data()), data.size() }, seed); }
+
+	/// Order-dependent
+	constexpr uint64_t HashCombine(uint64_t seed, uint64_t value) noexcept
+	{
+		value *= 0x9E3779B97F4A7C15ull;
+		value ^= value >> 32;
+		return (seed ^ value) * 0xFF51AFD7ED558CCDull + 0x632BE59BD9B4E019ull;
+	}
+}
@@ -0,0 +1,557 @@
+#include "pch.h"
+
+#include "Import.h"
+#include "Values.h"
+#include "Validation.h"
+#include "BlobStore.h"
+
+namespace dtmdl
+{
+
+	/// nlohmann::json SAX handler that converts values into storage form as they are parsed.
+	/// Each open array or object is a frame; scalars and new frames go into the slot the top frame says is next.
+	struct ValueImporter
+	{
+		enum class FrameKind
+		{
+			Envelope, /// { "type": ..., "value": ... }
+			Raw, /// json, ref, own and vector values are stored as they are
+			List,
+			Array,
+			Map,
+			Record,
+			Variant, /// [alternative index, value]
+			Flags, /// [enumerator names...]
+			Bytes, /// [byte values...]
+			BytesObject, /// { "bytes": [...], "subtype": ... }, as nlohmann::json writes binary values
+		};
+
+		struct Frame
+		{
+			FrameKind Kind{};
+			TypeReference const* Type = nullptr;
+			json* Value = nullptr;
+			size_t Index = 0; /// number of elements started, for arrays
+			std::string Key; /// current key, for objects; for records this is the field's storage key
+			std::string Name; /// current key as it appears in the document
+			TypeReference const* NextType = nullptr; /// for records, maps and variants
+		};
+
+		enum class SlotKind { Typed, Raw, VariantIndex, FlagName, ByteValue, BytesArray, Ignored };
+
+		struct Slot
+		{
+			SlotKind Kind = SlotKind::Typed;
+			TypeReference const* Type = nullptr;
+			json* Target = nullptr;
+		};
+
+		/// How often progress is reported
+		static constexpr uint64_t ProgressInterval = 64 * 1024;
+
+		/// NOTE: The SAX interface needs a member function named `string`, so the type has to be written `std::string` in here
+		ValueImporter(Schema const& schema, BlobStore& blobs, istream& input, uint64_t total_size, TypeReference const& type, ImportProgressFunc const& progress)
+			: Type(type), mSchema(schema), mBlobs(blobs), mInput(input), mProgress(progress)
+		{
+			mProgressState.TotalBytes = total_size;
+		}
+
+		TypeReference Type;
+		json Value;
+		bool HaveValue = false;
+		std::string Error;
+
+		bool null() { return Scalar(json{}); }
+		bool boolean(bool value) { return Scalar(value); }
+		bool number_integer(json::number_integer_t value) { return Scalar(value); }
+		bool number_unsigned(json::number_unsigned_t value) { return Scalar(value); }
+		bool number_float(json::number_float_t value, json::string_t const&) { return Scalar(value); }
+		bool string(json::string_t& value) { return Scalar(move(value)); }
+		bool binary(json::binary_t& value);
+		bool start_object(size_t) { return Begin(true); }
+		bool key(json::string_t& key);
+		bool end_object() { return End(); }
+		bool start_array(size_t) { return Begin(false); }
+		bool end_array() { return End(); }
+		bool parse_error(size_t position, std::string const&, nlohmann::detail::exception const& ex)
+		{
+			if (Error.empty())
+				Error = format("invalid JSON at byte {}: {}", position, ex.what());
+			return false;
+		}
+
+		bool ReportProgress()
+		{
+			if (!mProgress)
+				return true;
+			if (auto position = mInput.tellg(); position >= 0)
+				mProgressState.BytesRead = uint64_t(position);
+			if (!mProgress(mProgressState))
+				return Fail("import cancelled");
+			return true;
+		}
+
+	private:
+
+		Schema const& mSchema;
+		BlobStore& mBlobs;
+		istream& mInput;
+		ImportProgressFunc const& mProgress;
+		ImportProgress mProgressState;
+		vector<Frame> mFrames;
+		json mTypeJSON; /// for envelopes
+
+		bool Fail(std::string message)
+		{
+			if (Error.empty())
+			{
+				json::json_pointer path;
+				for (auto& frame : mFrames)
+				{
+					if (frame.Kind == FrameKind::Envelope || frame.Kind == FrameKind::Record || frame.Kind == FrameKind::Map || frame.Kind == FrameKind::BytesObject || (frame.Kind == FrameKind::Raw && frame.Value->is_object()))
+						path /= frame.Name;
+					else if (frame.Index > 0)
+						path /= frame.Index - 1;
+				}
+				Error = format("{}: {}", path.to_string(), message);
+			}
+			return false;
+		}
+
+		static TypeReference const& Argument(TypeReference const& type, size_t index) { return get<TypeReference>(type.TemplateArguments.at(index)); }
+
+		bool NextSlot(Slot& slot)
+		{
+			if (mFrames.empty())
+			{
+				if (HaveValue || !Type)
+					return Fail("unexpected value");
+				slot = { SlotKind::Typed, &Type, &Value };
+				return true;
+			}
+
+			auto& frame = mFrames.back();
+			switch (frame.Kind)
+			{
+			case FrameKind::Envelope:
+				if (frame.Key == "type")
+					slot = { SlotKind::Raw, nullptr, &mTypeJSON };
+				else
+					slot = { SlotKind::Typed, &Type, &Value };
+				return true;
+			case FrameKind::Raw:
+				slot = { SlotKind::Raw, nullptr, frame.Value->is_array() ? &frame.Value->emplace_back() : &(*frame.Value)[frame.Key] };
+				return true;
+			case FrameKind::List:
+			case FrameKind::Array:
+				if (frame.Kind == FrameKind::Array && frame.Index >= get<uint64_t>(frame.Type->TemplateArguments.at(1)))
+					return Fail(format("too many elements for {}", frame.Type->ToString()));
+				++frame.Index;
+				slot = { SlotKind::Typed, &Argument(*frame.Type, 0), &frame.Value->emplace_back() };
+				return true;
+			case FrameKind::Map:
+			case FrameKind::Record:
+				slot = { SlotKind::Typed, frame.NextType, &(*frame.Value)[frame.Key] };
+				return true;
+			case FrameKind::Variant:
+				if (frame.Index >= 2)
+					return Fail("variants must be [alternative index, value] pairs");
+				if (frame.Index++ == 0)
+					slot = { SlotKind::VariantIndex, nullptr, &(*frame.Value)[0] };
+				else
+					slot = { SlotKind::Typed, frame.NextType, &(*frame.Value)[1] };
+				return true;
+			case FrameKind::Flags:
+				slot = { SlotKind::FlagName, frame.Type, frame.Value };
+				return true;
+			case FrameKind::Bytes:
+				slot = { SlotKind::ByteValue, nullptr, frame.Value };
+				return true;
+			case FrameKind::BytesObject:
+				slot = { frame.Key == "bytes" ? SlotKind::BytesArray : SlotKind::Ignored, nullptr, frame.Value };
+				return true;
+			}
+			return Fail("internal error");
+		}
+
+		/// Called whenever a value is complete
+		bool Completed()
+		{
+			if (++mProgressState.ValuesRead % ProgressInterval == 0 && !ReportProgress())
+				return false;
+
+			if (mFrames.empty())
+			{
+				HaveValue = true;
+				return true;
+			}
+
+			auto& frame = mFrames.back();
+			if (frame.Kind != FrameKind::Envelope)
+				return true;
+			if (frame.Key == "value")
+			{
+				HaveValue = true;
+				return true;
+			}
+
+			try
+			{
+				Type = TypeFromJSON(mSchema, mTypeJSON);
+			}
+			catch (std::exception const& e)
+			{
+				return Fail(e.what());
+			}
+			if (auto valid = ValidateType(Type); valid.has_error())
+				return Fail(valid.error());
+			return true;
+		}
+
+		template <typename T>
+		static bool InRange(json const& value)
+		{
+			if (value.is_number_unsigned())
+				return value.get<uint64_t>() <= uint64_t(numeric_limits<T>::max());
+			if (value.is_number_integer())
+			{
+				auto const number = value.get<int64_t>();
+				if constexpr (is_signed_v<T>)
+					return number >= int64_t(numeric_limits<T>::min()) && number <= int64_t(numeric_limits<T>::max());
+				else
+					return number >= 0 && uint64_t(number) <= uint64_t(numeric_limits<T>::max());
+			}
+			return false;
+		}
+
+		template <typename T>
+		bool Integer(json& target, json const& value, std::string_view type_name)
+		{
+			if (!InRange<T>(value))
+				return Fail(format("{} is not a valid {}", value.dump(), type_name));
+			if constexpr (is_signed_v<T>)
+				target = value.get<int64_t>();
+			else
+				target = value.get<uint64_t>();
+			return true;
+		}
+
+		bool ConvertScalar(TypeReference const& type, json& target, json&& value)
+		{
+			if (auto enoom = type->AsEnum())
+			{
+				EnumeratorDefinition const* enumerator = nullptr;
+				if (value.is_string())
+					enumerator = enoom->Enumerator(value.get_ref<json::string_t const&>());
+				else if (value.is_number_integer())
+					enumerator = enoom->EnumeratorByValue(value.get<int64_t>());
+				if (!enumerator)
+					return Fail(format("{} is not an enumerator of {}", value.dump(), enoom->Name()));
+				target = enumerator->ActualValue();
+				return true;
+			}
+
+			if (!type->IsBuiltIn())
+				return Fail(format("expected an object of type {}, got {}", type.ToString(), value.dump()));
+
+			auto const& name = type->Name();
+			if (name == "json" || name == "ref" || name == "own")
+				target = move(value);
+			else if (name == "void")
+			{
+				if (!value.is_null())
+					return Fail(format("expected null, got {}", value.dump()));
+				target = json{};
+			}
+			else if (name == "f32" || name == "f64")
+			{
+				if (!value.is_number())
+					return Fail(format("expected a number, got {}", value.dump()));
+				if (name == "f32")
+					target = value.get<float>();
+				else
+					target = value.get<double>();
+			}
+			else if (name == "i8") return Integer<int8_t>(target, value, name);
+			else if (name == "i16") return Integer<int16_t>(target, value, name);
+			else if (name == "i32") return Integer<int32_t>(target, value, name);
+			else if (name == "i64") return Integer<int64_t>(target, value, name);
+			else if (name == "u8") return Integer<uint8_t>(target, value, name);
+			else if (name == "u16") return Integer<uint16_t>(target, value, name);
+			else if (name == "u32") return Integer<uint32_t>(target, value, name);
+			else if (name == "u64") return Integer<uint64_t>(target, value, name);
+			else if (name == "bool")
+			{
+				if (!value.is_boolean())
+					return Fail(format("expected true or false, got {}", value.dump()));
+				target = move(value);
+			}
+			else if (name == "string")
+			{
+				if (!value.is_string())
+					return Fail(format("expected a string, got {}", value.dump()));
+				target = move(value);
+			}
+			else if (name == "flags")
+			{
+				/// Bitmasks, as stored
+				if (!value.is_number_unsigned() && !(value.is_number_integer() && value.get<int64_t>() >= 0))
+					return Fail(format("expected an array of enumerator names, got {}", value.dump()));
+				target = value.get<uint64_t>();
+			}
+			else
+				return Fail(format("expected a value of type {}, got {}", type.ToString(), value.dump()));
+			return true;
+		}
+
+		bool Scalar(json value)
+		{
+			Slot slot;
+			if (!NextSlot(slot))
+				return false;
+
+			switch (slot.Kind)
+			{
+			case SlotKind::Typed:
+				if (!slot.Type || !*slot.Type)
+					return Fail("value has no type");
+				if (!ConvertScalar(*slot.Type, *slot.Target, move(value)))
+					return false;
+				break;
+			case SlotKind::Raw:
+				*slot.Target = move(value);
+				break;
+			case SlotKind::VariantIndex:
+			{
+				auto& frame = mFrames.back();
+				if (!value.is_number_integer() || value.get<int64_t>() < 0 || value.get<uint64_t>() >= frame.Type->TemplateArguments.size())
+					return Fail(format("{} is not an alternative of {}", value.dump(), frame.Type->ToString()));
+				frame.NextType = get_if<TypeReference>(&frame.Type->TemplateArguments[value.get<size_t>()]);
+				if (!frame.NextType)
+					return Fail(format("alternative {} of {} is not a type", value.dump(), frame.Type->ToString()));
+				*slot.Target = value.get<uint64_t>();
+				break;
+			}
+			case SlotKind::FlagName:
+			{
+				auto& enum_type = Argument(*slot.Type, 0);
+				auto enoom = enum_type ? enum_type->AsEnum() : nullptr;
+				auto enumerator = enoom && value.is_string() ? enoom->Enumerator(value.get_ref<json::string_t const&>()) : nullptr;
+				if (!enumerator)
+					return Fail(format("{} is not an enumerator of {}", value.dump(), slot.Type->ToString()));
+				*slot.Target = slot.Target->get<uint64_t>() | FlagBit(enumerator->ActualValue());
+				break;
+			}
+			case SlotKind::ByteValue:
+				if (!InRange<uint8_t>(value))
+					return Fail(format("{} is not a byte value", value.dump()));
+				slot.Target->get_binary().push_back(value.get<uint8_t>());
+				break;
+			case SlotKind::BytesArray:
+				return Fail("expected an array of byte values");
+			case SlotKind::Ignored:
+				break;
+			}
+			return Completed();
+		}
+
+		bool Begin(bool object)
+		{
+			if (mFrames.empty() && !Type)
+			{
+				if (!object)
+					return Fail("expected an exported value, { \"type\": ..., \"value\": ... }");
+				mFrames.push_back({ FrameKind::Envelope });
+				return true;
+			}
+
+			Slot slot;
+			if (!NextSlot(slot))
+				return false;
+
+			auto push = [&](FrameKind kind, json initial) {
+				*slot.Target = move(initial);
+				mFrames.push_back({ kind, slot.Type, slot.Target });
+				return true;
+			};
+
+			switch (slot.Kind)
+			{
+			case SlotKind::Raw:
+				return push(FrameKind::Raw, object ? json::object() : json::array());
+			case SlotKind::BytesArray:
+				if (object)
+					return Fail("expected an array of byte values");
+				mFrames.push_back({ FrameKind::Bytes, nullptr, slot.Target });
+				return true;
+			case SlotKind::Typed:
+				break;
+			default:
+				return Fail(format("unexpected {}", object ? "object" : "array"));
+			}
+
+			if (!slot.Type || !*slot.Type)
+				return Fail("value has no type");
+			auto& type = *slot.Type;
+			auto const& name = type->Name();
+
+			if (object)
+			{
+				if (type->AsRecord())
+					return push(FrameKind::Record, json::object());
+				if (!type->IsBuiltIn())
+					return Fail(format("expected a value of type {}, got an object", type.ToString()));
+				if (name == "map")
+					return push(FrameKind::Map, json::object());
+				if (name == "bytes")
+					return push(FrameKind::BytesObject, json::binary_t{});
+				if (name == "json" || name == "ref" || name == "own")
+					return push(FrameKind::Raw, json::object());
+				return Fail(format("expected a value of type {}, got an object", type.ToString()));
+			}
+
+			if (!type->IsBuiltIn())
+				return Fail(format("expected a value of type {}, got an array", type.ToString()));
+			if (name == "list")
+				return push(FrameKind::List, json::array());
+			if (name == "array")
+				return push(FrameKind::Array, json::array());
+			if (name == "variant")
+				return push(FrameKind::Variant, json::array({ json{}, json{} }));
+			if (name == "flags")
+				return push(FrameKind::Flags, uint64_t{});
+			if (name == "bytes")
+				return push(FrameKind::Bytes, json::binary_t{});
+			if (name == "json" || name == "ref" || name == "own" || name.find("vec") != std::string::npos)
+				return push(FrameKind::Raw, json::array());
+			return Fail(format("expected a value of type {}, got an array", type.ToString()));
+		}
+
+		bool End()
+		{
+			auto& frame = mFrames.back();
+			switch (frame.Kind)
+			{
+			case FrameKind::Envelope:
+				if (!HaveValue)
+					return Fail("export has no value");
+				mFrames.pop_back();
+				return true;
+			case FrameKind::Array:
+				if (auto const size = get<uint64_t>(frame.Type->TemplateArguments.at(1)); frame.Index != size)
+					return Fail(format("expected {} elements, got {}", size, frame.Index));
+				break;
+			case FrameKind::Variant:
+				if (frame.Index != 2)
+					return Fail("variants must be [alternative index, value] pairs");
+				break;
+			case FrameKind::Bytes:
+				if (auto const& data = frame.Value->get_binary(); data.size() >= BlobStore::OutOfLineThreshold)
+				{
+					auto hash = mBlobs.Put(data);
+					if (hash.has_error())
+						return Fail(hash.error());
+					*frame.Value = BlobStore::Reference(move(hash).value(), data.size());
+				}
+				/// Nested in a BytesObject frame, the bytes are only part of the value
+				if (mFrames.size() > 1 && mFrames[mFrames.size() - 2].Kind == FrameKind::BytesObject)
+				{
+					mFrames.pop_back();
+					return true;
+				}
+				break;
+			default:
+				break;
+			}
+			mFrames.pop_back();
+			return Completed();
+		}
+	};
+
+	bool ValueImporter::binary(json::binary_t& value)
+	{
+		Slot slot;
+		if (!NextSlot(slot))
+			return false;
+		if (slot.Kind == SlotKind::Raw)
+			*slot.Target = json::binary(move(value));
+		else if (slot.Kind == SlotKind::Typed && slot.Type && *slot.Type && (*slot.Type)->Name() == "bytes")
+		{
+			if (value.size() >= BlobStore::OutOfLineThreshold)
+			{
+				auto hash = mBlobs.Put(value);
+				if (hash.has_error())
+					return Fail(hash.error());
+				*slot.Target = BlobStore::Reference(move(hash).value(), value.size());
+			}
+			else
+				*slot.Target = json::binary(move(value));
+		}
+		else
+			return Fail("unexpected binary value");
+		return Completed();
+	}
+
+	bool ValueImporter::key(json::string_t& key)
+	{
+		auto& frame = mFrames.back();
+		frame.Name = key;
+		switch (frame.Kind)
+		{
+		case FrameKind::Envelope:
+			if (key != "type" && key != "value")
+				return Fail("exports must only have \"type\" and \"value\"");
+			if (key == "value" && !Type)
+				return Fail("an export's type must come before its value");
+			break;
+		case FrameKind::Record:
+		{
+			auto field = (*frame.Type)->AsRecord()->OwnOrBaseField(key);
+			if (!field)
+				return Fail(format("{} has no field named '{}'", (*frame.Type)->Name(), key));
+			frame.NextType = &field->FieldType;
+			frame.Key = field->StorageKey();
+			return true;
+		}
+		case FrameKind::Map:
+			frame.NextType = &Argument(*frame.Type, 1);
+			break;
+		case FrameKind::BytesObject:
+			if (key != "bytes" && key != "subtype")
+				return Fail(format("unexpected key '{}' in a binary value", key));
+			break;
+		default:
+			break;
+		}
+		frame.Key = move(key);
+		return true;
+	}
+
+	result<ImportedValue, string> ImportValueFromJSON(Schema const& schema, BlobStore& blobs, istream& input, uint64_t total_size, TypeReference const& type, ImportProgressFunc const& progress)
+	{
+		ValueImporter importer{ schema, blobs, input, total_size, type, progress };
+		auto const parsed = json::sax_parse(input, &importer);
+		if (!parsed || !importer.Error.empty())
+			return failure(importer.Error.empty() ? string{ "could not parse JSON" } : move(importer.Error));
+		if (!importer.HaveValue)
+			return failure("document has no value");
+		importer.ReportProgress();
+		return ImportedValue{ move(importer.Type), move(importer.Value) };
+	}
+
+	result<ImportedValue, string> ImportValueFromJSONFile(Schema const& schema, BlobStore& blobs, filesystem::path const& path, TypeReference const& type, ImportProgressFunc const& progress)
+	{
+		/// A bigger buffer than the default, as the parser reads one character at a time
+		vector<char> buffer(1024 * 1024);
+		ifstream file;
+		file.rdbuf()->pubsetbuf(buffer.data(), streamsize(buffer.size()));
+		file.open(path, ios::binary);
+		if (!file)
+			return failure(format("could not open '{}'", path.string()));
+
+		error_code ec;
+		auto const size = filesystem::file_size(path, ec);
+		return ImportValueFromJSON(schema, blobs, file, ec ? 0 : size, type, progress);
+	}
+
+}
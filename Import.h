@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	struct BlobStore;
+
+	struct ImportProgress
+	{
+		uint64_t BytesRead = 0;
+		uint64_t TotalBytes = 0; /// 0 if unknown
+		uint64_t ValuesRead = 0;
+	};
+
+	/// Called every so often while importing; return false to cancel the import
+	using ImportProgressFunc = function<bool(ImportProgress const&)>;
+
+	struct ImportedValue
+	{
+		TypeReference Type;
+		json Value; /// in storage form
+	};
+
+	/// Reads a value from a JSON document, in the form written by ExportValue (with field and enumerator names; see Export.h),
+	/// straight into storage form, checking it against its type as it goes. The document is parsed as a stream, and never
+	/// held in memory as a whole: only the converted value is built, and `bytes` values of at least BlobStore::OutOfLineThreshold
+	/// are written to `blobs` as soon as they've been read.
+	/// If `type` is empty, the document must be a whole export ({ "type": ..., "value": ... }, with the type first);
+	/// otherwise it is just the value.
+	result<ImportedValue, string> ImportValueFromJSON(Schema const& schema, BlobStore& blobs, istream& input, uint64_t total_size, TypeReference const& type = {}, ImportProgressFunc const& progress = {});
+	result<ImportedValue, string> ImportValueFromJSONFile(Schema const& schema, BlobStore& blobs, filesystem::path const& path, TypeReference const& type = {}, ImportProgressFunc const& progress = {});
+}
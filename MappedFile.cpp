@@ -0,0 +1,93 @@
+#include "pch.h"
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dtmdl
+{
+
+	result<shared_ptr<MappedFile const>, string> MappedFile::Open(filesystem::path const& path, Access access)
+	{
+		auto file = shared_ptr<MappedFile>(new MappedFile{});
+
+#ifdef _WIN32
+		auto handle = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | (access == Access::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS), nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+			return failure(format("could not open file '{}'", path.string()));
+		file->mFileHandle = handle;
+
+		LARGE_INTEGER size{};
+		if (!::GetFileSizeEx(handle, &size))
+			return failure(format("could not get size of file '{}'", path.string()));
+		file->mSize = size_t(size.QuadPart);
+
+		/// Empty files can't be mapped, but they are still valid files
+		if (file->mSize == 0)
+			return success(move(file));
+
+		file->mMappingHandle = ::CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!file->mMappingHandle)
+			return failure(format("could not map file '{}'", path.string()));
+
+		file->mData = ::MapViewOfFile(file->mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (!file->mData)
+			return failure(format("could not map file '{}'", path.string()));
+#else
+		auto fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return failure(format("could not open file '{}'", path.string()));
+
+		struct stat st {};
+		if (::fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return failure(format("could not get size of file '{}'", path.string()));
+		}
+		file->mSize = size_t(st.st_size);
+
+		if (file->mSize != 0)
+		{
+			auto data = ::mmap(nullptr, file->mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED)
+			{
+				::close(fd);
+				return failure(format("could not map file '{}'", path.string()));
+			}
+			file->mData = data;
+			if (access == Access::Sequential)
+				::madvise(data, file->mSize, MADV_SEQUENTIAL);
+		}
+
+		/// The mapping stays valid after the descriptor is closed
+		::close(fd);
+#endif
+
+		return success(move(file));
+	}
+
+	MappedFile::~MappedFile() noexcept
+	{
+#ifdef _WIN32
+		if (mData)
+			::UnmapViewOfFile(mData);
+		if (mMappingHandle)
+			::CloseHandle(mMappingHandle);
+		if (mFileHandle)
+			::CloseHandle(mFileHandle);
+#else
+		if (mData)
+			::munmap(const_cast<void*>(mData), mSize);
+#endif
+	}
+
+}
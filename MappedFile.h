@@ -0,0 +1,32 @@
+#pragma once
+
+namespace dtmdl
+{
+	/// A read-only view of an entire file, mapped into memory; unmapped on destruction
+	struct MappedFile
+	{
+		/// Tells the OS how the file will be read, so it can read ahead (or not)
+		enum class Access { Random, Sequential };
+
+		static result<shared_ptr<MappedFile const>, string> Open(filesystem::path const& path, Access access = Access::Random);
+
+		~MappedFile() noexcept;
+
+		MappedFile(MappedFile const&) = delete;
+		MappedFile& operator=(MappedFile const&) = delete;
+
+		span<uint8_t const> Data() const noexcept { return { static_cast<uint8_t const*>(mData), mSize }; }
+		size_t Size() const noexcept { return mSize; }
+
+	private:
+
+		MappedFile() noexcept = default;
+
+		void const* mData = nullptr;
+		size_t mSize = 0;
+#ifdef _WIN32
+		void* mFileHandle = nullptr;
+		void* mMappingHandle = nullptr;
+#endif
+	};
+}
@@ -0,0 +1,171 @@
+#include "pch.h"
+
+#include "Merge.h"
+#include "Hashing.h"
+
+namespace dtmdl
+{
+
+	uint64_t StructuralHasher::Hash(json const& value)
+	{
+		auto const tag = uint64_t(value.type());
+		switch (value.type())
+		{
+		case json::value_t::object:
+		case json::value_t::array:
+			break;
+		case json::value_t::string:
+			return Hash64(value.get_ref<json::string_t const&>(), tag);
+		case json::value_t::binary:
+		{
+			auto& binary = value.get_binary();
+			return HashCombine(Hash64(span{ binary.data(), binary.size() }, tag), binary.has_subtype() ? binary.subtype() : ~0ull);
+		}
+		case json::value_t::number_unsigned:
+		{
+			/// So that equal numbers hash the same whether they were read as signed or unsigned
+			auto const number = value.get<uint64_t>();
+			if (number <= uint64_t(numeric_limits<int64_t>::max()))
+				return HashCombine(uint64_t(json::value_t::number_integer), number);
+			return HashCombine(tag, number);
+		}
+		case json::value_t::number_integer:
+			return HashCombine(tag, uint64_t(value.get<int64_t>()));
+		case json::value_t::number_float:
+			return HashCombine(tag, bit_cast<uint64_t>(value.get<double>()));
+		case json::value_t::boolean:
+			return HashCombine(tag, value.get<bool>());
+		default:
+			return HashCombine(tag, 0);
+		}
+
+		if (auto it = mCache.find(&value); it != mCache.end())
+			return it->second;
+
+		uint64_t result = HashCombine(tag, value.size());
+		if (value.is_object())
+		{
+			/// Objects are sorted by key, so equal objects hash the same
+			for (auto& [key, element] : value.items())
+				result = HashCombine(HashCombine(result, Hash64(key)), Hash(element));
+		}
+		else
+		{
+			for (auto& element : value)
+				result = HashCombine(result, Hash(element));
+		}
+		mCache.emplace(&value, result);
+		return result;
+	}
+
+	void MergeReport::Append(MergeReport&& other)
+	{
+		Conflicts.insert(Conflicts.end(), make_move_iterator(other.Conflicts.begin()), make_move_iterator(other.Conflicts.end()));
+		Stats.SubtreesSkipped += other.Stats.SubtreesSkipped;
+		Stats.SubtreesTaken += other.Stats.SubtreesTaken;
+		Stats.RowsCompared += other.Stats.RowsCompared;
+	}
+
+	void MergeValues(json& ours, json const& theirs, json const* base, json::json_pointer const& path, MergeContext& context)
+	{
+		auto& stats = context.Report.Stats;
+
+		auto const our_hash = context.Ours.Hash(ours);
+		auto const their_hash = context.Theirs.Hash(theirs);
+		if (our_hash == their_hash)
+		{
+			++stats.SubtreesSkipped;
+			return;
+		}
+
+		if (base)
+		{
+			auto const base_hash = context.Base.Hash(*base);
+			if (base_hash == their_hash)
+			{
+				/// Only we changed it
+				++stats.SubtreesSkipped;
+				return;
+			}
+			if (base_hash == our_hash)
+			{
+				/// Only they changed it
+				ours = theirs;
+				++stats.SubtreesTaken;
+				return;
+			}
+		}
+
+		if (ours.is_object() && theirs.is_object())
+		{
+			auto const base_object = base && base->is_object() ? base : nullptr;
+
+			for (auto& [key, their_value] : theirs.items())
+			{
+				json const* base_value = nullptr;
+				if (base_object)
+				{
+					if (auto it = base_object->find(key); it != base_object->end())
+						base_value = &*it;
+				}
+
+				if (auto it = ours.find(key); it != ours.end())
+				{
+					MergeValues(*it, their_value, base_value, path / key, context);
+					continue;
+				}
+
+				if (!base_value)
+				{
+					/// They added it
+					ours[key] = their_value;
+					++stats.SubtreesTaken;
+				}
+				else if (context.Base.Hash(*base_value) != context.Theirs.Hash(their_value))
+				{
+					/// We deleted it, they changed it
+					context.Report.Conflicts.push_back({ (path / key).to_string(), json{}, their_value, *base_value });
+				}
+				/// else we deleted it, and they didn't change it
+			}
+
+			/// Without a common ancestor we can't tell whether they deleted what only we have, or we added it, so we keep it
+			if (base_object)
+			{
+				for (auto it = ours.begin(); it != ours.end();)
+				{
+					auto base_it = base_object->find(it.key());
+					if (theirs.contains(it.key()) || base_it == base_object->end())
+					{
+						++it;
+						continue;
+					}
+
+					if (context.Base.Hash(*base_it) == context.Ours.Hash(*it))
+					{
+						/// They deleted it, we didn't change it
+						it = ours.erase(it);
+						++stats.SubtreesTaken;
+					}
+					else
+					{
+						/// They deleted it, we changed it
+						context.Report.Conflicts.push_back({ (path / it.key()).to_string(), *it, json{}, *base_it });
+						++it;
+					}
+				}
+			}
+			return;
+		}
+
+		if (ours.is_array() && theirs.is_array() && ours.size() == theirs.size() && (!base || (base->is_array() && base->size() == ours.size())))
+		{
+			for (size_t i = 0; i < ours.size(); ++i)
+				MergeValues(ours[i], theirs[i], base ? &(*base)[i] : nullptr, path / i, context);
+			return;
+		}
+
+		context.Report.Conflicts.push_back({ path.to_string(), ours, theirs, base ? *base : json{} });
+	}
+
+}
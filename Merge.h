@@ -0,0 +1,58 @@
+#pragma once
+
+namespace dtmdl
+{
+	/// Merkle-style hashes of JSON values: the hash of an array or object is made from the hashes of its elements, and is
+	/// cached, so once a value has been hashed, comparing any of its subtrees to another hashed subtree is O(1).
+	/// Values must not be changed or destroyed while their hashes are cached.
+	struct StructuralHasher
+	{
+		uint64_t Hash(json const& value);
+
+		void Clear() { mCache.clear(); }
+
+	private:
+
+		/// Only arrays and objects are cached; scalars are cheap enough to hash again
+		unordered_map<json const*, uint64_t> mCache;
+	};
+
+	struct MergeConflict
+	{
+		string Path; /// JSON pointer into the data store's storage
+		json Ours; /// null if we deleted the value
+		json Theirs; /// null if they deleted the value
+		json Base; /// null if there was no common ancestor, or the value wasn't in it
+	};
+
+	struct MergeStats
+	{
+		size_t SubtreesSkipped = 0; /// identical on both sides, or changed only on our side
+		size_t SubtreesTaken = 0; /// changed only on their side, so copied over
+		size_t RowsCompared = 0;
+		chrono::microseconds Duration{};
+	};
+
+	struct MergeReport
+	{
+		vector<MergeConflict> Conflicts;
+		MergeStats Stats;
+
+		void Append(MergeReport&& other);
+	};
+
+	/// One merge of one part of a data store; the hashers cache hashes of values on each side
+	struct MergeContext
+	{
+		StructuralHasher Ours;
+		StructuralHasher Theirs;
+		StructuralHasher Base;
+		MergeReport Report;
+	};
+
+	/// Three-way merges `theirs` into `ours`, given their common ancestor `base` (or two-way, if `base` is null).
+	/// Changes made on only one side are kept; changes made to the same value on both sides are conflicts, in which case our value is kept.
+	/// Arrays are merged element by element only if they have the same size on every side; otherwise changing them on both sides is a conflict.
+	/// NOTE: Hashes of our values are only looked up before the values are changed, so `context.Ours` can be reused while merging
+	void MergeValues(json& ours, json const& theirs, json const* base, json::json_pointer const& path, MergeContext& context);
+}
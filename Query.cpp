@@ -0,0 +1,1047 @@
+#include "pch.h"
+
+#include "Query.h"
+#include "DataStore.h"
+#include "Values.h"
+
+namespace dtmdl
+{
+
+	json const& Query::FieldAccess::Get(json const& row) const
+	{
+		if (row.is_object())
+		{
+			if (auto it = row.find(Key); it != row.end())
+				return *it;
+		}
+		return Default;
+	}
+
+	bool Query::Expression::Test(json const& row) const
+	{
+		switch (Op)
+		{
+		case Operation::Field:
+		case Operation::Literal:
+		{
+			auto& value = Get(row);
+			return value.is_boolean() && value.get<bool>();
+		}
+		case Operation::Not: return !Operands[0].Test(row);
+		case Operation::And: return ranges::all_of(Operands, [&](Expression const& e) { return e.Test(row); });
+		case Operation::Or: return ranges::any_of(Operands, [&](Expression const& e) { return e.Test(row); });
+		case Operation::Equal: return Operands[0].Get(row) == Operands[1].Get(row);
+		case Operation::NotEqual: return Operands[0].Get(row) != Operands[1].Get(row);
+		case Operation::Less: return Operands[0].Get(row) < Operands[1].Get(row);
+		case Operation::LessEqual: return Operands[0].Get(row) <= Operands[1].Get(row);
+		case Operation::Greater: return Operands[0].Get(row) > Operands[1].Get(row);
+		case Operation::GreaterEqual: return Operands[0].Get(row) >= Operands[1].Get(row);
+		}
+		return false;
+	}
+
+	/// Parsing
+
+	namespace
+	{
+		struct Token
+		{
+			enum class Kind { End, Identifier, Number, String, Symbol };
+			Kind Type = Kind::End;
+			string_view Text;
+			json Value; /// for numbers and strings
+		};
+
+		struct QueryParser
+		{
+			Schema const& mSchema;
+			string_view mSource;
+			vector<Token> mTokens;
+			size_t mPosition = 0;
+			Query mQuery;
+
+			result<void, string> Tokenize();
+
+			Token const& Peek() const { return mTokens[mPosition]; }
+			Token const& Next() { auto& result = mTokens[mPosition]; if (result.Type != Token::Kind::End) ++mPosition; return result; }
+
+			bool IsKeyword(Token const& token, string_view keyword) const
+			{
+				return token.Type == Token::Kind::Identifier && string_ops::ascii::strings_equal_ignore_case(token.Text, keyword);
+			}
+			bool AcceptKeyword(string_view keyword) { if (!IsKeyword(Peek(), keyword)) return false; Next(); return true; }
+			bool AcceptSymbol(string_view symbol) { if (Peek().Type != Token::Kind::Symbol || Peek().Text != symbol) return false; Next(); return true; }
+
+			result<void, string> ExpectKeyword(string_view keyword)
+			{
+				if (!AcceptKeyword(keyword))
+					return failure(format("expected '{}', got '{}'", keyword, Describe(Peek())));
+				return success();
+			}
+			result<void, string> ExpectSymbol(string_view symbol)
+			{
+				if (!AcceptSymbol(symbol))
+					return failure(format("expected '{}', got '{}'", symbol, Describe(Peek())));
+				return success();
+			}
+
+			static string Describe(Token const& token) { return token.Type == Token::Kind::End ? string{ "end of query" } : string{ token.Text }; }
+
+			result<Query::FieldAccess, string> ResolveField(string_view name) const;
+			result<Query::Column, string> ParseColumn();
+			result<Query::Expression, string> ParseOr();
+			result<Query::Expression, string> ParseAnd();
+			result<Query::Expression, string> ParseNot();
+			result<Query::Expression, string> ParseComparison();
+			result<Query::Expression, string> ParseOperand();
+			result<size_t, string> ParseCount();
+			result<void, string> Parse();
+		};
+
+		result<void, string> QueryParser::Tokenize()
+		{
+			using namespace string_ops::ascii;
+
+			auto text = mSource;
+			while (true)
+			{
+				while (!text.empty() && isspace(text[0]))
+					text.remove_prefix(1);
+				if (text.empty())
+					break;
+
+				Token token;
+				if (isalpha(text[0]) || text[0] == '_')
+				{
+					size_t length = 1;
+					while (length < text.size() && isident(text[length]))
+						++length;
+					token.Type = Token::Kind::Identifier;
+					token.Text = text.substr(0, length);
+				}
+				else if (isdigit(text[0]) || (text[0] == '-' && text.size() > 1 && isdigit(text[1])))
+				{
+					size_t length = 1;
+					bool is_float = false;
+					while (length < text.size() && (isdigit(text[length]) || text[length] == '.' || text[length] == 'e' || text[length] == 'E'))
+					{
+						is_float |= !isdigit(text[length]);
+						++length;
+					}
+					token.Type = Token::Kind::Number;
+					token.Text = text.substr(0, length);
+					auto const begin = token.Text.data(), end = token.Text.data() + token.Text.size();
+					if (is_float)
+					{
+						double value{};
+						if (from_chars(begin, end, value).ptr != end)
+							return failure(format("invalid number '{}'", token.Text));
+						token.Value = value;
+					}
+					else if (token.Text[0] == '-')
+					{
+						int64_t value{};
+						if (from_chars(begin, end, value).ptr != end)
+							return failure(format("invalid number '{}'", token.Text));
+						token.Value = value;
+					}
+					else
+					{
+						uint64_t value{};
+						if (from_chars(begin, end, value).ptr != end)
+							return failure(format("invalid number '{}'", token.Text));
+						token.Value = value;
+					}
+				}
+				else if (text[0] == '"' || text[0] == '\'')
+				{
+					auto const quote = text[0];
+					string value;
+					size_t length = 1;
+					for (; length < text.size() && text[length] != quote; ++length)
+					{
+						if (text[length] == '\\' && length + 1 < text.size())
+							++length;
+						value += text[length];
+					}
+					if (length == text.size())
+						return failure("unterminated string");
+					token.Type = Token::Kind::String;
+					token.Text = text.substr(0, length + 1);
+					token.Value = move(value);
+				}
+				else
+				{
+					static constexpr string_view symbols[] = { "==", "!=", "<>", "<=", ">=", "<", ">", "=", "(", ")", ",", "*" };
+					auto symbol = ranges::find_if(symbols, [&](string_view symbol) { return text.starts_with(symbol); });
+					if (symbol == ranges::end(symbols))
+						return failure(format("unexpected character '{}'", text[0]));
+					token.Type = Token::Kind::Symbol;
+					token.Text = text.substr(0, symbol->size());
+				}
+
+				text.remove_prefix(token.Text.size());
+				mTokens.push_back(move(token));
+			}
+			mTokens.emplace_back();
+			return success();
+		}
+
+		result<Query::FieldAccess, string> QueryParser::ResolveField(string_view name) const
+		{
+			auto field = mQuery.Record->OwnOrBaseField(name);
+			if (!field)
+				return failure(format("record '{}' has no field named '{}'", mQuery.Record->Name(), name));
+
+			Query::FieldAccess access{ .Field = field, .Key = field->StorageKey() };
+			ignore = InitializeValue(field->FieldType, access.Default);
+			return success(move(access));
+		}
+
+		result<Query::Column, string> QueryParser::ParseColumn()
+		{
+			auto& name_token = Next();
+			if (name_token.Type != Token::Kind::Identifier)
+				return failure(format("expected a field name or aggregate, got '{}'", Describe(name_token)));
+
+			if (!AcceptSymbol("("))
+			{
+				auto field = ResolveField(name_token.Text);
+				if (field.has_error())
+					return failure(move(field).error());
+				return Query::Column{ .Label = field.value().Field->Name, .Field = move(field).value() };
+			}
+
+			static constexpr pair<string_view, Query::Aggregate> aggregates[] = {
+				{ "count", Query::Aggregate::Count },
+				{ "sum", Query::Aggregate::Sum },
+				{ "min", Query::Aggregate::Min },
+				{ "max", Query::Aggregate::Max },
+				{ "avg", Query::Aggregate::Avg },
+			};
+			auto aggregate = ranges::find_if(aggregates, [&](auto const& agg) { return IsKeyword(name_token, agg.first); });
+			if (aggregate == ranges::end(aggregates))
+				return failure(format("unknown aggregate function '{}'", name_token.Text));
+
+			Query::Column column{ .Function = aggregate->second };
+			if (Peek().Type == Token::Kind::Identifier)
+			{
+				auto field = ResolveField(Next().Text);
+				if (field.has_error())
+					return failure(move(field).error());
+				column.Field = move(field).value();
+			}
+			else if (column.Function != Query::Aggregate::Count)
+				return failure(format("aggregate function '{}' needs a field", aggregate->first));
+			if (auto result = ExpectSymbol(")"); result.has_error())
+				return failure(move(result).error());
+
+			column.Label = format("{}({})", aggregate->first, column.Field.Field ? column.Field.Field->Name : string{});
+			return column;
+		}
+
+		result<Query::Expression, string> QueryParser::ParseOr()
+		{
+			auto left = ParseAnd();
+			if (left.has_error() || !IsKeyword(Peek(), "or"))
+				return left;
+
+			Query::Expression result{ .Op = Query::Operation::Or };
+			result.Operands.push_back(move(left).value());
+			while (AcceptKeyword("or"))
+			{
+				auto right = ParseAnd();
+				if (right.has_error())
+					return right;
+				result.Operands.push_back(move(right).value());
+			}
+			return result;
+		}
+
+		result<Query::Expression, string> QueryParser::ParseAnd()
+		{
+			auto left = ParseNot();
+			if (left.has_error() || !IsKeyword(Peek(), "and"))
+				return left;
+
+			Query::Expression result{ .Op = Query::Operation::And };
+			result.Operands.push_back(move(left).value());
+			while (AcceptKeyword("and"))
+			{
+				auto right = ParseNot();
+				if (right.has_error())
+					return right;
+				result.Operands.push_back(move(right).value());
+			}
+			return result;
+		}
+
+		result<Query::Expression, string> QueryParser::ParseNot()
+		{
+			if (!AcceptKeyword("not"))
+				return ParseComparison();
+
+			auto operand = ParseNot();
+			if (operand.has_error())
+				return operand;
+			Query::Expression result{ .Op = Query::Operation::Not };
+			result.Operands.push_back(move(operand).value());
+			return result;
+		}
+
+		/// Identifiers that aren't fields are kept as "bareword" literals, so they can be resolved to enumerator names
+		static bool IsBareword(Query::Expression const& e) { return e.Op == Query::Operation::Literal && e.Value.is_object() && e.Value.contains("bareword"); }
+
+		result<Query::Expression, string> QueryParser::ParseComparison()
+		{
+			auto left = ParseOperand();
+			if (left.has_error())
+				return left;
+
+			static constexpr pair<string_view, Query::Operation> operators[] = {
+				{ "==", Query::Operation::Equal }, { "=", Query::Operation::Equal },
+				{ "!=", Query::Operation::NotEqual }, { "<>", Query::Operation::NotEqual },
+				{ "<", Query::Operation::Less }, { "<=", Query::Operation::LessEqual },
+				{ ">", Query::Operation::Greater }, { ">=", Query::Operation::GreaterEqual },
+			};
+			auto op = Peek().Type == Token::Kind::Symbol ? ranges::find_if(operators, [&](auto const& op) { return op.first == Peek().Text; }) : ranges::end(operators);
+			if (op == ranges::end(operators))
+			{
+				if (IsBareword(left.value()))
+					return failure(format("record '{}' has no field named '{}'", mQuery.Record->Name(), left.value().Value["bareword"].get<string>()));
+				return left;
+			}
+			Next();
+
+			auto right = ParseOperand();
+			if (right.has_error())
+				return right;
+
+			Query::Expression result{ .Op = op->second };
+			result.Operands.push_back(move(left).value());
+			result.Operands.push_back(move(right).value());
+
+			if (ranges::any_of(result.Operands, [](Query::Expression const& e) { return e.Op != Query::Operation::Field && e.Op != Query::Operation::Literal; }))
+				return failure("only fields and values can be compared");
+
+			/// Names compared against enum fields are enumerator names
+			for (size_t i = 0; i < 2; ++i)
+			{
+				auto& side = result.Operands[i];
+				auto& other = result.Operands[1 - i];
+				if (!IsBareword(side) && !(side.Op == Query::Operation::Literal && side.Value.is_string()))
+					continue;
+				auto name = IsBareword(side) ? side.Value["bareword"].get<string>() : side.Value.get<string>();
+				auto enoom = other.Op == Query::Operation::Field ? other.Field.Field->FieldType->AsEnum() : nullptr;
+				if (enoom)
+				{
+					auto enumerator = enoom->Enumerator(name);
+					if (!enumerator)
+						return failure(format("enum '{}' has no enumerator named '{}'", enoom->Name(), name));
+					side.Value = enumerator->ActualValue();
+				}
+				else if (IsBareword(side))
+					return failure(format("record '{}' has no field named '{}'", mQuery.Record->Name(), name));
+			}
+
+			return result;
+		}
+
+		result<Query::Expression, string> QueryParser::ParseOperand()
+		{
+			if (AcceptSymbol("("))
+			{
+				auto result = ParseOr();
+				if (result.has_error())
+					return result;
+				if (auto closed = ExpectSymbol(")"); closed.has_error())
+					return failure(move(closed).error());
+				return result;
+			}
+
+			auto& token = Next();
+			switch (token.Type)
+			{
+			case Token::Kind::Number:
+			case Token::Kind::String:
+				return Query::Expression{ .Op = Query::Operation::Literal, .Value = token.Value };
+			case Token::Kind::Identifier:
+				if (IsKeyword(token, "true")) return Query::Expression{ .Op = Query::Operation::Literal, .Value = true };
+				if (IsKeyword(token, "false")) return Query::Expression{ .Op = Query::Operation::Literal, .Value = false };
+				if (IsKeyword(token, "null")) return Query::Expression{ .Op = Query::Operation::Literal, .Value = json{} };
+				if (mQuery.Record->OwnOrBaseField(token.Text))
+				{
+					auto field = ResolveField(token.Text);
+					if (field.has_error())
+						return failure(move(field).error());
+					return Query::Expression{ .Op = Query::Operation::Field, .Field = move(field).value() };
+				}
+				return Query::Expression{ .Op = Query::Operation::Literal, .Value = json::object({ { "bareword", token.Text } }) };
+			default:
+				return failure(format("expected a field or value, got '{}'", Describe(token)));
+			}
+		}
+
+		result<size_t, string> QueryParser::ParseCount()
+		{
+			auto& token = Next();
+			if (token.Type != Token::Kind::Number || !token.Value.is_number_unsigned())
+				return failure(format("expected a non-negative integer, got '{}'", Describe(token)));
+			return token.Value.get<size_t>();
+		}
+
+		result<void, string> QueryParser::Parse()
+		{
+			if (auto result = Tokenize(); result.has_error())
+				return result;
+
+			if (auto result = ExpectKeyword("select"); result.has_error())
+				return result;
+
+			/// Columns come before the record name, so we need to skip ahead to find out which record we're selecting from
+			auto const columns_start = mPosition;
+			while (Peek().Type != Token::Kind::End && !IsKeyword(Peek(), "from"))
+				Next();
+			if (auto result = ExpectKeyword("from"); result.has_error())
+				return result;
+			auto& record_name = Next();
+			auto type = record_name.Type == Token::Kind::Identifier ? mSchema.ResolveType(record_name.Text) : nullptr;
+			if (!type || !type->IsRecord())
+				return failure(format("'{}' is not a struct or class", Describe(record_name)));
+			mQuery.Record = type->AsRecord();
+			auto const after_from = mPosition;
+
+			mPosition = columns_start;
+			if (AcceptSymbol("*"))
+			{
+				for (auto field : mQuery.Record->AllFieldsOrdered())
+				{
+					auto access = ResolveField(field->Name);
+					if (access.has_error())
+						return failure(move(access).error());
+					mQuery.Columns.push_back({ .Label = field->Name, .Field = move(access).value() });
+				}
+			}
+			else
+			{
+				do
+				{
+					auto column = ParseColumn();
+					if (column.has_error())
+						return failure(move(column).error());
+					mQuery.Columns.push_back(move(column).value());
+				} while (AcceptSymbol(","));
+			}
+			if (!IsKeyword(Peek(), "from"))
+				return failure(format("expected 'from', got '{}'", Describe(Peek())));
+			mPosition = after_from;
+
+			if (AcceptKeyword("where"))
+			{
+				auto where = ParseOr();
+				if (where.has_error())
+					return failure(move(where).error());
+				mQuery.Where = move(where).value();
+			}
+
+			if (AcceptKeyword("group"))
+			{
+				if (auto result = ExpectKeyword("by"); result.has_error())
+					return result;
+				auto field = ResolveField(Next().Text);
+				if (field.has_error())
+					return failure(move(field).error());
+				mQuery.GroupBy = move(field).value();
+			}
+
+			if (mQuery.IsAggregating())
+			{
+				for (auto& column : mQuery.Columns)
+				{
+					if (column.Function == Query::Aggregate::None && (!mQuery.GroupBy || mQuery.GroupBy->Field != column.Field.Field))
+						return failure(format("column '{}' must be aggregated or be the grouping field", column.Label));
+				}
+			}
+
+			if (AcceptKeyword("order"))
+			{
+				if (auto result = ExpectKeyword("by"); result.has_error())
+					return result;
+				do
+				{
+					auto column = ParseColumn();
+					if (column.has_error())
+						return failure(move(column).error());
+					auto function = column.value().Function;
+					Query::OrderItem item{ .Label = column.value().Label, .Field = move(column).value().Field };
+					if (mQuery.IsAggregating())
+					{
+						if (ranges::find(mQuery.Columns, item.Label, &Query::Column::Label) == mQuery.Columns.end())
+							return failure(format("cannot order by '{}' as it is not one of the selected columns", item.Label));
+					}
+					else if (function != Query::Aggregate::None)
+						return failure(format("cannot order by '{}' in a query that doesn't aggregate", item.Label));
+
+					if (AcceptKeyword("desc"))
+						item.Descending = true;
+					else
+						AcceptKeyword("asc");
+					mQuery.OrderBy.push_back(move(item));
+				} while (AcceptSymbol(","));
+			}
+
+			if (AcceptKeyword("limit"))
+			{
+				auto limit = ParseCount();
+				if (limit.has_error())
+					return failure(move(limit).error());
+				mQuery.Limit = limit.value();
+			}
+
+			if (AcceptKeyword("offset"))
+			{
+				auto offset = ParseCount();
+				if (offset.has_error())
+					return failure(move(offset).error());
+				mQuery.Offset = offset.value();
+			}
+
+			if (Peek().Type != Token::Kind::End)
+				return failure(format("unexpected '{}'", Describe(Peek())));
+
+			return success();
+		}
+	}
+
+	result<Query, string> ParseQuery(Schema const& schema, string_view text)
+	{
+		QueryParser parser{ schema, text };
+		if (auto result = parser.Parse(); result.has_error())
+			return failure(move(result).error());
+		return move(parser.mQuery);
+	}
+
+	/// Execution
+
+	namespace
+	{
+		/// Scans at least this big are filtered in parallel
+		static constexpr size_t ParallelScanThreshold = 16 * 1024;
+		/// Unordered results are streamed in chunks of this many scanned rows
+		static constexpr size_t StreamChunkSize = 256 * 1024;
+
+		vector<json const*> FilterRows(span<json const* const> rows, optional<Query::Expression> const& where)
+		{
+			if (!where)
+				return { rows.begin(), rows.end() };
+
+			vector<char> matches(rows.size());
+			auto test = [&](json const* row) -> char { return where->Test(*row); };
+			if (rows.size() >= ParallelScanThreshold)
+				transform(execution::par, rows.begin(), rows.end(), matches.begin(), test);
+			else
+				transform(rows.begin(), rows.end(), matches.begin(), test);
+
+			vector<json const*> result;
+			for (size_t i = 0; i < rows.size(); ++i)
+				if (matches[i])
+					result.push_back(rows[i]);
+			return result;
+		}
+
+		/// Result values are exported the same way as data store values, so enumerators are shown by name, etc.
+		json ExportCell(TypeReference const& type, json value)
+		{
+			if (!type->IsBuiltIn() || !type->TemplateParameters().empty())
+			{
+				ResolveEnumNames(type, value);
+				ResolveFieldNames(type, value);
+			}
+			return value;
+		}
+
+		json ProjectRow(Query const& query, json const& row)
+		{
+			json result = json::object();
+			for (auto& column : query.Columns)
+				result[column.Label] = ExportCell(column.Field.Field->FieldType, column.Field.Get(row));
+			return result;
+		}
+
+		struct AggregateState
+		{
+			size_t Count = 0;
+			int64_t IntegerSum = 0;
+			double FloatSum = 0;
+			bool IsFloat = false;
+			json Min, Max;
+
+			void Add(json const& value)
+			{
+				++Count;
+				if (value.is_number_integer())
+				{
+					IntegerSum += value.get<int64_t>();
+					FloatSum += value.get<double>();
+				}
+				else if (value.is_number())
+				{
+					IsFloat = true;
+					FloatSum += value.get<double>();
+				}
+				if (Min.is_null() || value < Min)
+					Min = value;
+				if (Max.is_null() || Max < value)
+					Max = value;
+			}
+
+			json Result(Query::Aggregate function) const
+			{
+				switch (function)
+				{
+				case Query::Aggregate::Count: return Count;
+				case Query::Aggregate::Sum: return IsFloat ? json(FloatSum) : json(IntegerSum);
+				case Query::Aggregate::Min: return Min;
+				case Query::Aggregate::Max: return Max;
+				case Query::Aggregate::Avg: return Count ? json(FloatSum / double(Count)) : json{};
+				}
+				return {};
+			}
+		};
+
+		template <typename GET_KEY>
+		void SortRows(auto& rows, vector<Query::OrderItem> const& order_by, optional<size_t> keep, GET_KEY&& get_key)
+		{
+			auto less = [&](auto const& a, auto const& b) {
+				for (auto& item : order_by)
+				{
+					auto& key_a = get_key(a, item);
+					auto& key_b = get_key(b, item);
+					if (key_a == key_b)
+						continue;
+					return item.Descending ? key_b < key_a : key_a < key_b;
+				}
+				return false;
+			};
+
+			/// When only the first few rows are needed, there's no need to sort all of them
+			if (keep && *keep < rows.size())
+				partial_sort(rows.begin(), rows.begin() + *keep, rows.end(), less);
+			else if (rows.size() >= ParallelScanThreshold)
+				stable_sort(execution::par, rows.begin(), rows.end(), less);
+			else
+				stable_sort(rows.begin(), rows.end(), less);
+		}
+
+		void CollectKeys(Query::Expression const& expression, set<string>& keys)
+		{
+			if (expression.Op == Query::Operation::Field)
+				keys.insert(expression.Field.Key);
+			for (auto& operand : expression.Operands)
+				CollectKeys(operand, keys);
+		}
+
+		vector<TableColumn const*> QueriedColumns(Query const& query, Table const& table)
+		{
+			set<string> keys;
+			for (auto& column : query.Columns)
+				if (column.Field.Field)
+					keys.insert(column.Field.Key);
+			if (query.Where)
+				CollectKeys(*query.Where, keys);
+			if (query.GroupBy)
+				keys.insert(query.GroupBy->Key);
+			for (auto& item : query.OrderBy)
+				if (item.Field.Field)
+					keys.insert(item.Field.Key);
+
+			vector<TableColumn const*> result;
+			for (auto& key : keys)
+				if (auto column = table.Column(key))
+					result.push_back(column);
+			return result;
+		}
+
+		optional<size_t> RowsToKeep(Query const& query)
+		{
+			if (query.Limit)
+				return query.Offset + *query.Limit;
+			return nullopt;
+		}
+
+		/// Emits rows[offset, offset+limit) and returns the number of rows emitted
+		template <typename ROWS, typename PROJECT>
+		size_t Emit(Query const& query, ROWS const& rows, PROJECT&& project, QueryRowFunc const& row_func)
+		{
+			size_t emitted = 0;
+			for (size_t i = query.Offset; i < rows.size(); ++i)
+			{
+				if (query.Limit && emitted >= *query.Limit)
+					break;
+				++emitted;
+				if (!row_func(project(rows[i])))
+					break;
+			}
+			return emitted;
+		}
+
+		/// A `where` expression bound to the columns of a table, so a row can be tested on its cells without building the row object
+		struct CellTest
+		{
+			Query::Operation Op = Query::Operation::Literal;
+			TableColumn const* Column = nullptr; /// for Operation::Field, if the table has a column for the field
+			json const* Value = nullptr; /// the literal, or the default value of a field the table has no column for
+			vector<CellTest> Operands;
+
+			CellTest(Query::Expression const& expression, Table const& table)
+				: Op(expression.Op)
+			{
+				if (Op == Query::Operation::Field)
+					Column = table.Column(expression.Field.Key);
+				if (!Column)
+					Value = Op == Query::Operation::Field ? &expression.Field.Default : &expression.Value;
+				for (auto& operand : expression.Operands)
+					Operands.emplace_back(operand, table);
+			}
+
+			template <typename FUNC>
+			bool WithValue(size_t position, FUNC&& func) const
+			{
+				if (Column)
+					return func(Column->Get(position));
+				return func(*Value);
+			}
+
+			/// Same as Query::Expression::Test
+			bool Test(size_t position) const
+			{
+				switch (Op)
+				{
+				case Query::Operation::Field:
+				case Query::Operation::Literal: return WithValue(position, [](json const& value) { return value.is_boolean() && value.get<bool>(); });
+				case Query::Operation::Not: return !Operands[0].Test(position);
+				case Query::Operation::And: return ranges::all_of(Operands, [&](CellTest const& e) { return e.Test(position); });
+				case Query::Operation::Or: return ranges::any_of(Operands, [&](CellTest const& e) { return e.Test(position); });
+				default: break;
+				}
+
+				return Operands[0].WithValue(position, [&](json const& a) {
+					return Operands[1].WithValue(position, [&](json const& b) {
+						switch (Op)
+						{
+						case Query::Operation::Equal: return a == b;
+						case Query::Operation::NotEqual: return a != b;
+						case Query::Operation::Less: return a < b;
+						case Query::Operation::LessEqual: return a <= b;
+						case Query::Operation::Greater: return a > b;
+						case Query::Operation::GreaterEqual: return a >= b;
+						default: return false;
+						}
+					});
+				});
+			}
+		};
+
+		/// Uses the indices of the fields that the `where` compares to literals (at its top level, or in a top-level `and`)
+		/// to narrow down which rows of the table can match. Returns their positions in ascending order, or nullopt if
+		/// every row has to be tested.
+		optional<vector<size_t>> IndexedPositions(Table const& table, optional<Query::Expression> const& where)
+		{
+			if (!where)
+				return nullopt;
+
+			struct Bounds
+			{
+				json const* From = nullptr;
+				json const* To = nullptr;
+				bool FromInclusive = true;
+				bool ToInclusive = true;
+
+				void SetFrom(json const& value, bool inclusive)
+				{
+					if (!From || *From < value || (*From == value && !inclusive))
+					{
+						From = &value;
+						FromInclusive = inclusive;
+					}
+				}
+				void SetTo(json const& value, bool inclusive)
+				{
+					if (!To || value < *To || (*To == value && !inclusive))
+					{
+						To = &value;
+						ToInclusive = inclusive;
+					}
+				}
+			};
+			map<TableColumn const*, Bounds> bounds;
+
+			auto conjuncts = where->Op == Query::Operation::And ? span<Query::Expression const>{ where->Operands } : span<Query::Expression const>{ &*where, 1 };
+			for (auto& conjunct : conjuncts)
+			{
+				if (conjunct.Operands.size() != 2)
+					continue;
+
+				auto op = conjunct.Op;
+				auto field = &conjunct.Operands[0];
+				auto literal = &conjunct.Operands[1];
+				if (field->Op != Query::Operation::Field)
+				{
+					/// `5 < X` is `X > 5`
+					swap(field, literal);
+					switch (op)
+					{
+					case Query::Operation::Less: op = Query::Operation::Greater; break;
+					case Query::Operation::LessEqual: op = Query::Operation::GreaterEqual; break;
+					case Query::Operation::Greater: op = Query::Operation::Less; break;
+					case Query::Operation::GreaterEqual: op = Query::Operation::LessEqual; break;
+					default: break;
+					}
+				}
+				if (field->Op != Query::Operation::Field || literal->Op != Query::Operation::Literal)
+					continue;
+
+				auto column = table.Column(field->Field.Key);
+				if (!column || !column->HasIndex())
+					continue;
+
+				auto& value = literal->Value;
+				switch (op)
+				{
+				case Query::Operation::Equal: bounds[column].SetFrom(value, true); bounds[column].SetTo(value, true); break;
+				case Query::Operation::Less: bounds[column].SetTo(value, false); break;
+				case Query::Operation::LessEqual: bounds[column].SetTo(value, true); break;
+				case Query::Operation::Greater: bounds[column].SetFrom(value, false); break;
+				case Query::Operation::GreaterEqual: bounds[column].SetFrom(value, true); break;
+				default: break;
+				}
+			}
+
+			/// Each column's rows are a superset of the matching rows, so their intersection is too
+			optional<vector<int64_t>> row_ids;
+			for (auto& [column, bound] : bounds)
+			{
+				auto found = column->FindInIndex(bound.From, bound.FromInclusive, bound.To, bound.ToInclusive);
+				if (!found)
+					continue;
+				if (!row_ids)
+					row_ids = move(*found);
+				else
+				{
+					vector<int64_t> both;
+					ranges::set_intersection(*row_ids, *found, back_inserter(both));
+					row_ids = move(both);
+				}
+			}
+			if (!row_ids)
+				return nullopt;
+
+			vector<size_t> result;
+			result.reserve(row_ids->size());
+			for (auto row_id : *row_ids)
+			{
+				if (auto position = table.PositionOf(row_id))
+					result.push_back(*position);
+			}
+			return result;
+		}
+
+		/// Finds the rows that match the query's `where`, a chunk of scanned rows at a time (see StreamChunkSize).
+		/// Table rows are narrowed down with indices where possible (see IndexedPositions) and tested on their cells;
+		/// only the ones that match are built into row objects, with just the columns the query looks at.
+		struct MatchScanner
+		{
+			MatchScanner(DataStore const& store, Query const& query, QueryStats& stats)
+				: mQuery(query), mStats(stats), mObjects(store.ObjectsWithTypeName(query.Record->Name())), mTable(store.FindTable(query.Record->Name()))
+			{
+				if (mTable)
+				{
+					mColumns = QueriedColumns(query, *mTable);
+					if (query.Where)
+						mTest.emplace(*query.Where, *mTable);
+					mPositions = IndexedPositions(*mTable, query.Where);
+				}
+			}
+
+			/// Replaces `matched` with the matching rows of the next chunk; returns false once everything was scanned
+			bool Next(vector<json const*>& matched)
+			{
+				if (mNextObject < mObjects.size())
+				{
+					auto chunk = span<json const* const>{ mObjects }.subspan(mNextObject, min(StreamChunkSize, mObjects.size() - mNextObject));
+					mNextObject += chunk.size();
+					mStats.RowsScanned += chunk.size();
+					matched = FilterRows(chunk, mQuery.Where);
+					mStats.RowsMatched += matched.size();
+					return true;
+				}
+
+				if (!mTable)
+					return false;
+				auto const total = mPositions ? mPositions->size() : mTable->RowCount();
+				if (mNextPosition >= total)
+					return false;
+
+				vector<size_t> positions(min(StreamChunkSize, total - mNextPosition));
+				for (size_t i = 0; i < positions.size(); ++i)
+					positions[i] = mPositions ? (*mPositions)[mNextPosition + i] : mNextPosition + i;
+				mNextPosition += positions.size();
+				mStats.RowsScanned += positions.size();
+
+				if (mTest)
+				{
+					vector<char> matches(positions.size());
+					auto test = [&](size_t position) -> char { return mTest->Test(position); };
+					if (positions.size() >= ParallelScanThreshold)
+						transform(execution::par, positions.begin(), positions.end(), matches.begin(), test);
+					else
+						transform(positions.begin(), positions.end(), matches.begin(), test);
+					size_t kept = 0;
+					for (size_t i = 0; i < positions.size(); ++i)
+						if (matches[i])
+							positions[kept++] = positions[i];
+					positions.resize(kept);
+				}
+				mStats.RowsMatched += positions.size();
+
+				auto& rows = mBuiltRows.emplace_back(positions.size());
+				auto build_row = [&](size_t const& position) { rows[&position - positions.data()] = mTable->Row(position, mColumns); };
+				if (positions.size() >= ParallelScanThreshold)
+					for_each(execution::par, positions.begin(), positions.end(), build_row);
+				else
+					for_each(positions.begin(), positions.end(), build_row);
+
+				matched.clear();
+				for (auto& row : rows)
+					matched.push_back(&row);
+				return true;
+			}
+
+			/// Rows built for the chunks matched so far stay alive until this is called
+			void DropBuiltRows() { mBuiltRows.clear(); }
+
+		private:
+
+			Query const& mQuery;
+			QueryStats& mStats;
+
+			vector<json const*> mObjects;
+			size_t mNextObject = 0;
+
+			Table const* mTable = nullptr;
+			vector<TableColumn const*> mColumns;
+			optional<CellTest> mTest;
+			optional<vector<size_t>> mPositions; /// unset if every row has to be tested
+			size_t mNextPosition = 0;
+			/// One vector per chunk, so building the rows of a chunk doesn't move those of earlier ones
+			vector<vector<json>> mBuiltRows;
+		};
+	}
+
+	result<QueryStats, string> RunQuery(DataStore const& store, Query const& query, QueryRowFunc const& row_func)
+	{
+		if (!query.Record)
+			return failure("query has no record type");
+
+		auto const start = chrono::steady_clock::now();
+		QueryStats stats;
+
+		MatchScanner scanner{ store, query, stats };
+		vector<json const*> chunk;
+
+		if (query.IsAggregating())
+		{
+			static json const no_group;
+			map<json, vector<AggregateState>> groups;
+			if (!query.GroupBy)
+				groups[no_group].resize(query.Columns.size());
+			while (scanner.Next(chunk))
+			{
+				for (auto row : chunk)
+				{
+					auto& group = groups[query.GroupBy ? query.GroupBy->Get(*row) : no_group];
+					group.resize(query.Columns.size());
+					for (size_t i = 0; i < query.Columns.size(); ++i)
+					{
+						auto& column = query.Columns[i];
+						if (column.Function == Query::Aggregate::Count && !column.Field.Field)
+							++group[i].Count;
+						else if (column.Function != Query::Aggregate::None)
+							group[i].Add(column.Field.Get(*row));
+					}
+				}
+				scanner.DropBuiltRows();
+			}
+
+			vector<json> results;
+			for (auto& [key, states] : groups)
+			{
+				json row = json::object();
+				for (size_t i = 0; i < query.Columns.size(); ++i)
+				{
+					auto& column = query.Columns[i];
+					if (column.Function == Query::Aggregate::None)
+						row[column.Label] = ExportCell(column.Field.Field->FieldType, key);
+					else if (column.Function == Query::Aggregate::Min || column.Function == Query::Aggregate::Max)
+						row[column.Label] = ExportCell(column.Field.Field->FieldType, states[i].Result(column.Function));
+					else
+						row[column.Label] = states[i].Result(column.Function);
+				}
+				results.push_back(move(row));
+			}
+
+			SortRows(results, query.OrderBy, RowsToKeep(query), [](json const& row, Query::OrderItem const& item) -> json const& { return row[item.Label]; });
+			stats.RowsReturned = Emit(query, results, [](json const& row) -> json const& { return row; }, row_func);
+		}
+		else if (!query.OrderBy.empty())
+		{
+			vector<json const*> matched;
+			while (scanner.Next(chunk))
+				matched.insert(matched.end(), chunk.begin(), chunk.end());
+
+			SortRows(matched, query.OrderBy, RowsToKeep(query), [](json const* row, Query::OrderItem const& item) -> json const& { return item.Field.Get(*row); });
+			stats.RowsReturned = Emit(query, matched, [&](json const* row) { return ProjectRow(query, *row); }, row_func);
+		}
+		else
+		{
+			/// Nothing needs to see all the rows first, so stream the results chunk by chunk
+			size_t to_skip = query.Offset;
+			bool done = false;
+			while (!done && scanner.Next(chunk))
+			{
+				for (auto row : chunk)
+				{
+					if (to_skip)
+					{
+						--to_skip;
+						continue;
+					}
+					if ((query.Limit && stats.RowsReturned >= *query.Limit))
+					{
+						done = true;
+						break;
+					}
+					++stats.RowsReturned;
+					if (!row_func(ProjectRow(query, *row)))
+					{
+						done = true;
+						break;
+					}
+				}
+				scanner.DropBuiltRows();
+			}
+		}
+
+		stats.Duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		return stats;
+	}
+
+	result<QueryStats, string> RunQuery(DataStore const& store, string_view query_text, QueryRowFunc const& row_func)
+	{
+		auto query = ParseQuery(store.Schema(), query_text);
+		if (query.has_error())
+			return failure(move(query).error());
+		return RunQuery(store, query.value(), row_func);
+	}
+
+}
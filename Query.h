@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	struct DataStore;
+
+	/// A query over all the values of a single record type in a data store, written in a small SQL-like syntax:
+	///		select Name, Weight from Item where Weight > 10 and not Broken order by Name desc limit 100 offset 20
+	///		select Category, count(), avg(Weight) from Item group by Category order by count() desc
+	/// Enum fields can be compared to enumerator names (`where Kind == Sword`).
+	struct Query
+	{
+		enum class Aggregate
+		{
+			None,
+			Count,
+			Sum,
+			Min,
+			Max,
+			Avg,
+		};
+
+		enum class Operation
+		{
+			Field,
+			Literal,
+			Not,
+			And,
+			Or,
+			Equal,
+			NotEqual,
+			Less,
+			LessEqual,
+			Greater,
+			GreaterEqual,
+		};
+
+		/// A field of the queried record, as seen by the query
+		struct FieldAccess
+		{
+			FieldDefinition const* Field = nullptr;
+			string Key; /// see FieldDefinition::StorageKey
+			json Default; /// value used when a record has no data for this field
+
+			json const& Get(json const& row) const;
+		};
+
+		struct Expression
+		{
+			Operation Op = Operation::Literal;
+			FieldAccess Field; /// for Operation::Field
+			json Value; /// for Operation::Literal
+			vector<Expression> Operands;
+
+			bool Test(json const& row) const;
+			json const& Get(json const& row) const { return Op == Operation::Field ? Field.Get(row) : Value; }
+		};
+
+		struct Column
+		{
+			string Label;
+			Aggregate Function = Aggregate::None;
+			FieldAccess Field; /// unset for `count()`
+		};
+
+		struct OrderItem
+		{
+			string Label; /// when grouping, the label of the result column to order by
+			FieldAccess Field; /// when not grouping, the field to order by
+			bool Descending = false;
+		};
+
+		RecordDefinition const* Record = nullptr;
+		vector<Column> Columns;
+		optional<Expression> Where;
+		optional<FieldAccess> GroupBy;
+		vector<OrderItem> OrderBy;
+		optional<size_t> Limit;
+		size_t Offset = 0;
+
+		bool IsAggregating() const noexcept { return GroupBy.has_value() || ranges::any_of(Columns, [](Column const& col) { return col.Function != Aggregate::None; }); }
+	};
+
+	struct QueryStats
+	{
+		size_t RowsScanned = 0;
+		size_t RowsMatched = 0;
+		size_t RowsReturned = 0;
+		chrono::microseconds Duration{};
+	};
+
+	/// Receives result rows, as objects of { column label: value }; return false to stop the query
+	using QueryRowFunc = function<bool(json const&)>;
+
+	result<Query, string> ParseQuery(Schema const& schema, string_view text);
+
+	/// Rows are streamed to `row_func` as they are found, unless the query has to see all of them first (when ordering or aggregating).
+	/// Comparisons of indexed table fields with literals narrow down which rows are scanned, and table rows are tested on their
+	/// cells, so only matching rows are built. Large scans are filtered in parallel. To query on another thread while the store is being changed, run the query on a snapshot (see DataStore::Snapshot).
+	result<QueryStats, string> RunQuery(DataStore const& store, Query const& query, QueryRowFunc const& row_func);
+	result<QueryStats, string> RunQuery(DataStore const& store, string_view query_text, QueryRowFunc const& row_func);
+}
@@ -68,6 +68,65 @@ namespace dtmdl
 		return result;
 	}
 
+	json ToStorageJSON(TypeReference const& ref)
+	{
+		if (!ref.Type)
+			return json{};
+		json result = json::object();
+		if (ref.Type->IsBuiltIn())
+			result["name"] = ref.Type->Name();
+		else
+			result["id"] = ref.Type->ID();
+		if (ref.TemplateArguments.size())
+		{
+			auto& args = result["args"] = json::array();
+			for (auto& arg : ref.TemplateArguments)
+			{
+				if (auto type_arg = get_if<TypeReference>(&arg))
+					args.push_back(ToStorageJSON(*type_arg));
+				else
+					args.push_back(get<uint64_t>(arg));
+			}
+		}
+		return result;
+	}
+
+	void FromStorageJSON(TypeReference& ref, Schema const& schema, json const& value)
+	{
+		ref.TemplateArguments.clear();
+		if (value.is_null())
+		{
+			ref.Type = {};
+			return;
+		}
+
+		auto& type = value.get_ref<json::object_t const&>();
+		/// Stores written before types had IDs refer to types by name
+		if (auto id = type.find("id"); id != type.end())
+		{
+			ref.Type = schema.ResolveTypeByID(id->second);
+			if (!ref.Type)
+				throw std::runtime_error(format("type with id {} not found", id->second.dump()));
+		}
+		else
+		{
+			ref.Type = schema.ResolveType(type.at("name"));
+			if (!ref.Type)
+				throw std::runtime_error(format("type '{}' not found", (string)type.at("name")));
+		}
+
+		if (auto it = type.find("args"); it != type.end())
+		{
+			for (auto& arg : it->second.get_ref<json::array_t const&>())
+			{
+				if (arg.is_number())
+					ref.TemplateArguments.emplace_back((uint64_t)arg);
+				else
+					ref.TemplateArguments.push_back(TypeFromStorageJSON(schema, arg));
+			}
+		}
+	}
+
 	void FromJSON(TypeReference& ref, Schema const& schema, json const& value)
 	{
 		ref.TemplateArguments.clear();
@@ -144,6 +203,26 @@ namespace dtmdl
 		return nullptr;
 	}
 
+	FieldDefinition const* RecordDefinition::OwnOrBaseFieldByID(uint64_t id) const
+	{
+		for (auto& field : mFields)
+		{
+			if (field->ID == id)
+				return field.get();
+		}
+		if (mBaseType.Type)
+			return mBaseType.Type->AsRecord()->OwnOrBaseFieldByID(id);
+		return nullptr;
+	}
+
+	FieldDefinition const* RecordDefinition::OwnOrBaseFieldByKey(string_view key) const
+	{
+		uint64_t id = 0;
+		if (from_chars(key.data(), key.data() + key.size(), id).ec != errc{})
+			return nullptr;
+		return OwnOrBaseFieldByID(id);
+	}
+
 	size_t RecordDefinition::FieldIndexOf(FieldDefinition const* field) const
 	{
 		for (size_t i = 0; i < mFields.size(); ++i)
@@ -230,6 +309,7 @@ namespace dtmdl
 	{
 		json result = json::object();
 		result["name"] = mName;
+		result["id"] = mID;
 		result["base"] = mBaseType;
 		if (mTemplateParameters.size())
 		{
@@ -243,6 +323,9 @@ namespace dtmdl
 	void TypeDefinition::FromJSON(json const& value)
 	{
 		mName = value.at("name").get_ref<json::string_t const&>();
+		/// Types from schemas saved before IDs existed keep the fresh ID they were given when added
+		if (auto it = value.find("id"); it != value.end())
+			mID = *it;
 		dtmdl::FromJSON(mBaseType, Schema(), value.at("base"));
 		if (auto it = value.find("params"); it != value.end())
 		{
@@ -331,6 +414,16 @@ namespace dtmdl
 		return nullptr;
 	}
 
+	TypeDefinition const* Schema::ResolveTypeByID(uint64_t id) const
+	{
+		if (id == 0)
+			return nullptr;
+		for (auto& def : mDefinitions)
+			if (def->ID() == id)
+				return def.get();
+		return nullptr;
+	}
+
 	TypeDefinition* Schema::ResolveType(string_view name)
 	{
 		for (auto& def : mDefinitions)
@@ -356,6 +449,19 @@ namespace dtmdl
 		return nullptr;
 	}
 
+	EnumeratorDefinition const* EnumDefinition::EnumeratorByValue(int64_t value) const
+	{
+		int64_t current = 0;
+		for (auto& e : mEnumerators)
+		{
+			current = e->Value.value_or(current);
+			if (current == value)
+				return e.get();
+			++current;
+		}
+		return nullptr;
+	}
+
 	size_t EnumDefinition::EnumeratorIndexOf(EnumeratorDefinition const* field) const
 	{
 		for (size_t i = 0; i < mEnumerators.size(); ++i)
@@ -382,6 +488,72 @@ namespace dtmdl
 			mEnumerators.push_back(make_unique<EnumeratorDefinition>(this, enumerator));
 	}
 
+	/// Same as ToJSON, but with user types referred to by ID (see ToStorageJSON)
+	static json StructuralJSON(TypeDefinition const* def)
+	{
+		auto result = def->ToJSON();
+		result["base"] = ToStorageJSON(def->BaseType());
+		/// Attributes are records too, without being IsRecord
+		if (auto record = dynamic_cast<RecordDefinition const*>(def))
+		{
+			auto& fields = result.at("fields");
+			for (size_t i = 0; i < record->Fields().size(); ++i)
+				fields[i]["type"] = ToStorageJSON(record->Fields()[i]->FieldType);
+		}
+		result["kind"] = magic_enum::enum_name(def->Type());
+		return result;
+	}
+
+	SHA256Digest Schema::CalculateHash() const
+	{
+		map<uint64_t, SHA256Digest> type_hashes;
+		for (auto def : UserDefinitions())
+		{
+			auto it = mTypeHashes.find(def->ID());
+			type_hashes[def->ID()] = it != mTypeHashes.end() ? it->second : SHA256(StructuralJSON(def).dump());
+		}
+		mTypeHashes = move(type_hashes);
+
+		SHA256Hasher hasher;
+		hasher.Update(Namespace);
+		for (auto& [id, hash] : mTypeHashes)
+			hasher.Update(hash);
+		return hasher.Finish();
+	}
+
+	string Schema::Hash() const
+	{
+		unique_lock lock{ mHashMutex };
+		return ToHex(CalculateHash());
+	}
+
+	uint64_t Schema::Version() const
+	{
+		unique_lock lock{ mHashMutex };
+		if (auto hash = ToHex(CalculateHash()); hash != mVersionHash)
+		{
+			++mVersion;
+			mVersionHash = move(hash);
+		}
+		return mVersion;
+	}
+
+	void Schema::Invalidate(TypeDefinition const* def) const
+	{
+		unique_lock lock{ mHashMutex };
+		mTypeHashes.erase(def->ID());
+	}
+
+	void Schema::Invalidate(FieldDefinition const* def) const
+	{
+		Invalidate(def->ParentRecord);
+	}
+
+	void Schema::Invalidate(EnumeratorDefinition const* def) const
+	{
+		Invalidate(def->ParentEnum);
+	}
+
 	BuiltinDefinition const* Schema::AddNative(string name, string native_name, vector<TemplateParameter> params, enum_flags<BuiltInFlags> flags, ghassanpl::enum_flags<TemplateParameterQualifier> applicable_qualifiers, string icon)
 	{
 		return AddType<BuiltinDefinition>(move(name), move(native_name), move(params), flags, applicable_qualifiers, move(icon));
@@ -433,11 +605,27 @@ namespace dtmdl
 		return result;
 	}
 
-	json FieldDefinition::ToJSON() const { return json::object({ { "name", Name },{ "type", dtmdl::ToJSON(FieldType) },{ "attributes", Attributes },{ "flags", FilterBy(this, Flags) } }); }
+	json FieldDefinition::ToJSON() const { return json::object({ { "name", Name },{ "id", ID },{ "type", dtmdl::ToJSON(FieldType) },{ "attributes", Attributes },{ "flags", FilterBy(this, Flags) } }); }
+
+	IndexKind FieldDefinition::IndexType() const
+	{
+		if (!Attributes.is_object())
+			return IndexKind::Ordered;
+		auto it = Attributes.find("index");
+		if (it == Attributes.end() || !it->is_string())
+			return IndexKind::Ordered;
+		auto const kind = magic_enum::enum_cast<IndexKind>(it->get_ref<json::string_t const&>()).value_or(IndexKind::Ordered);
+		if (kind == IndexKind::Hash && !Flags.contain(FieldFlags::Unique))
+			return IndexKind::Ordered;
+		return kind;
+	}
 
 	void FieldDefinition::FromJSON(json const& value)
 	{
 		Name = value.at("name").get_ref<json::string_t const&>();
+		/// Fields from schemas saved before IDs existed get one assigned by the database after loading
+		if (auto it = value.find("id"); it != value.end())
+			ID = *it;
 		dtmdl::FromJSON(FieldType, ParentRecord->Schema(), value.at("type"));
 		Attributes = get(value, "attributes");
 		Flags = get_array(value, "flags");
@@ -488,6 +676,11 @@ namespace dtmdl
 
 	bool IsFlagAvailable(StructDefinition const* strukt, StructFlags flag)
 	{
+		switch (flag)
+		{
+		case StructFlags::DenseTable: return strukt->Flags.contain(StructFlags::CreateTableType) && !strukt->Flags.contain(StructFlags::ColumnarTable);
+		case StructFlags::ColumnarTable: return strukt->Flags.contain(StructFlags::CreateTableType) && !strukt->Flags.contain(StructFlags::DenseTable);
+		}
 		return true;
 	}
 
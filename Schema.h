@@ -1,6 +1,7 @@
 #pragma once
 
 #include "dtmdl.h"
+#include "Hashing.h"
 
 namespace dtmdl
 {
@@ -21,6 +22,18 @@ namespace dtmdl
 
 	inline void to_json(json& j, TypeReference const& v) { j = ToJSON(v); }
 
+	/// Data stores refer to user types by their ID instead of their name, so renaming a type doesn't touch the data;
+	/// built-in types are never renamed, so they are still referred to by name
+	json ToStorageJSON(TypeReference const&);
+	void FromStorageJSON(TypeReference&, Schema const& schema, json const& value);
+
+	inline TypeReference TypeFromStorageJSON(Schema const& schema, json const& arg)
+	{
+		TypeReference result;
+		FromStorageJSON(result, schema, arg);
+		return result;
+	}
+
 	inline TypeReference TypeFromJSON(Schema const& schema, json const& arg)
 	{
 		TypeReference result;
@@ -90,6 +103,8 @@ namespace dtmdl
 
 		auto const& Schema() const noexcept { return mSchema; }
 		auto const& Name() const noexcept { return mName; }
+		/// Persistent, never reused; 0 for built-in types
+		auto ID() const noexcept { return mID; }
 		//string QualifiedName(string_view sep = "::") const noexcept;
 		string IconName() const noexcept { return string{ Icon() } + Name(); }
 		string IconNameWithParent() const noexcept {
@@ -139,6 +154,7 @@ namespace dtmdl
 		dtmdl::Schema const& mSchema;
 
 		string mName;
+		uint64_t mID = 0;
 		TypeReference mBaseType{};
 		vector<TemplateParameter> mTemplateParameters{};
 		json mAttributes;
@@ -160,13 +176,19 @@ namespace dtmdl
 	{
 		RecordDefinition const* ParentRecord = nullptr;
 		string Name;
+		uint64_t ID = 0; /// Persistent, never reused; data stores key record members by this, not by name
 		TypeReference FieldType{};
 		json Attributes;
 		enum_flags<FieldFlags> Flags;
 
-		FieldDefinition(RecordDefinition const* parent, string name, TypeReference ref) : ParentRecord(parent), Name(move(name)), FieldType(move(ref)) {}
+		FieldDefinition(RecordDefinition const* parent, string name, TypeReference ref, uint64_t id) : ParentRecord(parent), Name(move(name)), ID(id), FieldType(move(ref)) {}
 		FieldDefinition(RecordDefinition const* parent, json const& def) : ParentRecord(parent) { FromJSON(def); }
 
+		string StorageKey() const { return std::to_string(ID); }
+
+		/// From the "index" attribute; Ordered if it's missing, or not applicable to the field
+		IndexKind IndexType() const;
+
 		json ToJSON() const;
 		void FromJSON(json const& value);
 
@@ -187,6 +209,9 @@ namespace dtmdl
 		FieldDefinition const* Field(size_t i) const;
 		FieldDefinition const* OwnField(string_view name) const;
 		FieldDefinition const* OwnOrBaseField(string_view name) const;
+		FieldDefinition const* OwnOrBaseFieldByID(uint64_t id) const;
+		/// See FieldDefinition::StorageKey
+		FieldDefinition const* OwnOrBaseFieldByKey(string_view key) const;
 		size_t FieldIndexOf(FieldDefinition const* field) const;
 
 		set<string> OwnFieldNames() const;
@@ -308,6 +333,7 @@ namespace dtmdl
 
 		EnumeratorDefinition const* Enumerator(size_t i) const;
 		EnumeratorDefinition const* Enumerator(string_view name) const;
+		EnumeratorDefinition const* EnumeratorByValue(int64_t value) const;
 		size_t EnumeratorIndexOf(EnumeratorDefinition const* field) const;
 
 		auto DefaultEnumerator() const { return Enumerator(0); }
@@ -379,12 +405,22 @@ namespace dtmdl
 		TypeDefinition const* ResolveType(string_view name) const;
 		template <typename T>
 		T const* ResolveType(string_view name) const { return dynamic_cast<T const*>(ResolveType(name)); }
+		TypeDefinition const* ResolveTypeByID(uint64_t id) const;
 
 		BuiltinDefinition const* VoidType() const noexcept { return mVoid; }
 
-		/// TODO: These
-		size_t Version() const { return 1; }
-		size_t Hash() const { return 0; }
+		/// SHA-256 (in hex) of everything in the schema: each user type is hashed on its own (and cached until it changes),
+		/// and the schema hash is the hash of those, in ID order. Types refer to other user types by ID, so renaming one only
+		/// changes its own hash. Thread-safe.
+		string Hash() const;
+		/// Goes up by one whenever Hash() is different from the last time it was asked for (so many changes in between
+		/// only count once); saved with the schema. Thread-safe.
+		uint64_t Version() const;
+
+		/// Forget the cached hash of a type, before it (or one of its fields or enumerators) is changed
+		void Invalidate(TypeDefinition const* def) const;
+		void Invalidate(FieldDefinition const* def) const;
+		void Invalidate(EnumeratorDefinition const* def) const;
 
 		static bool IsParent(TypeDefinition const* parent, TypeDefinition const* potential_child);
 
@@ -396,6 +432,8 @@ namespace dtmdl
 		T const* AddType(ARGS&&... args)
 		{
 			auto ptr = unique_ptr<T>(new T{ *this, forward<ARGS>(args)... });
+			if constexpr (!is_same_v<T, BuiltinDefinition>)
+				ptr->mID = NewID();
 			auto result = ptr.get();
 			mDefinitions.push_back(move(ptr));
 			return result;
@@ -406,8 +444,19 @@ namespace dtmdl
 		vector<unique_ptr<TypeDefinition>> mDefinitions;
 		BuiltinDefinition const* mVoid = nullptr;
 
+		/// IDs are shared by types and fields
+		uint64_t NewID() noexcept { return mNextID++; }
+		uint64_t mNextID = 1;
+
 		TypeDefinition* ResolveType(string_view name);
 
+		mutable mutex mHashMutex;
+		/// By type ID; types that are gone are dropped the next time the hash is calculated
+		mutable map<uint64_t, SHA256Digest> mTypeHashes;
+		mutable uint64_t mVersion = 0;
+		mutable string mVersionHash;
+		SHA256Digest CalculateHash() const;
+
 		friend struct Database;
 	};
 
@@ -0,0 +1,658 @@
+#include "pch.h"
+
+#include "SelfTest.h"
+#include "Database.h"
+#include "Export.h"
+#include "Import.h"
+#include "CppReflectionFormat.h"
+#include "Query.h"
+
+namespace dtmdl
+{
+
+	/// A struct named `name` with a field of type `type` for each of `field_names`
+	static result<StructDefinition const*, string> AddStruct(Database& db, string const& name, TypeReference const& type, initializer_list<string> field_names)
+	{
+		auto record = db.AddNewStruct();
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		if (auto renamed = db.SetTypeName(def, name); renamed.has_error())
+			return failure(renamed.error());
+		for (auto& field_name : field_names)
+		{
+			if (auto added = db.AddNewField(def); added.has_error())
+				return failure(added.error());
+			auto const field = def->Fields().back().get();
+			if (auto renamed = db.SetFieldName(field, field_name); renamed.has_error())
+				return failure(renamed.error());
+			if (auto typed = db.SetFieldType(field, type); typed.has_error())
+				return failure(typed.error());
+		}
+		return success(def);
+	}
+
+	/// Heap objects added since the store file was written only exist in its journal
+	static result<void, string> JournaledHeapObjectsReload(filesystem::path const& directory)
+	{
+		uint64_t id = 0;
+		json value;
+		{
+			Database db{ directory };
+			auto klass = db.AddNewClass();
+			if (klass.has_error())
+				return failure(klass.error());
+			auto& store = db.DataStores().at("main");
+			auto const own_type = TypeReference{ db.Schema().ResolveType("own"), vector<TemplateArgument>{ TypeReference{ klass.value() } } };
+			store.SetValue("object", own_type, nullptr);
+			db.SaveAll();
+
+			auto new_id = store.NewObject(klass.value()->Name());
+			if (new_id.has_error())
+				return failure(new_id.error());
+			id = new_id.value();
+			store.SetValue("object", own_type, id);
+			db.SaveAll();
+
+			if (!filesystem::exists(DataStore::JournalPath(directory / "main.datastore")))
+				return failure("the second save didn't append to the journal");
+			value = store.Heap().Find(id)->Value;
+		}
+
+		Database reopened{ directory };
+		auto object = reopened.DataStores().at("main").Heap().Find(id);
+		if (!object)
+			return failure(format("object {} is gone after reloading", id));
+		if (object->Value != value)
+			return failure(format("object {} is {} after reloading, instead of {}", id, object->Value.dump(), value.dump()));
+		return success();
+	}
+
+	/// A crash between replacing the store file and deleting its journal leaves a journal for the file that was replaced
+	static result<void, string> StaleJournalsAreIgnored(filesystem::path const& directory)
+	{
+		auto const store_path = directory / "main.datastore";
+		auto const journal_path = DataStore::JournalPath(store_path);
+		auto const stale_path = filesystem::path{ journal_path } += ".stale";
+		json final_value;
+		{
+			Database db{ directory };
+			auto& store = db.DataStores().at("main");
+			auto const string_type = TypeReference{ db.Schema().ResolveType("string") };
+			store.SetValue("value", string_type, "first");
+			db.SaveAll();
+			store.SetValue("value", string_type, "second");
+			db.SaveAll();
+			if (!filesystem::exists(journal_path))
+				return failure("the second save didn't append to the journal");
+			filesystem::copy_file(journal_path, stale_path);
+
+			/// Too big a change for the journal, so the whole file is rewritten and the journal deleted
+			final_value = string(filesystem::file_size(store_path) * 2, 'x');
+			store.SetValue("value", string_type, final_value);
+			db.SaveAll();
+			if (filesystem::exists(journal_path))
+				return failure("the third save didn't rewrite the store file");
+		}
+		filesystem::rename(stale_path, journal_path);
+
+		Database reopened{ directory };
+		auto const& roots = reopened.DataStores().at("main").Roots();
+		auto const root = roots.find("value");
+		if (root == roots.end() || !root->second)
+			return failure("the root is gone after reloading");
+		if (root->second->at("value") != final_value)
+			return failure(format("the root is {} after reloading", root->second->at("value").dump().substr(0, 40)));
+		return success();
+	}
+
+	/// The binary export leaves NoSerialize fields out, so dtmdl_binary::Reader must not be given them either (see CppReflectionFormat)
+	static result<void, string> BinaryExportSkipsNoSerializeFields(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto record = db.AddNewStruct();
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		auto const i32 = TypeReference{ db.Schema().ResolveType("i32") };
+		for (int i = 0; i < 3; ++i)
+		{
+			if (auto added = db.AddNewField(def); added.has_error())
+				return failure(added.error());
+			if (auto typed = db.SetFieldType(def->Fields().back().get(), i32); typed.has_error())
+				return failure(typed.error());
+		}
+		auto const hidden = def->Fields()[1].get();
+		if (auto flagged = db.SetFieldFlags(hidden, enum_flags<FieldFlags>{ FieldFlags::NoSerialize }); flagged.has_error())
+			return failure(flagged.error());
+
+		auto& store = db.DataStores().at("main");
+		json value = json::object();
+		for (auto& field : def->Fields())
+			value[field->StorageKey()] = value.size() + 1;
+		store.SetValue("value", TypeReference{ def }, value);
+
+		string exported;
+		auto const sink = [&](span<char const> chunk) -> result<void, string> {
+			exported.append(chunk.begin(), chunk.end());
+			return success();
+		};
+		if (auto written = ExportValue(store, "value", sink, { .Format = ExportFormat::Binary }); written.has_error())
+			return failure(written.error());
+		/// The header ("DTMB", version, content, size-prefixed schema hash), then 1 and 3 as zigzag varints
+		auto const header_size = 4 + 1 + 1 + 1 + db.Schema().Hash().size();
+		if (exported.size() != header_size + 2 || !exported.ends_with("\x02\x06"))
+			return failure(format("the value was exported as {} bytes after the header, instead of 2", exported.size() - header_size));
+
+		auto const reader_guard = format("visitor.SkipField(record.{}, \"{}\", dtmdl_{}_Mirror_Tag); }})))", MemberName(db, hidden), hidden->Name, def->Name());
+		if (CppReflectionFormat{}.Export(db).find(reader_guard) == string::npos)
+			return failure(format("the reflection header lets readers of serialized data visit '{}'", hidden->Name));
+		return success();
+	}
+
+	/// Narrowing a query down with a table index must not change which rows it finds
+	static result<void, string> IndexedQueriesMatchFullScans(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto record = AddStruct(db, "Item", TypeReference{ db.Schema().ResolveType("i32") }, { "Key", "Copy" });
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		if (auto flagged = db.SetStructFlags(def, enum_flags<StructFlags>{ StructFlags::CreateTableType }); flagged.has_error())
+			return failure(flagged.error());
+
+		auto& store = db.DataStores().at("main");
+		auto const key = def->Fields()[0].get();
+		auto const copy = def->Fields()[1].get();
+		for (int i = 0; i < 100; ++i)
+		{
+			auto const value = (i * 37) % 100;
+			if (auto inserted = store.InsertRow(def->Name(), json{ { key->StorageKey(), value }, { copy->StorageKey(), value } }); inserted.has_error())
+				return failure(inserted.error());
+		}
+		if (auto flagged = db.SetFieldFlags(key, enum_flags<FieldFlags>{ FieldFlags::Indexed }); flagged.has_error())
+			return failure(flagged.error());
+
+		vector<json> indexed_rows, scanned_rows;
+		auto indexed = RunQuery(store, "select Key, Copy from Item where Key >= 30 and Key < 70 order by Key", [&](json const& row) { indexed_rows.push_back(row); return true; });
+		if (indexed.has_error())
+			return failure(indexed.error());
+		auto scanned = RunQuery(store, "select Key, Copy from Item where Copy >= 30 and Copy < 70 order by Key", [&](json const& row) { scanned_rows.push_back(row); return true; });
+		if (scanned.has_error())
+			return failure(scanned.error());
+
+		if (scanned.value().RowsScanned != 100)
+			return failure(format("the query on an unindexed field scanned {} rows instead of all 100", scanned.value().RowsScanned));
+		if (indexed.value().RowsScanned != 40)
+			return failure(format("the query on an indexed field scanned {} rows instead of the 40 in range", indexed.value().RowsScanned));
+		if (indexed_rows.size() != 40 || indexed_rows != scanned_rows)
+			return failure(format("the indexed query found {} rows, and the full scan {}", indexed_rows.size(), scanned_rows.size()));
+		return success();
+	}
+
+	/// A field changed on both sides of a three-way merge is a conflict at that field; one changed only on their side is taken
+	static result<void, string> MergeConflictsHaveTheirPaths(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto record = AddStruct(db, "Settings", TypeReference{ db.Schema().ResolveType("i32") }, { "Both", "Theirs" });
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		auto const both = def->Fields()[0]->StorageKey();
+		auto const only_theirs = def->Fields()[1]->StorageKey();
+
+		auto& store = db.DataStores().at("main");
+		store.SetValue("config", TypeReference{ def }, json{ { both, 1 }, { only_theirs, 1 } });
+		auto const base = store.Snapshot();
+		auto theirs = store.Snapshot();
+		auto& their_value = theirs.MutableRoot("config")->at("value");
+		their_value[both] = 2;
+		their_value[only_theirs] = 5;
+		store.MutableRoot("config")->at("value")[both] = 3;
+
+		auto merged = store.Merge(theirs, &base);
+		if (merged.has_error())
+			return failure(merged.error());
+		auto const& conflicts = merged.value().Conflicts;
+		auto const expected_path = (json::json_pointer{ "/roots/config/value" } / both).to_string();
+		if (conflicts.size() != 1)
+			return failure(format("the merge reported {} conflicts instead of 1", conflicts.size()));
+		if (conflicts[0].Path != expected_path)
+			return failure(format("the conflict was reported at '{}' instead of '{}'", conflicts[0].Path, expected_path));
+		if (conflicts[0].Ours != 3 || conflicts[0].Theirs != 2 || conflicts[0].Base != 1)
+			return failure(format("the conflict has ours {}, theirs {} and base {}", conflicts[0].Ours.dump(), conflicts[0].Theirs.dump(), conflicts[0].Base.dump()));
+		auto const& value = store.Root("config")->at("value");
+		if (value.at(both) != 3 || value.at(only_theirs) != 5)
+			return failure(format("the merged value is {}", value.dump()));
+		return success();
+	}
+
+	/// Importing an exported value gives back the value in the same storage form, blobs included
+	static result<void, string> ImportedExportsMatch(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto record = AddStruct(db, "Asset", TypeReference{ db.Schema().ResolveType("i32") }, { "Count", "Name", "Data" });
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		auto const name = def->Fields()[1].get();
+		auto const data = def->Fields()[2].get();
+		if (auto typed = db.SetFieldType(name, TypeReference{ db.Schema().ResolveType("string") }); typed.has_error())
+			return failure(typed.error());
+		if (auto typed = db.SetFieldType(data, TypeReference{ db.Schema().ResolveType("bytes") }); typed.has_error())
+			return failure(typed.error());
+
+		auto& store = db.DataStores().at("main");
+		vector<uint8_t> bytes;
+		for (size_t i = 0; i < BlobStore::OutOfLineThreshold * 2; ++i)
+			bytes.push_back(uint8_t(i * 7));
+		store.SetValue("asset", TypeReference{ def }, json{ { def->Fields()[0]->StorageKey(), -7 }, { name->StorageKey(), "crate \"1\"\n" }, { data->StorageKey(), json::binary(move(bytes)) } });
+		/// The import puts big `bytes` values in the blob store as it reads them, so the store has to as well to compare the same
+		store.ExternalizeBlobs();
+
+		auto const export_path = directory / "asset.json";
+		if (auto exported = ExportValueToFile(store, "asset", export_path); exported.has_error())
+			return failure(exported.error());
+		auto imported = ImportValueFromJSONFile(db.Schema(), store.Blobs(), export_path);
+		if (imported.has_error())
+			return failure(imported.error());
+
+		if (imported.value().Type.Type != def)
+			return failure("the value was imported with a different type");
+		auto const& value = store.Root("asset")->at("value");
+		if (imported.value().Value != value)
+			return failure(format("the value was imported as {} instead of {}", imported.value().Value.dump(), value.dump()));
+		return success();
+	}
+
+	/// Importing every root and table of an exported store, one at a time, gives back the store's data
+	static result<void, string> ImportedStoreExportsMatch(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto const i32 = TypeReference{ db.Schema().ResolveType("i32") };
+		auto record = AddStruct(db, "Point", i32, { "X", "Y" });
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		if (auto flagged = db.SetStructFlags(def, enum_flags<StructFlags>{ StructFlags::CreateTableType }); flagged.has_error())
+			return failure(flagged.error());
+		auto const x = def->Fields()[0]->StorageKey();
+		auto const y = def->Fields()[1]->StorageKey();
+
+		auto& store = db.DataStores().at("main");
+		auto const names_type = TypeReference{ db.Schema().ResolveType("list"), vector<TemplateArgument>{ TypeReference{ db.Schema().ResolveType("string") } } };
+		store.SetValue("count", i32, 42);
+		store.SetValue("names", names_type, json{ "a", "b", "" });
+		store.SetValue("origin", TypeReference{ def }, json{ { x, 0 }, { y, -1 } });
+		for (int i = 0; i < 3; ++i)
+		{
+			if (auto inserted = store.InsertRow(def->Name(), json{ { x, i }, { y, i * i } }); inserted.has_error())
+				return failure(inserted.error());
+		}
+
+		auto const export_path = directory / "store.json";
+		if (auto exported = ExportStoreToFile(store, export_path); exported.has_error())
+			return failure(exported.error());
+		auto const exported = json::parse(ifstream{ export_path });
+
+		auto const import_path = directory / "part.json";
+		auto const import_part = [&](json const& part, TypeReference const& type) {
+			ofstream{ import_path } << part.dump();
+			return ImportValueFromJSONFile(db.Schema(), store.Blobs(), import_path, type);
+		};
+		for (auto& [name, root] : store.Roots())
+		{
+			if (!exported.at("roots").contains(name))
+				return failure(format("root '{}' wasn't exported", name));
+			auto imported = import_part(exported.at("roots").at(name), {});
+			if (imported.has_error())
+				return failure(format("root '{}': {}", name, imported.error()));
+			if (imported.value().Value != root->at("value"))
+				return failure(format("root '{}' was imported as {} instead of {}", name, imported.value().Value.dump(), root->at("value").dump()));
+		}
+
+		auto const table = store.FindTable(def->Name());
+		auto rows = json::array();
+		for (size_t i = 0; i < table->RowCount(); ++i)
+			rows.push_back(table->Row(i));
+		auto imported = import_part(exported.at("tables").at(def->Name()), TypeReference{ db.Schema().ResolveType("list"), vector<TemplateArgument>{ TypeReference{ def } } });
+		if (imported.has_error())
+			return failure(format("table '{}': {}", def->Name(), imported.error()));
+		if (imported.value().Value != rows)
+			return failure(format("table '{}' was imported as {} instead of {}", def->Name(), imported.value().Value.dump(), rows.dump()));
+		return success();
+	}
+
+	/// Values that don't fit their types are reported at their paths, and values that do aren't reported
+	static result<void, string> ValidationFindsBrokenValues(filesystem::path const& directory)
+	{
+		Database db{ directory };
+		auto record = AddStruct(db, "Stats", TypeReference{ db.Schema().ResolveType("i8") }, { "Small", "Label" });
+		if (record.has_error())
+			return failure(record.error());
+		auto const def = record.value();
+		if (auto typed = db.SetFieldType(def->Fields()[1].get(), TypeReference{ db.Schema().ResolveType("string") }); typed.has_error())
+			return failure(typed.error());
+		auto const small = def->Fields()[0]->StorageKey();
+		auto const label = def->Fields()[1]->StorageKey();
+
+		auto& store = db.DataStores().at("main");
+		store.SetValue("good", TypeReference{ def }, json{ { small, -128 }, { label, "fine" } });
+		if (auto reports = db.ValidateAll(); reports.at("main").HasErrors())
+			return failure(format("a store that matches the schema has {} diagnostics", reports.at("main").Diagnostics.size()));
+
+		store.SetValue("bad", TypeReference{ def }, json{ { small, 300 }, { label, 5 } });
+		auto const reports = db.ValidateAll();
+		auto const& diagnostics = reports.at("main").Diagnostics;
+		auto const reported = [&](string const& path) {
+			return ranges::any_of(diagnostics, [&](ValueDiagnostic const& diagnostic) { return diagnostic.Path == path && diagnostic.Level == ValueDiagnostic::Severity::Error; });
+		};
+		for (auto& key : { small, label })
+		{
+			auto const path = (json::json_pointer{ "/roots/bad/value" } / key).to_string();
+			if (!reported(path))
+				return failure(format("no error was reported at '{}'", path));
+		}
+		if (ranges::any_of(diagnostics, [](ValueDiagnostic const& diagnostic) { return diagnostic.Path.starts_with("/roots/good"); }))
+			return failure("a root that matches the schema was reported");
+		return success();
+	}
+
+	/// Every root (json) and table row (json) of the store, to compare stores by
+	static json StoreContents(DataStore const& store)
+	{
+		json contents = json::object();
+		for (auto& [name, root] : store.Roots())
+			contents["roots"][name] = *root;
+		for (auto& [record, table] : store.Tables())
+		{
+			auto& rows = contents["tables"][record->Name()] = json::array();
+			for (size_t i = 0; i < table->RowCount(); ++i)
+				rows.push_back(table->Row(i));
+		}
+		return contents;
+	}
+
+	/// A sharded store reads back the same, both after it's first written as a directory and after only some roots are rewritten
+	static result<void, string> ShardedStoresReload(filesystem::path const& directory)
+	{
+		json contents;
+		{
+			Database db{ directory };
+			auto const i32 = TypeReference{ db.Schema().ResolveType("i32") };
+			auto record = AddStruct(db, "Cell", i32, { "Value" });
+			if (record.has_error())
+				return failure(record.error());
+			auto const def = record.value();
+			if (auto flagged = db.SetStructFlags(def, enum_flags<StructFlags>{ StructFlags::CreateTableType }); flagged.has_error())
+				return failure(flagged.error());
+
+			auto& store = db.DataStores().at("main");
+			store.SetSharded(true);
+			for (int i = 0; i < 10; ++i)
+				store.SetValue(format("root{}", i), i32, i);
+			store.SetValue("a name/with \"odd\" characters", TypeReference{ db.Schema().ResolveType("string") }, "odd");
+			if (auto inserted = store.InsertRow(def->Name(), json{ { def->Fields()[0]->StorageKey(), 7 } }); inserted.has_error())
+				return failure(inserted.error());
+			db.SaveAll();
+			if (!filesystem::is_directory(directory / "main.datastore"))
+				return failure("the sharded store wasn't saved as a directory");
+
+			store.SetValue("root3", i32, 33);
+			store.DeleteValue("root4");
+			db.SaveAll();
+			contents = StoreContents(store);
+		}
+
+		Database reopened{ directory };
+		auto const& store = reopened.DataStores().at("main");
+		if (!store.Sharded())
+			return failure("the store isn't sharded after reloading");
+		if (auto const reloaded = StoreContents(store); reloaded != contents)
+			return failure(format("the store reloaded as {} instead of {}", reloaded.dump(), contents.dump()));
+		return success();
+	}
+
+	/// Roots of a mapped store that were never loaded survive both a journaled save and a whole rewrite of the store file
+	static result<void, string> UnloadedRootsSurviveSaves(filesystem::path const& directory)
+	{
+		json original;
+		{
+			Database db{ directory };
+			auto& store = db.DataStores().at("main");
+			auto const string_type = TypeReference{ db.Schema().ResolveType("string") };
+			for (int i = 0; i < 10; ++i)
+				store.SetValue(format("root{}", i), string_type, format("value {}", i));
+			db.SaveAll();
+			original = StoreContents(store);
+		}
+
+		auto const big = string(filesystem::file_size(directory / "main.datastore") * 2, 'x');
+		{
+			Database db{ directory };
+			auto& store = db.DataStores().at("main");
+			store.MutableRoot("root1")->at("value") = "changed";
+			db.SaveAll();
+			if (!filesystem::exists(DataStore::JournalPath(directory / "main.datastore")))
+				return failure("changing one root didn't append to the journal");
+
+			/// Too big a change for the journal, so the whole store file is rewritten from the roots that were loaded and the mapped file
+			store.SetValue("big", TypeReference{ db.Schema().ResolveType("string") }, big);
+			auto const unloaded = ranges::count_if(store.LazyRoots(), [](auto const& root) { return !root.second; });
+			if (unloaded == 0)
+				return failure("every root was loaded before saving");
+			db.SaveAll();
+			if (filesystem::exists(DataStore::JournalPath(directory / "main.datastore")))
+				return failure("the big change didn't rewrite the store file");
+		}
+
+		Database reopened{ directory };
+		auto const reloaded = StoreContents(reopened.DataStores().at("main"));
+		if (!reloaded.at("roots").contains("big") || reloaded.at("roots").at("big").at("value") != big)
+			return failure("the root added before the rewrite is gone");
+		auto expected = original;
+		expected["roots"]["root1"]["value"] = "changed";
+		expected["roots"]["big"] = reloaded.at("roots").at("big");
+		if (reloaded != expected)
+			return failure(format("the store reloaded as {} instead of {}", reloaded.dump(), expected.dump()));
+		return success();
+	}
+
+	/// Contents of every file under `directory`, by generic path relative to it
+	static map<string, string> FileContents(filesystem::path const& directory)
+	{
+		map<string, string> files;
+		for (auto& entry : filesystem::recursive_directory_iterator{ directory })
+		{
+			if (!entry.is_regular_file())
+				continue;
+			string contents(entry.file_size(), '\0');
+			ifstream{ entry.path(), ios::binary }.read(contents.data(), contents.size());
+			files[entry.path().lexically_relative(directory).generic_string()] = move(contents);
+		}
+		return files;
+	}
+
+	/// The changelog is appended to once a backup is done, so the restored one only has to be the start of `expected`'s
+	static result<void, string> CheckRestoredBackup(filesystem::path const& backup_directory, string_view snapshot, filesystem::path const& target, map<string, string> const& expected)
+	{
+		if (auto restored = Database::RestoreBackup(backup_directory, snapshot, target); restored.has_error())
+			return failure(restored.error());
+		auto const files = FileContents(target);
+		for (auto& [path, contents] : expected)
+		{
+			auto const file = files.find(path);
+			if (file == files.end())
+				return failure(format("'{}' is missing from snapshot {}", path, snapshot));
+			if (path == "changelog.wilson" ? !contents.starts_with(file->second) : contents != file->second)
+				return failure(format("'{}' of snapshot {} has {} bytes that differ from the original's {}", path, snapshot, file->second.size(), contents.size()));
+		}
+		for (auto& [path, contents] : files)
+		{
+			if (!expected.contains(path))
+				return failure(format("snapshot {} has '{}', which wasn't backed up", snapshot, path));
+		}
+		return success();
+	}
+
+	/// Bytes that don't compress, and have no runs for content-defined chunking to get stuck on
+	static vector<uint8_t> NoiseBytes(size_t size, uint64_t seed)
+	{
+		vector<uint8_t> bytes(size);
+		for (auto& byte : bytes)
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			byte = uint8_t(seed);
+		}
+		return bytes;
+	}
+
+	/// Each backup restores to the files as they were, and a small change is backed up without storing everything again
+	static result<void, string> BackupsRestore(filesystem::path const& directory)
+	{
+		auto const database_directory = directory / "database";
+		Database db{ database_directory };
+		auto& store = db.DataStores().at("main");
+		auto text = NoiseBytes(BackupRepository::MaxChunkSize * 2, 1);
+		for (auto& c : text)
+			c = 'a' + c % 26;
+		store.SetValue("text", TypeReference{ db.Schema().ResolveType("string") }, string{ text.begin(), text.end() });
+		store.SetValue("blob", TypeReference{ db.Schema().ResolveType("bytes") }, json::binary(NoiseBytes(BackupRepository::MaxChunkSize, 2)));
+		db.SaveAll();
+
+		auto first = db.CreateBackup(directory);
+		if (first.has_error())
+			return failure(first.error());
+		auto const first_files = FileContents(database_directory);
+
+		text[text.size() / 2] = text[text.size() / 2] == 'a' ? 'b' : 'a';
+		store.SetValue("text", TypeReference{ db.Schema().ResolveType("string") }, string{ text.begin(), text.end() });
+		db.SaveAll();
+		auto second = db.CreateBackup(directory);
+		if (second.has_error())
+			return failure(second.error());
+		auto const second_files = FileContents(database_directory);
+		if (second.value().NewBytes * 2 > second.value().Bytes)
+			return failure(format("a one byte change stored {} of {} bytes again", second.value().NewBytes, second.value().Bytes));
+
+		if (auto restored = CheckRestoredBackup(directory, first.value().Snapshot, directory / "first", first_files); restored.has_error())
+			return restored;
+		return CheckRestoredBackup(directory, second.value().Snapshot, directory / "second", second_files);
+	}
+
+	/// Backups restore the same whatever the compression settings, including storing everything uncompressed
+	static result<void, string> BackupCompressionRestores(filesystem::path const& directory)
+	{
+		auto const database_directory = directory / "database";
+		Database db{ database_directory };
+		auto& store = db.DataStores().at("main");
+		/// Compresses well, unlike the blob
+		store.SetValue("text", TypeReference{ db.Schema().ResolveType("string") }, string(BackupRepository::MaxChunkSize * 3, 'x'));
+		store.SetValue("blob", TypeReference{ db.Schema().ResolveType("bytes") }, json::binary(NoiseBytes(BackupRepository::MaxChunkSize, 3)));
+		db.SaveAll();
+
+		BackupOptions const option_sets[] = {
+			{ .CompressionLevel = 0 },
+			{ .CompressionLevel = 1 },
+			{ .CompressionLevel = 9 },
+			{ .CompressionLevel = 9, .StoreUncompressed = [](filesystem::path const&) { return true; } },
+		};
+		for (size_t i = 0; i < size(option_sets); ++i)
+		{
+			/// A repository per option set, so no chunk is shared with one written with other options
+			auto const backup_directory = directory / format("backup{}", i);
+			auto backup = db.CreateBackup(backup_directory, option_sets[i]);
+			if (backup.has_error())
+				return failure(backup.error());
+			if (auto restored = CheckRestoredBackup(backup_directory, backup.value().Snapshot, directory / format("restored{}", i), FileContents(database_directory)); restored.has_error())
+				return failure(format("options #{}: {}", i, restored.error()));
+		}
+		return success();
+	}
+
+	/// The schema hash only depends on what's in the schema: not on data, saving and reloading, or changes that were undone
+	static result<void, string> SchemaHashesAreStable(filesystem::path const& directory)
+	{
+		string hash;
+		uint64_t version = 0;
+		{
+			Database db{ directory };
+			auto record = AddStruct(db, "Unit", TypeReference{ db.Schema().ResolveType("i32") }, { "Health", "Armor" });
+			if (record.has_error())
+				return failure(record.error());
+			auto enoom = db.AddNewEnum();
+			if (enoom.has_error())
+				return failure(enoom.error());
+			if (auto added = db.AddNewEnumerator(enoom.value()); added.has_error())
+				return failure(added.error());
+			db.SaveAll();
+			hash = db.Schema().Hash();
+
+			auto const field = record.value()->Fields()[0].get();
+			if (auto renamed = db.SetFieldName(field, "Shield"); renamed.has_error())
+				return failure(renamed.error());
+			if (auto renamed = db.SetFieldName(field, "Health"); renamed.has_error())
+				return failure(renamed.error());
+			if (db.Schema().Hash() != hash)
+				return failure(format("renaming a field and back changed the schema hash from {} to {}", hash, db.Schema().Hash()));
+
+			/// Each rename was saved, so the version went up, but it mustn't for saving data only
+			version = db.Schema().Version();
+			db.DataStores().at("main").SetValue("unit", TypeReference{ record.value() }, json::object());
+			db.SaveAll();
+			if (db.Schema().Hash() != hash || db.Schema().Version() != version)
+				return failure("saving data changed the schema hash or version");
+		}
+
+		Database reopened{ directory };
+		if (reopened.Schema().Hash() != hash || reopened.Schema().Version() != version)
+			return failure(format("the schema reloaded as {} (version {}) instead of {} (version {})", reopened.Schema().Hash(), reopened.Schema().Version(), hash, version));
+		auto const def = reopened.Schema().ResolveType<StructDefinition>("Unit");
+		if (!def)
+			return failure("the struct is gone after reloading");
+		if (auto renamed = reopened.SetFieldName(def->Fields()[1].get(), "Plating"); renamed.has_error())
+			return failure(renamed.error());
+		if (reopened.Schema().Hash() == hash)
+			return failure("renaming a field didn't change the schema hash");
+		return success();
+	}
+
+	vector<pair<string, string>> RunSelfTests(filesystem::path const& scratch_directory)
+	{
+		static const pair<string_view, result<void, string>(*)(filesystem::path const&)> tests[] = {
+			{ "journaled heap objects reload", &JournaledHeapObjectsReload },
+			{ "stale journals are ignored", &StaleJournalsAreIgnored },
+			{ "binary export skips NoSerialize fields", &BinaryExportSkipsNoSerializeFields },
+			{ "indexed queries match full scans", &IndexedQueriesMatchFullScans },
+			{ "merge conflicts have their paths", &MergeConflictsHaveTheirPaths },
+			{ "imported exports match", &ImportedExportsMatch },
+			{ "imported store exports match", &ImportedStoreExportsMatch },
+			{ "validation finds broken values", &ValidationFindsBrokenValues },
+			{ "sharded stores reload", &ShardedStoresReload },
+			{ "unloaded roots survive saves", &UnloadedRootsSurviveSaves },
+			{ "backups restore", &BackupsRestore },
+			{ "backup compression restores", &BackupCompressionRestores },
+			{ "schema hashes are stable", &SchemaHashesAreStable },
+		};
+
+		vector<pair<string, string>> failures;
+		for (auto& [name, test] : tests)
+		{
+			auto const directory = scratch_directory / name;
+			error_code ec;
+			filesystem::remove_all(directory, ec);
+			try
+			{
+				if (auto result = test(directory); result.has_error())
+					failures.emplace_back(name, result.error());
+			}
+			catch (std::exception const& e)
+			{
+				failures.emplace_back(name, e.what());
+			}
+		}
+		return failures;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	/// Checks that need a whole database (saving, journals, reloading) to go wrong; each one works in its own subdirectory of
+	/// `scratch_directory`, which is emptied first. Returns the names of the checks that failed, with why.
+	vector<pair<string, string>> RunSelfTests(filesystem::path const& scratch_directory);
+}
\ No newline at end of file
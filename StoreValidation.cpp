@@ -0,0 +1,285 @@
+#include "pch.h"
+
+#include "StoreValidation.h"
+#include "DataStore.h"
+#include "BlobStore.h"
+
+namespace dtmdl
+{
+
+	bool StoreValidationReport::HasErrors() const noexcept
+	{
+		return ranges::any_of(Diagnostics, [](ValueDiagnostic const& diagnostic) { return diagnostic.Level == ValueDiagnostic::Severity::Error; });
+	}
+
+	struct ValueValidator
+	{
+		DataStore const& Store;
+		vector<ValueDiagnostic>& Diagnostics;
+		uint64_t ValuesChecked = 0;
+
+		void Error(json::json_pointer const& path, string message)
+		{
+			Diagnostics.push_back({ ValueDiagnostic::Severity::Error, path.to_string(), move(message) });
+		}
+
+		void Warning(json::json_pointer const& path, string message)
+		{
+			Diagnostics.push_back({ ValueDiagnostic::Severity::Warning, path.to_string(), move(message) });
+		}
+
+		template <typename T>
+		static bool InRange(json const& value)
+		{
+			if (value.is_number_unsigned())
+				return value.get<uint64_t>() <= uint64_t(numeric_limits<T>::max());
+			if (value.is_number_integer())
+			{
+				auto const number = value.get<int64_t>();
+				if constexpr (is_signed_v<T>)
+					return number >= int64_t(numeric_limits<T>::min()) && number <= int64_t(numeric_limits<T>::max());
+				else
+					return number >= 0 && uint64_t(number) <= uint64_t(numeric_limits<T>::max());
+			}
+			return false;
+		}
+
+		template <typename T>
+		void Integer(json const& value, json::json_pointer const& path, string_view type_name)
+		{
+			if (!InRange<T>(value))
+				Error(path, format("{} is not a valid {}", value.dump(), type_name));
+		}
+
+		void Check(TypeReference const& type, json const& value, json::json_pointer const& path)
+		{
+			++ValuesChecked;
+			if (!type)
+				return Error(path, "value has no type");
+
+			switch (type->Type())
+			{
+			case DefinitionType::Enum:
+				if (!value.is_number_integer() || !type->AsEnum()->EnumeratorByValue(value.get<int64_t>()))
+					Error(path, format("{} is not an enumerator of {}", value.dump(), type->Name()));
+				return;
+			case DefinitionType::Struct:
+			case DefinitionType::Class:
+				return Record(type->AsRecord(), value, path);
+			case DefinitionType::BuiltIn:
+				return BuiltIn(type, value, path);
+			default:
+				return Error(path, format("values of type {} can't be stored", type.ToString()));
+			}
+		}
+
+		void Record(RecordDefinition const* record, json const& value, json::json_pointer const& path)
+		{
+			if (!value.is_object())
+				return Error(path, format("expected an object of type {}, got {}", record->Name(), value.type_name()));
+			for (auto& [key, field_value] : value.items())
+			{
+				if (auto field = record->OwnOrBaseFieldByKey(key))
+					Check(field->FieldType, field_value, path / key);
+				else
+					Warning(path / key, format("{} has no field with key {}", record->Name(), key));
+			}
+		}
+
+		void Elements(TypeReference const& element_type, json const& value, json::json_pointer const& path)
+		{
+			for (size_t i = 0; i < value.size(); ++i)
+				Check(element_type, value[i], path / i);
+		}
+
+		void Object(TypeReference const& type, json const& value, json::json_pointer const& path, bool owned)
+		{
+			if (value.is_null())
+				return;
+
+			auto const object = Store.Heap().Resolve(value);
+			if (!object)
+			{
+				if (!value.is_number_integer())
+					Error(path, format("expected an object ID, got {}", value.dump()));
+				else if (owned)
+					Error(path, format("owns object #{}, which doesn't exist", value.dump()));
+				else
+					Warning(path, format("refers to object #{}, which was collected", value.dump()));
+				return;
+			}
+
+			auto const& pointee = get<TypeReference>(type.TemplateArguments.at(0));
+			if (pointee && object->Class != pointee.Type && !object->Class->IsChildOf(pointee.Type))
+				Error(path, format("object #{} is a {}, not a {}", value.dump(), object->Class->Name(), pointee->Name()));
+		}
+
+		void BuiltIn(TypeReference const& type, json const& value, json::json_pointer const& path)
+		{
+			auto const& name = type->Name();
+			if (name == "json")
+				return;
+			else if (name == "void")
+			{
+				if (!value.is_null())
+					Error(path, format("expected null, got {}", value.dump()));
+			}
+			else if (name == "f32" || name == "f64")
+			{
+				if (!value.is_number())
+					Error(path, format("expected a number, got {}", value.type_name()));
+			}
+			else if (name == "i8") Integer<int8_t>(value, path, name);
+			else if (name == "i16") Integer<int16_t>(value, path, name);
+			else if (name == "i32") Integer<int32_t>(value, path, name);
+			else if (name == "i64") Integer<int64_t>(value, path, name);
+			else if (name == "u8") Integer<uint8_t>(value, path, name);
+			else if (name == "u16") Integer<uint16_t>(value, path, name);
+			else if (name == "u32") Integer<uint32_t>(value, path, name);
+			else if (name == "u64") Integer<uint64_t>(value, path, name);
+			else if (name == "bool")
+			{
+				if (!value.is_boolean())
+					Error(path, format("expected true or false, got {}", value.type_name()));
+			}
+			else if (name == "string")
+			{
+				if (!value.is_string())
+					Error(path, format("expected a string, got {}", value.type_name()));
+			}
+			else if (name == "bytes")
+			{
+				if (BlobStore::IsReference(value))
+				{
+					if (!Store.Blobs().Has(BlobStore::ReferencedHash(value)))
+						Error(path, format("blob {} is missing", BlobStore::ReferencedHash(value)));
+				}
+				else if (!value.is_binary())
+					Error(path, format("expected bytes, got {}", value.type_name()));
+			}
+			else if (name == "flags")
+			{
+				if (!InRange<uint64_t>(value))
+					return Error(path, format("expected a bitmask, got {}", value.dump()));
+				auto const enum_type = get_if<TypeReference>(&type.TemplateArguments.at(0));
+				auto const enoom = enum_type && enum_type->Type ? enum_type->Type->AsEnum() : nullptr;
+				if (!enoom)
+					return;
+				uint64_t known_bits = 0;
+				for (auto e : enoom->Enumerators())
+					known_bits |= FlagBit(e->ActualValue());
+				if (auto const unknown = value.get<uint64_t>() & ~known_bits)
+					Error(path, format("bits {:#x} are not flags of {}", unknown, enoom->Name()));
+			}
+			else if (name == "list")
+			{
+				if (!value.is_array())
+					return Error(path, format("expected an array, got {}", value.type_name()));
+				Elements(get<TypeReference>(type.TemplateArguments.at(0)), value, path);
+			}
+			else if (name == "array")
+			{
+				if (!value.is_array())
+					return Error(path, format("expected an array, got {}", value.type_name()));
+				auto const size = get<uint64_t>(type.TemplateArguments.at(1));
+				if (value.size() != size)
+					Error(path, format("expected {} elements, got {}", size, value.size()));
+				Elements(get<TypeReference>(type.TemplateArguments.at(0)), value, path);
+			}
+			else if (name == "map")
+			{
+				if (!value.is_object())
+					return Error(path, format("expected an object, got {}", value.type_name()));
+				auto const& value_type = get<TypeReference>(type.TemplateArguments.at(1));
+				for (auto& [key, element] : value.items())
+					Check(value_type, element, path / key);
+			}
+			else if (name == "ref" || name == "own")
+				Object(type, value, path, name == "own");
+			else if (name == "variant")
+			{
+				if (!value.is_array() || value.size() != 2 || !value[0].is_number_unsigned())
+					return Error(path, format("expected [index, value], got {}", value.dump()));
+				auto const index = value[0].get<uint64_t>();
+				auto const alternative = index < type.TemplateArguments.size() ? get_if<TypeReference>(&type.TemplateArguments[index]) : nullptr;
+				if (!alternative)
+					return Error(path / 0, format("{} is not a valid alternative of {}", index, type.ToString()));
+				Check(*alternative, value[1], path / 1);
+			}
+		}
+	};
+
+	uint64_t ValidateValue(DataStore const& store, TypeReference const& type, json const& value, json::json_pointer const& path, vector<ValueDiagnostic>& diagnostics)
+	{
+		ValueValidator validator{ store, diagnostics };
+		validator.Check(type, value, path);
+		return validator.ValuesChecked;
+	}
+
+	StoreValidationReport ValidateStore(DataStore const& store)
+	{
+		auto const start = chrono::steady_clock::now();
+
+		/// Each root, table column and heap page is checked separately, into its own diagnostics
+		struct Part
+		{
+			function<uint64_t(vector<ValueDiagnostic>&)> Validate;
+			vector<ValueDiagnostic> Diagnostics;
+			uint64_t ValuesChecked = 0;
+		};
+		vector<Part> parts;
+
+		for (auto& [name, root] : store.Roots())
+		{
+			parts.push_back({ [&store, &name, &root = *root](vector<ValueDiagnostic>& diagnostics) {
+				auto const type = TypeFromStorageJSON(store.Schema(), root.at("type"));
+				return ValidateValue(store, type, root.at("value"), json::json_pointer{ "/roots" } / name / "value", diagnostics);
+			} });
+		}
+
+		for (auto& [record, table] : store.Tables())
+		{
+			for (auto& column : table->Columns())
+			{
+				/// Plain columns check their values as they're stored
+				if (column->IsPlain())
+					continue;
+				parts.push_back({ [&store, record, &table = *table, &column = *column](vector<ValueDiagnostic>& diagnostics) {
+					uint64_t checked = 0;
+					auto const table_path = json::json_pointer{ "/tables" } / record->Name();
+					for (size_t i = 0; i < table.RowCount(); ++i)
+						checked += ValidateValue(store, column.Type, column.Get(i), table_path / to_string(table.RowIDs()[i]) / column.Key, diagnostics);
+					return checked;
+				} });
+			}
+		}
+
+		auto& heap = store.Heap();
+		for (size_t page = 0; page < heap.PageCount(); ++page)
+		{
+			parts.push_back({ [&store, &heap, page](vector<ValueDiagnostic>& diagnostics) {
+				uint64_t checked = 0;
+				ignore = heap.AnyObjectOnPage(page, [&](uint64_t id, HeapObject const& object) {
+					checked += ValidateValue(store, TypeReference{ object.Class }, object.Value, json::json_pointer{ "/gcheap" } / to_string(id), diagnostics);
+					return false;
+				});
+				return checked;
+			} });
+		}
+
+		for_each(execution::par, parts.begin(), parts.end(), [](Part& part) {
+			part.ValuesChecked = part.Validate(part.Diagnostics);
+		});
+
+		StoreValidationReport report;
+		for (auto& part : parts)
+		{
+			report.ValuesChecked += part.ValuesChecked;
+			report.Diagnostics.insert(report.Diagnostics.end(), make_move_iterator(part.Diagnostics.begin()), make_move_iterator(part.Diagnostics.end()));
+		}
+		ranges::sort(report.Diagnostics, {}, &ValueDiagnostic::Path);
+		report.Duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+		return report;
+	}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	struct DataStore;
+
+	struct ValueDiagnostic
+	{
+		enum class Severity { Warning, Error };
+
+		Severity Level = Severity::Error;
+		/// JSON pointer to the value: /roots/<name>/value/..., /tables/<struct name>/<row id>/<field key>/..., or /gcheap/<object id>/...
+		string Path;
+		string Message;
+	};
+
+	struct StoreValidationReport
+	{
+		vector<ValueDiagnostic> Diagnostics; /// in path order
+		uint64_t ValuesChecked = 0;
+		chrono::microseconds Duration{};
+
+		bool HasErrors() const noexcept;
+	};
+
+	/// Checks a value in storage form against its type, and everything inside it: integer ranges, enumerators and flag bits,
+	/// array sizes, variant indices, field keys, blob references, and `own`/`ref` targets (refs to collected objects are
+	/// only warnings, as refs don't keep objects alive). Returns the number of values checked.
+	uint64_t ValidateValue(DataStore const& store, TypeReference const& type, json const& value, json::json_pointer const& path, vector<ValueDiagnostic>& diagnostics);
+
+	/// Validates every root, table column and gcheap object of the store. Each of those is checked on its own, in parallel.
+	/// This only reads the store, so it can run on another thread on a snapshot (see DataStore::Snapshot).
+	StoreValidationReport ValidateStore(DataStore const& store);
+}
@@ -0,0 +1,605 @@
+#include "pch.h"
+
+#include "Table.h"
+#include "Values.h"
+
+namespace dtmdl
+{
+
+	template <typename T>
+	struct TypedColumn : TableColumn
+	{
+		vector<T> Values;
+		/// value -> row id
+		shared_ptr<multimap<T, int64_t>> Index;
+		bool Unique = false;
+
+		static optional<T> FromJSON(json const& value)
+		{
+			if constexpr (is_same_v<T, json>)
+				return value;
+			else if constexpr (is_same_v<T, string>)
+			{
+				if (!value.is_string())
+					return nullopt;
+				return value.get<string>();
+			}
+			else if constexpr (is_same_v<T, bool>)
+			{
+				if (!value.is_boolean())
+					return nullopt;
+				return value.get<bool>();
+			}
+			else
+			{
+				if (!value.is_number())
+					return nullopt;
+				return value.get<T>();
+			}
+		}
+
+		T Convert(json const& value) const
+		{
+			auto result = FromJSON(value);
+			if (!result)
+				throw std::runtime_error(format("value {} is not valid for column '{}' of type {}", value.dump(), Key, Type.ToString()));
+			return move(*result);
+		}
+
+		/// Indices are shared between clones until one of them changes (see MutableIndex)
+		virtual unique_ptr<TableColumn> Clone() const override { return make_unique<TypedColumn<T>>(*this); }
+
+		virtual bool Accepts(json const& value) const override { return FromJSON(value).has_value(); }
+		virtual size_t Size() const noexcept override { return Values.size(); }
+		virtual json Get(size_t position) const override { return json(T(Values[position])); }
+
+		virtual void Insert(size_t position, int64_t row_id, json const& value) override
+		{
+			auto it = Values.insert(Values.begin() + position, Convert(value));
+			if (Index)
+				MutableIndex().emplace(*it, row_id);
+		}
+
+		virtual void Set(size_t position, int64_t row_id, json const& value) override
+		{
+			auto new_value = Convert(value);
+			if (Index)
+			{
+				EraseFromIndex(Values[position], row_id);
+				MutableIndex().emplace(new_value, row_id);
+			}
+			Values[position] = move(new_value);
+		}
+
+		virtual void Erase(span<char const> erased, span<int64_t const> row_ids) override
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < Values.size(); ++i)
+			{
+				if (erased[i])
+				{
+					if (Index)
+						EraseFromIndex(Values[i], row_ids[i]);
+					continue;
+				}
+				if (kept != i)
+					Values[kept] = move(Values[i]);
+				++kept;
+			}
+			Values.resize(kept);
+		}
+
+		virtual size_t MemoryUsage() const noexcept override
+		{
+			size_t result = 0;
+			if constexpr (is_same_v<T, bool>)
+				result = Values.capacity() / 8;
+			else
+				result = Values.capacity() * sizeof(T);
+			if constexpr (is_same_v<T, string>)
+			{
+				for (auto& value : Values)
+					if (value.capacity() > sizeof(string))
+						result += value.capacity();
+			}
+			/// Rough estimate of the node size of a map
+			if (Index)
+				result += Index->size() * (sizeof(T) + sizeof(int64_t) + 4 * sizeof(void*));
+			return result;
+		}
+
+		virtual bool SameValues(TableColumn const& other) const override
+		{
+			auto typed = dynamic_cast<TypedColumn<T> const*>(&other);
+			return typed && Type == other.Type && Values == typed->Values;
+		}
+
+		virtual bool KeepsJSON() const noexcept override { return is_same_v<T, json>; }
+		virtual span<json> JSONValues() noexcept override
+		{
+			if constexpr (is_same_v<T, json>)
+				return Values;
+			else
+				return {};
+		}
+		virtual span<json const> JSONValues() const noexcept override
+		{
+			if constexpr (is_same_v<T, json>)
+				return Values;
+			else
+				return {};
+		}
+
+		virtual bool HasIndex() const noexcept override { return Index != nullptr; }
+		virtual bool IsUnique() const noexcept override { return Index && Unique; }
+
+		virtual result<void, string> BuildIndex(span<int64_t const> row_ids, bool unique) override
+		{
+			auto index = make_shared<multimap<T, int64_t>>();
+			for (size_t i = 0; i < Values.size(); ++i)
+			{
+				if (unique && index->contains(Values[i]))
+					return failure(format("value {} appears more than once", Get(i).dump()));
+				index->emplace(Values[i], row_ids[i]);
+			}
+			Index = move(index);
+			Unique = unique;
+			return success();
+		}
+
+		virtual void DropIndex() override
+		{
+			Index = nullptr;
+			Unique = false;
+		}
+
+		virtual vector<int64_t> Find(json const& value, span<int64_t const> row_ids) const override
+		{
+			vector<int64_t> result;
+			auto key = FromJSON(value);
+			if (!key)
+				return result;
+
+			if (Index)
+			{
+				auto [begin, end] = Index->equal_range(*key);
+				for (auto it = begin; it != end; ++it)
+					result.push_back(it->second);
+				ranges::sort(result);
+			}
+			else
+			{
+				for (size_t i = 0; i < Values.size(); ++i)
+					if (Values[i] == *key)
+						result.push_back(row_ids[i]);
+			}
+			return result;
+		}
+
+		virtual optional<vector<int64_t>> FindInIndex(json const* from, bool from_inclusive, json const* to, bool to_inclusive) const override
+		{
+			if (!Index)
+				return nullopt;
+
+			optional<T> from_key, to_key;
+			if (from)
+			{
+				from_key = FromJSON(*from);
+				if (!from_key || json(T(*from_key)) != *from)
+					return nullopt;
+			}
+			if (to)
+			{
+				to_key = FromJSON(*to);
+				if (!to_key || json(T(*to_key)) != *to)
+					return nullopt;
+			}
+
+			vector<int64_t> result;
+			if (from_key && to_key && (*to_key < *from_key || (*to_key == *from_key && !(from_inclusive && to_inclusive))))
+				return result;
+
+			auto begin = !from_key ? Index->begin() : from_inclusive ? Index->lower_bound(*from_key) : Index->upper_bound(*from_key);
+			auto end = !to_key ? Index->end() : to_inclusive ? Index->upper_bound(*to_key) : Index->lower_bound(*to_key);
+			for (auto it = begin; it != end; ++it)
+				result.push_back(it->second);
+			ranges::sort(result);
+			return result;
+		}
+
+		virtual bool Conflicts(json const& value, optional<int64_t> except_row_id) const override
+		{
+			if (!IsUnique())
+				return false;
+			auto key = FromJSON(value);
+			if (!key)
+				return false;
+			auto [begin, end] = Index->equal_range(*key);
+			return any_of(begin, end, [&](auto const& kvp) { return kvp.second != except_row_id; });
+		}
+
+	private:
+
+		multimap<T, int64_t>& MutableIndex()
+		{
+			if (Index.use_count() > 1)
+				Index = make_shared<multimap<T, int64_t>>(*Index);
+			return *Index;
+		}
+
+		void EraseFromIndex(T const& value, int64_t row_id)
+		{
+			auto& index = MutableIndex();
+			auto [begin, end] = index.equal_range(value);
+			for (auto it = begin; it != end; ++it)
+			{
+				if (it->second == row_id)
+				{
+					index.erase(it);
+					return;
+				}
+			}
+		}
+	};
+
+	json TableColumn::ToJSON() const
+	{
+		json result = json::array();
+		auto& array = result.get_ref<json::array_t&>();
+		array.reserve(Size());
+		for (size_t i = 0; i < Size(); ++i)
+			array.push_back(Get(i));
+		return result;
+	}
+
+	template <typename T>
+	static unique_ptr<TableColumn> MakeTypedColumn() { return make_unique<TypedColumn<T>>(); }
+
+	unique_ptr<TableColumn> TableColumn::Make(string key, TypeReference const& type, json const& values)
+	{
+		static map<string, unique_ptr<TableColumn>(*)(), less<>> const native_columns = {
+			{ "f32", &MakeTypedColumn<float> },
+			{ "f64", &MakeTypedColumn<double> },
+			{ "i8", &MakeTypedColumn<int8_t> },
+			{ "i16", &MakeTypedColumn<int16_t> },
+			{ "i32", &MakeTypedColumn<int32_t> },
+			{ "i64", &MakeTypedColumn<int64_t> },
+			{ "u8", &MakeTypedColumn<uint8_t> },
+			{ "u16", &MakeTypedColumn<uint16_t> },
+			{ "u32", &MakeTypedColumn<uint32_t> },
+			{ "u64", &MakeTypedColumn<uint64_t> },
+			{ "bool", &MakeTypedColumn<bool> },
+			{ "string", &MakeTypedColumn<string> },
+			{ "flags", &MakeTypedColumn<uint64_t> }, /// see FlagBit
+		};
+
+		unique_ptr<TableColumn> result;
+		if (type->Type() == DefinitionType::Enum)
+			result = MakeTypedColumn<int64_t>();
+		else if (auto it = type->IsBuiltIn() ? native_columns.find(type->Name()) : native_columns.end(); it != native_columns.end())
+			result = it->second();
+		else
+			result = MakeTypedColumn<json>();
+
+		result->Key = move(key);
+		result->Type = type;
+
+		if (!values.is_array())
+			throw std::runtime_error(format("values of column '{}' are not an array", result->Key));
+		for (auto& value : values)
+			result->Append(0, value);
+		return result;
+	}
+
+	static json DefaultValue(TypeReference const& type)
+	{
+		json result;
+		ignore = InitializeValue(type, result);
+		return result;
+	}
+
+	Table::Table(StructDefinition const* record)
+		: mRecord(record)
+	{
+		AddMissingColumns();
+	}
+
+	Table::Table(Table const& other)
+		: mRecord(other.mRecord), mLastRowID(other.mLastRowID), mRowIDs(other.mRowIDs)
+	{
+		for (auto& column : other.mColumns)
+			mColumns.push_back(column->Clone());
+	}
+
+	Table& Table::operator=(Table const& other)
+	{
+		if (this != &other)
+			*this = Table{ other };
+		return *this;
+	}
+
+	optional<size_t> Table::PositionOf(int64_t row_id) const
+	{
+		auto it = ranges::lower_bound(mRowIDs, row_id);
+		if (it == mRowIDs.end() || *it != row_id)
+			return nullopt;
+		return size_t(it - mRowIDs.begin());
+	}
+
+	TableColumn const* Table::Column(string_view key) const
+	{
+		auto it = ranges::find(mColumns, key, [](auto const& column) -> string_view { return column->Key; });
+		return it != mColumns.end() ? it->get() : nullptr;
+	}
+
+	TableColumn* Table::MutableColumn(string_view key)
+	{
+		return const_cast<TableColumn*>(Column(key));
+	}
+
+	json Table::Row(size_t position) const
+	{
+		json result = json::object();
+		for (auto& column : mColumns)
+			result[column->Key] = column->Get(position);
+		return result;
+	}
+
+	json Table::Row(size_t position, span<TableColumn const* const> columns) const
+	{
+		json result = json::object();
+		for (auto column : columns)
+			result[column->Key] = column->Get(position);
+		return result;
+	}
+
+	result<int64_t, string> Table::Insert(json const& row)
+	{
+		auto const row_id = mLastRowID + 1;
+		if (auto inserted = InsertAt(mRowIDs.size(), row_id, row); inserted.has_error())
+			return failure(move(inserted).error());
+		return row_id;
+	}
+
+	result<void, string> Table::InsertWithID(int64_t row_id, json const& row)
+	{
+		if (row_id <= 0)
+			return failure(format("invalid row id {}", row_id));
+		auto it = ranges::lower_bound(mRowIDs, row_id);
+		if (it != mRowIDs.end() && *it == row_id)
+			return failure(format("table already has a row with id {}", row_id));
+		return InsertAt(size_t(it - mRowIDs.begin()), row_id, row);
+	}
+
+	result<void, string> Table::InsertAt(size_t position, int64_t row_id, json const& row)
+	{
+		if (!row.is_object())
+			return failure("table rows must be objects");
+
+		AddMissingColumns();
+
+		vector<json> values;
+		values.reserve(mColumns.size());
+		for (auto& column : mColumns)
+		{
+			auto it = row.find(column->Key);
+			auto& value = values.emplace_back(it != row.end() ? *it : DefaultValue(column->Type));
+			/// Check everything up front, so a failed insert doesn't leave the columns out of step
+			if (!column->Accepts(value))
+				return failure(format("value {} is not valid for column '{}' of type {}", value.dump(), column->Key, column->Type.ToString()));
+			if (column->Conflicts(value))
+				return failure(format("a row with value {} in unique column '{}' already exists", value.dump(), column->Key));
+		}
+
+		for (size_t i = 0; i < mColumns.size(); ++i)
+			mColumns[i]->Insert(position, row_id, values[i]);
+		mRowIDs.insert(mRowIDs.begin() + position, row_id);
+		mLastRowID = max(mLastRowID, row_id);
+		return success();
+	}
+
+	result<void, string> Table::Set(int64_t row_id, string_view key, json const& value)
+	{
+		auto position = PositionOf(row_id);
+		if (!position)
+			return failure(format("table has no row with id {}", row_id));
+		auto column = MutableColumn(key);
+		if (!column)
+			return failure(format("table has no column '{}'", key));
+		if (!column->Accepts(value))
+			return failure(format("value {} is not valid for column '{}' of type {}", value.dump(), key, column->Type.ToString()));
+		if (column->Conflicts(value, row_id))
+			return failure(format("a row with value {} in unique column '{}' already exists", value.dump(), key));
+
+		column->Set(*position, row_id, value);
+		return success();
+	}
+
+	size_t Table::Delete(span<int64_t const> row_ids)
+	{
+		vector<char> erased(mRowIDs.size());
+		size_t count = 0;
+		for (auto row_id : row_ids)
+		{
+			if (auto position = PositionOf(row_id); position && !erased[*position])
+			{
+				erased[*position] = true;
+				++count;
+			}
+		}
+		if (count == 0)
+			return 0;
+
+		for (auto& column : mColumns)
+			column->Erase(erased, mRowIDs);
+		size_t kept = 0;
+		for (size_t i = 0; i < mRowIDs.size(); ++i)
+			if (!erased[i])
+				mRowIDs[kept++] = mRowIDs[i];
+		mRowIDs.resize(kept);
+		return count;
+	}
+
+	vector<int64_t> Table::FindRows(string_view key, json const& value) const
+	{
+		auto column = Column(key);
+		if (!column)
+			return {};
+		return column->Find(value, mRowIDs);
+	}
+
+	void Table::AddMissingColumns()
+	{
+		for (auto field : mRecord->AllFieldsOrdered())
+		{
+			auto key = field->StorageKey();
+			if (Column(key))
+				continue;
+			auto column = TableColumn::Make(key, field->FieldType);
+			auto const default_value = DefaultValue(field->FieldType);
+			for (auto row_id : mRowIDs)
+				column->Append(row_id, default_value);
+			mColumns.push_back(move(column));
+		}
+	}
+
+	void Table::ConvertColumn(string_view key, TypeReference const& old_type, TypeReference const& new_type)
+	{
+		auto it = ranges::find(mColumns, key, [](auto const& column) -> string_view { return column->Key; });
+		if (it == mColumns.end())
+			return;
+
+		auto values = (*it)->ToJSON();
+		for (auto& value : values)
+		{
+			/// Same as with record objects, except that values which can't be converted are reset instead of removed
+			if (!Convert(old_type, new_type, value) && !InitializeValue(new_type, value))
+				value = json{};
+		}
+		*it = TableColumn::Make(string{ key }, new_type, values);
+		if (auto result = UpdateIndices(); result.has_error())
+			throw std::runtime_error(result.error());
+	}
+
+	void Table::SetColumnValues(string_view key, json const& values)
+	{
+		auto it = ranges::find(mColumns, key, [](auto const& column) -> string_view { return column->Key; });
+		if (it == mColumns.end())
+			return;
+
+		auto column = TableColumn::Make(string{ key }, (*it)->Type, values);
+		if (column->Size() != mRowIDs.size())
+			throw std::runtime_error(format("column '{}' of table '{}' would have {} values, but the table has {} rows", key, mRecord->Name(), column->Size(), mRowIDs.size()));
+		*it = move(column);
+		if (auto result = UpdateIndices(); result.has_error())
+			throw std::runtime_error(result.error());
+	}
+
+	span<json> Table::MutableJSONValues(string_view key)
+	{
+		auto column = MutableColumn(key);
+		return column ? column->JSONValues() : span<json>{};
+	}
+
+	result<void, string> Table::RebuildJSONIndices()
+	{
+		for (auto& column : mColumns)
+		{
+			if (!column->KeepsJSON() || !column->HasIndex())
+				continue;
+			auto const unique = column->IsUnique();
+			column->DropIndex();
+			if (auto result = column->BuildIndex(mRowIDs, unique); result.has_error())
+				return failure(format("cannot index column '{}' of '{}': {}", column->Key, mRecord->Name(), result.error()));
+		}
+		return success();
+	}
+
+	void Table::DropColumn(string_view key)
+	{
+		erase_if(mColumns, [key](auto const& column) { return column->Key == key; });
+	}
+
+	result<void, string> Table::UpdateIndices()
+	{
+		for (auto& column : mColumns)
+		{
+			auto field = mRecord->OwnOrBaseFieldByKey(column->Key);
+			if (!field)
+				continue;
+			auto const unique = field->Flags.contain(FieldFlags::Unique);
+			auto const indexed = unique || field->Flags.contain(FieldFlags::Indexed);
+			if (!indexed)
+				column->DropIndex();
+			else if (!column->HasIndex() || column->IsUnique() != unique)
+			{
+				if (auto result = column->BuildIndex(mRowIDs, unique); result.has_error())
+					return failure(format("cannot index field '{}' of '{}': {}", field->Name, mRecord->Name(), result.error()));
+			}
+		}
+		return success();
+	}
+
+	size_t Table::MemoryUsage() const noexcept
+	{
+		size_t result = mRowIDs.capacity() * sizeof(int64_t);
+		for (auto& column : mColumns)
+			result += column->MemoryUsage();
+		return result;
+	}
+
+	bool Table::SameRows(Table const& other) const
+	{
+		if (mRecord != other.mRecord || mRowIDs != other.mRowIDs || mColumns.size() != other.mColumns.size())
+			return false;
+		for (auto& column : mColumns)
+		{
+			auto other_column = other.Column(column->Key);
+			if (!other_column || !column->SameValues(*other_column))
+				return false;
+		}
+		return true;
+	}
+
+	json Table::ToJSON() const
+	{
+		json columns = json::object();
+		for (auto& column : mColumns)
+			columns[column->Key] = column->ToJSON();
+		return json::object({
+			{ "last_rowid", mLastRowID },
+			{ "rowids", mRowIDs },
+			{ "columns", move(columns) },
+		});
+	}
+
+	Table Table::FromJSON(StructDefinition const* record, json const& value)
+	{
+		Table result{ record };
+		result.mColumns.clear();
+		result.mLastRowID = value.at("last_rowid").get<int64_t>();
+		result.mRowIDs = value.at("rowids").get<vector<int64_t>>();
+		if (!ranges::is_sorted(result.mRowIDs) || ranges::adjacent_find(result.mRowIDs) != result.mRowIDs.end())
+			throw std::runtime_error(format("row ids of table '{}' are not in ascending order", record->Name()));
+		if (!result.mRowIDs.empty() && result.mRowIDs.back() > result.mLastRowID)
+			throw std::runtime_error(format("row ids of table '{}' are past its last row id", record->Name()));
+
+		for (auto& [key, values] : value.at("columns").items())
+		{
+			/// Columns of fields that no longer exist are dropped
+			auto field = record->OwnOrBaseFieldByKey(key);
+			if (!field)
+				continue;
+			auto column = TableColumn::Make(key, field->FieldType, values);
+			if (column->Size() != result.mRowIDs.size())
+				throw std::runtime_error(format("column '{}' of table '{}' has {} values, but the table has {} rows", field->Name, record->Name(), column->Size(), result.mRowIDs.size()));
+			result.mColumns.push_back(move(column));
+		}
+
+		result.AddMissingColumns();
+		if (auto indexed = result.UpdateIndices(); indexed.has_error())
+			throw std::runtime_error(indexed.error());
+		return result;
+	}
+
+}
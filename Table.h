@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Schema.h"
+
+namespace dtmdl
+{
+	/// One field of a table. Values of numeric, bool, enum, flags and string fields are kept in a vector of their native type;
+	/// anything else is kept as a vector of JSON values.
+	struct TableColumn
+	{
+		virtual ~TableColumn() noexcept = default;
+
+		string Key; /// see FieldDefinition::StorageKey
+		TypeReference Type;
+
+		virtual unique_ptr<TableColumn> Clone() const = 0;
+
+		virtual size_t Size() const noexcept = 0;
+		virtual json Get(size_t position) const = 0;
+		virtual bool Accepts(json const& value) const = 0;
+		/// These throw if `value` is not a valid value of the column's type
+		virtual void Insert(size_t position, int64_t row_id, json const& value) = 0;
+		void Append(int64_t row_id, json const& value) { Insert(Size(), row_id, value); }
+		virtual void Set(size_t position, int64_t row_id, json const& value) = 0;
+		/// Removes the values at the positions where `erased` is set; `row_ids` are the row ids before erasing
+		virtual void Erase(span<char const> erased, span<int64_t const> row_ids) = 0;
+
+		virtual size_t MemoryUsage() const noexcept = 0;
+		/// True if `other` has the same type and values
+		virtual bool SameValues(TableColumn const& other) const = 0;
+
+		/// Indices (see FieldFlags::Indexed and FieldFlags::Unique)
+		virtual bool HasIndex() const noexcept = 0;
+		virtual bool IsUnique() const noexcept = 0;
+		virtual result<void, string> BuildIndex(span<int64_t const> row_ids, bool unique) = 0;
+		virtual void DropIndex() = 0;
+		/// Returns the ids of rows holding `value`; uses the index if there is one, scans otherwise
+		virtual vector<int64_t> Find(json const& value, span<int64_t const> row_ids) const = 0;
+		/// Returns the ids of rows with values between `from` and `to` (null for no bound), in ascending order, using the index.
+		/// Returns nullopt if there is no index, or if a bound isn't exactly a value of the column's type (5.5 in an integer column,
+		/// say), as it would be rounded to one that doesn't compare the same way.
+		virtual optional<vector<int64_t>> FindInIndex(json const* from, bool from_inclusive, json const* to, bool to_inclusive) const = 0;
+		/// True if setting a row other than `except_row_id` to `value` would break uniqueness
+		virtual bool Conflicts(json const& value, optional<int64_t> except_row_id = nullopt) const = 0;
+
+		/// Values of columns that keep them as JSON (see above) can be visited and changed in place; these are empty for the others.
+		/// Changing them leaves the column's index out of date (see Table::RebuildJSONIndices).
+		virtual bool KeepsJSON() const noexcept = 0;
+		virtual span<json> JSONValues() noexcept = 0;
+		virtual span<json const> JSONValues() const noexcept = 0;
+
+		json ToJSON() const;
+		/// Numbers, bools and strings can't contain values of any other type, so there's no point in visiting them
+		bool IsPlain() const noexcept { return Type->IsBuiltIn() && Type.TemplateArguments.empty() && Type->Name() != "bytes"; }
+
+		/// Throws if any of the values is not a valid value of `type`
+		static unique_ptr<TableColumn> Make(string key, TypeReference const& type, json const& values = json::array());
+	};
+
+	/// Column-oriented storage for the records of a struct with the StructFlags::CreateTableType flag.
+	/// Rows are identified by row ids, which are never reused and are kept in ascending order.
+	struct Table
+	{
+		explicit Table(StructDefinition const* record);
+
+		Table(Table const& other);
+		Table(Table&&) noexcept = default;
+		Table& operator=(Table const& other);
+		Table& operator=(Table&&) noexcept = default;
+
+		StructDefinition const* Record() const noexcept { return mRecord; }
+
+		size_t RowCount() const noexcept { return mRowIDs.size(); }
+		auto const& RowIDs() const noexcept { return mRowIDs; }
+		int64_t LastRowID() const noexcept { return mLastRowID; }
+		optional<size_t> PositionOf(int64_t row_id) const;
+
+		auto const& Columns() const noexcept { return mColumns; }
+		TableColumn const* Column(string_view key) const;
+
+		/// Row values are objects keyed by field storage keys; missing fields get their default values
+		json Row(size_t position) const;
+		json Row(size_t position, span<TableColumn const* const> columns) const;
+
+		result<int64_t, string> Insert(json const& row);
+		/// Inserts a row with the given id (for merging tables); fails if the id is taken
+		result<void, string> InsertWithID(int64_t row_id, json const& row);
+		result<void, string> Set(int64_t row_id, string_view key, json const& value);
+		/// Returns the number of rows deleted
+		size_t Delete(span<int64_t const> row_ids);
+
+		/// Uses the field's index if it has one
+		vector<int64_t> FindRows(string_view key, json const& value) const;
+
+		/// Schema changes
+
+		/// Adds columns for fields that were added to the record since the table was created
+		void AddMissingColumns();
+		void ConvertColumn(string_view key, TypeReference const& old_type, TypeReference const& new_type);
+		/// Replaces all values of a column; throws unless `values` has one valid value for each row
+		void SetColumnValues(string_view key, json const& values);
+		/// The values of a column kept as JSON, to be changed in place; call RebuildJSONIndices afterwards
+		span<json> MutableJSONValues(string_view key);
+		/// Rebuilds the indices of columns kept as JSON, whose values may have been changed in place
+		result<void, string> RebuildJSONIndices();
+		void DropColumn(string_view key);
+		/// Makes the indices match the fields' Indexed and Unique flags
+		result<void, string> UpdateIndices();
+
+		size_t MemoryUsage() const noexcept;
+		/// True if both tables have the same rows, with the same ids
+		bool SameRows(Table const& other) const;
+
+		/// Tables are saved as { "last_rowid": ..., "rowids": [...], "columns": { key: [values...] } }
+		json ToJSON() const;
+		/// Throws if the data is malformed
+		static Table FromJSON(StructDefinition const* record, json const& value);
+
+	private:
+
+		TableColumn* MutableColumn(string_view key);
+		result<void, string> InsertAt(size_t position, int64_t row_id, json const& row);
+
+		StructDefinition const* mRecord = nullptr;
+		int64_t mLastRowID = 0;
+		vector<int64_t> mRowIDs;
+		vector<unique_ptr<TableColumn>> mColumns;
+	};
+}
@@ -0,0 +1,279 @@
+#include "pch.h"
+
+#include "UBJSON.h"
+
+namespace dtmdl
+{
+
+	struct UBJSONScanner
+	{
+		span<uint8_t const> Data;
+		size_t Position = 0;
+
+		result<uint8_t, string> Peek() const
+		{
+			if (Position >= Data.size())
+				return failure("unexpected end of UBJSON data");
+			return Data[Position];
+		}
+
+		result<uint8_t, string> Byte()
+		{
+			auto byte = Peek();
+			if (byte.has_value())
+				++Position;
+			return byte;
+		}
+
+		result<void, string> Skip(size_t count)
+		{
+			if (count > Data.size() - Position)
+				return failure("unexpected end of UBJSON data");
+			Position += count;
+			return success();
+		}
+
+		/// Integers are big endian
+		result<int64_t, string> Integer(uint8_t marker)
+		{
+			size_t size = 0;
+			switch (marker)
+			{
+			case 'i': size = 1; break;
+			case 'U': size = 1; break;
+			case 'I': size = 2; break;
+			case 'l': size = 4; break;
+			case 'L': size = 8; break;
+			default: return failure(format("'{}' is not a UBJSON integer marker", char(marker)));
+			}
+			if (size > Data.size() - Position)
+				return failure("unexpected end of UBJSON data");
+
+			uint64_t bits = 0;
+			for (size_t i = 0; i < size; ++i)
+				bits = (bits << 8) | Data[Position + i];
+			Position += size;
+			if (marker == 'U')
+				return int64_t(bits);
+			/// Sign-extend from the integer's size
+			auto const shift = 64 - int(size * 8);
+			return int64_t(bits << shift) >> shift;
+		}
+
+		result<size_t, string> Length()
+		{
+			auto marker = Byte();
+			if (marker.has_error())
+				return failure(move(marker).error());
+			auto length = Integer(marker.value());
+			if (length.has_error())
+				return failure(move(length).error());
+			if (length.value() < 0)
+				return failure("negative UBJSON length");
+			return size_t(length.value());
+		}
+
+		/// Keys are strings without the `S` marker
+		result<void, string> Key(string_view& key)
+		{
+			auto length = Length();
+			if (length.has_error())
+				return failure(move(length).error());
+			auto const start = Position;
+			if (auto skipped = Skip(length.value()); skipped.has_error())
+				return skipped;
+			key = { reinterpret_cast<char const*>(Data.data() + start), length.value() };
+			return success();
+		}
+
+		static size_t ScalarSize(uint8_t marker)
+		{
+			switch (marker)
+			{
+			case 'Z': case 'N': case 'T': case 'F': return 0;
+			case 'i': case 'U': case 'C': return 1;
+			case 'I': return 2;
+			case 'l': case 'd': return 4;
+			case 'L': case 'D': return 8;
+			default: return SIZE_MAX;
+			}
+		}
+
+		result<void, string> SkipValue(uint8_t marker)
+		{
+			if (auto const size = ScalarSize(marker); size != SIZE_MAX)
+				return Skip(size);
+
+			switch (marker)
+			{
+			case 'S':
+			case 'H':
+			{
+				auto length = Length();
+				if (length.has_error())
+					return failure(move(length).error());
+				return Skip(length.value());
+			}
+			case '[':
+				return SkipContainer(false);
+			case '{':
+				return SkipContainer(true);
+			default:
+				return failure(format("unknown UBJSON marker '{}' at offset {}", char(marker), Position - 1));
+			}
+		}
+
+		result<void, string> SkipContainer(bool object)
+		{
+			optional<uint8_t> value_type;
+			optional<size_t> count;
+			if (auto next = Peek(); next.has_value() && next.value() == '$')
+			{
+				++Position;
+				auto type = Byte();
+				if (type.has_error())
+					return failure(move(type).error());
+				value_type = type.value();
+			}
+			if (auto next = Peek(); next.has_value() && next.value() == '#')
+			{
+				++Position;
+				auto length = Length();
+				if (length.has_error())
+					return failure(move(length).error());
+				count = length.value();
+			}
+			if (value_type && !count)
+				return failure("UBJSON container has a type but no count");
+
+			/// Arrays of fixed-size values (like `bytes` values) are skipped in one go
+			if (value_type && !object)
+			{
+				if (auto const size = ScalarSize(*value_type); size != SIZE_MAX)
+				{
+					if (size != 0 && *count > (Data.size() - Position) / size)
+						return failure("unexpected end of UBJSON data");
+					return Skip(*count * size);
+				}
+			}
+
+			for (size_t i = 0; !count || i < *count; ++i)
+			{
+				if (!count)
+				{
+					auto next = Peek();
+					if (next.has_error())
+						return failure(move(next).error());
+					if (next.value() == (object ? '}' : ']'))
+					{
+						++Position;
+						break;
+					}
+				}
+				string_view key;
+				if (object)
+				{
+					if (auto read = Key(key); read.has_error())
+						return read;
+				}
+				uint8_t marker = 0;
+				if (value_type)
+					marker = *value_type;
+				else if (auto byte = Byte(); byte.has_value())
+					marker = byte.value();
+				else
+					return failure(move(byte).error());
+				if (auto skipped = SkipValue(marker); skipped.has_error())
+					return skipped;
+			}
+			return success();
+		}
+	};
+
+	result<map<string, UBJSONRange, less<>>, string> IndexUBJSONObject(span<uint8_t const> data, size_t offset)
+	{
+		UBJSONScanner scanner{ data, offset };
+		if (auto open = scanner.Byte(); open.has_error() || open.value() != '{')
+			return failure("not a UBJSON object");
+
+		optional<size_t> count;
+		if (auto next = scanner.Peek(); next.has_value() && next.value() == '$')
+			return failure("UBJSON objects with a fixed value type can't be indexed");
+		if (auto next = scanner.Peek(); next.has_value() && next.value() == '#')
+		{
+			++scanner.Position;
+			auto length = scanner.Length();
+			if (length.has_error())
+				return failure(move(length).error());
+			count = length.value();
+		}
+
+		map<string, UBJSONRange, less<>> members;
+		for (size_t i = 0; !count || i < *count; ++i)
+		{
+			if (!count)
+			{
+				auto next = scanner.Peek();
+				if (next.has_error())
+					return failure(move(next).error());
+				if (next.value() == '}')
+				{
+					++scanner.Position;
+					break;
+				}
+			}
+
+			string_view key;
+			if (auto read = scanner.Key(key); read.has_error())
+				return failure(move(read).error());
+			auto const start = scanner.Position;
+			auto marker = scanner.Byte();
+			if (marker.has_error())
+				return failure(move(marker).error());
+			if (auto skipped = scanner.SkipValue(marker.value()); skipped.has_error())
+				return failure(move(skipped).error());
+			members.insert_or_assign(string{ key }, UBJSONRange{ start, scanner.Position - start });
+		}
+
+		if (offset == 0 && scanner.Position != data.size())
+			return failure("unexpected data after UBJSON object");
+		return members;
+	}
+
+	void AppendUBJSONKey(vector<uint8_t>& out, string_view key)
+	{
+		/// Same as nlohmann::json: the smallest integer type that fits the length
+		auto const length = key.size();
+		auto const append_big_endian = [&](uint64_t value, size_t size) {
+			for (size_t i = size; i-- > 0;)
+				out.push_back(uint8_t(value >> (i * 8)));
+		};
+		if (length <= size_t(numeric_limits<int8_t>::max()))
+		{
+			out.push_back('i');
+			append_big_endian(length, 1);
+		}
+		else if (length <= size_t(numeric_limits<uint8_t>::max()))
+		{
+			out.push_back('U');
+			append_big_endian(length, 1);
+		}
+		else if (length <= size_t(numeric_limits<int16_t>::max()))
+		{
+			out.push_back('I');
+			append_big_endian(length, 2);
+		}
+		else if (length <= size_t(numeric_limits<int32_t>::max()))
+		{
+			out.push_back('l');
+			append_big_endian(length, 4);
+		}
+		else
+		{
+			out.push_back('L');
+			append_big_endian(length, 8);
+		}
+		out.insert(out.end(), key.begin(), key.end());
+	}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace dtmdl
+{
+	/// Where a value is in a UBJSON document, so it can be decoded (or copied as it is) later
+	struct UBJSONRange
+	{
+		size_t Offset = 0;
+		size_t Size = 0;
+	};
+
+	/// Finds the members of the UBJSON object at `offset`, without decoding their values; each range covers the value's
+	/// type marker and everything after it, so it can be passed to json::from_ubjson on its own.
+	/// If `offset` is 0, the object must be the whole of `data`.
+	/// NOTE: Objects with a fixed value type (`$`) fail, as their values have no markers of their own
+	result<map<string, UBJSONRange, less<>>, string> IndexUBJSONObject(span<uint8_t const> data, size_t offset = 0);
+
+	/// Appends an object key, encoded the way json::to_ubjson encodes them
+	void AppendUBJSONKey(vector<uint8_t>& out, string_view key);
+}
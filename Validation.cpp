@@ -172,6 +172,36 @@ namespace dtmdl
 		return success();
 	}
 
+	/// Whether `type` is, or has as a template argument, `flags<enoom>`
+	static bool HasFlagsOf(TypeReference const& type, TypeDefinition const* enoom)
+	{
+		if (type.Type && type.Type->IsBuiltIn() && type.Type->Name() == "flags" && !type.TemplateArguments.empty())
+		{
+			if (auto arg = get_if<TypeReference>(&type.TemplateArguments[0]); arg && arg->Type == enoom)
+				return true;
+		}
+		return ranges::any_of(type.TemplateArguments, [enoom](auto const& arg) {
+			auto ref = get_if<TypeReference>(&arg);
+			return ref && HasFlagsOf(*ref, enoom);
+		});
+	}
+
+	result<void, string> Database::ValidateEnumeratorValues(Enum def) const
+	{
+		for (auto type : mSchema.Definitions())
+		{
+			if (auto record = type->AsRecord())
+			{
+				for (auto& field : record->Fields())
+				{
+					if (HasFlagsOf(field->FieldType, def))
+						return ValidateFlagsEnum(def);
+				}
+			}
+		}
+		return success();
+	}
+
 	result<void, string> Database::ValidateClassFlags(Cls def, enum_flags<ClassFlags> flags)
 	{
 		AssumingNotNull(def);
@@ -206,6 +236,23 @@ namespace dtmdl
 		return success();
 	}
 
+	result<void, string> Database::ValidateFieldIndexType(Fld def, IndexKind kind)
+	{
+		AssumingNotNull(def);
+
+		if (!def->Flags.contain(FieldFlags::Indexed))
+			return failure(format("field '{}' is not {}", def->Name, magic_enum::enum_name(FieldFlags::Indexed)));
+		if (kind == IndexKind::Hash && !def->Flags.contain(FieldFlags::Unique))
+			return failure(format("a {} index can only be used for {} fields", magic_enum::enum_name(kind), magic_enum::enum_name(FieldFlags::Unique)));
+		if (kind != IndexKind::Ordered)
+		{
+			auto const table = def->ParentRecord->AsStruct();
+			if (!table || (!table->Flags.contain(StructFlags::DenseTable) && !table->Flags.contain(StructFlags::ColumnarTable)))
+				return failure(format("a {} index can only be used in {} or {} tables", magic_enum::enum_name(kind), magic_enum::enum_name(StructFlags::DenseTable), magic_enum::enum_name(StructFlags::ColumnarTable)));
+		}
+		return success();
+	}
+
 	result<void, string> Database::ValidateStructFlags(Str def, enum_flags<StructFlags> flags)
 	{
 		AssumingNotNull(def);
@@ -217,6 +264,13 @@ namespace dtmdl
 				| views::transform([](auto& field) { return field->Name; }), ", ", ", and ");
 			if (total.size())
 				return failure(format("cannot unset {} because the following fields are set as Unique: {}", magic_enum::enum_name(StructFlags::CreateTableType), move(total)));
+
+			auto stores = mDataStores
+				| views::filter([def](auto const& kvp) { auto table = kvp.second.FindTable(def->Name()); return table && table->RowCount() > 0; })
+				| views::transform([](auto const& kvp) -> string const& { return kvp.first; });
+			string store_names = string_ops::join_and(stores, ", ", ", and ");
+			if (store_names.size())
+				return failure(format("cannot unset {} because the following data stores have rows in its table: {}", magic_enum::enum_name(StructFlags::CreateTableType), move(store_names)));
 		}
 		return success();
 	}
@@ -301,6 +355,15 @@ namespace dtmdl
 						return failure(format("{}: in template argument {}:\n{}", type.ToString(), i, move(result).error()));
 				}
 			}
+
+			if (type.Type->IsBuiltIn() && type.Type->Name() == "flags")
+			{
+				if (auto ref = get_if<TypeReference>(&type.TemplateArguments[0]); ref && ref->Type && ref->Type->AsEnum())
+				{
+					if (auto result = ValidateFlagsEnum(ref->Type->AsEnum()); result.has_failure())
+						return failure(format("{}: {}", type.ToString(), move(result).error()));
+				}
+			}
 			return success();
 		}
 	};
@@ -338,6 +401,19 @@ namespace dtmdl
 		return success();
 	}*/
 
+	result<void, string> ValidateFlagsEnum(EnumDefinition const* def)
+	{
+		vector<string> out_of_range;
+		for (auto e : def->Enumerators())
+		{
+			if (auto value = e->ActualValue(); value < 0 || value >= 64)
+				out_of_range.push_back(format("- {} = {}", e->Name, value));
+		}
+		if (!out_of_range.empty())
+			return failure(format("enum {} is used as flags, which can only hold enumerators with values from 0 to 63:\n{}", def->Name(), string_ops::join(out_of_range, "\n")));
+		return success();
+	}
+
 	result<void, string> ValidateFieldType(FieldDefinition const* def, TypeReference const& type)
 	{
 		if (!type.Type)
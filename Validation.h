@@ -10,6 +10,8 @@ namespace dtmdl
 	//result<void, string> ValidateTemplateArgument(TemplateArgument const& arg, TemplateParameter const& param);
 	result<void, string> ValidateType(TypeReference const& type);
 	result<void, string> ValidateFieldType(FieldDefinition const* def, TypeReference const& type);
+	/// Flags are stored as a 64-bit mask (see FlagBit), so an enum used as flags can only have enumerator values from 0 to 63
+	result<void, string> ValidateFlagsEnum(EnumDefinition const* def);
 
 	result<void, string> ValidateTypeDefinition(TypeDefinition const* type, TemplateParameterQualifier qualifier);
 	bool MatchesQualifier(TypeDefinition const* type, TemplateParameterQualifier qualifier);
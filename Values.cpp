@@ -4,6 +4,7 @@
 
 #include "Database.h"
 #include "Values.h"
+#include "BlobStore.h"
 
 #include "codicons_font.h"
 
@@ -87,14 +88,14 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const = 0;
 		virtual void View(ConstValueDescriptor const&) const = 0;
 		virtual bool Edit(ValueDescriptor const&) const = 0;
-		virtual bool Visit(json& value, VisitorFunc visitor) const = 0;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const = 0;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const = 0;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const = 0;
 	};
 
 	struct IScalarHandler : IBuiltInHandler
 	{
-		virtual bool Visit(json& value, VisitorFunc visitor) const { return false; }
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override { return false; }
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override { return false; }
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override { return false; }
 	};
 
 	struct VoidHandler : IScalarHandler
@@ -207,8 +208,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mListHandler;
 
 	struct ArrayHandler : IBuiltInHandler
@@ -216,8 +217,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mArrayHandler;
 
 	struct RefHandler : IBuiltInHandler
@@ -225,8 +226,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mRefHandler;
 
 	struct OwnHandler : IBuiltInHandler
@@ -234,8 +235,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mOwnHandler;
 
 	struct VariantHandler : IBuiltInHandler
@@ -243,8 +244,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mVariantHandler;
 
 	struct MapHandler : IBuiltInHandler
@@ -252,8 +253,8 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override;
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override;
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override;
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override;
 	} mMapHandler;
 
 	struct JSONHandler : IBuiltInHandler
@@ -261,10 +262,20 @@ namespace dtmdl
 		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
 		virtual void View(ConstValueDescriptor const&) const override;
 		virtual bool Edit(ValueDescriptor const&) const override;
-		virtual bool Visit(json& value, VisitorFunc visitor) const override { return false; }
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override { return false; }
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override { return false; }
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override { return false; }
 	} mJSONHandler;
 
+	/// Not a built-in, but enums are scalars that are handled exactly the same way
+	/// NOTE: Enum values are stored as their (actual) integer value, and flags as a bitmask of (1 << value);
+	///				enumerator names only come into play when viewing, editing or exporting values
+	struct EnumHandler : IScalarHandler
+	{
+		virtual result<void, string> Initialize(TypeReference const& to_type, json& value) const override;
+		virtual void View(ConstValueDescriptor const&) const override;
+		virtual bool Edit(ValueDescriptor const&) const override;
+	} mEnumHandler;
+
 	template <typename T, size_t D>
 	struct VecHandler : IBuiltInHandler
 	{
@@ -282,11 +293,11 @@ namespace dtmdl
 		{
 			return false;
 		}
-		virtual bool Visit(json& value, VisitorFunc visitor) const override
+		virtual bool Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const override
 		{
 			return false;
 		}
-		virtual bool Visit(json const& value, ConstVisitorFunc visitor) const override
+		virtual bool Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const override
 		{
 			return false;
 		}
@@ -504,67 +515,155 @@ namespace dtmdl
 		return false;
 	}
 
-	/// TODO: Actually fill these visitors!
-
-	bool ListHandler::Visit(json& value, VisitorFunc visitor) const
+	template <typename JSON, typename VISITOR>
+	bool VisitElements(TypeReference const& element_type, JSON& value, VISITOR const& visitor)
 	{
+		if (!value.is_array())
+			return false;
+		size_t i = 0;
+		for (auto& element : value)
+		{
+			if (visitor(element_type, json::json_pointer{} / i, element))
+				return true;
+			++i;
+		}
 		return false;
 	}
 
-	bool ListHandler::Visit(json const& value, ConstVisitorFunc visitor) const
+	template <typename JSON, typename VISITOR>
+	bool VisitMapValues(TypeReference const& value_type, JSON& value, VISITOR const& visitor)
 	{
+		if (!value.is_object())
+			return false;
+		for (auto&& [key, element] : value.items())
+		{
+			if (visitor(value_type, json::json_pointer{} / key, element))
+				return true;
+		}
 		return false;
 	}
 
-	bool MapHandler::Visit(json& value, VisitorFunc visitor) const
+	template <typename JSON, typename VISITOR>
+	bool VisitVariant(TypeReference const& type, JSON& value, VISITOR const& visitor)
 	{
+		if (!value.is_array() || value.size() != 2 || !value[0].is_number_integer())
+			return false;
+		auto index = value[0].template get<size_t>();
+		if (index >= type.TemplateArguments.size())
+			return false;
+		if (auto alternative = get_if<TypeReference>(&type.TemplateArguments[index]))
+			return visitor(*alternative, json::json_pointer{ "/1" }, value[1]);
 		return false;
 	}
 
-	bool MapHandler::Visit(json const& value, ConstVisitorFunc visitor) const
+	/// Record members are keyed by field ID (see FieldDefinition::StorageKey); members with no matching field are skipped
+	template <typename JSON, typename VISITOR>
+	bool VisitRecord(RecordDefinition const* record, JSON& value, VISITOR const& visitor)
 	{
+		if (!value.is_object())
+			return false;
+		for (auto&& [key, field_value] : value.items())
+		{
+			auto field = record->OwnOrBaseFieldByKey(key);
+			if (field && visitor(field->FieldType, json::json_pointer{} / key, field_value))
+				return true;
+		}
 		return false;
 	}
 
+	static TypeReference const& ElementType(TypeReference const& type) { return get<TypeReference>(type.TemplateArguments.at(0)); }
+
+	bool ListHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const { return VisitElements(ElementType(type), value, visitor); }
+	bool ListHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const { return VisitElements(ElementType(type), value, visitor); }
+	bool MapHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const { return VisitMapValues(get<TypeReference>(type.TemplateArguments.at(1)), value, visitor); }
+	bool MapHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const { return VisitMapValues(get<TypeReference>(type.TemplateArguments.at(1)), value, visitor); }
+
 	bool BytesHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
-	bool FlagsHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
 	bool ArrayHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
-	bool ArrayHandler::Visit(json& value, VisitorFunc visitor) const
-	{
-		return false;
-	}
-	bool ArrayHandler::Visit(json const& value, ConstVisitorFunc visitor) const
-	{
-		return false;
-	}
+	bool ArrayHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const { return VisitElements(ElementType(type), value, visitor); }
+	bool ArrayHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const { return VisitElements(ElementType(type), value, visitor); }
 	bool RefHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
-	bool RefHandler::Visit(json& value, VisitorFunc visitor) const
+	bool RefHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const
 	{
 		return false;
 	}
-	bool RefHandler::Visit(json const& value, ConstVisitorFunc visitor) const
+	bool RefHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const
 	{
 		return false;
 	}
 	bool OwnHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
-	bool OwnHandler::Visit(json& value, VisitorFunc visitor) const
+	bool OwnHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const
 	{
 		return false;
 	}
-	bool OwnHandler::Visit(json const& value, ConstVisitorFunc visitor) const
+	bool OwnHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const
 	{
 		return false;
 	}
 	bool VariantHandler::Edit(ValueDescriptor const& descriptor) const { return false; }
+	bool VariantHandler::Visit(TypeReference const& type, json& value, VisitorFunc const& visitor) const { return VisitVariant(type, value, visitor); }
+	bool VariantHandler::Visit(TypeReference const& type, json const& value, ConstVisitorFunc const& visitor) const { return VisitVariant(type, value, visitor); }
 
-	bool VariantHandler::Visit(json& value, VisitorFunc visitor) const
+	static EnumDefinition const* FlagsEnum(TypeReference const& flags_type)
 	{
-		return false;
+		if (auto arg = get_if<TypeReference>(&flags_type.TemplateArguments.at(0)); arg && arg->Type)
+			return arg->Type->AsEnum();
+		return nullptr;
 	}
 
-	bool VariantHandler::Visit(json const& value, ConstVisitorFunc visitor) const
+	bool FlagsHandler::Edit(ValueDescriptor const& descriptor) const
 	{
-		return false;
+		auto enoom = FlagsEnum(descriptor.Type);
+		if (!enoom || !descriptor.Value.is_number_integer())
+			return EditScalar<json::number_unsigned_t>(descriptor, [](auto&, auto&) { return false; });
+
+		bool edited = false;
+		auto bits = descriptor.Value.get<uint64_t>();
+		ImGui::PushID(&descriptor.Value);
+		for (auto e : enoom->Enumerators())
+		{
+			auto bit = FlagBit(e->ActualValue());
+			if (bit == 0)
+				continue;
+			bool set = (bits & bit) != 0;
+			if (ImGui::Checkbox(e->Name.c_str(), &set))
+			{
+				bits = set ? (bits | bit) : (bits & ~bit);
+				edited = true;
+			}
+			ImGui::SameLine();
+		}
+		ImGui::NewLine();
+		ImGui::PopID();
+
+		if (edited)
+			descriptor.Value = bits;
+		return edited;
+	}
+
+	bool EnumHandler::Edit(ValueDescriptor const& descriptor) const
+	{
+		auto enoom = descriptor.Type->AsEnum();
+		if (!descriptor.Value.is_number_integer())
+			return EditScalar<json::number_integer_t>(descriptor, [](auto&, auto&) { return false; });
+
+		bool edited = false;
+		auto current = enoom->EnumeratorByValue(descriptor.Value.get<int64_t>());
+		ImGui::PushID(&descriptor.Value);
+		if (ImGui::BeginCombo("", current ? current->Name.c_str() : "<invalid enumerator>"))
+		{
+			for (auto e : enoom->Enumerators())
+			{
+				if (ImGui::Selectable(e->Name.c_str(), e == current))
+				{
+					descriptor.Value = e->ActualValue();
+					edited = true;
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::PopID();
+		return edited;
 	}
 
 	result<void, string> VoidHandler::Initialize(TypeReference const& type, json& value) const { value = {}; return success(); }
@@ -612,6 +711,7 @@ namespace dtmdl
 		return InitializeValue(element_type, arr.at(1));
 	}
 	result<void, string> JSONHandler::Initialize(TypeReference const& type, json& value) const { value = json{}; return success(); }
+	result<void, string> EnumHandler::Initialize(TypeReference const& type, json& value) const { value = type->AsEnum()->DefaultEnumerator()->ActualValue(); return success(); }
 
 	/*
 	template <typename... ARGS>
@@ -634,13 +734,48 @@ namespace dtmdl
 	void U64Handler::View(ConstValueDescriptor const& descriptor) const { TextF("{}", (uint64_t)descriptor.Value); }
 	void BoolHandler::View(ConstValueDescriptor const& descriptor) const { TextF("{}", (bool)descriptor.Value); }
 	void StringHandler::View(ConstValueDescriptor const& descriptor) const { TextF("{}", (string_view)descriptor.Value); }
-	void BytesHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<bytes>"); }
-	void FlagsHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<flags>"); }
+	void BytesHandler::View(ConstValueDescriptor const& descriptor) const
+	{
+		if (descriptor.Value.is_binary())
+			TextF("<{} bytes>", descriptor.Value.get_binary().size());
+		else if (BlobStore::IsReference(descriptor.Value))
+			TextF("<{} bytes, blob {}>", descriptor.Value.value("size", size_t{}), BlobStore::ReferencedHash(descriptor.Value).substr(0, 12));
+		else
+			TextF("<bytes>");
+	}
+	void FlagsHandler::View(ConstValueDescriptor const& descriptor) const
+	{
+		if (auto enoom = FlagsEnum(descriptor.Type); enoom && descriptor.Value.is_number_integer())
+			TextU(string_ops::join(FlagNames(enoom, descriptor.Value.get<uint64_t>()), ", "));
+		else
+			TextF("<flags>");
+	}
+	void EnumHandler::View(ConstValueDescriptor const& descriptor) const
+	{
+		auto e = descriptor.Value.is_number_integer() ? descriptor.Type->AsEnum()->EnumeratorByValue(descriptor.Value.get<int64_t>()) : nullptr;
+		if (e)
+			TextU(e->Name);
+		else
+			TextF("<invalid enumerator: {}>", descriptor.Value.dump());
+	}
 	void ListHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<list>"); }
 	void MapHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<map>"); }
 	void ArrayHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<array>"); }
-	void RefHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<ref>"); }
-	void OwnHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<own>"); }
+	/// `own` and `ref` values are IDs of objects in the store's gcheap
+	static void ViewObjectID(ConstValueDescriptor const& descriptor)
+	{
+		if (descriptor.Value.is_null())
+			TextF("null");
+		else if (!descriptor.Store)
+			TextF("#{}", descriptor.Value.dump());
+		else if (auto object = descriptor.Store->Heap().Resolve(descriptor.Value))
+			TextF("#{} ({})", descriptor.Value.dump(), object->Class->Name());
+		else
+			TextF("#{} (collected)", descriptor.Value.dump());
+	}
+
+	void RefHandler::View(ConstValueDescriptor const& descriptor) const { ViewObjectID(descriptor); }
+	void OwnHandler::View(ConstValueDescriptor const& descriptor) const { ViewObjectID(descriptor); }
 	void VariantHandler::View(ConstValueDescriptor const& descriptor) const { TextF("<variant>"); }
 	void JSONHandler::View(ConstValueDescriptor const& descriptor) const { TextF("{}", descriptor.Value.dump()); }
 
@@ -756,7 +891,7 @@ namespace dtmdl
 		case DefinitionType::BuiltIn:
 			return mBuiltIns.at(type.Type->Name())->Initialize(type, value);
 		case DefinitionType::Enum:
-			return failure("TODO: cannot initialize enums");
+			return mEnumHandler.Initialize(type, value);
 		case DefinitionType::Struct:
 			return failure("TODO: cannot initialize structs");
 		case DefinitionType::Class:
@@ -765,7 +900,7 @@ namespace dtmdl
 		return failure(format("unknown type type: {}", magic_enum::enum_name(type.Type->Type())));
 	}
 
-	void ViewValue(TypeReference const& type, json& value, json const& field_attributes, DataStore const* store)
+	void ViewValue(TypeReference const& type, json const& value, json const& field_attributes, DataStore const* store)
 	{
 		if (!type)
 		{
@@ -779,7 +914,8 @@ namespace dtmdl
 			mBuiltIns.at(type.Type->Name())->View({ type, value, field_attributes, json::json_pointer{}, store });
 			return;
 		case DefinitionType::Enum:
-			break;
+			mEnumHandler.View({ type, value, field_attributes, json::json_pointer{}, store });
+			return;
 		case DefinitionType::Struct:
 			break;
 		case DefinitionType::Class:
@@ -802,7 +938,7 @@ namespace dtmdl
 		case DefinitionType::BuiltIn:
 			return mBuiltIns.at(type.Type->Name())->Edit({ type, value, field_attributes, move(value_path), store });
 		case DefinitionType::Enum:
-			break;
+			return mEnumHandler.Edit({ type, value, field_attributes, move(value_path), store });
 		case DefinitionType::Struct:
 			break;
 		case DefinitionType::Class:
@@ -880,48 +1016,154 @@ namespace dtmdl
 		return failure(format("unknown type type: {}", magic_enum::enum_name(from.Type->Type())));
 	}
 
-	bool VisitValue(TypeReference const& type, json& value, VisitorFunc visitor)
+	template <typename JSON, typename VISITOR>
+	bool VisitValueImpl(TypeReference const& type, JSON& value, VISITOR const& visitor)
 	{
 		if (!type)
 			return false;
 
-		/// TODO: This
-
 		switch (type.Type->Type())
 		{
 		case DefinitionType::BuiltIn:
-			return mBuiltIns.at(type.Type->Name())->Visit(value, visitor);
+			return mBuiltIns.at(type.Type->Name())->Visit(type, value, visitor);
 		case DefinitionType::Enum:
-			break;
+			return false;
 		case DefinitionType::Struct:
-			break;
 		case DefinitionType::Class:
-			break;
+			return VisitRecord(type->AsRecord(), value, visitor);
 		}
 
 		return false;
 	}
 
+	bool VisitValue(TypeReference const& type, json& value, VisitorFunc visitor)
+	{
+		return VisitValueImpl(type, value, visitor);
+	}
+
 	bool VisitValue(TypeReference const& type, json const& value, ConstVisitorFunc visitor)
 	{
-		if (!type)
-			return false;
+		return VisitValueImpl(type, value, visitor);
+	}
 
-		/// TODO: This
+	uint64_t FlagBit(int64_t enumerator_value)
+	{
+		if (enumerator_value < 0 || enumerator_value >= 64)
+			return 0;
+		return uint64_t(1) << enumerator_value;
+	}
 
-		switch (type.Type->Type())
+	vector<string> FlagNames(EnumDefinition const* enoom, uint64_t bits)
+	{
+		vector<string> result;
+		for (auto e : enoom->Enumerators())
 		{
-		case DefinitionType::BuiltIn:
-			return mBuiltIns.at(type.Type->Name())->Visit(value, visitor);
-		case DefinitionType::Enum:
-			break;
-		case DefinitionType::Struct:
-			break;
-		case DefinitionType::Class:
-			break;
+			if (auto bit = FlagBit(e->ActualValue()); bit && (bits & bit) != 0)
+				result.push_back(e->Name);
 		}
+		return result;
+	}
 
-		return false;
+	uint64_t FlagsFromNames(EnumDefinition const* enoom, json const& names)
+	{
+		uint64_t bits = 0;
+		if (names.is_array())
+		{
+			for (auto& name : names)
+			{
+				if (!name.is_string())
+					continue;
+				if (auto e = enoom->Enumerator(name.get_ref<json::string_t const&>()))
+					bits |= FlagBit(e->ActualValue());
+			}
+		}
+		return bits;
+	}
+
+	void ResolveEnumNames(TypeReference const& type, json& value)
+	{
+		VisitorFunc visitor = [&](TypeReference const& child_type, json::json_pointer, json& child_value) {
+			if (!child_type)
+				return false;
+			if (auto enoom = child_type->AsEnum(); enoom && child_value.is_number_integer())
+			{
+				if (auto e = enoom->EnumeratorByValue(child_value.get<int64_t>()))
+					child_value = e->Name;
+			}
+			else if (child_type->Name() == "flags" && child_value.is_number_integer())
+			{
+				if (auto flags_enum = FlagsEnum(child_type))
+					child_value = FlagNames(flags_enum, child_value.get<uint64_t>());
+			}
+			else
+				return VisitValue(child_type, child_value, visitor);
+			return false;
+		};
+		ignore = visitor(type, json::json_pointer{}, value);
+	}
+
+	void EncodeEnumNames(TypeReference const& type, json& value)
+	{
+		VisitorFunc visitor = [&](TypeReference const& child_type, json::json_pointer, json& child_value) {
+			if (!child_type)
+				return false;
+			if (auto enoom = child_type->AsEnum(); enoom && child_value.is_string())
+			{
+				auto e = enoom->Enumerator(child_value.get_ref<json::string_t const&>());
+				child_value = (e ? e : enoom->DefaultEnumerator())->ActualValue();
+			}
+			else if (child_type->Name() == "flags" && child_value.is_array())
+			{
+				if (auto flags_enum = FlagsEnum(child_type))
+					child_value = FlagsFromNames(flags_enum, child_value);
+			}
+			else
+				return VisitValue(child_type, child_value, visitor);
+			return false;
+		};
+		ignore = visitor(type, json::json_pointer{}, value);
+	}
+
+	void ResolveFieldNames(TypeReference const& type, json& value)
+	{
+		VisitorFunc visitor = [&](TypeReference const& child_type, json::json_pointer, json& child_value) {
+			if (!child_type)
+				return false;
+			/// Children first, since visiting them needs the ID keys
+			ignore = VisitValue(child_type, child_value, visitor);
+			if (auto record = child_type->AsRecord(); record && child_value.is_object())
+			{
+				json named = json::object();
+				for (auto&& [key, field_value] : child_value.items())
+				{
+					auto field = record->OwnOrBaseFieldByKey(key);
+					named[field ? field->Name : key] = move(field_value);
+				}
+				child_value = move(named);
+			}
+			return false;
+		};
+		ignore = visitor(type, json::json_pointer{}, value);
+	}
+
+	void EncodeFieldNames(TypeReference const& type, json& value)
+	{
+		VisitorFunc visitor = [&](TypeReference const& child_type, json::json_pointer, json& child_value) {
+			if (!child_type)
+				return false;
+			if (auto record = child_type->AsRecord(); record && child_value.is_object())
+			{
+				json keyed = json::object();
+				for (auto&& [name, field_value] : child_value.items())
+				{
+					auto field = record->OwnOrBaseField(name);
+					keyed[field ? field->StorageKey() : name] = move(field_value);
+				}
+				child_value = move(keyed);
+			}
+			return VisitValue(child_type, child_value, visitor);
+		};
+		ignore = visitor(type, json::json_pointer{}, value);
 	}
 
 	bool ForEveryObjectWithTypeName(TypeReference const& type, json& value, string_view type_name, function<bool(json&)> const& object_func)
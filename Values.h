@@ -4,11 +4,12 @@ namespace dtmdl
 {
 	struct DataStore;
 	struct TypeReference;
+	struct EnumDefinition;
 
 	result<void, string> InitializeValue(TypeReference const& type, json& value);
 
-	void ViewValue(TypeReference const& type, json& value, json const& field_attributes, DataStore const* store = nullptr);
-	inline void ViewValue(TypeReference const& type, json& value) { ViewValue(type, value, empty_json, nullptr); }
+	void ViewValue(TypeReference const& type, json const& value, json const& field_attributes, DataStore const* store = nullptr);
+	inline void ViewValue(TypeReference const& type, json const& value) { ViewValue(type, value, empty_json, nullptr); }
 
 	bool EditValue(TypeReference const& type, json& value, json const& field_attributes, json::json_pointer value_path, DataStore* store = nullptr);
 	inline bool EditValue(TypeReference const& type, json& value) { return EditValue(type, value, empty_json, json::json_pointer{}, nullptr); }
@@ -29,6 +30,19 @@ namespace dtmdl
 	[[nodiscard]] bool VisitValue(TypeReference const& type, json& value, VisitorFunc visitor);
 	[[nodiscard]] bool VisitValue(TypeReference const& type, json const& value, ConstVisitorFunc visitor);
 
+	/// Enum values are stored as the enumerator's actual value, flags as a bitmask with bit (1 << value) set for each enumerator
+	uint64_t FlagBit(int64_t enumerator_value);
+	vector<string> FlagNames(EnumDefinition const* enoom, uint64_t bits);
+	uint64_t FlagsFromNames(EnumDefinition const* enoom, json const& names);
+
+	/// Converts stored enum/flags values into enumerator names (for export), and back (for import and legacy stores)
+	void ResolveEnumNames(TypeReference const& type, json& value);
+	void EncodeEnumNames(TypeReference const& type, json& value);
+
+	/// Converts record member keys from field IDs into field names (for export), and back (for import and legacy stores)
+	void ResolveFieldNames(TypeReference const& type, json& value);
+	void EncodeFieldNames(TypeReference const& type, json& value);
+
 	[[nodiscard]] bool ForEveryObjectWithTypeName(TypeReference const& value_type, json& value, string_view type_name, function<bool(json&)> const& object_func);
 	[[nodiscard]] bool ForEveryObjectWithTypeName(TypeReference const& value_type, json const& value, string_view type_name, function<bool(json const&)> const& object_func);
 
@@ -69,6 +69,10 @@ namespace dtmdl
 	enum class StructFlags
 	{
 		CreateTableType,
+		/// The generated table keeps its rows contiguous (in a slot map) instead of in a map keyed by row id
+		DenseTable,
+		/// Like DenseTable, but each field is kept in its own contiguous array (structure of arrays)
+		ColumnarTable,
 	};
 
 	enum class ClassFlags
@@ -78,6 +82,14 @@ namespace dtmdl
 		CreateIsAs,
 	};
 
+	/// How generated tables index an Indexed field; chosen with the field's "index" attribute
+	enum class IndexKind
+	{
+		Ordered, /// std::map or std::multimap
+		Hash, /// open addressing; equality lookups only, so only for Unique fields
+		Sorted, /// sorted vector; compact and fast to scan, but inserting and erasing move the entries after them
+	};
+
 	enum class FieldFlags
 	{
 		Private,
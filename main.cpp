@@ -10,6 +10,7 @@
 #include "Database.h"
 #include "Validation.h"
 #include "Values.h"
+#include "SelfTest.h"
 
 #include "X:\Code\Native\ghassanpl\windows_message_box\windows_message_box.h"
 #include "X:\Code\Native\ghassanpl\windows_message_box\windows_folder_browser.h"
@@ -619,6 +620,24 @@ bool FieldFlagsEditor(Database& db, FieldDefinition const* field)
 	);
 }
 
+void FieldIndexTypeEditor(Database& db, FieldDefinition const* field)
+{
+	using namespace ImGui;
+	auto const current = field->IndexType();
+	SetNextItemWidth(GetContentRegionAvail().x);
+	if (BeginCombo("##Index", format("{} Index", magic_enum::enum_name(current)).c_str()))
+	{
+		for (auto& [kind, name] : magic_enum::enum_entries<IndexKind>())
+		{
+			if (!db.ValidateFieldIndexType(field, kind).has_value())
+				continue;
+			if (Selectable(string{ name }.c_str(), kind == current) && kind != current)
+				LateExec.push_back([&db, field, kind = kind] { CheckError(db.SetFieldIndexType(field, kind)); });
+		}
+		EndCombo();
+	}
+}
+
 bool ClassFlagsEditor(Database& db, ClassDefinition const* klass)
 {
 	return GenericEditor<ClassDefinition const*, enum_flags<ClassFlags>>("Class Flags", klass,
@@ -698,6 +717,8 @@ void EditRecord(Database& db, RecordDefinition const* def, bool is_struct)
 				FieldTypeEditor(db, field);
 				TableNextColumn();
 				FieldFlagsEditor(db, field);
+				if (field->Flags.contain(FieldFlags::Indexed))
+					FieldIndexTypeEditor(db, field);
 				TableNextColumn();
 
 				BeginDisabled(own_field_index == 0);
@@ -816,6 +837,7 @@ void EditEnum(Database& db, EnumDefinition const* enoom)
 }
 
 unique_ptr<Database> mCurrentDatabase = nullptr;
+BackupOptions mBackupOptions;
 
 string Multiples(string_view objs)
 {
@@ -965,12 +987,117 @@ void PropertiesTab()
 	auto dir = mCurrentDatabase->Directory().string();
 	LabelText("Directory", "%s", dir.c_str());
 
+	auto& timings = mCurrentDatabase->OpenTimings();
+	auto const ms = [](chrono::microseconds time) { return time.count() / 1000.0; };
+	TextF("Opened in {:.1f} ms: files parsed in {:.1f} ms, schema loaded in {:.1f} ms, data stores loaded in {:.1f} ms",
+		ms(timings.Total), ms(timings.ParseFiles), ms(timings.ApplySchema), ms(timings.LoadDataStores));
+	for (auto& [name, time] : timings.DataStores)
+		BulletText("%s", format("{}: {:.1f} ms", name, ms(time)).c_str());
+
+	auto& schema = mCurrentDatabase->Schema();
+	LabelText("Schema Version", "%llu", (unsigned long long)schema.Version());
+	LabelText("Schema Hash", "%s", schema.Hash().c_str());
+	for (auto& name : mCurrentDatabase->StoresSavedWithOtherSchema())
+		TextColored({ 1,1,0,1 }, ICON_VS_WARNING "%s", format("Data store '{}' was last saved with a different schema ({})", name, mCurrentDatabase->DataStores().at(name).SchemaStamp().dump()).c_str());
+
 	/// TODO: validation - identifier, cannot be "std" or "dtmdl"
 	//InputText("Namespace", &mCurrentDatabase->Schema().Namespace);
 }
 
+/// `dtmdl --validate <database directory>` checks every data store against the schema without opening a window;
+/// prints the diagnostics and returns 1 if any of them is an error
+int ValidateFromCommandLine(char const* directory)
+{
+	try
+	{
+		Database db{ directory };
+		printf("opened in %.3f ms, schema version %llu (%s)\n", db.OpenTimings().Total.count() / 1000.0, (unsigned long long)db.Schema().Version(), db.Schema().Hash().c_str());
+		for (auto& name : db.StoresSavedWithOtherSchema())
+			printf("%s: last saved with a different schema: %s\n", name.c_str(), db.DataStores().at(name).SchemaStamp().dump().c_str());
+		bool any_errors = false;
+		for (auto& [name, report] : db.ValidateAll())
+		{
+			printf("%s: %llu values checked in %.3f ms, %zu diagnostics\n", name.c_str(), (unsigned long long)report.ValuesChecked, report.Duration.count() / 1000.0, report.Diagnostics.size());
+			for (auto& diagnostic : report.Diagnostics)
+				printf("  %s %s: %s\n", diagnostic.Level == ValueDiagnostic::Severity::Error ? "error" : "warning", diagnostic.Path.c_str(), diagnostic.Message.c_str());
+			any_errors |= report.HasErrors();
+		}
+		return any_errors ? 1 : 0;
+	}
+	catch (exception const& e)
+	{
+		printf("Error: %s\n", e.what());
+		return -1;
+	}
+}
+
+/// `--backup <database directory> [<compression level>]`, for scheduled backups
+int BackupFromCommandLine(int argc, char** argv)
+{
+	try
+	{
+		Database db{ argv[2] };
+		BackupOptions options;
+		if (argc > 3)
+			options.CompressionLevel = clamp(atoi(argv[3]), 0, 9);
+		auto backup = db.CreateBackup(options);
+		if (backup.has_error())
+		{
+			printf("Error: %s\n", backup.error().c_str());
+			return -1;
+		}
+		auto& report = backup.value();
+		printf("%s: %zu files, %zu of %zu chunks (%llu of %llu bytes) new, in %.3f ms\n", report.Snapshot.c_str(), report.Files, report.NewChunks, report.Chunks,
+			(unsigned long long)report.NewBytes, (unsigned long long)report.Bytes, report.Duration.count() / 1000.0);
+		return 0;
+	}
+	catch (exception const& e)
+	{
+		printf("Error: %s\n", e.what());
+		return -1;
+	}
+}
+
+/// `--restore-backup <directory the backup was created in> <snapshot> <target directory>`; without a snapshot, lists the snapshots
+int RestoreBackupFromCommandLine(int argc, char** argv)
+{
+	if (argc < 5)
+	{
+		for (auto& snapshot : BackupRepository{ filesystem::path{ argv[2] } / "backups" }.Snapshots())
+			printf("%s\n", snapshot.c_str());
+		return 0;
+	}
+
+	if (auto restored = Database::RestoreBackup(argv[2], argv[3], argv[4]); restored.has_error())
+	{
+		printf("Error: %s\n", restored.error().c_str());
+		return -1;
+	}
+	printf("restored %s to %s\n", argv[3], argv[4]);
+	return 0;
+}
+
+/// `--self-test <scratch directory>` runs the checks in SelfTest.cpp; returns 1 if any of them failed
+int SelfTestFromCommandLine(char const* scratch_directory)
+{
+	auto const failures = RunSelfTests(scratch_directory);
+	for (auto& [name, error] : failures)
+		printf("%s: %s\n", name.c_str(), error.c_str());
+	printf("%zu self-tests failed\n", failures.size());
+	return failures.empty() ? 0 : 1;
+}
+
 int main(int argc, char** argv)
 {
+	if (argc > 2 && argv[1] == "--validate"sv)
+		return ValidateFromCommandLine(argv[2]);
+	if (argc > 2 && argv[1] == "--backup"sv)
+		return BackupFromCommandLine(argc, argv);
+	if (argc > 2 && argv[1] == "--restore-backup"sv)
+		return RestoreBackupFromCommandLine(argc, argv);
+	if (argc > 2 && argv[1] == "--self-test"sv)
+		return SelfTestFromCommandLine(argv[2]);
+
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
 	{
 		printf("Error: %s\n", SDL_GetError());
@@ -1075,7 +1202,18 @@ int main(int argc, char** argv)
 		}
 		ImGui::SameLine();
 		if (ImGui::Button(ICON_VS_FILE_ZIP "Create Backup"))
-			CheckError(mCurrentDatabase->CreateBackup(), "Backup successfully created");
+		{
+			if (auto backup = mCurrentDatabase->CreateBackup(mBackupOptions); backup.has_error())
+				CheckError(failure(move(backup).error()));
+			else
+			{
+				auto& report = backup.value();
+				CheckError(success(), format("Backup {} created: {} files, {} of {} chunks ({} of {} bytes) were new", report.Snapshot, report.Files, report.NewChunks, report.Chunks, report.NewBytes, report.Bytes));
+			}
+		}
+		ImGui::SameLine();
+		ImGui::SetNextItemWidth(150);
+		ImGui::SliderInt("Compression", &mBackupOptions.CompressionLevel, 0, 9);
 		ImGui::SameLine();
 
 		ImGui::NewLine();
@@ -1083,6 +1221,8 @@ int main(int argc, char** argv)
 
 		if (mCurrentDatabase)
 		{
+			mCurrentDatabase->CollectGarbage();
+
 			if (ImGui::BeginTabBar("Main Tabs"))
 			{
 				if (ImGui::BeginTabItem(ICON_VS_TYPE_HIERARCHY_SUB "Types"))
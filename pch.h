@@ -6,6 +6,15 @@
 #include <filesystem>
 #include <functional>
 #include <format>
+#include <execution>
+#include <chrono>
+#include <span>
+#include <charconv>
+#include <bit>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <fstream>
 
 #include <outcome.hpp>
 #include <nlohmann/json.hpp>